@@ -16,7 +16,7 @@ BuildRequires:	gcc gcc-c++
 %endif
 
 BuildRequires:	boost-devel, boost-thread, boost-system
-BuildRequires:	cmake msgpack-devel
+BuildRequires:	cmake msgpack-devel zlib-devel
 BuildRequires:	elliptics-client-devel >= 2.24.14.19
 BuildRequires:	fastcgi-daemon2-libs-devel
 BuildRequires:	libthevoid-devel >= 0.5.5.0
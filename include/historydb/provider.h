@@ -1,11 +1,13 @@
 #ifndef HISTORY_PROVIDER_H
 #define HISTORY_PROVIDER_H
 
+#include <functional>
 #include <memory>
 #include <stdint.h>
 #include <string>
 #include <vector>
 #include <list>
+#include <map>
 #include <set>
 
 namespace history {
@@ -17,6 +19,82 @@ struct server_info
 	int family;
 };
 
+/* Counters of the provider operations */
+struct provider_stats
+{
+	uint64_t early_acks; // writes which have been acknowledged before all replicas completed
+	uint64_t late_replica_failures; // replicas which failed after the write had been acknowledged
+	uint64_t read_errors; // error replies of replicas to reads, lookups and index requests, missing keys aren't counted
+	uint64_t write_errors; // error replies of replicas to writes and index updates
+	uint64_t missing_logs_hits; // reads of user logs skipped because the logs haven't been found recently
+	uint64_t filtered_activities_hits; // writes of activity filter positions skipped because they have been set recently
+	uint64_t fanout_queued; // reads of range operations which wait for free slots of the fanout limits
+	uint64_t fanout_in_flight; // reads of range operations which are in flight
+};
+
+/* Log record for adding by batch */
+struct log_record
+{
+	log_record()
+	: time(0)
+	, activity(false)
+	{}
+
+	std::string			user; // name of user
+	std::string			subkey; // custom key of the record, if it is empty the key is calculated from time
+	uint64_t			time; // timestamp of the record
+	bool				activity; // if true, the user is also added to activity statistics
+	std::vector<char>	data; // user log data
+};
+
+/* Page of active users */
+struct active_users_page
+{
+	std::vector<std::string>	users; // active users of the page
+	std::string					cursor; // opaque cursor of the next page, empty if it is the last page
+};
+
+/* Sorted list of unique active users.
+ * Names are stored end to end in one buffer, so the list takes two allocations regardless of the number of users
+ * and is moved without copying names.
+ */
+class active_users_list
+{
+public:
+	size_t size() const { return offsets_.empty() ? 0 : offsets_.size() - 1; }
+	bool empty() const { return size() == 0; }
+
+	// returns pointer to the name of the user, it isn't null-terminated
+	const char* data(size_t index) const { return arena_.data() + offsets_[index]; }
+	// returns length of the name of the user
+	size_t length(size_t index) const { return offsets_[index + 1] - offsets_[index]; }
+	// returns copy of the name of the user
+	std::string operator[](size_t index) const { return std::string(data(index), length(index)); }
+
+	// returns true if the user is in the list, it is binary search
+	bool contains(const std::string& user) const;
+
+	/* Replaces the list by the users
+		users - pointers to names and their lengths, they can be unsorted and repeated
+	*/
+	void assign(std::vector<std::pair<const char*, size_t>>& users);
+
+private:
+	std::vector<char>	arena_; // names of users end to end
+	std::vector<size_t>	offsets_; // offset of each name in arena_ and the end of the last name
+};
+
+/* Retention of cohorts of active users.
+ * Cohort is the users which are active in the cohort day.
+ */
+struct retention_matrix
+{
+	std::vector<std::string>			days; // subkeys of the cohort days
+	std::vector<uint32_t>				offsets; // offsets in days of retention columns, e.g. 1, 7, 30
+	std::vector<uint64_t>				cohorts; // number of users in each cohort
+	std::vector<std::vector<uint64_t>>	retained; // retained[i][j] - users of cohort i which are active in day i + offsets[j]
+};
+
 class provider
 {
 public:
@@ -37,6 +115,99 @@ public:
 	*/
 	void set_session_parameters(const std::vector<int>& groups, uint32_t min_writes);
 
+	/* Sets write acknowledge policy.
+		early_ack - if true, callbacks of async writes are called as soon as min_writes groups have confirmed the write.
+			The remaining replicas are completed in background and their failures are counted in provider_stats.
+			If false (default), callbacks are called after all groups have completed the write.
+	*/
+	void set_early_ack(bool early_ack);
+
+	/* Sets number of chunks of each activity statistics index.
+	   Users are spread over the chunks by hash of the name, so a page of active users is read from one chunk at a time.
+		chunks - number of chunks, 1 (default) means one index per day which is compatible with previous versions.
+			It should be changed only for storage without activity statistics, because statistics written
+			with other number of chunks isn't found.
+	*/
+	void set_activity_chunks(uint32_t chunks);
+
+	/* Gets number of chunks of each activity statistics index
+	*/
+	uint32_t get_activity_chunks() const;
+
+	/* Enables counting activities of each user in each day.
+	   If it is enabled, each added activity also increments the counter of the user in the day.
+	   Counters are appended by one byte in separate namespace, so concurrent increments don't conflict.
+	   Failed increment is logged and doesn't fail adding of activity, because a retry would count the activity twice.
+		enable - true for counting activities, false (default) for keeping only activity statistics
+	*/
+	void set_activity_counters(bool enable);
+
+	/* Enables marking days with user logs.
+	   If it is enabled, each write of user log of the day also marks the day in the object of the user bucket of days,
+	   and reads of user logs for days read the marks at first and skip days without logs.
+	   Marks are overwritten in place, so they take one byte per day and don't grow with number of writes.
+		enable - true for marking days, false (default) for reading logs of all days.
+			It should be enabled only for storage without user logs of days, because logs written
+			without marks aren't read.
+	*/
+	void set_log_days(bool enable);
+
+	/* Sets time of remembering user logs of past days which haven't been found.
+	   Reads of user logs skip remembered logs. Logs written by this provider are forgotten immediately,
+	   logs of past days written by other providers aren't read during ttl.
+		ttl - seconds, 0 (default) disables remembering
+	*/
+	void set_missing_logs_ttl(uint32_t ttl);
+
+	/* Enables Bloom filters of active users of days.
+	   If it is enabled, each added activity also sets positions of the user in the filter of the day,
+	   and is_active reads indexes of the user only if the filter says that the user may be active.
+	   Users which aren't in the list of indexes of the user object are confirmed by the activity index of the day.
+		enable - true for writing and reading filters, false (default) for checking users by activity index of the day.
+			It should be enabled for all providers of the storage at once, because users added without filters
+			into days which have filters aren't found.
+	*/
+	void set_activity_filters(bool enable);
+
+	/* Sets expected number of active users of one day, filter of the day has 20 positions per user.
+	   It should be the same in all providers of the storage and shouldn't be changed after filters have been written.
+		users - number of users, 0 (default) means 16M positions
+	*/
+	void set_activity_filter_users(uint32_t users);
+
+	/* Sets number of threads which merge active users found for several subkeys.
+	   Found names are deduplicated by partitioned hash sets, each partition in its own thread.
+	   Small results are merged by the calling thread.
+		threads - number of threads, 0 (default) - number of cores
+	*/
+	void set_merge_threads(uint32_t threads);
+
+	/* Sets limits of reads of range operations which are in flight.
+	   Range operation sends its reads in order and keeps at most request_limit of them in flight,
+	   all range operations together keep at most global_limit of reads in flight.
+	   Lookups of active users in activity statistics aren't limited: each of them is one elliptics request
+	   for all days of the range, which is bounded by set_max_range().
+		request_limit - limit of one operation, default 32
+		global_limit - limit of all operations, default 1024
+	*/
+	void set_fanout_limits(uint32_t request_limit, uint32_t global_limit);
+
+	/* Sets maximum number of days (subkeys) of range operation.
+	   Range operations with more subkeys throw std::invalid_argument before sending any read.
+		max_range - maximum number of subkeys, 0 (default) - unlimited
+	*/
+	void set_max_range(uint32_t max_range);
+
+	/* Checks number of subkeys of range operation
+		subkeys - days or custom keys of the operation
+		throws std::invalid_argument if there are more subkeys than maximum range
+	*/
+	void check_range(const std::vector<std::string>& subkeys) const;
+
+	/* Gets counters of the provider operations
+	*/
+	provider_stats get_stats() const;
+
 	/* Adds data to user logs
 		user - name of user
 		time - timestamp of the log record
@@ -73,6 +244,24 @@ public:
 	             const std::vector<char>& data,
 	             std::function<void(bool added)> callback);
 
+	/* Rewrites user logs with data
+		user - name of user
+		subkey - custom key for user logs
+		data - new user log data
+	*/
+	void write_log(const std::string& user, const std::string& subkey, const std::vector<char>& data);
+
+	/* Async rewrites user logs with data
+		user - name of user
+		subkey - custom key for user logs
+		data - new user log data
+		callback - complete callback
+	*/
+	void write_log(const std::string& user,
+	               const std::string& subkey,
+	               const std::vector<char>& data,
+	               std::function<void(bool written)> callback);
+
 	/* Adds user to activity statistics
 		user - name of user
 		time - timestamp of activity statistics
@@ -143,6 +332,20 @@ public:
 	                           const std::vector<char>& data,
 	                           std::function<void(bool added)> callback);
 
+	/* Adds batch of records to user logs and, if it is required by the record, users to activity statistics
+		records - records for adding
+		returns statuses of the records in the same order: true if the record has been added
+	*/
+	std::vector<bool> add_logs(const std::vector<log_record>& records);
+
+	/* Async adds batch of records to user logs and, if it is required by the record, users to activity statistics.
+	   Writes of all records are sent simultaneously
+		records - records for adding
+		callback - complete callback which gets statuses of the records in the same order
+	*/
+	void add_logs(const std::vector<log_record>& records,
+	              std::function<void(const std::vector<bool>& added)> callback);
+
 	/* Gets user's logs for specified period
 		user - name of user
 		begin_time - begin of the time period
@@ -178,6 +381,97 @@ public:
 	                   const std::vector<std::string>& subkeys,
 	                   std::function<void(const std::vector<char>& data)> callback);
 
+	/* Async gets user's logs for specified period and reports whether all of them have been read.
+	   Missing logs of days aren't failures, failed reads are
+		user - name of user
+		begin_time - begin of the time period
+		end_time - end of the time period
+		callback - gets logs in order of days and true if all logs have been read,
+			false if some reads have failed and the data is incomplete
+	*/
+	void get_user_logs_checked(const std::string& user,
+	                           uint64_t begin_time,
+	                           uint64_t end_time,
+	                           std::function<void(const std::vector<char>& data, bool complete)> callback);
+
+	/* Async gets user's logs for subkeys and reports whether all of them have been read
+		user - name of user
+		subkeys - custom keys of user logs
+		callback - gets logs in order of subkeys and true if all logs have been read
+	*/
+	void get_user_logs_checked(const std::string& user,
+	                           const std::vector<std::string>& subkeys,
+	                           std::function<void(const std::vector<char>& data, bool complete)> callback);
+
+	/* Async selects subkeys which may have user's logs.
+	   If days with user logs are marked, marks of the whole range are read once and days without logs are skipped.
+	   Logs of past days which haven't been found recently are skipped too.
+	   Readers which read the range day by day select days at first and then read selected days by get_selected_user_logs
+		user - name of user
+		subkeys - custom keys of user logs
+		callback - gets selected subkeys in the same order
+	*/
+	void select_user_logs(const std::string& user,
+	                      const std::vector<std::string>& subkeys,
+	                      std::function<void(const std::vector<std::string>& subkeys)> callback);
+
+	/* Async gets user's logs for subkeys selected by select_user_logs, marks of days aren't read again
+		user - name of user
+		subkeys - selected keys of user logs
+		callback - gets logs in order of subkeys and true if all logs have been read
+	*/
+	void get_selected_user_logs(const std::string& user,
+	                            const std::vector<std::string>& subkeys,
+	                            std::function<void(const std::vector<char>& data, bool complete)> callback);
+
+	/* Gets logs of many users for specified period.
+	   Logs of batches of users are read by bulk reads which are grouped by destination node,
+	   number of bulk reads in flight is bounded, so memory doesn't grow with the number of users
+		users - names of users
+		begin_time - begin of the time period
+		end_time - end of the time period
+		callback - is called for each user with its logs as soon as they have been read, so users come in order of completion.
+			complete is false if some logs of the user haven't been read because of errors, missing logs aren't errors.
+			It is called from elliptics threads but never simultaneously. Returns after it has been called for all users
+	*/
+	void get_users_logs(const std::vector<std::string>& users,
+	                    uint64_t begin_time,
+	                    uint64_t end_time,
+	                    std::function<void(const std::string& user, const std::vector<char>& data, bool complete)> callback);
+
+	/* Gets logs of many users for subkeys
+		users - names of users
+		subkeys - custom keys of user logs
+		callback - is called for each user with its logs in order of completion
+	*/
+	void get_users_logs(const std::vector<std::string>& users,
+	                    const std::vector<std::string>& subkeys,
+	                    std::function<void(const std::string& user, const std::vector<char>& data, bool complete)> callback);
+
+	/* Async gets logs of many users for specified period
+		users - names of users
+		begin_time - begin of the time period
+		end_time - end of the time period
+		callback - is called for each user with its logs in order of completion
+		complete_callback - is called after callback has been called for all users
+	*/
+	void get_users_logs(const std::vector<std::string>& users,
+	                    uint64_t begin_time,
+	                    uint64_t end_time,
+	                    std::function<void(const std::string& user, const std::vector<char>& data, bool complete)> callback,
+	                    std::function<void()> complete_callback);
+
+	/* Async gets logs of many users for subkeys
+		users - names of users
+		subkeys - custom keys of user logs
+		callback - is called for each user with its logs in order of completion
+		complete_callback - is called after callback has been called for all users
+	*/
+	void get_users_logs(const std::vector<std::string>& users,
+	                    const std::vector<std::string>& subkeys,
+	                    std::function<void(const std::string& user, const std::vector<char>& data, bool complete)> callback,
+	                    std::function<void()> complete_callback);
+
 	/* Gets active users with activity statistics for specified period
 		time - timestamp of the activity statistics day
 		returns list of active users
@@ -205,6 +499,287 @@ public:
 	void get_active_users(const std::vector<std::string>& subkeys,
 	                      std::function<void(const std::set<std::string> &active_users)> callback);
 
+	/* Async gets active users for specified period and reports whether all activity statistics have been read
+		begin_time - begin of the time period
+		end_time - end of the time period
+		callback - gets active users and true if all statistics have been read,
+			false if some reads have failed and the users are incomplete
+	*/
+	void get_active_users_checked(uint64_t begin_time,
+	                              uint64_t end_time,
+	                              std::function<void(const std::set<std::string>& active_users, bool complete)> callback);
+
+	/* Async gets active users for specified subkeys and reports whether all activity statistics have been read
+		subkeys - custom keys of activity statistics
+		callback - gets active users and true if all statistics have been read
+	*/
+	void get_active_users_checked(const std::vector<std::string>& subkeys,
+	                              std::function<void(const std::set<std::string>& active_users, bool complete)> callback);
+
+	/* Async gets users which have been active in any of subkeys and whose names are in the chunk of activity statistics.
+	   Each user is always in the same chunk, so users of different chunks are different and all days can be
+	   deduplicated chunk by chunk: memory is bounded by one chunk of all days instead of the whole range
+		subkeys - custom keys of activity statistics
+		chunk - index of the chunk from 0 to get_activity_chunks() - 1
+		callback - gets unique active users of the chunk and true if all statistics have been read
+	*/
+	void get_active_users_chunk(const std::vector<std::string>& subkeys,
+	                            uint32_t chunk,
+	                            std::function<void(const std::set<std::string>& active_users, bool complete)> callback);
+
+	/* Gets unique active users for specified period in no particular order.
+	   It skips sorting, so it is faster than get_active_users for long periods
+		begin_time - begin of the time period
+		end_time - end of the time period
+		returns unsorted unique active users
+	*/
+	std::vector<std::string> get_active_users_unsorted(uint64_t begin_time, uint64_t end_time);
+
+	/* Gets unique active users for specified subkeys in no particular order
+		subkeys - custom keys of activity statistics
+		returns unsorted unique active users
+	*/
+	std::vector<std::string> get_active_users_unsorted(const std::vector<std::string>& subkeys);
+
+	/* Async gets unique active users for specified period in no particular order
+		begin_time - begin of the time period
+		end_time - end of the time period
+		callback - complete callback which gets unsorted unique active users
+	*/
+	void get_active_users_unsorted(uint64_t begin_time,
+	                               uint64_t end_time,
+	                               std::function<void(const std::vector<std::string>& active_users)> callback);
+
+	/* Async gets unique active users for specified subkeys in no particular order
+		subkeys - custom keys of activity statistics
+		callback - complete callback which gets unsorted unique active users
+	*/
+	void get_active_users_unsorted(const std::vector<std::string>& subkeys,
+	                               std::function<void(const std::vector<std::string>& active_users)> callback);
+
+	/* Gets active users for specified period as flat list.
+	   List takes much less memory than set and is built by one sort of the found names
+		begin_time - begin of the time period
+		end_time - end of the time period
+		returns sorted list of unique active users
+	*/
+	active_users_list get_active_users_list(uint64_t begin_time, uint64_t end_time);
+
+	/* Gets active users for specified subkeys as flat list
+		subkeys - custom keys of activity statistics
+		returns sorted list of unique active users
+	*/
+	active_users_list get_active_users_list(const std::vector<std::string>& subkeys);
+
+	/* Async gets active users for specified period as shared list.
+	   The list is immutable, so it can be kept and passed to other threads without copying
+		begin_time - begin of the time period
+		end_time - end of the time period
+		callback - complete callback which gets the list
+	*/
+	void get_active_users_list(uint64_t begin_time,
+	                           uint64_t end_time,
+	                           std::function<void(const std::shared_ptr<const active_users_list>& active_users)> callback);
+
+	/* Async gets active users for specified subkeys as shared list
+		subkeys - custom keys of activity statistics
+		callback - complete callback which gets the list
+	*/
+	void get_active_users_list(const std::vector<std::string>& subkeys,
+	                           std::function<void(const std::shared_ptr<const active_users_list>& active_users)> callback);
+
+	/* Gets page of active users for specified period.
+	   User which is active in several days is listed only once. Pages are read chunk by chunk,
+	   so memory used by one page is proportional to the size of one chunk of activity statistics.
+	   Elliptics reads an index only whole, so each page reads at least one whole chunk of all days:
+	   with one chunk (default) each page reads whole days, set_activity_chunks() bounds the cost of a page.
+		begin_time - begin of the time period
+		end_time - end of the time period
+		cursor - cursor of the page returned by the previous call, empty for the first page
+		limit - maximum number of users in the page, page can contain less users even if it isn't the last
+		returns page of active users, throws std::invalid_argument if cursor or limit is invalid
+			and ioremap::elliptics::error if a chunk can't be read
+	*/
+	active_users_page get_active_users(uint64_t begin_time,
+	                                   uint64_t end_time,
+	                                   const std::string& cursor,
+	                                   uint32_t limit);
+
+	/* Gets page of active users for specified subkeys
+		subkeys - custom keys of activity statistics
+		cursor - cursor of the page returned by the previous call, empty for the first page
+		limit - maximum number of users in the page
+		returns page of active users, throws std::invalid_argument if cursor or limit is invalid
+	*/
+	active_users_page get_active_users(const std::vector<std::string>& subkeys,
+	                                   const std::string& cursor,
+	                                   uint32_t limit);
+
+	/* Async gets page of active users for specified subkeys
+		subkeys - custom keys of activity statistics
+		cursor - cursor of the page returned by the previous call, empty for the first page
+		limit - maximum number of users in the page
+		callback - complete callback which gets the page
+		throws std::invalid_argument if cursor or limit is invalid
+	*/
+	void get_active_users(const std::vector<std::string>& subkeys,
+	                      const std::string& cursor,
+	                      uint32_t limit,
+	                      std::function<void(const active_users_page& page)> callback);
+
+	/* Async gets page of active users for specified subkeys and reports whether all its chunks have been read
+		subkeys - custom keys of activity statistics
+		cursor - cursor of the page returned by the previous call, empty for the first page
+		limit - maximum number of users in the page
+		callback - gets the page and true if it has been read, false if a chunk can't be read and the page is invalid
+		throws std::invalid_argument if cursor or limit is invalid
+	*/
+	void get_active_users_checked(const std::vector<std::string>& subkeys,
+	                              const std::string& cursor,
+	                              uint32_t limit,
+	                              std::function<void(const active_users_page& page, bool complete)> callback);
+
+	/* Gets users which are active in each of the days.
+	   Days are intersected by elliptics, so users of separate days aren't read
+		subkeys - custom keys of activity statistics
+		returns users active in all subkeys
+	*/
+	std::set<std::string> get_active_users_intersection(const std::vector<std::string>& subkeys);
+
+	/* Async gets users which are active in each of the days
+		subkeys - custom keys of activity statistics
+		callback - complete callback which gets users active in all subkeys
+	*/
+	void get_active_users_intersection(const std::vector<std::string>& subkeys,
+	                                   std::function<void(const std::set<std::string>& active_users)> callback);
+
+	/* Gets users which are active in at least specified number of the days.
+	   Days of each user are counted while the activity statistics is scanned once
+		subkeys - custom keys of activity statistics
+		days - minimum number of days, throws std::invalid_argument if it is 0
+		returns users active in at least days of subkeys
+	*/
+	std::set<std::string> get_active_users_at_least(const std::vector<std::string>& subkeys, uint32_t days);
+
+	/* Async gets users which are active in at least specified number of the days
+		subkeys - custom keys of activity statistics
+		days - minimum number of days, throws std::invalid_argument if it is 0
+		callback - complete callback which gets users active in at least days of subkeys
+	*/
+	void get_active_users_at_least(const std::vector<std::string>& subkeys,
+	                               uint32_t days,
+	                               std::function<void(const std::set<std::string>& active_users)> callback);
+
+	/* Gets users which are active in any of the days but aren't active in any of the excluded days.
+	   For example, new users are users active today and not active in previous days
+		subkeys - custom keys of activity statistics
+		excluded - custom keys of activity statistics which users shouldn't be active in
+		returns users active in subkeys and not active in excluded
+	*/
+	std::set<std::string> get_active_users_difference(const std::vector<std::string>& subkeys,
+	                                                  const std::vector<std::string>& excluded);
+
+	/* Async gets users which are active in any of the days but aren't active in any of the excluded days
+		subkeys - custom keys of activity statistics
+		excluded - custom keys of activity statistics which users shouldn't be active in
+		callback - complete callback which gets users active in subkeys and not active in excluded
+	*/
+	void get_active_users_difference(const std::vector<std::string>& subkeys,
+	                                 const std::vector<std::string>& excluded,
+	                                 std::function<void(const std::set<std::string>& active_users)> callback);
+
+	/* Computes retention matrix of cohorts of the days in the period.
+	   Activity statistics of each required day is read once and is kept as sorted hashes of users,
+	   cohorts are intersected with the later days in parallel. Counts are approximate only in case of hash collision
+		begin_time - begin of the period of cohort days
+		end_time - end of the period of cohort days
+		offsets - offsets in days for which retention is computed
+		threads - number of threads which read days and intersect them, 0 - number of cores
+		returns retention matrix
+		throws std::invalid_argument if cohort days and days of offsets are more than maximum range
+	*/
+	retention_matrix get_retention(uint64_t begin_time,
+	                               uint64_t end_time,
+	                               const std::vector<uint32_t>& offsets,
+	                               uint32_t threads = 0);
+
+	/* Checks whether the user is active in the day
+		user - name of user
+		time - timestamp of the activity statistics day
+		returns true if the user is active in the day
+	*/
+	bool is_active(const std::string& user, uint64_t time);
+
+	/* Checks whether the user is active in the day
+		user - name of user
+		subkey - custom key of activity statistics
+		returns true if the user is active in the subkey
+	*/
+	bool is_active(const std::string& user, const std::string& subkey);
+
+	/* Checks whether users are active in the day.
+	   Each user costs the filter reads and, only if the filter says "maybe", one read of indexes of the user,
+	   so active users of the day aren't read
+		users - names of users
+		time - timestamp of the activity statistics day
+		returns activity of the users in the same order
+	*/
+	std::vector<bool> is_active(const std::vector<std::string>& users, uint64_t time);
+
+	/* Checks whether users are active in the day
+		users - names of users
+		subkey - custom key of activity statistics
+		returns activity of the users in the same order
+	*/
+	std::vector<bool> is_active(const std::vector<std::string>& users, const std::string& subkey);
+
+	/* Async checks whether users are active in the day
+		users - names of users
+		time - timestamp of the activity statistics day
+		callback - complete callback which gets activity of the users in the same order
+	*/
+	void is_active(const std::vector<std::string>& users,
+	               uint64_t time,
+	               std::function<void(const std::vector<bool>& active)> callback);
+
+	/* Async checks whether users are active in the day
+		users - names of users
+		subkey - custom key of activity statistics
+		callback - complete callback which gets activity of the users in the same order
+	*/
+	void is_active(const std::vector<std::string>& users,
+	               const std::string& subkey,
+	               std::function<void(const std::vector<bool>& active)> callback);
+
+	/* Gets number of activities of each active user for specified period
+		begin_time - begin of the time period
+		end_time - end of the time period
+		returns map of user to the sum of his activity counters in the period,
+			user which has been active without enabled counters has 0
+	*/
+	std::map<std::string, uint64_t> get_activity_counts(uint64_t begin_time, uint64_t end_time);
+
+	/* Gets number of activities of each active user for specified subkeys
+		subkeys - custom keys of activity statistics
+		returns map of user to the sum of his activity counters in the subkeys
+	*/
+	std::map<std::string, uint64_t> get_activity_counts(const std::vector<std::string>& subkeys);
+
+	/* Async gets number of activities of each active user for specified period
+		begin_time - begin of the time period
+		end_time - end of the time period
+		callback - complete callback which gets map of user to the sum of his activity counters
+	*/
+	void get_activity_counts(uint64_t begin_time,
+	                         uint64_t end_time,
+	                         std::function<void(const std::map<std::string, uint64_t>& counts)> callback);
+
+	/* Async gets number of activities of each active user for specified subkeys
+		subkeys - custom keys of activity statistics
+		callback - complete callback which gets map of user to the sum of his activity counters
+	*/
+	void get_activity_counts(const std::vector<std::string>& subkeys,
+	                         std::function<void(const std::map<std::string, uint64_t>& counts)> callback);
 
 	/* Runs through users logs for specified time period and calls callback on each log file
 		user - name of user
@@ -226,10 +801,11 @@ public:
 	                   const std::vector<std::string>& subkeys,
 	                   std::function<bool(const std::vector<char>& data)> callback);
 
-	/* Runs throgh activity statistics for specified time period and calls callback on each activity statistics
+	/* Runs throgh activity statistics for specified time period and calls callback on each activity statistics.
+	   Active users of the next days are read while the callback handles the current day
 		begin_time - begin of the time period
 		end_time - end of the time period
-		callback - on active users callback
+		callback - on active users callback, returns false for stopping the iteration
 	*/
 	void for_active_users(uint64_t begin_time,
 	                      uint64_t end_time,
@@ -242,6 +818,27 @@ public:
 	void for_active_users(const std::vector<std::string>& subkeys,
 	                      std::function<bool(const std::set<std::string>& active_users)> callback);
 
+	/* Async runs throgh activity statistics for specified time period.
+	   It doesn't block: the callback is called from elliptics threads, one day at a time in order of days
+		begin_time - begin of the time period
+		end_time - end of the time period
+		callback - on active users callback, returns false for stopping the iteration
+		complete_callback - is called once after the iteration is over
+	*/
+	void for_active_users(uint64_t begin_time,
+	                      uint64_t end_time,
+	                      std::function<bool(const std::set<std::string>& active_users)> callback,
+	                      std::function<void()> complete_callback);
+
+	/* Async runs throgh activity statistics for specified subkeys
+		subkeys - custom keys of activity statistics
+		callback - on active users callback, returns false for stopping the iteration
+		complete_callback - is called once after the iteration is over
+	*/
+	void for_active_users(const std::vector<std::string>& subkeys,
+	                      std::function<bool(const std::set<std::string>& active_users)> callback,
+	                      std::function<void()> complete_callback);
+
 private:
 	provider(const provider&) = delete;
 	provider& operator=(const provider&) = delete;
@@ -252,6 +849,13 @@ private:
 
 extern int get_log_level(const std::string& log_level);
 
+/* Converts time period into subkeys of the days which it covers
+	begin_time - begin of the time period
+	end_time - end of the time period
+	returns subkeys in order of days
+*/
+extern std::vector<std::string> time_period_to_subkeys(uint64_t begin_time, uint64_t end_time);
+
 } /* namespace history */
 
 #endif //HISTORY_PROVIDER_H
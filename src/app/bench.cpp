@@ -0,0 +1,573 @@
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <atomic>
+#include <cmath>
+#include <numeric>
+#include <future>
+#include <time.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "historydb/provider.h"
+#include "histogram.h"
+
+namespace consts {
+	const uint32_t DEFAULT_DURATION = 60; // default duration of the benchmark in seconds
+	const uint32_t DEFAULT_CONCURRENCY = 16; // default number of threads or async requests in flight
+	const uint32_t DEFAULT_USERS = 1000000; // default number of users
+	const double DEFAULT_ZIPF = 0.99; // default exponent of users popularity
+	const char DEFAULT_MIX[] = "add_log_with_activity=90,get_user_logs=10";
+	const char DEFAULT_PAYLOAD[] = "fixed:100";
+	const char DEFAULT_LOG_FILE[] = "/dev/stderr";
+	const uint64_t MAX_PAYLOAD = 64 * 1024 * 1024; // maximum size of generated log record
+	const uint64_t EXP_PAYLOAD_MEANS = 32; // exponential sizes are capped at this number of means
+} /* namespace consts */
+
+enum operation {
+	ADD_LOG = 0,
+	ADD_LOG_WITH_ACTIVITY,
+	GET_USER_LOGS,
+	GET_ACTIVE_USERS,
+	OPERATIONS_NO
+};
+
+const char* OPERATION_NAMES[OPERATIONS_NO] = {
+	"add_log",
+	"add_log_with_activity",
+	"get_user_logs",
+	"get_active_users"
+};
+
+void print_usage(char* s)
+{
+	std::cout << "Usage: " << s << " [options]\n"
+	<< " -r addr:port:family    - adds a route to the given node, could be specified several times\n"
+	<< " -g groups              - groups id to connect which are separated by ','\n"
+	<< " -m min_writes          - minimum number of succeeded writes [default: number of groups]\n"
+	<< " -d seconds             - duration of the benchmark [default: " << consts::DEFAULT_DURATION << "]\n"
+	<< " -R rate                - target rate of requests per second, 0 - as fast as possible (closed loop) [default: 0]\n"
+	<< " -c concurrency         - number of threads for sync API or maximum requests in flight for async API [default: "
+	<< consts::DEFAULT_CONCURRENCY << "]\n"
+	<< " -a                     - use async API [default: sync API]\n"
+	<< " -x mix                 - weights of operations: add_log, add_log_with_activity, get_user_logs, get_active_users\n"
+	<< "                          [default: " << consts::DEFAULT_MIX << "]\n"
+	<< " -u users               - number of users [default: " << consts::DEFAULT_USERS << "]\n"
+	<< " -z exponent            - exponent of zipf distribution of users popularity, 0 - uniform [default: " << consts::DEFAULT_ZIPF << "]\n"
+	<< " -s payload             - size distribution of log record: fixed:SIZE, uniform:MIN:MAX or exp:MEAN\n"
+	<< "                          [default: " << consts::DEFAULT_PAYLOAD << "]\n"
+	<< " -o file                - file for json report [default: stdout]\n"
+	<< " -l log_file            - elliptics client log file [default: " << consts::DEFAULT_LOG_FILE << "]\n"
+	<< " -L log_level           - elliptics client log level: DATA, ERROR, INFO, NOTICE, DEBUG [default: ERROR]\n"
+	;
+}
+
+uint64_t now_us()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void sleep_until_us(uint64_t time)
+{
+	const auto now = now_us();
+	if (time > now)
+		boost::this_thread::sleep(boost::posix_time::microseconds(time - now));
+}
+
+/* Generates ranks from 1 to n with probability proportional to 1 / rank^exponent.
+ * Uses rejection-inversion method (W. Hormann, G. Derflinger) which doesn't require table of n elements.
+ */
+class zipf_distribution
+{
+public:
+	zipf_distribution(uint64_t n, double exponent)
+	: n_(n)
+	, exponent_(exponent)
+	, h_integral_x1_(h_integral(1.5) - 1)
+	, h_integral_n_(h_integral(n + 0.5))
+	, s_(2 - h_integral_inverse(h_integral(2.5) - h(2)))
+	{}
+
+	template<typename Generator>
+	uint64_t operator()(Generator& gen) {
+		std::uniform_real_distribution<double> uniform(0, 1);
+		while (true) {
+			const double u = h_integral_n_ + uniform(gen) * (h_integral_x1_ - h_integral_n_);
+			const double x = h_integral_inverse(u);
+			uint64_t k = x + 0.5;
+			if (k < 1)
+				k = 1;
+			else if (k > n_)
+				k = n_;
+			if (k - x <= s_ || u >= h_integral(k + 0.5) - h(k))
+				return k;
+		}
+	}
+
+private:
+	double h(double x) const {
+		return std::exp(-exponent_ * std::log(x));
+	}
+
+	double h_integral(double x) const {
+		const double log_x = std::log(x);
+		return helper2((1 - exponent_) * log_x) * log_x;
+	}
+
+	double h_integral_inverse(double x) const {
+		double t = x * (1 - exponent_);
+		if (t < -1)
+			t = -1;
+		return std::exp(helper1(t) * x);
+	}
+
+	static double helper1(double x) { // log(1 + x) / x
+		return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (0.5 - x * (1. / 3 - 0.25 * x));
+	}
+
+	static double helper2(double x) { // (exp(x) - 1) / x
+		return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+	}
+
+	uint64_t	n_;
+	double		exponent_;
+	double		h_integral_x1_;
+	double		h_integral_n_;
+	double		s_;
+};
+
+/* Generates sizes of log records from description: fixed:SIZE, uniform:MIN:MAX or exp:MEAN
+ */
+class payload_distribution
+{
+public:
+	payload_distribution(const std::string& description)
+	: description_(description)
+	{
+		std::vector<std::string> strs;
+		boost::split(strs, description, boost::is_any_of(":"));
+
+		type_ = strs[0];
+		if (type_ == "fixed" && strs.size() == 2) {
+			min_ = max_ = boost::lexical_cast<uint64_t>(strs[1]);
+		}
+		else if (type_ == "uniform" && strs.size() == 3) {
+			min_ = boost::lexical_cast<uint64_t>(strs[1]);
+			max_ = boost::lexical_cast<uint64_t>(strs[2]);
+		}
+		else if (type_ == "exp" && strs.size() == 2) {
+			min_ = 0;
+			max_ = boost::lexical_cast<uint64_t>(strs[1]);
+		}
+		else
+			throw std::invalid_argument("payload");
+
+		if (min_ > max_ || max_ > consts::MAX_PAYLOAD)
+			throw std::invalid_argument("payload");
+
+		limit_ = type_ == "exp" ? std::min(max_ * consts::EXP_PAYLOAD_MEANS, consts::MAX_PAYLOAD) : max_;
+	}
+
+	template<typename Generator>
+	uint64_t operator()(Generator& gen) const {
+		if (type_ == "uniform")
+			return std::uniform_int_distribution<uint64_t>(min_, max_)(gen);
+		if (type_ == "exp")
+			return std::min<uint64_t>(std::exponential_distribution<double>(1. / max_)(gen), limit_);
+		return min_;
+	}
+
+	const std::string& description() const { return description_; }
+
+	/* Returns the largest size which can be generated
+	 */
+	uint64_t limit() const { return limit_; }
+
+private:
+	std::string	description_;
+	std::string	type_;
+	uint64_t	min_;
+	uint64_t	max_;
+	uint64_t	limit_;
+};
+
+struct bench_config
+{
+	bench_config()
+	: min_writes(-1)
+	, duration(consts::DEFAULT_DURATION)
+	, rate(0)
+	, concurrency(consts::DEFAULT_CONCURRENCY)
+	, async(false)
+	, mix(consts::DEFAULT_MIX)
+	, users(consts::DEFAULT_USERS)
+	, zipf(consts::DEFAULT_ZIPF)
+	, payload(consts::DEFAULT_PAYLOAD)
+	, log_file(consts::DEFAULT_LOG_FILE)
+	, log_level("ERROR")
+	{}
+
+	std::vector<std::string>	remotes;
+	std::vector<int>			groups;
+	int							min_writes;
+	uint32_t					duration;
+	double						rate;
+	uint32_t					concurrency;
+	bool						async;
+	std::string					mix;
+	uint64_t					users;
+	double						zipf;
+	std::string					payload;
+	std::string					output;
+	std::string					log_file;
+	std::string					log_level;
+};
+
+/* Latencies and errors of one operation
+ */
+struct operation_stats
+{
+	operation_stats()
+	: errors(0)
+	{}
+
+	void merge(const operation_stats& other) {
+		latency.merge(other.latency);
+		errors += other.errors;
+	}
+
+	history::histogram	latency; // latencies in microseconds
+	uint64_t			errors;
+};
+
+/* Runs requests with configured mix of operations against provider and reports throughput and latencies.
+ * In open loop mode requests are scheduled with target rate and their latencies are measured from the scheduled time,
+ * so stalls of the storage are accounted for the requests which should have been sent during the stall.
+ */
+class bench
+{
+public:
+	bench(const bench_config& config, std::shared_ptr<history::provider> provider)
+	: config_(config)
+	, provider_(provider)
+	, payload_(config.payload)
+	, stats_(OPERATIONS_NO)
+	, in_flight_(0)
+	{
+		std::vector<std::string> items;
+		boost::split(items, config.mix, boost::is_any_of(","));
+
+		weights_.assign(OPERATIONS_NO, 0);
+		for (auto it = items.begin(), end = items.end(); it != end; ++it) {
+			std::vector<std::string> strs;
+			boost::split(strs, *it, boost::is_any_of("="));
+			if (strs.size() != 2)
+				throw std::invalid_argument("mix");
+
+			auto op = std::find(OPERATION_NAMES, OPERATION_NAMES + OPERATIONS_NO, strs[0]) - OPERATION_NAMES;
+			if (op == OPERATIONS_NO)
+				throw std::invalid_argument("mix");
+
+			weights_[op] = boost::lexical_cast<double>(strs[1]);
+		}
+
+		if (std::accumulate(weights_.begin(), weights_.end(), 0.) <= 0)
+			throw std::invalid_argument("mix");
+
+		std::mt19937_64 gen(time(NULL));
+		data_.resize(payload_.limit());
+		for (auto it = data_.begin(), end = data_.end(); it != end; ++it) {
+			*it = 'a' + gen() % 26;
+		}
+	}
+
+	void run() {
+		time_ = time(NULL);
+		start_ = now_us();
+		end_ = start_ + uint64_t(config_.duration) * 1000000;
+
+		if (config_.async) {
+			dispatch(0, 1);
+
+			boost::unique_lock<boost::mutex> lock(mutex_);
+			while (in_flight_ > 0)
+				cond_.wait(lock);
+		}
+		else {
+			std::list<boost::thread> threads;
+			for (uint32_t i = 0; i < config_.concurrency; ++i) {
+				threads.push_back(boost::thread(boost::bind(&bench::dispatch, this, i, config_.concurrency)));
+			}
+
+			while(!threads.empty()) {
+				threads.begin()->join();
+				threads.erase(threads.begin());
+			}
+		}
+
+		elapsed_ = (now_us() - start_) / 1000000.;
+	}
+
+	void report(std::ostream& out) const {
+		out << "{\n"
+		    << "\t\"config\": {"
+		    << "\"api\": \"" << (config_.async ? "async" : "sync") << "\", "
+		    << "\"duration\": " << config_.duration << ", "
+		    << "\"rate\": " << config_.rate << ", "
+		    << "\"concurrency\": " << config_.concurrency << ", "
+		    << "\"mix\": \"" << config_.mix << "\", "
+		    << "\"users\": " << config_.users << ", "
+		    << "\"zipf\": " << config_.zipf << ", "
+		    << "\"payload\": \"" << payload_.description() << "\"},\n"
+		    << "\t\"elapsed\": " << elapsed_ << ",\n";
+
+		operation_stats total;
+		for (size_t op = 0; op < OPERATIONS_NO; ++op) {
+			total.merge(stats_[op]);
+		}
+
+		out << "\t\"total\": ";
+		report(out, total);
+		out << ",\n\t\"operations\": {";
+
+		bool first = true;
+		for (size_t op = 0; op < OPERATIONS_NO; ++op) {
+			if (weights_[op] <= 0)
+				continue;
+			out << (first ? "\n" : ",\n") << "\t\t\"" << OPERATION_NAMES[op] << "\": ";
+			report(out, stats_[op]);
+			first = false;
+		}
+
+		out << "\n\t}\n}" << std::endl;
+	}
+
+private:
+	void report(std::ostream& out, const operation_stats& stats) const {
+		const auto& l = stats.latency;
+		out << "{\"ops\": " << l.count()
+		    << ", \"errors\": " << stats.errors
+		    << ", \"throughput\": " << (elapsed_ > 0 ? l.count() / elapsed_ : 0)
+		    << ", \"latency_us\": {"
+		    << "\"min\": " << l.min()
+		    << ", \"mean\": " << l.mean()
+		    << ", \"p50\": " << l.percentile(50)
+		    << ", \"p99\": " << l.percentile(99)
+		    << ", \"p999\": " << l.percentile(99.9)
+		    << ", \"max\": " << l.max()
+		    << "}}";
+	}
+
+	/* Sends requests until the end of the benchmark.
+	 * Each of dispatchers sends 1/dispatchers part of the target rate.
+	 */
+	void dispatch(uint32_t dispatcher, uint32_t dispatchers) {
+		std::mt19937_64 gen(time(NULL) + dispatcher);
+		std::discrete_distribution<int> operations(weights_.begin(), weights_.end());
+		zipf_distribution zipf(config_.users, config_.zipf);
+		std::uniform_int_distribution<uint64_t> uniform(1, config_.users);
+
+		std::vector<operation_stats> stats(OPERATIONS_NO);
+		const double interval = config_.rate > 0 ? 1000000. * dispatchers / config_.rate : 0;
+
+		for (uint64_t i = 0;; ++i) {
+			uint64_t scheduled = now_us();
+			if (interval > 0) {
+				scheduled = start_ + uint64_t(i * interval);
+				sleep_until_us(scheduled);
+			}
+
+			if (scheduled >= end_)
+				break;
+
+			const auto op = operation(operations(gen));
+			const auto user = "user" + boost::lexical_cast<std::string>(config_.zipf > 0 ? zipf(gen) : uniform(gen));
+			const auto size = payload_(gen);
+
+			if (config_.async) {
+				boost::unique_lock<boost::mutex> lock(mutex_);
+				while (in_flight_ >= config_.concurrency)
+					cond_.wait(lock);
+				++in_flight_;
+				lock.unlock();
+
+				run_async(op, user, size, scheduled);
+			}
+			else {
+				bool result = false;
+				try {
+					result = run_sync(op, user, size);
+				}
+				catch (...) {}
+
+				stats[op].latency.record(now_us() - scheduled);
+				if (!result)
+					++stats[op].errors;
+			}
+		}
+
+		boost::unique_lock<boost::mutex> lock(mutex_);
+		for (size_t op = 0; op < OPERATIONS_NO; ++op) {
+			stats_[op].merge(stats[op]);
+		}
+	}
+
+	bool run_sync(operation op, const std::string& user, uint64_t size) {
+		switch(op) {
+			case ADD_LOG:
+				provider_->add_log(user, time_, std::vector<char>(data_.begin(), data_.begin() + size));
+				return true;
+			case ADD_LOG_WITH_ACTIVITY:
+				provider_->add_log_with_activity(user, time_, std::vector<char>(data_.begin(), data_.begin() + size));
+				return true;
+			case GET_USER_LOGS: {
+				std::promise<bool> complete;
+				provider_->get_user_logs_checked(user, time_, time_, [&complete](const std::vector<char>&, bool result) { complete.set_value(result); });
+				return complete.get_future().get();
+			}
+			case GET_ACTIVE_USERS: {
+				std::promise<bool> complete;
+				provider_->get_active_users_checked(time_, time_, [&complete](const std::set<std::string>&, bool result) { complete.set_value(result); });
+				return complete.get_future().get();
+			}
+			default:
+				return false;
+		}
+	}
+
+	void run_async(operation op, const std::string& user, uint64_t size, uint64_t scheduled) {
+		const auto on_added = std::function<void(bool)>(boost::bind(&bench::on_completed, this, op, scheduled, _1));
+		const auto on_read = boost::bind(&bench::on_completed, this, op, scheduled, _2); // _2 - whether all reads have succeeded
+
+		switch(op) {
+			case ADD_LOG:
+				provider_->add_log(user, time_, std::vector<char>(data_.begin(), data_.begin() + size), on_added);
+				break;
+			case ADD_LOG_WITH_ACTIVITY:
+				provider_->add_log_with_activity(user, time_, std::vector<char>(data_.begin(), data_.begin() + size), on_added);
+				break;
+			case GET_USER_LOGS:
+				provider_->get_user_logs_checked(user, time_, time_, std::function<void(const std::vector<char>&, bool)>(on_read));
+				break;
+			case GET_ACTIVE_USERS:
+				provider_->get_active_users_checked(time_, time_, std::function<void(const std::set<std::string>&, bool)>(on_read));
+				break;
+			default:
+				on_completed(op, scheduled, false);
+		}
+	}
+
+	void on_completed(operation op, uint64_t scheduled, bool result) {
+		const auto latency = now_us() - scheduled;
+
+		boost::unique_lock<boost::mutex> lock(mutex_);
+		stats_[op].latency.record(latency);
+		if (!result)
+			++stats_[op].errors;
+
+		--in_flight_;
+		cond_.notify_all();
+	}
+
+	const bench_config					config_;
+	std::shared_ptr<history::provider>	provider_;
+	payload_distribution				payload_;
+	std::vector<double>					weights_; // weights of operations
+	std::vector<char>					data_; // data from which log records are taken
+
+	boost::mutex						mutex_;
+	boost::condition_variable			cond_;
+	std::vector<operation_stats>		stats_; // stats of operations
+	uint32_t							in_flight_; // number of async requests in flight
+
+	uint64_t							time_; // timestamp for logs and activity
+	uint64_t							start_; // start of the benchmark in microseconds
+	uint64_t							end_; // end of the benchmark in microseconds
+	double								elapsed_; // actual duration of the benchmark in seconds
+};
+
+int main(int argc, char* argv[])
+{
+	int ch, err = 0;
+	bench_config config;
+
+	try {
+		while((ch = getopt(argc, argv, "r:g:m:d:R:c:ax:u:z:s:o:l:L:")) != -1) {
+			switch(ch) {
+				case 'r': config.remotes.push_back(optarg); break;
+				case 'g': {
+					std::vector<std::string> strs;
+					boost::split(strs, optarg, boost::is_any_of(","));
+
+					for (auto it = strs.begin(), itEnd = strs.end(); it != itEnd; ++it) {
+						config.groups.push_back(boost::lexical_cast<int>(*it));
+					}
+				}
+				break;
+				case 'm': config.min_writes = boost::lexical_cast<int>(optarg); break;
+				case 'd': config.duration = boost::lexical_cast<uint32_t>(optarg); break;
+				case 'R': config.rate = boost::lexical_cast<double>(optarg); break;
+				case 'c': config.concurrency = boost::lexical_cast<uint32_t>(optarg); break;
+				case 'a': config.async = true; break;
+				case 'x': config.mix = optarg; break;
+				case 'u': config.users = boost::lexical_cast<uint64_t>(optarg); break;
+				case 'z': config.zipf = boost::lexical_cast<double>(optarg); break;
+				case 's': config.payload = optarg; break;
+				case 'o': config.output = optarg; break;
+				case 'l': config.log_file = optarg; break;
+				case 'L': config.log_level = optarg; break;
+				default: throw std::invalid_argument("unknown option");
+			}
+		}
+
+		if (config.remotes.empty() ||
+		    config.groups.empty() ||
+		    config.concurrency == 0 ||
+		    config.users == 0 ||
+		    config.zipf < 0 ||
+		    config.rate < 0)
+			throw std::invalid_argument("Required parameters are missing");
+	}
+	catch(...) {
+		err = -1;
+	}
+
+	if (err) {
+		print_usage(argv[0]);
+		return err;
+	}
+
+	if (config.min_writes < 0)
+		config.min_writes = config.groups.size();
+
+	try {
+		auto provider = std::make_shared<history::provider>(config.remotes,
+		                                                    config.groups,
+		                                                    config.min_writes,
+		                                                    config.log_file,
+		                                                    history::get_log_level(config.log_level));
+
+		bench b(config, provider);
+		b.run();
+
+		if (config.output.empty()) {
+			b.report(std::cout);
+		}
+		else {
+			std::ofstream out(config.output.c_str());
+			b.report(out);
+		}
+	}
+	catch (std::exception& e) {
+		std::cerr << "Benchmark failed: " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
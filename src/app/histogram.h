@@ -0,0 +1,113 @@
+#ifndef APP_HISTOGRAM_H
+#define APP_HISTOGRAM_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+namespace history {
+
+/* Log-linear histogram of latencies (or any other non-negative values).
+ * Values less than SUB_BUCKETS are recorded exactly, bigger values are recorded with relative error less than 1/HALF_BUCKETS.
+ * Histogram isn't thread-safe: record into per-thread histograms and merge them.
+ */
+class histogram
+{
+public:
+	histogram()
+	: counts_(BUCKETS, 0)
+	, total_(0)
+	, sum_(0)
+	, min_(std::numeric_limits<uint64_t>::max())
+	, max_(0)
+	{}
+
+	void record(uint64_t value) {
+		++counts_[bucket(value)];
+		++total_;
+		sum_ += value;
+		min_ = std::min(min_, value);
+		max_ = std::max(max_, value);
+	}
+
+	void merge(const histogram& other) {
+		for (size_t i = 0; i < BUCKETS; ++i) {
+			counts_[i] += other.counts_[i];
+		}
+		total_ += other.total_;
+		sum_ += other.sum_;
+		min_ = std::min(min_, other.min_);
+		max_ = std::max(max_, other.max_);
+	}
+
+	void reset() {
+		std::fill(counts_.begin(), counts_.end(), 0);
+		total_ = sum_ = max_ = 0;
+		min_ = std::numeric_limits<uint64_t>::max();
+	}
+
+	uint64_t count() const { return total_; }
+	uint64_t min() const { return total_ ? min_ : 0; }
+	uint64_t max() const { return max_; }
+	double mean() const { return total_ ? double(sum_) / total_ : 0; }
+
+	// returns value below which lies the percent of recorded values
+	uint64_t percentile(double percent) const {
+		if (!total_)
+			return 0;
+
+		const uint64_t rank = std::max<uint64_t>(1, uint64_t(total_ * percent / 100. + 0.5));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < BUCKETS; ++i) {
+			seen += counts_[i];
+			if (seen >= rank)
+				return std::min(max_, upper_bound(i));
+		}
+		return max_;
+	}
+
+	// returns number of values and upper bounds of non-empty buckets for exporting histogram
+	std::vector<std::pair<uint64_t, uint64_t>> buckets() const {
+		std::vector<std::pair<uint64_t, uint64_t>> ret;
+		for (size_t i = 0; i < BUCKETS; ++i) {
+			if (counts_[i])
+				ret.push_back(std::make_pair(upper_bound(i), counts_[i]));
+		}
+		return ret;
+	}
+
+private:
+	static const size_t SUB_BITS = 8;
+	static const size_t SUB_BUCKETS = 1 << SUB_BITS;
+	static const size_t HALF_BUCKETS = SUB_BUCKETS / 2;
+	static const size_t BUCKETS = SUB_BUCKETS + (64 - SUB_BITS) * HALF_BUCKETS;
+
+	static size_t bucket(uint64_t value) {
+		if (value < SUB_BUCKETS)
+			return value;
+
+		const size_t msb = 63 - __builtin_clzll(value);
+		const size_t shift = msb - (SUB_BITS - 1);
+		return SUB_BUCKETS + (shift - 1) * HALF_BUCKETS + ((value >> shift) - HALF_BUCKETS);
+	}
+
+	static uint64_t upper_bound(size_t index) {
+		if (index < SUB_BUCKETS)
+			return index;
+
+		const size_t shift = (index - SUB_BUCKETS) / HALF_BUCKETS + 1;
+		const uint64_t sub = (index - SUB_BUCKETS) % HALF_BUCKETS + HALF_BUCKETS;
+		return ((sub + 1) << shift) - 1;
+	}
+
+	std::vector<uint64_t>	counts_;
+	uint64_t				total_;
+	uint64_t				sum_;
+	uint64_t				min_;
+	uint64_t				max_;
+};
+
+} /* namespace history */
+
+#endif //APP_HISTOGRAM_H
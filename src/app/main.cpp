@@ -9,8 +9,6 @@
 
 #include "historydb/provider.h"
 
-#include "test2.h"
-
 char UMM[]		= "User made money\n";
 char UCM[]		= "User check mail\n";
 char UCR[]		= "User clear recycle\n";
@@ -145,7 +143,6 @@ void run_test(int test_no, std::shared_ptr<history::provider> provider)
 {
 	switch(test_no) {
 		case 1:	test1(provider); break;
-		case 2:	test2(provider); break;
 		case 3: test3(provider); break;
 		case 4: test4(provider); break;
 	}
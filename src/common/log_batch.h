@@ -0,0 +1,461 @@
+#ifndef HISTORY_SRC_COMMON_LOG_BATCH_H
+#define HISTORY_SRC_COMMON_LOG_BATCH_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/lexical_cast.hpp>
+
+#include <msgpack.hpp>
+
+#include <historydb/provider.h>
+
+#include "../fastcgi/rapidjson/reader.h"
+#include "../fastcgi/rapidjson/writer.h"
+#include "../fastcgi/rapidjson/stringbuffer.h"
+
+namespace history {
+
+namespace consts { namespace batch {
+const char USER_ITEM[] = "user";
+const char DATA_ITEM[] = "data";
+const char KEY_ITEM[] = "key";
+const char TIME_ITEM[] = "time";
+const char ACTIVITY_ITEM[] = "activity";
+const char STATUSES_ITEM[] = "statuses";
+const size_t DEFAULT_MAX_RECORDS = 1000; // default maximum number of records in one batch
+} } /* namespace consts::batch */
+
+/* Stream of one NDJSON line for rapidjson reader, the end of the line is read as null character,
+ * so the line is parsed in place without copying it into null-terminated string.
+ */
+struct json_line_stream
+{
+	typedef char Ch;
+
+	json_line_stream(const char* begin, const char* end)
+	: src_(begin)
+	, head_(begin)
+	, end_(end)
+	{}
+
+	Ch Peek() const { return src_ < end_ ? *src_ : '\0'; }
+	Ch Take() { return src_ < end_ ? *src_++ : '\0'; }
+	size_t Tell() const { return src_ - head_; }
+
+	Ch* PutBegin() { RAPIDJSON_ASSERT(false); return 0; }
+	void Put(Ch) { RAPIDJSON_ASSERT(false); }
+	size_t PutEnd(Ch*) { RAPIDJSON_ASSERT(false); return 0; }
+
+	const char*	src_;
+	const char*	head_;
+	const char*	end_;
+};
+
+/* SAX handler which fills log record from json object of one line without building DOM of the line.
+ * Only members of the root object are taken, values of other types and nested values are skipped.
+ */
+class json_record_handler
+{
+public:
+	typedef char Ch;
+
+	json_record_handler(log_record& record)
+	: record_(record)
+	, depth_(0)
+	, member_(MEMBER_OTHER)
+	, expects_name_(true)
+	, root_object_(false)
+	, has_user_(false)
+	, has_data_(false)
+	, has_key_(false)
+	, has_time_(false)
+	, time_(0)
+	{}
+
+	// returns true if the record has all required fields, it follows the rules of /add_log:
+	// key is preferred over time, time could be a number or a string
+	bool valid() {
+		if (!root_object_ || !has_user_ || !has_data_)
+			return false;
+
+		if (has_key_) {
+			if (record_.subkey.empty())
+				return false;
+		}
+		else if (has_time_)
+			record_.time = time_;
+		else
+			return false;
+
+		return !record_.user.empty();
+	}
+
+	void Null() { value(); }
+	void Bool(bool b) {
+		if (is_value(MEMBER_ACTIVITY))
+			record_.activity = b;
+		value();
+	}
+	void Int(int i) { number(i >= 0, i); }
+	void Uint(unsigned i) { number(true, i); }
+	void Int64(int64_t i) { number(i >= 0, i); }
+	void Uint64(uint64_t i) { number(true, i); }
+	void Double(double) { value(); }
+	void String(const Ch* str, rapidjson::SizeType length, bool) {
+		if (depth_ == 1 && expects_name_) { // name of the member of the root object
+			member_ = member(str, length);
+			expects_name_ = false;
+			return;
+		}
+
+		if (is_value(MEMBER_USER)) {
+			record_.user.assign(str, length);
+			has_user_ = true;
+		}
+		else if (is_value(MEMBER_DATA)) {
+			record_.data.assign(str, str + length);
+			has_data_ = true;
+		}
+		else if (is_value(MEMBER_KEY)) {
+			record_.subkey.assign(str, length);
+			has_key_ = true;
+		}
+		else if (is_value(MEMBER_TIME)) {
+			try {
+				time_ = boost::lexical_cast<uint64_t>(std::string(str, length));
+				has_time_ = true;
+			}
+			catch (boost::bad_lexical_cast&) {
+				has_time_ = false;
+			}
+		}
+		value();
+	}
+	void StartObject() {
+		if (depth_ == 0)
+			root_object_ = true;
+		++depth_;
+	}
+	void EndObject(rapidjson::SizeType) { end_nested(); }
+	void StartArray() { ++depth_; }
+	void EndArray(rapidjson::SizeType) { end_nested(); }
+
+private:
+	enum member_type {
+		MEMBER_USER,
+		MEMBER_DATA,
+		MEMBER_KEY,
+		MEMBER_TIME,
+		MEMBER_ACTIVITY,
+		MEMBER_OTHER
+	};
+
+	static member_type member(const Ch* str, rapidjson::SizeType length) {
+		const std::string name(str, length);
+		if (name == consts::batch::USER_ITEM)
+			return MEMBER_USER;
+		if (name == consts::batch::DATA_ITEM)
+			return MEMBER_DATA;
+		if (name == consts::batch::KEY_ITEM)
+			return MEMBER_KEY;
+		if (name == consts::batch::TIME_ITEM)
+			return MEMBER_TIME;
+		if (name == consts::batch::ACTIVITY_ITEM)
+			return MEMBER_ACTIVITY;
+		return MEMBER_OTHER;
+	}
+
+	// returns true if the scalar value belongs to the member of the root object
+	bool is_value(member_type member) const {
+		return depth_ == 1 && !expects_name_ && member_ == member;
+	}
+
+	template<typename T>
+	void number(bool unsigned_value, T i) {
+		if (is_value(MEMBER_TIME)) {
+			has_time_ = unsigned_value;
+			time_ = has_time_ ? i : 0;
+		}
+		value();
+	}
+
+	// the value of the member of the root object has been read, so the next string is the name of the next member
+	void value() {
+		if (depth_ == 1)
+			expects_name_ = true;
+	}
+
+	void end_nested() {
+		--depth_;
+		value(); // nested value of the member of the root object is skipped as a whole
+	}
+
+	log_record&	record_;
+	size_t		depth_; // depth of the current value, members of the root object are at depth 1
+	member_type	member_; // member whose value is expected at depth 1
+	bool		expects_name_; // true if the next string at depth 1 is the name of the member
+	bool		root_object_;
+	bool		has_user_;
+	bool		has_data_;
+	bool		has_key_; // true if key is a string, then time is ignored
+	bool		has_time_; // true if time is a non-negative number or a string with such number
+	uint64_t	time_;
+};
+
+/* Batch of log records of /add_logs request which is shared by fastcgi and thevoid frontends.
+ * Records are sent as NDJSON (one json object per line) or as msgpack (sequence of maps).
+ * Each record has fields: user, data, time or key and optional activity flag.
+ * Invalid record doesn't fail the whole batch: it gets status 400 and other records are added.
+ * Batch of more than max records fails as a whole, so one request doesn't send unbounded number of writes.
+ * The body could be parsed by parts as it is received: only the last incomplete NDJSON line
+ * or the incomplete msgpack record is kept between parts, so the whole body isn't buffered.
+ */
+class log_batch
+{
+public:
+	enum status {
+		STATUS_ADDED = 200,
+		STATUS_BAD_RECORD = 400,
+		STATUS_NOT_ADDED = 500
+	};
+
+	log_batch(size_t max_records = consts::batch::DEFAULT_MAX_RECORDS)
+	: max_records_(max_records)
+	{}
+
+	log_batch(const log_batch&) = delete;
+	log_batch& operator=(const log_batch&) = delete;
+
+	// parses records from the whole NDJSON body, throws std::length_error if there are more than max records
+	void parse_json(const char* data, size_t size) {
+		feed_json(data, size);
+		finish_json();
+	}
+
+	// parses complete lines of the part of NDJSON body, the incomplete last line is kept until the next part,
+	// throws std::length_error if there are more than max records
+	void feed_json(const char* data, size_t size) {
+		const char* end = data + size;
+
+		if (!tail_.empty()) { // completes the line of the previous part
+			const char* line_end = static_cast<const char*>(memchr(data, '\n', size));
+			if (!line_end) {
+				tail_.append(data, end);
+				return;
+			}
+
+			tail_.append(data, line_end);
+			data = line_end + 1;
+			parse_json_line(tail_.data(), tail_.data() + tail_.size());
+			tail_.clear();
+		}
+
+		while (data < end) {
+			const char* line_end = static_cast<const char*>(memchr(data, '\n', end - data));
+			if (!line_end) {
+				tail_.assign(data, end);
+				return;
+			}
+
+			parse_json_line(data, line_end);
+			data = line_end + 1;
+		}
+	}
+
+	// parses the last line of NDJSON body which hasn't been ended by new line
+	void finish_json() {
+		if (tail_.empty())
+			return;
+
+		parse_json_line(tail_.data(), tail_.data() + tail_.size());
+		std::string().swap(tail_);
+	}
+
+	// parses complete records of the part of msgpack body, the incomplete last record is kept until the next part,
+	// returns false if the body is malformed, throws std::length_error if there are more than max records
+	bool feed_msgpack(const char* data, size_t size) {
+		try {
+			unpacker_.reserve_buffer(size);
+			memcpy(unpacker_.buffer(), data, size);
+			unpacker_.buffer_consumed(size);
+
+			msgpack::unpacked result;
+			while (unpacker_.next(&result)) {
+				check_size();
+
+				log_record record;
+				if (!parse_msgpack_record(result.get(), record)) {
+					statuses_.push_back(STATUS_BAD_RECORD);
+					continue;
+				}
+
+				add_record(record);
+			}
+		}
+		catch (std::length_error&) {
+			throw;
+		}
+		catch (std::exception&) { // the rest of the stream can't be parsed
+			return false;
+		}
+
+		return true;
+	}
+
+	// returns false if msgpack body has been ended in the middle of a record
+	bool finish_msgpack() {
+		return unpacker_.nonparsed_size() == 0;
+	}
+
+	// parses records from msgpack body, returns false if the body is malformed,
+	// throws std::length_error if there are more than max records
+	bool parse_msgpack(const char* data, size_t size) {
+		try {
+			size_t offset = 0;
+			msgpack::unpacked result;
+
+			while (offset < size) {
+				msgpack::unpack(&result, data, size, &offset);
+				check_size();
+
+				log_record record;
+				if (!parse_msgpack_record(result.get(), record)) {
+					statuses_.push_back(STATUS_BAD_RECORD);
+					continue;
+				}
+
+				add_record(record);
+			}
+		}
+		catch (std::length_error&) {
+			throw;
+		}
+		catch (std::exception&) { // the rest of the stream can't be parsed
+			return false;
+		}
+
+		return true;
+	}
+
+	const std::vector<log_record>& records() const { return records_; }
+
+	// sets statuses of the parsed records by results of adding them
+	void set_results(const std::vector<bool>& added) {
+		for (size_t i = 0; i < added.size() && i < positions_.size(); ++i) {
+			statuses_[positions_[i]] = added[i] ? STATUS_ADDED : STATUS_NOT_ADDED;
+		}
+	}
+
+	// serializes statuses of all records in order of the request: {"statuses": [200, 400, ...]}
+	std::string write_statuses(bool msgpack) const {
+		if (msgpack) {
+			msgpack::sbuffer buffer;
+			msgpack::packer<msgpack::sbuffer> packer(&buffer);
+			packer.pack_map(1);
+			packer.pack_raw(sizeof(consts::batch::STATUSES_ITEM) - 1);
+			packer.pack_raw_body(consts::batch::STATUSES_ITEM, sizeof(consts::batch::STATUSES_ITEM) - 1);
+			packer.pack_array(statuses_.size());
+			for (auto it = statuses_.begin(), end = statuses_.end(); it != end; ++it) {
+				packer.pack_uint64(*it);
+			}
+			return std::string(buffer.data(), buffer.size());
+		}
+
+		rapidjson::StringBuffer buffer;
+		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+		writer.StartObject();
+		writer.String(consts::batch::STATUSES_ITEM, sizeof(consts::batch::STATUSES_ITEM) - 1);
+		writer.StartArray();
+		for (auto it = statuses_.begin(), end = statuses_.end(); it != end; ++it) {
+			writer.Uint(*it);
+		}
+		writer.EndArray();
+		writer.EndObject();
+		return std::string(buffer.GetString(), buffer.Size());
+	}
+
+private:
+	void check_size() const {
+		if (max_records_ != 0 && statuses_.size() >= max_records_)
+			throw std::length_error("Too many records in batch, maximum is " + boost::lexical_cast<std::string>(max_records_));
+	}
+
+	void add_record(log_record& record) {
+		positions_.push_back(statuses_.size());
+		statuses_.push_back(STATUS_NOT_ADDED);
+		records_.push_back(log_record());
+		std::swap(records_.back(), record);
+	}
+
+	void parse_json_line(const char* begin, const char* end) {
+		const char* it = begin;
+		while (it < end && (*it == ' ' || *it == '\t' || *it == '\r'))
+			++it;
+		if (it == end) // skips empty lines
+			return;
+
+		check_size();
+
+		log_record record;
+		json_record_handler handler(record);
+		json_line_stream stream(begin, end);
+
+		if (!reader_.Parse<0>(stream, handler) || !handler.valid()) {
+			statuses_.push_back(STATUS_BAD_RECORD);
+			return;
+		}
+
+		add_record(record);
+	}
+
+	static bool parse_msgpack_record(const msgpack::object& obj, log_record& record) {
+		if (obj.type != msgpack::type::MAP)
+			return false;
+
+		bool has_data = false, has_key = false, empty_key = false;
+
+		for (size_t i = 0; i < obj.via.map.size; ++i) {
+			const auto& key = obj.via.map.ptr[i].key;
+			const auto& val = obj.via.map.ptr[i].val;
+			if (key.type != msgpack::type::RAW)
+				continue;
+
+			const std::string name(key.via.raw.ptr, key.via.raw.size);
+
+			if (name == consts::batch::USER_ITEM && val.type == msgpack::type::RAW)
+				record.user.assign(val.via.raw.ptr, val.via.raw.size);
+			else if (name == consts::batch::DATA_ITEM && val.type == msgpack::type::RAW) {
+				record.data.assign(val.via.raw.ptr, val.via.raw.ptr + val.via.raw.size);
+				has_data = true;
+			}
+			else if (name == consts::batch::KEY_ITEM && val.type == msgpack::type::RAW) {
+				record.subkey.assign(val.via.raw.ptr, val.via.raw.size);
+				has_key = true;
+				empty_key = record.subkey.empty(); // empty key isn't replaced by time
+			}
+			else if (name == consts::batch::TIME_ITEM && val.type == msgpack::type::POSITIVE_INTEGER) {
+				record.time = val.via.u64;
+				has_key = true;
+			}
+			else if (name == consts::batch::ACTIVITY_ITEM && val.type == msgpack::type::BOOLEAN)
+				record.activity = val.via.boolean;
+		}
+
+		return !record.user.empty() && has_data && has_key && !empty_key;
+	}
+
+	size_t					max_records_; // maximum number of records, 0 - unlimited
+	std::vector<log_record>	records_; // records which have been parsed
+	std::vector<size_t>		positions_; // positions of the parsed records in the request
+	std::vector<int>		statuses_; // statuses of all records in order of the request
+	rapidjson::Reader		reader_; // keeps its stack between lines
+	std::string				tail_; // incomplete last line of the parsed part of NDJSON body
+	msgpack::unpacker		unpacker_; // keeps incomplete last record of the parsed part of msgpack body
+};
+
+} /* namespace history */
+
+#endif //HISTORY_SRC_COMMON_LOG_BATCH_H
@@ -1,23 +1,30 @@
 #include "historydb-fastcgi.h"
 #include <iostream>
 #include <stdexcept>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <cerrno>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/bind.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/thread/tss.hpp>
 
 #include <fastcgi2/logger.h>
 #include <fastcgi2/config.h>
-#include <fastcgi2/stream.h>
 #include <fastcgi2/request.h>
 #include <fastcgi2/component_factory.h>
 
 #include <historydb/provider.h>
 #include <elliptics/error.hpp>
 
-#include "rapidjson/document.h"
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
+#include "../common/log_batch.h"
+
+#include <msgpack.hpp>
 
 #define ADD_HANDLER(script, func) m_handlers.insert(\
 		std::make_pair(script, boost::bind(&handler::func, this, _1, _2)));
@@ -32,11 +39,213 @@ const char DATA_ITEM[] = "data";
 const char BEGIN_TIME_ITEM[] = "begin_time";
 const char END_TIME_ITEM[] = "end_time";
 const char KEYS_ITEM[] = "keys";
+const char LOGS_ITEM[] = "logs";
+const char ACTIVE_USERS_ITEM[] = "active_users";
+const char ACTIVITY_COUNTS_ITEM[] = "activity_counts";
+const char USERS_ITEM[] = "users";
+const char ACTIVE_ITEM[] = "active";
+const char OP_ITEM[] = "op";
+const char DAYS_ITEM[] = "days";
+const char EXCLUDE_KEYS_ITEM[] = "exclude_keys";
+const char EXCLUDE_BEGIN_TIME_ITEM[] = "exclude_begin_time";
+const char EXCLUDE_END_TIME_ITEM[] = "exclude_end_time";
+const char INTERSECTION_OP[] = "intersection";
+const char AT_LEAST_OP[] = "at_least";
+const char DIFFERENCE_OP[] = "difference";
+const char LIMIT_ITEM[] = "limit";
+const char CURSOR_ITEM[] = "cursor";
+const char ACCEPT_HEADER[] = "Accept";
+const char CONTENT_TYPE_HEADER[] = "Content-Type";
+const char MSGPACK_CONTENT_TYPE[] = "application/x-msgpack";
+const int DEFAULT_TIMEOUT = 60; // default timeout in seconds for waiting results of provider calls
+const size_t DEFAULT_MAX_ORPHANED_READS = 1024; // default limit of reads of timed out requests which are still in flight
+const size_t MAX_KEPT_BUFFER = 1024 * 1024; // larger json buffer of the worker is freed after the reply
+}
+
+/* Counts reads of timed out requests which are still in flight.
+ * Nobody waits for such reads, but they hold elliptics resources, so while elliptics is slow
+ * new requests would add reads faster than they complete. New reads are rejected while the limit is exceeded.
+ */
+class orphaned_reads
+{
+public:
+	orphaned_reads(size_t limit)
+	: limit_(limit)
+	, count_(0)
+	{}
+
+	// returns true if new reads should be rejected, 0 limit means unlimited
+	bool exceeded() const {
+		return limit_ != 0 && count_.load(std::memory_order_relaxed) >= limit_;
+	}
+
+	void add(size_t count) {
+		count_.fetch_add(count, std::memory_order_relaxed);
+	}
+
+	void remove(size_t count) {
+		count_.fetch_sub(count, std::memory_order_relaxed);
+	}
+
+private:
+	const size_t		limit_;
+	std::atomic<size_t>	count_;
+};
+
+namespace {
+
+// returns true if the client prefers msgpack reply instead of json
+bool accepts_msgpack(fastcgi::Request* req)
+{
+	return req->hasHeader(consts::ACCEPT_HEADER) &&
+	       req->getHeader(consts::ACCEPT_HEADER).find(consts::MSGPACK_CONTENT_TYPE) != std::string::npos;
+}
+
+// thrown if results of provider calls haven't been received in time
+struct timeout_error : public std::runtime_error
+{
+	timeout_error() : std::runtime_error("provider call timed out") {}
+};
+
+// thrown if reads are rejected because too many reads of timed out requests are still in flight
+struct overload_error : public std::runtime_error
+{
+	overload_error() : std::runtime_error("too many orphaned reads") {}
+};
+
+// returns true if the request body is serialized into msgpack
+bool sends_msgpack(fastcgi::Request* req)
+{
+	return req->hasHeader(consts::CONTENT_TYPE_HEADER) &&
+	       req->getHeader(consts::CONTENT_TYPE_HEADER).find(consts::MSGPACK_CONTENT_TYPE) != std::string::npos;
 }
 
+/* Collects results of async provider calls which can be made simultaneously.
+ * fastcgi-daemon2 finishes the request when the handler returns and can't detach it,
+ * so the worker thread is blocked while it waits for the results: concurrency of the module
+ * is still bounded by its pool of threads, HistoryDB-TheVoid should be used for thousands of requests in flight.
+ * The collector only allows several calls of one request to be made simultaneously and bounds the waiting of reads.
+ * Callbacks hold the collector, so it outlives the handler if the handler stops waiting:
+ * calls which are still in flight are counted as orphaned reads until their results are received.
+ */
+template<typename T>
+class collector
+{
+public:
+	collector(size_t count, const std::shared_ptr<orphaned_reads>& orphans = std::shared_ptr<orphaned_reads>())
+	: results_(count)
+	, pending_(count)
+	, orphans_(orphans)
+	, orphaned_(false)
+	{}
+
+	void on_result(size_t index, const T& result) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (orphaned_) // nobody waits for the result, so it isn't kept
+			orphans_->remove(1);
+		else
+			results_[index] = result;
+		if (--pending_ == 0)
+			cond_.notify_all();
+	}
+
+	// waits for all results and returns them in order of calls, throws timeout_error if timeout in seconds is exceeded
+	const std::vector<T>& wait(int timeout) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (!cond_.wait_for(lock, std::chrono::seconds(timeout), [this] { return pending_ == 0; })) {
+			if (orphans_) {
+				orphaned_ = true;
+				orphans_->add(pending_);
+			}
+			throw timeout_error();
+		}
+		return results_;
+	}
+
+	/* waits for all results without own timeout, the waiting is bounded by timeout of elliptics session.
+	 * It is used by writes: the write can still succeed after the handler stops waiting,
+	 * so the client must get the real result of the write instead of timeout.
+	 */
+	const std::vector<T>& wait() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		cond_.wait(lock, [this] { return pending_ == 0; });
+		return results_;
+	}
+
+private:
+	std::vector<T>						results_;
+	size_t								pending_;
+	std::shared_ptr<orphaned_reads>		orphans_; // counter of reads which are in flight after the timeout, NULL for writes
+	bool								orphaned_; // true if the handler has stopped waiting
+	std::mutex							mutex_;
+	std::condition_variable				cond_;
+};
+
+// creates collector of reads, throws overload_error if too many reads of timed out requests are still in flight
+template<typename Collector>
+std::shared_ptr<Collector> read_collector(size_t count, const std::shared_ptr<orphaned_reads>& orphans)
+{
+	if (orphans->exceeded())
+		throw overload_error();
+	return std::make_shared<Collector>(count, orphans);
+}
+
+boost::thread_specific_ptr<rapidjson::StringBuffer> thread_json_buffer;
+
+// returns cleared json buffer of the current worker thread, the buffer keeps its memory between requests up to the limit
+rapidjson::StringBuffer& json_buffer()
+{
+	if (!thread_json_buffer.get())
+		thread_json_buffer.reset(new rapidjson::StringBuffer());
+
+	thread_json_buffer->Clear();
+	return *thread_json_buffer;
+}
+
+// frees json buffer of the current worker thread if a large reply has grown it,
+// so one large reply doesn't keep its memory in each worker forever
+void shrink_json_buffer()
+{
+	if (thread_json_buffer.get() && thread_json_buffer->stack_.GetCapacity() > consts::MAX_KEPT_BUFFER)
+		thread_json_buffer.reset();
+}
+
+// gets subkeys from parameter with custom keys or from parameters with time period, returns false if they are missed
+bool request_keys(fastcgi::Request* req,
+                  const char* keys_item,
+                  const char* begin_time_item,
+                  const char* end_time_item,
+                  std::vector<std::string>& keys)
+{
+	if (req->hasArg(keys_item) && !req->getArg(keys_item).empty()) {
+		std::string keys_value = req->getArg(keys_item);
+		boost::split(keys, keys_value, boost::is_any_of(":"));
+		return true;
+	}
+
+	if (req->hasArg(begin_time_item) && req->hasArg(end_time_item)) {
+		keys = time_period_to_subkeys(boost::lexical_cast<uint64_t>(req->getArg(begin_time_item)),
+		                              boost::lexical_cast<uint64_t>(req->getArg(end_time_item)));
+		return true;
+	}
+
+	return false;
+}
+
+void pack_raw(msgpack::packer<msgpack::sbuffer>& packer, const char* data, size_t size)
+{
+	packer.pack_raw(size);
+	packer.pack_raw_body(data, size);
+}
+
+} /* namespace */
+
 handler::handler(fastcgi::ComponentContext* context)
 : fastcgi::Component(context)
 , m_logger(NULL)
+, m_timeout(consts::DEFAULT_TIMEOUT)
+, m_orphans(std::make_shared<orphaned_reads>(consts::DEFAULT_MAX_ORPHANED_READS))
+, m_max_batch(history::consts::batch::DEFAULT_MAX_RECORDS)
 {
 	init_handlers(); // Inits handlers map
 }
@@ -96,6 +305,22 @@ void handler::onLoad()
 	                                                 min_writes,
 	                                                 log_file,
 	                                                 history::get_log_level(log_level));
+
+	m_provider->set_early_ack(config->asInt(xpath + "/early_ack", 0) != 0);
+	m_provider->set_activity_chunks(config->asInt(xpath + "/activity_chunks", 1));
+	m_provider->set_activity_counters(config->asInt(xpath + "/activity_counters", 0) != 0);
+	m_provider->set_activity_filters(config->asInt(xpath + "/activity_filters", 0) != 0);
+	m_provider->set_activity_filter_users(config->asInt(xpath + "/activity_filter_users", 0));
+	m_provider->set_merge_threads(config->asInt(xpath + "/merge_threads", 0));
+	m_provider->set_fanout_limits(config->asInt(xpath + "/fanout_request_limit", 32),
+	                              config->asInt(xpath + "/fanout_global_limit", 1024));
+	m_provider->set_max_range(config->asInt(xpath + "/max_range", 0));
+	m_provider->set_log_days(config->asInt(xpath + "/log_days", 0) != 0);
+	m_provider->set_missing_logs_ttl(config->asInt(xpath + "/missing_logs_ttl", 0));
+
+	m_timeout = config->asInt(xpath + "/timeout", consts::DEFAULT_TIMEOUT);
+	m_orphans = std::make_shared<orphaned_reads>(config->asInt(xpath + "/max_orphaned_reads", consts::DEFAULT_MAX_ORPHANED_READS));
+	m_max_batch = config->asInt(xpath + "/max_batch", history::consts::batch::DEFAULT_MAX_RECORDS);
 }
 
 void handler::onUnload()
@@ -123,8 +348,12 @@ void handler::init_handlers()
 	ADD_HANDLER("/",					handle_root);
 	ADD_HANDLER("/add_log",				handle_add_log);
 	ADD_HANDLER("/add_activity",		handle_add_activity);
+	ADD_HANDLER("/add_logs",			handle_add_logs);
 	ADD_HANDLER("/get_active_users",	handle_get_active_users);
 	ADD_HANDLER("/get_user_logs",		handle_get_user_logs);
+	ADD_HANDLER("/get_active_users_set",	handle_get_active_users_set);
+	ADD_HANDLER("/get_activity_counts",	handle_get_activity_counts);
+	ADD_HANDLER("/is_active",			handle_is_active);
 }
 
 void handler::handle_root(fastcgi::Request* req, fastcgi::HandlerContext*)
@@ -156,20 +385,25 @@ void handler::handle_add_log(fastcgi::Request* req, fastcgi::HandlerContext*)
 		auto data = req->getArg(consts::DATA_ITEM);
 		std::vector<char> std_data(data.begin(), data.end());
 
+		auto added = std::make_shared<collector<bool>>(1);
+		auto callback = std::bind(&collector<bool>::on_result, added, 0, std::placeholders::_1);
+
 		if (req->hasArg(consts::KEY_ITEM)) {
 			m_provider->add_log(req->getArg(consts::USER_ITEM),
 			                    req->getArg(consts::KEY_ITEM),
-			                    std_data);
+			                    std_data,
+			                    callback);
 		}
 		else if (req->hasArg(consts::TIME_ITEM)) {
 			m_provider->add_log(req->getArg(consts::USER_ITEM),
 			                    boost::lexical_cast<uint64_t>(req->getArg(consts::TIME_ITEM)),
-			                    std_data);
+			                    std_data,
+			                    callback);
 		}
 		else
 			throw std::invalid_argument("Required parameters are missing");
 
-		req->setStatus(200);
+		req->setStatus(added->wait().front() ? 200 : 500);
 	}
 	catch(ioremap::elliptics::error&) {
 		req->setStatus(500);
@@ -188,24 +422,68 @@ void handler::handle_add_activity(fastcgi::Request* req, fastcgi::HandlerContext
 		if(!req->hasArg(consts::USER_ITEM))
 			throw std::invalid_argument("Required parameters are missing");
 
+		auto added = std::make_shared<collector<bool>>(1);
+		auto callback = std::bind(&collector<bool>::on_result, added, 0, std::placeholders::_1);
+
 		if(req->hasArg(consts::KEY_ITEM) &&
 		   !req->getArg(consts::KEY_ITEM).empty()) {
 			m_provider->add_activity(req->getArg(consts::USER_ITEM),
-			                         req->getArg(consts::KEY_ITEM));
+			                         req->getArg(consts::KEY_ITEM),
+			                         callback);
 		}
 		else if(req->hasArg(consts::TIME_ITEM)) {
 			m_provider->add_activity(req->getArg(consts::USER_ITEM),
-			                         boost::lexical_cast<uint64_t>(req->getArg(consts::TIME_ITEM)));
+			                         boost::lexical_cast<uint64_t>(req->getArg(consts::TIME_ITEM)),
+			                         callback);
 		}
 		else
 			throw std::invalid_argument("Required parameters are missing");
 
+		req->setStatus(added->wait().front() ? 200 : 500);
+	}
+	catch(ioremap::elliptics::error&) {
+		req->setStatus(500);
+	}
+	catch(...) {
+		req->setStatus(400);
+	}
+}
+
+void handler::handle_add_logs(fastcgi::Request* req, fastcgi::HandlerContext*)
+{
+	m_logger->debug("Handle add logs request\n");
+
+	try {
+		std::string body;
+		req->requestBody().toString(body);
+
+		log_batch batch(m_max_batch);
+		if (!sends_msgpack(req))
+			batch.parse_json(body.data(), body.size());
+		else if (!batch.parse_msgpack(body.data(), body.size()))
+			throw std::invalid_argument("Malformed msgpack");
+
+		typedef collector<std::vector<bool>> added_collector;
+		auto added = std::make_shared<added_collector>(1);
+		m_provider->add_logs(batch.records(), std::bind(&added_collector::on_result, added, 0, std::placeholders::_1));
+
+		batch.set_results(added->wait().front());
+
+		const bool msgpack = accepts_msgpack(req);
+		const auto reply = batch.write_statuses(msgpack);
+
+		if (msgpack)
+			req->setContentType(consts::MSGPACK_CONTENT_TYPE);
+		req->setHeader("Content-Length", boost::lexical_cast<std::string>(reply.size()));
+		req->write(reply.data(), reply.size());
 		req->setStatus(200);
 	}
 	catch(ioremap::elliptics::error&) {
+		req->setHeader("Content-Length", "0");
 		req->setStatus(500);
 	}
 	catch(...) {
+		req->setHeader("Content-Length", "0");
 		req->setStatus(400);
 	}
 }
@@ -214,54 +492,72 @@ void handler::handle_get_active_users(fastcgi::Request* req, fastcgi::HandlerCon
 {
 	m_logger->debug("Handle get active user request\n");
 	try {
-		fastcgi::RequestStream stream(req);
-
-		std::set<std::string> res;
+		std::vector<std::string> keys;
 
 		if (req->hasArg(consts::KEYS_ITEM) &&
 		    !req->getArg(consts::KEYS_ITEM).empty()) { // checks optional parameter key
 			std::string keys_value = req->getArg(consts::KEYS_ITEM);
-			std::vector<std::string> keys;
 			boost::split(keys, keys_value, boost::is_any_of(":"));
 			m_logger->debug("Gets active users by key: %s\n", keys.front().c_str());
-
-			res = m_provider->get_active_users(keys); // gets active users by key
 		}
 		else if(req->hasArg(consts::BEGIN_TIME_ITEM) &&
 		        req->hasArg(consts::END_TIME_ITEM)) { // checks optional parameter time
-			res = m_provider->get_active_users(boost::lexical_cast<uint64_t>(req->getArg(consts::BEGIN_TIME_ITEM)),
-											   boost::lexical_cast<uint64_t>(req->getArg(consts::END_TIME_ITEM))); // gets active users by time
+			keys = time_period_to_subkeys(boost::lexical_cast<uint64_t>(req->getArg(consts::BEGIN_TIME_ITEM)),
+			                              boost::lexical_cast<uint64_t>(req->getArg(consts::END_TIME_ITEM)));
 		}
 		else
 			throw std::invalid_argument("Required parameters are missing");
 
-		rapidjson::Document d; // creates document for json serialization
-		d.SetObject();
+		m_provider->check_range(keys); // rejects too long range before any read
 
-		rapidjson::Value active_users(rapidjson::kArrayType);
+		if (req->hasArg(consts::LIMIT_ITEM)) {
+			write_active_users_page(req, keys);
+			return;
+		}
 
-		for (auto it = res.begin(), itEnd = res.end(); it != itEnd; ++it) { // adds all active user with counters to json
-			rapidjson::Value user(it->c_str(), it->size(), d.GetAllocator());
-			active_users.PushBack(user, d.GetAllocator());
+		if (accepts_msgpack(req)) {
+			write_active_users_msgpack(req, keys);
+			return;
 		}
 
-		d.AddMember("active_users", active_users, d.GetAllocator());
+		typedef collector<std::shared_ptr<const active_users_list>> users_collector;
+		auto users = read_collector<users_collector>(1, m_orphans);
+		m_provider->get_active_users_list(keys, std::bind(&users_collector::on_result, users, 0, std::placeholders::_1));
+
+		const auto& res = *users->wait(m_timeout).front(); // gets active users by keys
 
-		rapidjson::StringBuffer buffer; // creates string buffer for serialized json
-		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer); // creates json writer
-		d.Accept(writer); // accepts writer by json document
+		auto& buffer = json_buffer(); // serializes users directly into the buffer of the worker
+		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+
+		writer.StartObject();
+		writer.String(consts::ACTIVE_USERS_ITEM, sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+		writer.StartArray();
+		for (size_t i = 0; i < res.size(); ++i) { // adds all active users to json
+			writer.String(res.data(i), res.length(i));
+		}
+		writer.EndArray();
+		writer.EndObject();
 
 		auto json = buffer.GetString();
 
 		m_logger->debug("Result json: %s\n", json);
 		req->setHeader("Content-Length", boost::lexical_cast<std::string>(buffer.Size()));
 
-		stream << json; // write result json to fastcgi stream
+		req->write(json, buffer.Size()); // writes result json to fastcgi stream
+		shrink_json_buffer();
 	}
 	catch(ioremap::elliptics::error&) {
 		req->setHeader("Content-Length", "0");
 		req->setStatus(500);
 	}
+	catch(timeout_error&) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(504);
+	}
+	catch(overload_error&) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(503);
+	}
 	catch(...) {
 		req->setHeader("Content-Length", "0");
 		req->setStatus(400);
@@ -272,39 +568,44 @@ void handler::handle_get_user_logs(fastcgi::Request* req, fastcgi::HandlerContex
 {
 	m_logger->debug("Handlle get user logs request\n");
 	try {
-		fastcgi::RequestStream stream(req);
-
 		if (!req->hasArg(consts::USER_ITEM))
 			throw std::invalid_argument("Required parameters are missing");
 
-		std::vector<char> res;
+		std::vector<std::string> keys;
 
 		if(req->hasArg(consts::KEYS_ITEM)) {
 			std::string keys_value = req->getArg(consts::KEYS_ITEM);
-			std::vector<std::string> keys;
 			boost::split(keys, keys_value, boost::is_any_of(":"));
-
-			res = m_provider->get_user_logs(req->getArg(consts::USER_ITEM),
-											keys); // gets user logs from historydb library
 		}
 		else if(req->hasArg(consts::BEGIN_TIME_ITEM) && req->hasArg(consts::END_TIME_ITEM)) {
-			res = m_provider->get_user_logs(req->getArg(consts::USER_ITEM),
-											boost::lexical_cast<uint64_t>(req->getArg(consts::BEGIN_TIME_ITEM)),
-											boost::lexical_cast<uint64_t>(req->getArg(consts::END_TIME_ITEM))); // gets user logs from historydb library
+			keys = time_period_to_subkeys(boost::lexical_cast<uint64_t>(req->getArg(consts::BEGIN_TIME_ITEM)),
+			                              boost::lexical_cast<uint64_t>(req->getArg(consts::END_TIME_ITEM)));
 		}
 		else
 			throw std::invalid_argument("Required parameters are missing");
 
-		rapidjson::Document d; // creates json document
-		d.SetObject();
+		m_provider->check_range(keys); // rejects too long range before any read
 
-		rapidjson::Value user_logs(res.data(), res.size(), d.GetAllocator()); // creates vector value for user one's day log
+		if (accepts_msgpack(req)) {
+			write_user_logs_msgpack(req, req->getArg(consts::USER_ITEM), keys);
+			return;
+		}
 
-		d.AddMember("logs", user_logs, d.GetAllocator()); // adds logs array to json document
+		typedef collector<std::vector<char>> logs_collector;
+		auto logs = read_collector<logs_collector>(1, m_orphans);
+		m_provider->get_user_logs(req->getArg(consts::USER_ITEM),
+		                          keys,
+		                          std::bind(&logs_collector::on_result, logs, 0, std::placeholders::_1));
 
-		rapidjson::StringBuffer buffer; // creates string buffer for serialized json
-		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer); // creates json writer
-		d.Accept(writer); // accepts writer by json document
+		const auto& res = logs->wait(m_timeout).front(); // gets user logs from historydb library
+
+		auto& buffer = json_buffer(); // serializes logs directly into the buffer of the worker
+		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+
+		writer.StartObject();
+		writer.String(consts::LOGS_ITEM, sizeof(consts::LOGS_ITEM) - 1);
+		writer.String(res.data(), res.size());
+		writer.EndObject();
 
 		auto json = buffer.GetString();
 
@@ -312,7 +613,8 @@ void handler::handle_get_user_logs(fastcgi::Request* req, fastcgi::HandlerContex
 
 		req->setHeader("Content-Length", boost::lexical_cast<std::string>(buffer.Size()));
 
-		stream << json; // writes result json to fastcgi stream
+		req->write(json, buffer.Size()); // writes result json to fastcgi stream
+		shrink_json_buffer();
 
 		req->setStatus(200);
 	}
@@ -320,12 +622,389 @@ void handler::handle_get_user_logs(fastcgi::Request* req, fastcgi::HandlerContex
 		req->setHeader("Content-Length", "0");
 		req->setStatus(500);
 	}
+	catch(timeout_error&) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(504);
+	}
+	catch(overload_error&) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(503);
+	}
 	catch(...) {
 		req->setHeader("Content-Length", "0");
 		req->setStatus(400);
 	}
 }
 
+void handler::handle_get_active_users_set(fastcgi::Request* req, fastcgi::HandlerContext*)
+{
+	m_logger->debug("Handle get active users set request\n");
+	try {
+		std::vector<std::string> keys;
+		if (!request_keys(req, consts::KEYS_ITEM, consts::BEGIN_TIME_ITEM, consts::END_TIME_ITEM, keys) ||
+		    !req->hasArg(consts::OP_ITEM))
+			throw std::invalid_argument("Required parameters are missing");
+
+		m_provider->check_range(keys); // rejects too long range before any read
+
+		typedef collector<std::set<std::string>> users_collector;
+		auto users = read_collector<users_collector>(1, m_orphans);
+		auto callback = std::bind(&users_collector::on_result, users, 0, std::placeholders::_1);
+
+		const auto op = req->getArg(consts::OP_ITEM);
+		if (op == consts::INTERSECTION_OP)
+			m_provider->get_active_users_intersection(keys, callback);
+		else if (op == consts::AT_LEAST_OP)
+			m_provider->get_active_users_at_least(keys, boost::lexical_cast<uint32_t>(req->getArg(consts::DAYS_ITEM)), callback);
+		else if (op == consts::DIFFERENCE_OP) {
+			std::vector<std::string> excluded;
+			if (!request_keys(req, consts::EXCLUDE_KEYS_ITEM, consts::EXCLUDE_BEGIN_TIME_ITEM, consts::EXCLUDE_END_TIME_ITEM, excluded))
+				throw std::invalid_argument("Excluded days are missing");
+			m_provider->check_range(excluded);
+			m_provider->get_active_users_difference(keys, excluded, callback);
+		}
+		else
+			throw std::invalid_argument("Unknown operation");
+
+		const auto& res = users->wait(m_timeout).front();
+
+		if (accepts_msgpack(req)) { // {"active_users": [users]}
+			msgpack::sbuffer buffer;
+			msgpack::packer<msgpack::sbuffer> packer(&buffer);
+
+			packer.pack_map(1);
+			pack_raw(packer, consts::ACTIVE_USERS_ITEM, sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+			packer.pack_array(res.size());
+			for (auto it = res.begin(), itEnd = res.end(); it != itEnd; ++it) {
+				pack_raw(packer, it->data(), it->size());
+			}
+
+			req->setContentType(consts::MSGPACK_CONTENT_TYPE);
+			req->setHeader("Content-Length", boost::lexical_cast<std::string>(buffer.size()));
+			req->write(buffer.data(), buffer.size());
+			req->setStatus(200);
+			return;
+		}
+
+		auto& buffer = json_buffer();
+		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+
+		writer.StartObject();
+		writer.String(consts::ACTIVE_USERS_ITEM, sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+		writer.StartArray();
+		for (auto it = res.begin(), itEnd = res.end(); it != itEnd; ++it) {
+			writer.String(it->c_str(), it->size());
+		}
+		writer.EndArray();
+		writer.EndObject();
+
+		req->setHeader("Content-Length", boost::lexical_cast<std::string>(buffer.Size()));
+		req->write(buffer.GetString(), buffer.Size());
+		shrink_json_buffer();
+	}
+	catch(ioremap::elliptics::error&) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(500);
+	}
+	catch(timeout_error&) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(504);
+	}
+	catch(overload_error&) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(503);
+	}
+	catch(...) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(400);
+	}
+}
+
+void handler::handle_get_activity_counts(fastcgi::Request* req, fastcgi::HandlerContext*)
+{
+	m_logger->debug("Handle get activity counts request\n");
+	try {
+		std::vector<std::string> keys;
+		if (!request_keys(req, consts::KEYS_ITEM, consts::BEGIN_TIME_ITEM, consts::END_TIME_ITEM, keys))
+			throw std::invalid_argument("Required parameters are missing");
+
+		m_provider->check_range(keys); // rejects too long range before any read
+
+		typedef collector<std::map<std::string, uint64_t>> counts_collector;
+		auto counts = read_collector<counts_collector>(1, m_orphans);
+		m_provider->get_activity_counts(keys, std::bind(&counts_collector::on_result, counts, 0, std::placeholders::_1));
+
+		const auto& res = counts->wait(m_timeout).front();
+
+		if (accepts_msgpack(req)) { // {"activity_counts": {user: count}}
+			msgpack::sbuffer buffer;
+			msgpack::packer<msgpack::sbuffer> packer(&buffer);
+
+			packer.pack_map(1);
+			pack_raw(packer, consts::ACTIVITY_COUNTS_ITEM, sizeof(consts::ACTIVITY_COUNTS_ITEM) - 1);
+			packer.pack_map(res.size());
+			for (auto it = res.begin(), itEnd = res.end(); it != itEnd; ++it) {
+				pack_raw(packer, it->first.data(), it->first.size());
+				packer.pack_uint64(it->second);
+			}
+
+			req->setContentType(consts::MSGPACK_CONTENT_TYPE);
+			req->setHeader("Content-Length", boost::lexical_cast<std::string>(buffer.size()));
+			req->write(buffer.data(), buffer.size());
+			req->setStatus(200);
+			return;
+		}
+
+		auto& buffer = json_buffer();
+		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+
+		writer.StartObject();
+		writer.String(consts::ACTIVITY_COUNTS_ITEM, sizeof(consts::ACTIVITY_COUNTS_ITEM) - 1);
+		writer.StartObject();
+		for (auto it = res.begin(), itEnd = res.end(); it != itEnd; ++it) { // adds all active users with counters to json
+			writer.String(it->first.c_str(), it->first.size());
+			writer.Uint64(it->second);
+		}
+		writer.EndObject();
+		writer.EndObject();
+
+		req->setHeader("Content-Length", boost::lexical_cast<std::string>(buffer.Size()));
+		req->write(buffer.GetString(), buffer.Size());
+		shrink_json_buffer();
+	}
+	catch(ioremap::elliptics::error&) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(500);
+	}
+	catch(timeout_error&) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(504);
+	}
+	catch(overload_error&) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(503);
+	}
+	catch(...) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(400);
+	}
+}
+
+void handler::handle_is_active(fastcgi::Request* req, fastcgi::HandlerContext*)
+{
+	m_logger->debug("Handle is active request\n");
+	try {
+		std::vector<std::string> users;
+		if (req->hasArg(consts::USERS_ITEM)) {
+			std::string users_value = req->getArg(consts::USERS_ITEM);
+			boost::split(users, users_value, boost::is_any_of(":"));
+		}
+		else if (req->hasArg(consts::USER_ITEM))
+			users.push_back(req->getArg(consts::USER_ITEM));
+		else
+			throw std::invalid_argument("Required parameters are missing");
+
+		std::string key;
+		if (req->hasArg(consts::KEY_ITEM))
+			key = req->getArg(consts::KEY_ITEM);
+		else if (req->hasArg(consts::TIME_ITEM)) {
+			auto time = boost::lexical_cast<uint64_t>(req->getArg(consts::TIME_ITEM));
+			key = time_period_to_subkeys(time, time).front();
+		}
+		else
+			throw std::invalid_argument("Required parameters are missing");
+
+		typedef collector<std::vector<bool>> active_collector;
+		auto active = read_collector<active_collector>(1, m_orphans);
+		m_provider->is_active(users, key, std::bind(&active_collector::on_result, active, 0, std::placeholders::_1));
+
+		const auto& res = active->wait(m_timeout).front();
+
+		if (accepts_msgpack(req)) { // {"active": {user: bool}}
+			msgpack::sbuffer buffer;
+			msgpack::packer<msgpack::sbuffer> packer(&buffer);
+
+			packer.pack_map(1);
+			pack_raw(packer, consts::ACTIVE_ITEM, sizeof(consts::ACTIVE_ITEM) - 1);
+			packer.pack_map(users.size());
+			for (size_t i = 0; i < users.size(); ++i) {
+				pack_raw(packer, users[i].data(), users[i].size());
+				if (res[i])
+					packer.pack_true();
+				else
+					packer.pack_false();
+			}
+
+			req->setContentType(consts::MSGPACK_CONTENT_TYPE);
+			req->setHeader("Content-Length", boost::lexical_cast<std::string>(buffer.size()));
+			req->write(buffer.data(), buffer.size());
+			req->setStatus(200);
+			return;
+		}
+
+		auto& buffer = json_buffer();
+		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+
+		writer.StartObject();
+		writer.String(consts::ACTIVE_ITEM, sizeof(consts::ACTIVE_ITEM) - 1);
+		writer.StartObject();
+		for (size_t i = 0; i < users.size(); ++i) {
+			writer.String(users[i].c_str(), users[i].size());
+			writer.Bool(res[i]);
+		}
+		writer.EndObject();
+		writer.EndObject();
+
+		req->setHeader("Content-Length", boost::lexical_cast<std::string>(buffer.Size()));
+		req->write(buffer.GetString(), buffer.Size());
+		shrink_json_buffer();
+	}
+	catch(ioremap::elliptics::error&) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(500);
+	}
+	catch(timeout_error&) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(504);
+	}
+	catch(overload_error&) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(503);
+	}
+	catch(...) {
+		req->setHeader("Content-Length", "0");
+		req->setStatus(400);
+	}
+}
+
+void handler::write_user_logs_msgpack(fastcgi::Request* req,
+                                      const std::string& user,
+                                      const std::vector<std::string>& keys)
+{
+	typedef collector<std::vector<char>> logs_collector;
+	auto logs = read_collector<logs_collector>(keys.size(), m_orphans);
+
+	for (size_t i = 0; i < keys.size(); ++i) { // reads all days simultaneously
+		m_provider->get_user_logs(user,
+		                          std::vector<std::string>(1, keys[i]),
+		                          std::bind(&logs_collector::on_result, logs, i, std::placeholders::_1));
+	}
+
+	const auto& days = logs->wait(m_timeout);
+
+	msgpack::sbuffer buffer;
+	msgpack::packer<msgpack::sbuffer> packer(&buffer);
+
+	packer.pack_map(1); // {"logs": [raw logs of each day]}
+	pack_raw(packer, consts::LOGS_ITEM, sizeof(consts::LOGS_ITEM) - 1);
+	packer.pack_array(days.size());
+	for (auto it = days.begin(), end = days.end(); it != end; ++it) {
+		pack_raw(packer, it->data(), it->size());
+	}
+
+	req->setContentType(consts::MSGPACK_CONTENT_TYPE);
+	req->setHeader("Content-Length", boost::lexical_cast<std::string>(buffer.size()));
+	req->write(buffer.data(), buffer.size());
+	req->setStatus(200);
+}
+
+void handler::write_active_users_msgpack(fastcgi::Request* req, const std::vector<std::string>& keys)
+{
+	typedef std::pair<std::set<std::string>, bool> chunk_t; // users of the chunk and whether it has been read completely
+	typedef collector<chunk_t> users_collector;
+
+	const size_t chunks = keys.empty() ? 0 : m_provider->get_activity_chunks();
+	auto users = read_collector<users_collector>(chunks, m_orphans);
+
+	for (size_t i = 0; i < chunks; ++i) { // reads all chunks of all days simultaneously, chunks don't share users
+		m_provider->get_active_users_chunk(keys, i, [users, i](const std::set<std::string>& active_users, bool complete) {
+			users->on_result(i, chunk_t(active_users, complete));
+		});
+	}
+
+	const auto& parts = users->wait(m_timeout);
+
+	for (auto it = parts.begin(), end = parts.end(); it != end; ++it) {
+		if (!it->second)
+			throw ioremap::elliptics::error(EIO, "Active users haven't been read completely");
+	}
+
+	msgpack::sbuffer buffer;
+	msgpack::packer<msgpack::sbuffer> packer(&buffer);
+
+	packer.pack_map(1); // {"active_users": [[users of each chunk]]}, the same chunks as HistoryDB-TheVoid streams
+	pack_raw(packer, consts::ACTIVE_USERS_ITEM, sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+	packer.pack_array(parts.size());
+	for (auto it = parts.begin(), end = parts.end(); it != end; ++it) {
+		packer.pack_array(it->first.size());
+		for (auto user = it->first.begin(), user_end = it->first.end(); user != user_end; ++user) {
+			pack_raw(packer, user->data(), user->size());
+		}
+	}
+
+	req->setContentType(consts::MSGPACK_CONTENT_TYPE);
+	req->setHeader("Content-Length", boost::lexical_cast<std::string>(buffer.size()));
+	req->write(buffer.data(), buffer.size());
+	req->setStatus(200);
+}
+
+void handler::write_active_users_page(fastcgi::Request* req, const std::vector<std::string>& keys)
+{
+	const auto limit = boost::lexical_cast<uint32_t>(req->getArg(consts::LIMIT_ITEM));
+	const auto cursor = req->hasArg(consts::CURSOR_ITEM) ? req->getArg(consts::CURSOR_ITEM) : std::string();
+
+	typedef std::pair<active_users_page, bool> page_t; // page and whether all its chunks have been read
+	typedef collector<page_t> page_collector;
+	auto pages = read_collector<page_collector>(1, m_orphans);
+	m_provider->get_active_users_checked(keys, cursor, limit, [pages](const active_users_page& page, bool complete) {
+		pages->on_result(0, page_t(page, complete));
+	});
+
+	const auto& result = pages->wait(m_timeout).front();
+	if (!result.second) // the cursor would skip users of the failed chunk
+		throw ioremap::elliptics::error(EIO, "Page of active users hasn't been read completely");
+
+	const auto& page = result.first;
+
+	if (accepts_msgpack(req)) {
+		msgpack::sbuffer buffer;
+		msgpack::packer<msgpack::sbuffer> packer(&buffer);
+
+		packer.pack_map(2);
+		pack_raw(packer, consts::ACTIVE_USERS_ITEM, sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+		packer.pack_array(page.users.size());
+		for (auto it = page.users.begin(), end = page.users.end(); it != end; ++it) {
+			pack_raw(packer, it->data(), it->size());
+		}
+		pack_raw(packer, consts::CURSOR_ITEM, sizeof(consts::CURSOR_ITEM) - 1);
+		pack_raw(packer, page.cursor.data(), page.cursor.size());
+
+		req->setContentType(consts::MSGPACK_CONTENT_TYPE);
+		req->setHeader("Content-Length", boost::lexical_cast<std::string>(buffer.size()));
+		req->write(buffer.data(), buffer.size());
+		req->setStatus(200);
+		return;
+	}
+
+	auto& buffer = json_buffer();
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+
+	writer.StartObject();
+	writer.String(consts::ACTIVE_USERS_ITEM, sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+	writer.StartArray();
+	for (auto it = page.users.begin(), end = page.users.end(); it != end; ++it) {
+		writer.String(it->c_str(), it->size());
+	}
+	writer.EndArray();
+	writer.String(consts::CURSOR_ITEM, sizeof(consts::CURSOR_ITEM) - 1);
+	writer.String(page.cursor.c_str(), page.cursor.size());
+	writer.EndObject();
+
+	req->setHeader("Content-Length", boost::lexical_cast<std::string>(buffer.Size()));
+	req->write(buffer.GetString(), buffer.Size());
+	shrink_json_buffer();
+}
+
 FCGIDAEMON_REGISTER_FACTORIES_BEGIN()
 	FCGIDAEMON_ADD_DEFAULT_FACTORY("historydb", handler)
 FCGIDAEMON_REGISTER_FACTORIES_END()
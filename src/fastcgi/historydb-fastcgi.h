@@ -6,6 +6,8 @@
 
 #include <memory>
 #include <map>
+#include <vector>
+#include <string>
 
 namespace fastcgi {
 	class ComponentContext;
@@ -18,6 +20,8 @@ namespace history {
 	class provider;
 namespace fcgi {
 
+	class orphaned_reads;
+
 	class handler : virtual public fastcgi::Component, virtual public fastcgi::Handler
 	{
 	public:
@@ -37,10 +41,23 @@ namespace fcgi {
 
 		void handle_add_log(fastcgi::Request* req, fastcgi::HandlerContext* context);
 		void handle_add_activity(fastcgi::Request* req, fastcgi::HandlerContext* context);
+		void handle_add_logs(fastcgi::Request* req, fastcgi::HandlerContext* context); // handle batch of log records
 		void handle_get_active_users(fastcgi::Request* req, fastcgi::HandlerContext* context); // handle get active user request
 		void handle_get_user_logs(fastcgi::Request* req, fastcgi::HandlerContext* context); // handle get user logs request
+		void handle_get_active_users_set(fastcgi::Request* req, fastcgi::HandlerContext* context); // handle set operation over active users
+		void handle_get_activity_counts(fastcgi::Request* req, fastcgi::HandlerContext* context); // handle get activity counts request
+		void handle_is_active(fastcgi::Request* req, fastcgi::HandlerContext* context); // handle is active request
+
+		// writes reply in msgpack: logs of each day are raw items, users of each chunk of activity statistics are arrays of raw items
+		void write_user_logs_msgpack(fastcgi::Request* req, const std::string& user, const std::vector<std::string>& keys);
+		void write_active_users_msgpack(fastcgi::Request* req, const std::vector<std::string>& keys);
+		// writes one page of active users: {"active_users": [...], "cursor": "cursor of the next page or empty"}
+		void write_active_users_page(fastcgi::Request* req, const std::vector<std::string>& keys);
 
 		fastcgi::Logger*	m_logger;
+		int					m_timeout; // timeout in seconds for waiting results of provider reads
+		std::shared_ptr<orphaned_reads>	m_orphans; // reads of timed out requests which are still in flight
+		size_t				m_max_batch; // maximum number of records of /add_logs request, 0 - unlimited
 		std::shared_ptr<history::provider>	m_provider;
 
 		std::map<std::string,
@@ -5,10 +5,6 @@
 
 namespace history {
 
-namespace consts {
-	const uint32_t SECONDS_IN_DAY = 24 * 60 * 60; // number of seconds in one day. used for calculation days
-}
-
 std::string time_to_subkey(uint64_t time)
 {
 	return boost::lexical_cast<std::string>(time / consts::SECONDS_IN_DAY);
@@ -31,6 +27,52 @@ std::vector<std::string> time_period_to_subkeys(uint64_t begin_time, uint64_t en
 	return ret;
 }
 
+bool active_users_list::contains(const std::string& user) const
+{
+	size_t first = 0, last = size();
+	while (first < last) {
+		const size_t middle = first + (last - first) / 2;
+		const int cmp = user.compare(0, user.size(), data(middle), length(middle));
+		if (cmp == 0)
+			return true;
+		if (cmp < 0)
+			last = middle;
+		else
+			first = middle + 1;
+	}
+	return false;
+}
+
+void active_users_list::assign(std::vector<std::pair<const char*, size_t>>& users)
+{
+	auto less = [](const std::pair<const char*, size_t>& lhs, const std::pair<const char*, size_t>& rhs) {
+		const int cmp = memcmp(lhs.first, rhs.first, std::min(lhs.second, rhs.second));
+		return cmp < 0 || (cmp == 0 && lhs.second < rhs.second);
+	};
+	auto equal = [](const std::pair<const char*, size_t>& lhs, const std::pair<const char*, size_t>& rhs) {
+		return lhs.second == rhs.second && memcmp(lhs.first, rhs.first, lhs.second) == 0;
+	};
+
+	std::sort(users.begin(), users.end(), less);
+	users.erase(std::unique(users.begin(), users.end(), equal), users.end());
+
+	size_t total = 0;
+	for (auto it = users.begin(), end = users.end(); it != end; ++it) {
+		total += it->second;
+	}
+
+	arena_.clear();
+	arena_.reserve(total);
+	offsets_.clear();
+	offsets_.reserve(users.size() + 1);
+
+	for (auto it = users.begin(), end = users.end(); it != end; ++it) {
+		offsets_.push_back(arena_.size());
+		arena_.insert(arena_.end(), it->first, it->first + it->second);
+	}
+	offsets_.push_back(arena_.size());
+}
+
 provider::provider(const std::vector<server_info>& servers,
                    const std::vector<int>& groups,
                    uint32_t min_writes,
@@ -53,6 +95,71 @@ void provider::set_session_parameters(const std::vector<int>& groups,
 	m_impl->set_session_parameters(groups, min_writes);
 }
 
+void provider::set_early_ack(bool early_ack)
+{
+	m_impl->set_early_ack(early_ack);
+}
+
+void provider::set_activity_chunks(uint32_t chunks)
+{
+	m_impl->set_activity_chunks(chunks);
+}
+
+uint32_t provider::get_activity_chunks() const
+{
+	return m_impl->get_activity_chunks();
+}
+
+void provider::set_activity_counters(bool enable)
+{
+	m_impl->set_activity_counters(enable);
+}
+
+void provider::set_log_days(bool enable)
+{
+	m_impl->set_log_days(enable);
+}
+
+void provider::set_missing_logs_ttl(uint32_t ttl)
+{
+	m_impl->set_missing_logs_ttl(ttl);
+}
+
+void provider::set_activity_filters(bool enable)
+{
+	m_impl->set_activity_filters(enable);
+}
+
+void provider::set_activity_filter_users(uint32_t users)
+{
+	m_impl->set_activity_filter_users(users);
+}
+
+void provider::set_merge_threads(uint32_t threads)
+{
+	m_impl->set_merge_threads(threads);
+}
+
+void provider::set_fanout_limits(uint32_t request_limit, uint32_t global_limit)
+{
+	m_impl->set_fanout_limits(request_limit, global_limit);
+}
+
+void provider::set_max_range(uint32_t max_range)
+{
+	m_impl->set_max_range(max_range);
+}
+
+void provider::check_range(const std::vector<std::string>& subkeys) const
+{
+	m_impl->check_range(subkeys);
+}
+
+provider_stats provider::get_stats() const
+{
+	return m_impl->get_stats();
+}
+
 void provider::add_log(const std::string& user,
                        uint64_t time,
                        const std::vector<char>& data)
@@ -83,6 +190,21 @@ void provider::add_log(const std::string& user,
 	m_impl->add_log(user, subkey, data, callback);
 }
 
+void provider::write_log(const std::string& user,
+                         const std::string& subkey,
+                         const std::vector<char>& data)
+{
+	m_impl->write_log(user, subkey, data);
+}
+
+void provider::write_log(const std::string& user,
+                         const std::string& subkey,
+                         const std::vector<char>& data,
+                         std::function<void(bool written)> callback)
+{
+	m_impl->write_log(user, subkey, data, callback);
+}
+
 void provider::add_activity(const std::string& user, uint64_t time)
 {
 	m_impl->add_activity(user, time_to_subkey(time));
@@ -137,6 +259,30 @@ void provider::add_log_with_activity(const std::string& user,
 	m_impl->add_log_with_activity(user, subkey, data, callback);
 }
 
+// returns subkeys of the records: custom subkey or subkey of the day of the record
+std::vector<std::string> records_subkeys(const std::vector<log_record>& records)
+{
+	std::vector<std::string> ret;
+	ret.reserve(records.size());
+
+	for (auto it = records.begin(), end = records.end(); it != end; ++it) {
+		ret.emplace_back(it->subkey.empty() ? time_to_subkey(it->time) : it->subkey);
+	}
+
+	return ret;
+}
+
+std::vector<bool> provider::add_logs(const std::vector<log_record>& records)
+{
+	return m_impl->add_logs(records, records_subkeys(records));
+}
+
+void provider::add_logs(const std::vector<log_record>& records,
+                        std::function<void(const std::vector<bool>& added)> callback)
+{
+	m_impl->add_logs(records, records_subkeys(records), callback);
+}
+
 std::vector<char> provider::get_user_logs(const std::string& user,
                                           uint64_t begin_time,
                                           uint64_t end_time)
@@ -167,6 +313,70 @@ void provider::get_user_logs(const std::string& user,
 	m_impl->get_user_logs(user, subkeys, callback);
 }
 
+void provider::get_user_logs_checked(const std::string& user,
+                                     uint64_t begin_time,
+                                     uint64_t end_time,
+                                     std::function<void(const std::vector<char>& data, bool complete)> callback)
+{
+	m_impl->get_user_logs_checked(user, time_period_to_subkeys(begin_time, end_time), callback);
+}
+
+void provider::get_user_logs_checked(const std::string& user,
+                                     const std::vector<std::string>& subkeys,
+                                     std::function<void(const std::vector<char>& data, bool complete)> callback)
+{
+	m_impl->get_user_logs_checked(user, subkeys, callback);
+}
+
+void provider::select_user_logs(const std::string& user,
+                                const std::vector<std::string>& subkeys,
+                                std::function<void(const std::vector<std::string>& subkeys)> callback)
+{
+	m_impl->select_user_logs(user, subkeys, callback);
+}
+
+void provider::get_selected_user_logs(const std::string& user,
+                                      const std::vector<std::string>& subkeys,
+                                      std::function<void(const std::vector<char>& data, bool complete)> callback)
+{
+	m_impl->read_user_logs(user, subkeys, callback);
+}
+
+void provider::get_users_logs(const std::vector<std::string>& users,
+                              uint64_t begin_time,
+                              uint64_t end_time,
+                              std::function<void(const std::string& user, const std::vector<char>& data, bool complete)> callback)
+{
+	m_impl->get_users_logs(users, time_period_to_subkeys(begin_time, end_time), callback);
+}
+
+void provider::get_users_logs(const std::vector<std::string>& users,
+                              const std::vector<std::string>& subkeys,
+                              std::function<void(const std::string& user, const std::vector<char>& data, bool complete)> callback)
+{
+	m_impl->get_users_logs(users, subkeys, callback);
+}
+
+void provider::get_users_logs(const std::vector<std::string>& users,
+                              uint64_t begin_time,
+                              uint64_t end_time,
+                              std::function<void(const std::string& user, const std::vector<char>& data, bool complete)> callback,
+                              std::function<void()> complete_callback)
+{
+	m_impl->get_users_logs(users,
+	                       time_period_to_subkeys(begin_time, end_time),
+	                       callback,
+	                       complete_callback);
+}
+
+void provider::get_users_logs(const std::vector<std::string>& users,
+                              const std::vector<std::string>& subkeys,
+                              std::function<void(const std::string& user, const std::vector<char>& data, bool complete)> callback,
+                              std::function<void()> complete_callback)
+{
+	m_impl->get_users_logs(users, subkeys, callback, complete_callback);
+}
+
 std::set<std::string> provider::get_active_users(uint64_t begin_time, uint64_t end_time)
 {
 	return m_impl->get_active_users(time_period_to_subkeys(begin_time, end_time));
@@ -190,6 +400,206 @@ void provider::get_active_users(const std::vector<std::string>& subkeys,
 	m_impl->get_active_users(subkeys, callback);
 }
 
+void provider::get_active_users_checked(uint64_t begin_time,
+                                        uint64_t end_time,
+                                        std::function<void(const std::set<std::string>& active_users, bool complete)> callback)
+{
+	m_impl->get_active_users_checked(time_period_to_subkeys(begin_time, end_time), callback);
+}
+
+void provider::get_active_users_checked(const std::vector<std::string>& subkeys,
+                                        std::function<void(const std::set<std::string>& active_users, bool complete)> callback)
+{
+	m_impl->get_active_users_checked(subkeys, callback);
+}
+
+void provider::get_active_users_chunk(const std::vector<std::string>& subkeys,
+                                      uint32_t chunk,
+                                      std::function<void(const std::set<std::string>& active_users, bool complete)> callback)
+{
+	m_impl->get_active_users_chunk(subkeys, chunk, callback);
+}
+
+std::vector<std::string> provider::get_active_users_unsorted(uint64_t begin_time, uint64_t end_time)
+{
+	return m_impl->get_active_users_unsorted(time_period_to_subkeys(begin_time, end_time));
+}
+
+std::vector<std::string> provider::get_active_users_unsorted(const std::vector<std::string>& subkeys)
+{
+	return m_impl->get_active_users_unsorted(subkeys);
+}
+
+void provider::get_active_users_unsorted(uint64_t begin_time,
+                                         uint64_t end_time,
+                                         std::function<void(const std::vector<std::string>& active_users)> callback)
+{
+	m_impl->get_active_users_unsorted(time_period_to_subkeys(begin_time, end_time), callback);
+}
+
+void provider::get_active_users_unsorted(const std::vector<std::string>& subkeys,
+                                         std::function<void(const std::vector<std::string>& active_users)> callback)
+{
+	m_impl->get_active_users_unsorted(subkeys, callback);
+}
+
+active_users_list provider::get_active_users_list(uint64_t begin_time, uint64_t end_time)
+{
+	return m_impl->get_active_users_list(time_period_to_subkeys(begin_time, end_time));
+}
+
+active_users_list provider::get_active_users_list(const std::vector<std::string>& subkeys)
+{
+	return m_impl->get_active_users_list(subkeys);
+}
+
+void provider::get_active_users_list(uint64_t begin_time,
+                                     uint64_t end_time,
+                                     std::function<void(const std::shared_ptr<const active_users_list>& active_users)> callback)
+{
+	m_impl->get_active_users_list(time_period_to_subkeys(begin_time, end_time), callback);
+}
+
+void provider::get_active_users_list(const std::vector<std::string>& subkeys,
+                                     std::function<void(const std::shared_ptr<const active_users_list>& active_users)> callback)
+{
+	m_impl->get_active_users_list(subkeys, callback);
+}
+
+active_users_page provider::get_active_users(uint64_t begin_time,
+                                             uint64_t end_time,
+                                             const std::string& cursor,
+                                             uint32_t limit)
+{
+	return m_impl->get_active_users(time_period_to_subkeys(begin_time, end_time), cursor, limit);
+}
+
+active_users_page provider::get_active_users(const std::vector<std::string>& subkeys,
+                                             const std::string& cursor,
+                                             uint32_t limit)
+{
+	return m_impl->get_active_users(subkeys, cursor, limit);
+}
+
+void provider::get_active_users(const std::vector<std::string>& subkeys,
+                                const std::string& cursor,
+                                uint32_t limit,
+                                std::function<void(const active_users_page& page)> callback)
+{
+	m_impl->get_active_users(subkeys, cursor, limit, callback);
+}
+
+void provider::get_active_users_checked(const std::vector<std::string>& subkeys,
+                                        const std::string& cursor,
+                                        uint32_t limit,
+                                        std::function<void(const active_users_page& page, bool complete)> callback)
+{
+	m_impl->get_active_users_checked(subkeys, cursor, limit, callback);
+}
+
+std::set<std::string> provider::get_active_users_intersection(const std::vector<std::string>& subkeys)
+{
+	return m_impl->get_active_users_intersection(subkeys);
+}
+
+void provider::get_active_users_intersection(const std::vector<std::string>& subkeys,
+                                             std::function<void(const std::set<std::string>& active_users)> callback)
+{
+	m_impl->get_active_users_intersection(subkeys, callback);
+}
+
+std::set<std::string> provider::get_active_users_at_least(const std::vector<std::string>& subkeys, uint32_t days)
+{
+	return m_impl->get_active_users_at_least(subkeys, days);
+}
+
+void provider::get_active_users_at_least(const std::vector<std::string>& subkeys,
+                                         uint32_t days,
+                                         std::function<void(const std::set<std::string>& active_users)> callback)
+{
+	m_impl->get_active_users_at_least(subkeys, days, callback);
+}
+
+std::set<std::string> provider::get_active_users_difference(const std::vector<std::string>& subkeys,
+                                                            const std::vector<std::string>& excluded)
+{
+	return m_impl->get_active_users_difference(subkeys, excluded);
+}
+
+void provider::get_active_users_difference(const std::vector<std::string>& subkeys,
+                                           const std::vector<std::string>& excluded,
+                                           std::function<void(const std::set<std::string>& active_users)> callback)
+{
+	m_impl->get_active_users_difference(subkeys, excluded, callback);
+}
+
+retention_matrix provider::get_retention(uint64_t begin_time,
+                                         uint64_t end_time,
+                                         const std::vector<uint32_t>& offsets,
+                                         uint32_t threads)
+{
+	return m_impl->get_retention(begin_time / consts::SECONDS_IN_DAY,
+	                             end_time / consts::SECONDS_IN_DAY,
+	                             offsets,
+	                             threads);
+}
+
+bool provider::is_active(const std::string& user, uint64_t time)
+{
+	return m_impl->is_active(std::vector<std::string>(1, user), time_to_subkey(time)).front();
+}
+
+bool provider::is_active(const std::string& user, const std::string& subkey)
+{
+	return m_impl->is_active(std::vector<std::string>(1, user), subkey).front();
+}
+
+std::vector<bool> provider::is_active(const std::vector<std::string>& users, uint64_t time)
+{
+	return m_impl->is_active(users, time_to_subkey(time));
+}
+
+std::vector<bool> provider::is_active(const std::vector<std::string>& users, const std::string& subkey)
+{
+	return m_impl->is_active(users, subkey);
+}
+
+void provider::is_active(const std::vector<std::string>& users,
+                         uint64_t time,
+                         std::function<void(const std::vector<bool>& active)> callback)
+{
+	m_impl->is_active(users, time_to_subkey(time), callback);
+}
+
+void provider::is_active(const std::vector<std::string>& users,
+                         const std::string& subkey,
+                         std::function<void(const std::vector<bool>& active)> callback)
+{
+	m_impl->is_active(users, subkey, callback);
+}
+
+std::map<std::string, uint64_t> provider::get_activity_counts(uint64_t begin_time, uint64_t end_time)
+{
+	return m_impl->get_activity_counts(time_period_to_subkeys(begin_time, end_time));
+}
+
+std::map<std::string, uint64_t> provider::get_activity_counts(const std::vector<std::string>& subkeys)
+{
+	return m_impl->get_activity_counts(subkeys);
+}
+
+void provider::get_activity_counts(uint64_t begin_time,
+                                   uint64_t end_time,
+                                   std::function<void(const std::map<std::string, uint64_t>& counts)> callback)
+{
+	m_impl->get_activity_counts(time_period_to_subkeys(begin_time, end_time), callback);
+}
+
+void provider::get_activity_counts(const std::vector<std::string>& subkeys,
+                                   std::function<void(const std::map<std::string, uint64_t>& counts)> callback)
+{
+	m_impl->get_activity_counts(subkeys, callback);
+}
 
 void provider::for_user_logs(const std::string& user,
                              uint64_t begin_time,
@@ -219,6 +629,21 @@ void provider::for_active_users(const std::vector<std::string>& subkeys,
 	m_impl->for_active_users(subkeys, callback);
 }
 
+void provider::for_active_users(uint64_t begin_time,
+                                uint64_t end_time,
+                                std::function<bool(const std::set<std::string>& active_users)> callback,
+                                std::function<void()> complete_callback)
+{
+	m_impl->for_active_users(time_period_to_subkeys(begin_time, end_time), callback, complete_callback);
+}
+
+void provider::for_active_users(const std::vector<std::string>& subkeys,
+                                std::function<bool(const std::set<std::string>& active_users)> callback,
+                                std::function<void()> complete_callback)
+{
+	m_impl->for_active_users(subkeys, callback, complete_callback);
+}
+
 
 int get_log_level(const std::string& log_level)
 {
@@ -4,12 +4,26 @@
 
 #include <functional>
 #include <deque>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <iterator>
+#include <thread>
+#include <exception>
+#include <future>
+#include <chrono>
+#include <ctime>
+#include <cerrno>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/bind.hpp>
 #include <boost/lambda/lambda.hpp>
-#include <boost/thread/mutex.hpp>
-#include <boost/make_shared.hpp>
+#include <boost/pool/pool_alloc.hpp>
 
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
@@ -20,512 +34,3620 @@ namespace history {
 
 namespace consts {
 	const uint32_t TIMEOUT = 60; // timeout for node configuration and session
+	const char COUNTERS_NAMESPACE[] = "activity_counters"; // namespace of activity counters, so they don't clash with logs
+	const char COUNTER_INCREMENT[] = "1"; // counter object grows by one byte on each activity
+	const size_t USERS_LOGS_BATCH = 256; // number of users whose logs are read by one bulk read
+	const size_t USERS_LOGS_WINDOW = 8; // maximum number of bulk reads of users logs in flight
+	const size_t ACTIVE_USERS_PREFETCH = 4; // number of days whose active users are read ahead of the iteration
+	const size_t FANOUT_REQUEST_LIMIT = 32; // default maximum number of reads of one range operation in flight
+	const size_t FANOUT_GLOBAL_LIMIT = 1024; // default maximum number of reads of all range operations in flight
+	const uint32_t SECONDS_IN_DAY = 24 * 60 * 60; // number of seconds in one day. used for calculation days
+	const char LOG_DAYS_NAMESPACE[] = "log_days"; // namespace of objects which mark days with user logs
+	const uint64_t DAYS_IN_BUCKET = 512; // number of days marked by one object, one byte per day
+	const char DAY_MARK[] = "1"; // mark of the day with user logs
+	const size_t MISSING_LOGS_CACHE_SIZE = 65536; // maximum number of remembered missing user logs
+	const char FILTERS_NAMESPACE[] = "activity_filters"; // namespace of Bloom filters of active users of days
+	const uint64_t DEFAULT_ACTIVITY_FILTER_SIZE = 1 << 24; // number of positions (bytes) in filter of one day if expected users aren't set
+	const uint64_t ACTIVITY_FILTER_POSITIONS_PER_USER = 20; // about 1% of false positives with 2 positions per user
+	const uint64_t ACTIVITY_FILTER_SHARDS = 256; // number of objects of filter of one day, so writes of the day are spread
+	const size_t FILTERED_ACTIVITIES_CACHE_SIZE = 1 << 18; // maximum number of remembered activities with set filter positions
+	const size_t ACTIVITY_FILTER_HASHES = 2; // number of positions of each user in the filter
+	const char FILTER_MARK[] = "1"; // mark of the set position of the filter
+	const size_t PARALLEL_MERGE_MIN = 1 << 16; // minimum number of found names which are merged by several threads
 }
 
-struct waiter
+/* Aggregates results of any number of sub-operations and calls handler once when all of them are completed.
+ * Each sub-operation writes its status and data only into its own slot and decrements atomic counter,
+ * so completion doesn't take any lock. The sub-operation which completes last calls handler.
+ * Aggregators are allocated from the pool, use aggregator::create for creating them.
+ */
+class aggregator
 {
-	waiter(std::function<void(bool added)> callback,
-	       ioremap::elliptics::node &node,
-	       uint32_t min_writes,
-	       bool log_init = false,
-	       bool activity_init = false)
-	: log_completed(log_init)
-	, activity_completed(activity_init)
-	, result_(true)
-	, callback_(callback)
+public:
+	typedef std::function<void(const aggregator& agg)> handler_t;
+
+	aggregator(size_t count,
+	           handler_t handler,
+	           ioremap::elliptics::node &node,
+	           uint32_t min_writes)
+	: pending_(count)
+	, results_(count, true)
+	, datas_(count)
+	, handler_(handler)
 	, node_(node)
 	, min_writes_(min_writes)
 	{}
 
-	void on_log(const ioremap::elliptics::sync_write_result &res,
-	            const ioremap::elliptics::error_info &error) {
-		boost::mutex::scoped_lock lock(mutex_);
+	static std::shared_ptr<aggregator> create(size_t count,
+	                                          handler_t handler,
+	                                          ioremap::elliptics::node &node,
+	                                          uint32_t min_writes) {
+		return std::allocate_shared<aggregator>(boost::fast_pool_allocator<aggregator>(),
+		                                        count, handler, node, min_writes);
+	}
+
+	static std::shared_ptr<aggregator> create(size_t count,
+	                                          std::function<void(bool result)> callback,
+	                                          ioremap::elliptics::node &node,
+	                                          uint32_t min_writes) {
+		return create(count,
+		              handler_t(std::bind(&aggregator::call_result, callback, std::placeholders::_1)),
+		              node,
+		              min_writes);
+	}
+
+	void on_write(size_t index,
+	              const ioremap::elliptics::sync_write_result &res,
+	              const ioremap::elliptics::error_info &error) {
 		if (res.size() < min_writes_) {
-			LOG(DNET_LOG_ERROR, "Can't write data to the minimum number of groups while appending data to user log error: %s\n", error.message().c_str());
-			result_ = false;
+			LOG(DNET_LOG_ERROR, "Can't write data to the minimum number of groups while writing user log error: %s\n", error.message().c_str());
+			results_[index] = false;
 		}
 
-		log_completed = true;
-
-		handle();
+		complete();
 	}
 
-	void on_activity(const ioremap::elliptics::sync_set_indexes_result &res,
-	                 const ioremap::elliptics::error_info &error) {
-		boost::mutex::scoped_lock lock(mutex_);
+	void on_indexes(size_t index,
+	                const ioremap::elliptics::sync_set_indexes_result &res,
+	                const ioremap::elliptics::error_info &error) {
 		if (res.size() < min_writes_) {
 			LOG(DNET_LOG_ERROR, "Can't write data while adding activity error: %s\n", error.message().c_str());
-			result_ = false;
+			results_[index] = false;
+		}
+
+		complete();
+	}
+
+	void on_read(size_t index,
+	             const ioremap::elliptics::sync_read_result &res,
+	             const ioremap::elliptics::error_info &/*error*/) {
+		try {
+			if (!res.empty())
+				datas_[index] = res.front().file();
+			else
+				results_[index] = false;
+		}
+		catch (ioremap::elliptics::error& e) {
+			results_[index] = false;
 		}
 
-		activity_completed = true;
+		complete();
+	}
+
+	void on_result(size_t index, bool result) {
+		results_[index] = result;
+		complete();
+	}
+
+	size_t size() const { return results_.size(); }
 
-		handle();
+	// returns true if all sub-operations have been succeeded
+	bool result() const {
+		return std::find(results_.begin(), results_.end(), false) == results_.end();
 	}
 
+	bool result(size_t index) const { return results_[index]; }
+
+	const ioremap::elliptics::data_pointer& data(size_t index) const { return datas_[index]; }
 
 private:
+	void complete() {
+		if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			handler_(*this);
+	}
 
-	void handle() {
-		if (log_completed && activity_completed)
-			callback_(result_);
+	static void call_result(std::function<void(bool result)> callback, const aggregator& agg) {
+		callback(agg.result());
 	}
 
-	bool log_completed;
-	bool activity_completed;
-	bool result_;
-	boost::mutex mutex_;
-	std::function<void(bool added)> callback_;
-	ioremap::elliptics::node &node_; // elliptics node
-	uint32_t min_writes_;
+	std::atomic<size_t>								pending_; // number of uncompleted sub-operations
+	std::vector<char>								results_; // statuses of sub-operations
+	std::vector<ioremap::elliptics::data_pointer>	datas_; // data read by sub-operations
+	handler_t										handler_;
+	ioremap::elliptics::node						&node_; // elliptics node
+	uint32_t										min_writes_;
 };
 
-class provider::impl : public std::enable_shared_from_this<provider::impl>
+/* Counters of the provider operations which are shared with completion handlers
+ */
+struct counters
 {
-public:
-	impl(const std::vector<server_info>& servers,
-	     const std::vector<int>& groups,
-	     uint32_t min_writes,
-	     const std::string& log_file,
-	     const int log_level);
-	impl(const std::vector<std::string>& servers,
-	     const std::vector<int>& groups,
-	     uint32_t min_writes,
-	     const std::string& log_file,
-	     const int log_level);
+	counters()
+	: early_acks(0)
+	, late_replica_failures(0)
+	, read_errors(0)
+	, write_errors(0)
+	{}
 
-	void set_session_parameters(const std::vector<int>& groups, uint32_t min_writes);
+	// counts error reply of elliptics, it is called for each reply of the session, missing keys aren't errors
+	void on_entry(const ioremap::elliptics::callback_result_entry& entry) {
+		if (entry.status() == 0 || entry.status() == -ENOENT || !entry.command())
+			return;
 
-	void add_log(const std::string& user,
-	             const std::string& subkey,
-	             const std::vector<char>& data);
-	void add_log(const std::string& user,
-	             const std::string& subkey,
-	             const std::vector<char>& data,
-	             std::function<void(bool added)> callback);
+		switch (entry.command()->cmd) {
+		case DNET_CMD_WRITE:
+		case DNET_CMD_DEL:
+		case DNET_CMD_INDEXES_UPDATE:
+		case DNET_CMD_INDEXES_INTERNAL:
+			++write_errors;
+			break;
+		default:
+			++read_errors;
+		}
+	}
 
-	void add_activity(const std::string& user, const std::string& subkey);
-	void add_activity(const std::string& user,
-	                  const std::string& subkey,
-	                  std::function<void(bool added)> callback);
+	std::atomic<uint64_t>	early_acks;
+	std::atomic<uint64_t>	late_replica_failures;
+	std::atomic<uint64_t>	read_errors; // error replies of replicas to reads, lookups and index requests
+	std::atomic<uint64_t>	write_errors; // error replies of replicas to writes and index updates
+};
 
-	void add_log_with_activity(const std::string& user,
-	                           const std::string& subkey,
-	                           const std::vector<char>& data);
-	void add_log_with_activity(const std::string& user,
-	                           const std::string& subkey,
-	                           const std::vector<char>& data,
-	                           std::function<void(bool added)> callback);
+/* Acknowledges replicated write as soon as min_writes groups have confirmed it.
+ * Replies of the remaining groups are handled in background: their failures are logged and counted.
+ * If the quorum hasn't been reached, the write is acknowledged when all groups have replied.
+ */
+class quorum
+{
+public:
+	quorum(std::function<void(bool result)> callback,
+	       ioremap::elliptics::node &node,
+	       uint32_t min_writes,
+	       size_t groups,
+	       std::shared_ptr<counters> counters)
+	: acked_(false)
+	, replies_(0)
+	, succeeded_(0)
+	, callback_(callback)
+	, node_(node)
+	, min_writes_(min_writes)
+	, groups_(groups)
+	, counters_(counters)
+	{}
 
-	std::vector<char> get_user_logs(const std::string& user,
-	                                const std::vector<std::string>& subkeys);
-	void get_user_logs(const std::string& user,
-	                   const std::vector<std::string>& subkeys,
-	                   std::function<void(const std::vector<char>& data)> callback);
+	static std::shared_ptr<quorum> create(std::function<void(bool result)> callback,
+	                                      ioremap::elliptics::node &node,
+	                                      uint32_t min_writes,
+	                                      size_t groups,
+	                                      std::shared_ptr<counters> counters) {
+		return std::allocate_shared<quorum>(boost::fast_pool_allocator<quorum>(),
+		                                    callback, node, min_writes, groups, counters);
+	}
 
-	std::set<std::string> get_active_users(const std::vector<std::string>& subkeys);
-	void get_active_users(const std::vector<std::string>& subkeys,
-	                      std::function<void(const std::set<std::string> &active_users)> callback);
+	void on_entry(const ioremap::elliptics::callback_result_entry &entry) {
+		const auto replies = ++replies_;
 
-	void for_user_logs(const std::string& user,
-	                   const std::vector<std::string>& subkeys,
-	                   std::function<bool(const std::vector<char>& data)> callback);
+		if (entry.status() != 0) {
+			if (acked_) {
+				LOG(DNET_LOG_ERROR, "Replica has failed after the write had been acknowledged: %d\n", entry.status());
+				++counters_->late_replica_failures;
+			}
+			return;
+		}
 
-	void for_active_users(const std::vector<std::string>& subkeys,
-	                      std::function<bool(const std::set<std::string>& active_users)> callback);
+		if (++succeeded_ >= min_writes_ && !acked_.exchange(true)) {
+			if (replies < groups_)
+				++counters_->early_acks;
+			callback_(true);
+		}
+	}
 
-private:
-	ioremap::elliptics::session create_session(uint32_t io_flags = 0) const;
+	void on_final(const ioremap::elliptics::error_info &error) {
+		if (acked_.exchange(true)) {
+			if (replies_ < groups_) { // groups which haven't replied at all
+				LOG(DNET_LOG_ERROR, "%zu replicas haven't replied after the write had been acknowledged: %s\n", groups_ - replies_, error.message().c_str());
+				counters_->late_replica_failures += groups_ - replies_;
+			}
+			return;
+		}
 
-	ioremap::elliptics::async_write_result
-	add_log(ioremap::elliptics::session& s,
-	        const std::string& user,
-	        const std::string& subkey,
-	        const std::vector<char> data);
-	ioremap::elliptics::async_set_indexes_result
-	add_activity(ioremap::elliptics::session& s,
-	             const std::string& user,
-	             const std::string& subkey);
-	ioremap::elliptics::async_find_indexes_result
-	get_active_users(ioremap::elliptics::session& s,
-	                 const std::vector<std::string>& subkeys);
+		const bool result = succeeded_ >= min_writes_;
+		if (!result)
+			LOG(DNET_LOG_ERROR, "Can't write data to the minimum number of groups error: %s\n", error.message().c_str());
 
-	static void on_user_log(std::shared_ptr<std::list<ioremap::elliptics::async_read_result>> results,
-							std::shared_ptr<std::deque<char>> data,
-							std::function<void(const std::vector<char>& data)> callback,
-							const ioremap::elliptics::sync_read_result &entry,
-							const ioremap::elliptics::error_info &error);
-	static void on_active_users(std::function<void(const std::set<std::string> &active_users)> callback,
-	                            const ioremap::elliptics::sync_find_indexes_result &result,
-	                            const ioremap::elliptics::error_info &error);
+		callback_(result);
+	}
 
-	std::string combine_key(const std::string& user, const std::string& subkey) const;
+private:
+	std::atomic<bool>					acked_; // callback has been called
+	std::atomic<size_t>					replies_; // number of groups which have replied
+	std::atomic<size_t>					succeeded_; // number of groups which have confirmed the write
+	std::function<void(bool result)>	callback_;
+	ioremap::elliptics::node			&node_; // elliptics node
+	uint32_t							min_writes_;
+	size_t								groups_; // number of groups in which the data is written
+	std::shared_ptr<counters>			counters_;
+};
 
+/* Activity statistics of the day is stored in one or several indexes (chunks).
+ * If there is one chunk, its index is named by the subkey as in previous versions,
+ * otherwise the user is added to the index "subkey.N" where N is hash of the user name modulo number of chunks.
+ */
+uint32_t activity_chunk(const std::string& user, uint32_t chunks)
+{
+	uint32_t hash = 2166136261U; // FNV-1a, it doesn't depend on platform and standard library
+	for (auto it = user.begin(), end = user.end(); it != end; ++it) {
+		hash = (hash ^ static_cast<unsigned char>(*it)) * 16777619U;
+	}
+	return hash % chunks;
+}
 
-	std::vector<int>					groups_; // groups of elliptics
-	uint32_t							min_writes_; // minimum number of succeeded writes for each write attempt
-	dnet_config							config_; //elliptics config
-	ioremap::elliptics::file_logger		log_; // logger
-	ioremap::elliptics::node			node_; // elliptics node
-};
+// returns 64-bit FNV-1a hash of user name
+uint64_t user_hash(const std::string& user)
+{
+	uint64_t ret = 14695981039346656037ULL;
+	for (auto it = user.begin(), end = user.end(); it != end; ++it) {
+		ret = (ret ^ static_cast<unsigned char>(*it)) * 1099511628211ULL;
+	}
+	return ret;
+}
 
-dnet_config create_config()
+std::string activity_index(const std::string& subkey, uint32_t chunk, uint32_t chunks)
 {
-	dnet_config config;
-	memset(&config, 0, sizeof(config));
+	if (chunks == 1)
+		return subkey;
+	return subkey + "." + boost::lexical_cast<std::string>(chunk);
+}
 
-	config.io_thread_num = 100;
-	config.nonblocking_io_thread_num = 100;
-	config.net_thread_num = 16;
-	config.check_timeout = consts::TIMEOUT;
-	config.wait_timeout = consts::TIMEOUT;
+// returns indexes of all chunks of the subkeys
+std::vector<std::string> activity_indexes(const std::vector<std::string>& subkeys, uint32_t chunks)
+{
+	std::vector<std::string> ret;
+	ret.reserve(subkeys.size() * chunks);
+	for (auto it = subkeys.begin(), end = subkeys.end(); it != end; ++it) {
+		for (uint32_t chunk = 0; chunk < chunks; ++chunk) {
+			ret.emplace_back(activity_index(*it, chunk, chunks));
+		}
+	}
+	return ret;
+}
 
-	return config;
+// inserts users found in the activity indexes
+template<typename Result>
+void collect_users(Result& result, std::set<std::string>& users)
+{
+	for (auto it = result.begin(), end = result.end(); it != end; ++it) {
+		for (auto ind_it = it->indexes.begin(), ind_end = it->indexes.end(); ind_it != ind_end; ++ind_it) {
+			users.insert(ind_it->data.to_string());
+		}
+	}
 }
 
-provider::impl::impl(const std::vector<server_info>& servers,
-                     const std::vector<int>& groups,
-                     uint32_t min_writes,
-                     const std::string& log_file,
-                     const int log_level)
-: groups_(groups)
-, min_writes_(min_writes)
-, config_(create_config())
-, log_(log_file.c_str(), log_level)
-, node_(log_, config_)
+// builds list of users found in the activity indexes, names are copied from the result only once
+template<typename Result>
+void collect_users(Result& result, active_users_list& users)
 {
-	for (auto it = servers.begin(), end = servers.end(); it != end; ++it) {
+	std::vector<std::pair<const char*, size_t>> names;
+	for (auto it = result.begin(), end = result.end(); it != end; ++it) {
+		for (auto ind_it = it->indexes.begin(), ind_end = it->indexes.end(); ind_it != ind_end; ++ind_it) {
+			names.emplace_back(ind_it->data.template data<char>(), ind_it->data.size());
+		}
+	}
+	users.assign(names);
+}
+
+/* Merges users found in the activity indexes of several subkeys in parallel.
+ * At first threads hash stripes of found names and spread them into partitions by the hash,
+ * then each partition is deduplicated by its own hash set in its own thread. Names are copied only once,
+ * after deduplication. Partitions are sorted and merged only if sorted result is required.
+ */
+class users_merge
+{
+public:
+	users_merge(const ioremap::elliptics::sync_find_indexes_result& result, uint32_t threads)
+	: next_(0)
+	{
+		for (auto it = result.begin(), end = result.end(); it != end; ++it) {
+			for (auto ind_it = it->indexes.begin(), ind_end = it->indexes.end(); ind_it != ind_end; ++ind_it) {
+				names_.emplace_back(ind_it->data.data<char>(), ind_it->data.size());
+			}
+		}
+
+		if (threads == 0)
+			threads = std::max(1U, std::thread::hardware_concurrency());
+		if (names_.size() < consts::PARALLEL_MERGE_MIN)
+			threads = 1; // starting threads costs more than merging of small result
+		threads_ = threads;
+
+		buckets_.resize(threads_, std::vector<std::vector<name_ref>>(threads_));
+		partitions_.resize(threads_);
+	}
+
+	// returns unique users, they are sorted only if sorted is true
+	std::vector<std::string> run(bool sorted) {
+		sorted_ = sorted;
+
+		run_threads(&users_merge::spread);
+		next_ = 0;
+		run_threads(&users_merge::deduplicate);
+
+		size_t total = 0;
+		for (auto it = partitions_.begin(), end = partitions_.end(); it != end; ++it) {
+			total += it->size();
+		}
+
+		std::vector<std::string> ret;
+		ret.reserve(total);
+		std::vector<size_t> bounds(1, 0); // bounds of sorted ranges in ret
+		for (auto it = partitions_.begin(), end = partitions_.end(); it != end; ++it) {
+			std::move(it->begin(), it->end(), std::back_inserter(ret));
+			bounds.push_back(ret.size());
+			std::vector<std::string>().swap(*it);
+		}
+
+		if (sorted_) {
+			for (size_t step = 1; step + 1 < bounds.size(); step *= 2) { // merges pairs of neighbouring ranges
+				for (size_t i = 0; i + step + 1 < bounds.size(); i += 2 * step) {
+					std::inplace_merge(ret.begin() + bounds[i],
+					                   ret.begin() + bounds[i + step],
+					                   ret.begin() + bounds[std::min(i + 2 * step, bounds.size() - 1)]);
+				}
+			}
+		}
+
+		return ret;
+	}
+
+private:
+	struct name_ref
+	{
+		name_ref(const char* data_, size_t size_) : data(data_), size(size_), hash(0) {}
+
+		const char*	data;
+		size_t		size;
+		uint64_t	hash;
+	};
+
+	struct name_hash
+	{
+		size_t operator()(const name_ref& name) const { return name.hash; }
+	};
+
+	struct name_equal
+	{
+		bool operator()(const name_ref& lhs, const name_ref& rhs) const {
+			return lhs.size == rhs.size && memcmp(lhs.data, rhs.data, lhs.size) == 0;
+		}
+	};
+
+	void run_threads(void (users_merge::*work)(size_t thread)) {
+		if (threads_ == 1) {
+			(this->*work)(0);
+			return;
+		}
+
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < threads_; ++i) {
+			workers.emplace_back(std::bind(&users_merge::run_work, this, work, i));
+		}
+		for (auto it = workers.begin(), end = workers.end(); it != end; ++it) {
+			it->join();
+		}
+
+		if (error_)
+			std::rethrow_exception(error_);
+	}
+
+	void run_work(void (users_merge::*work)(size_t thread), size_t thread) {
 		try {
-			node_.add_remote(it->addr.c_str(), it->port, it->family);	// Adds connection parameters to the node.
-			LOG(DNET_LOG_INFO, "Added elliptics server: %s:%d:%d\n", it->addr.c_str(), it->port, it->family);
+			(this->*work)(thread);
 		}
-		catch (ioremap::elliptics::error& e) {
-			LOG(DNET_LOG_ERROR, "Coudn't connect to %s:%d:%d: %s\n", it->addr.c_str(), it->port, it->family, e.error_message().c_str());
+		catch (...) {
+			std::unique_lock<std::mutex> lock(mutex_);
+			error_ = std::current_exception();
 		}
 	}
 
-	if (min_writes_ > groups_.size())
-		min_writes_ = groups_.size();
+	// hashes the stripe of names of the thread and spreads them into the buckets of the thread
+	void spread(size_t thread) {
+		const size_t stripe = (names_.size() + threads_ - 1) / threads_;
+		auto& buckets = buckets_[thread];
+		const auto begin = names_.begin() + std::min(names_.size(), thread * stripe);
+		const auto end = names_.begin() + std::min(names_.size(), (thread + 1) * stripe);
+		for (auto it = begin; it != end; ++it) {
+			uint64_t hash = 14695981039346656037ULL; // the same FNV-1a as user_hash
+			for (size_t i = 0; i < it->size; ++i) {
+				hash = (hash ^ static_cast<unsigned char>(it->data[i])) * 1099511628211ULL;
+			}
+			it->hash = hash;
+			buckets[(hash >> 32) % threads_].push_back(*it);
+		}
+	}
 
-	LOG(DNET_LOG_INFO, "provider::impl has been created\n");
-}
+	// builds partitions from the buckets of all threads
+	void deduplicate(size_t /*thread*/) {
+		for (size_t partition; (partition = next_++) < threads_;) {
+			size_t size = 0;
+			for (size_t i = 0; i < threads_; ++i) {
+				size += buckets_[i][partition].size();
+			}
 
-provider::impl::impl(const std::vector<std::string>& servers,
-                     const std::vector<int>& groups,
-                     uint32_t min_writes,
-                     const std::string& log_file,
-                     const int log_level)
-: groups_(groups)
-, min_writes_(min_writes)
-, config_(create_config())
-, log_(log_file.c_str(), log_level)
-, node_(log_, config_)
+			std::unordered_set<name_ref, name_hash, name_equal> unique(size);
+			for (size_t i = 0; i < threads_; ++i) {
+				auto& bucket = buckets_[i][partition];
+				unique.insert(bucket.begin(), bucket.end());
+				std::vector<name_ref>().swap(bucket);
+			}
+
+			auto& users = partitions_[partition];
+			users.reserve(unique.size());
+			for (auto it = unique.begin(), end = unique.end(); it != end; ++it) {
+				users.emplace_back(it->data, it->size);
+			}
+			if (sorted_)
+				std::sort(users.begin(), users.end());
+		}
+	}
+
+	std::vector<name_ref>						names_; // all found names, they point to data of the result
+	size_t										threads_;
+	bool										sorted_;
+	std::vector<std::vector<std::vector<name_ref>>>	buckets_; // names spread by each thread into each partition
+	std::vector<std::vector<std::string>>		partitions_; // unique users of each partition
+	std::atomic<size_t>							next_; // the next partition which should be taken by a thread
+	std::exception_ptr							error_; // error of any thread
+	std::mutex									mutex_;
+};
+
+/* Makes page of active users by reading activity statistics chunk by chunk.
+ * The user is in the same chunk of each day, so the page is deduplicated by reading the chunk of all days at once.
+ * Cursor is "chunk:hex of the last user of the page", the next page starts after this user in this chunk.
+ * Elliptics reads an index only whole, so each page reads at least one whole chunk of all days:
+ * a page costs O(chunk), and with one chunk each page reads whole days. The number of chunks bounds the cost.
+ * Failed read of a chunk fails the page, so the cursor doesn't skip users of the chunk.
+ */
+class active_users_pager : public std::enable_shared_from_this<active_users_pager>
 {
-	for (auto it = servers.begin(), end = servers.end(); it != end; ++it) {
-		try {
-			node_.add_remote(it->c_str());	// Adds connection parameters to the node.
-			LOG(DNET_LOG_INFO, "Added elliptics server: %s\n", it->c_str());
+public:
+	typedef std::function<void(const active_users_page& page, bool complete)> callback_t;
+
+	active_users_pager(const std::vector<std::string>& subkeys,
+	                   const std::string& cursor,
+	                   uint32_t limit,
+	                   uint32_t chunks)
+	: subkeys_(subkeys)
+	, limit_(limit)
+	, chunks_(chunks)
+	, chunk_(0)
+	, done_(subkeys.empty())
+	{
+		if (limit_ == 0)
+			throw std::invalid_argument("limit should be positive");
+
+		if (!cursor.empty())
+			parse_cursor(cursor);
+	}
+
+	// returns true if the page has been completed
+	bool done() const { return done_; }
+
+	const active_users_page& page() const { return page_; }
+
+	// returns indexes of the current chunk in all subkeys
+	std::vector<std::string> indexes() const {
+		std::vector<std::string> ret;
+		ret.reserve(subkeys_.size());
+		for (auto it = subkeys_.begin(), end = subkeys_.end(); it != end; ++it) {
+			ret.emplace_back(activity_index(*it, chunk_, chunks_));
 		}
-		catch (ioremap::elliptics::error& e) {
-			LOG(DNET_LOG_ERROR, "Coudn't connect to %s: %s\n", it->c_str(), e.error_message().c_str());
+		return ret;
+	}
+
+	// adds users of the current chunk to the page and moves to the next chunk if the current one has been taken whole
+	void on_chunk(const std::set<std::string>& users) {
+		auto it = last_.empty() ? users.begin() : users.upper_bound(last_);
+		for (; it != users.end() && page_.users.size() < limit_; ++it) {
+			page_.users.push_back(*it);
+		}
+
+		if (it != users.end()) { // the page is full, the next one continues the current chunk
+			page_.cursor = make_cursor(chunk_, page_.users.back());
+			done_ = true;
+			return;
+		}
+
+		++chunk_;
+		last_.clear();
+
+		if (chunk_ == chunks_) {
+			done_ = true;
+		}
+		else if (page_.users.size() >= limit_) {
+			page_.cursor = make_cursor(chunk_, std::string());
+			done_ = true;
+		}
+	}
+
+	// reads chunks asynchronously until the page is completed, callback gets false if a chunk can't be read
+	void read(ioremap::elliptics::session s, callback_t callback) {
+		if (done_) {
+			callback(page_, true);
+			return;
+		}
+
+		s.find_any_indexes(indexes())
+		.connect(std::bind(&active_users_pager::on_read,
+		                   shared_from_this(),
+		                   s,
+		                   callback,
+		                   std::placeholders::_1,
+		                   std::placeholders::_2));
+	}
+
+private:
+	void on_read(ioremap::elliptics::session s,
+	             callback_t callback,
+	             const ioremap::elliptics::sync_find_indexes_result &result,
+	             const ioremap::elliptics::error_info &error) {
+		if (error && error.code() != -ENOENT) { // missing index means the day without activity
+			callback(page_, false);
+			return;
+		}
+
+		std::set<std::string> users;
+		collect_users(result, users);
+		on_chunk(users);
+		read(s, callback);
+	}
+
+	static std::string make_cursor(uint32_t chunk, const std::string& last) {
+		static const char digits[] = "0123456789abcdef";
+		std::string ret = boost::lexical_cast<std::string>(chunk);
+		ret.reserve(ret.size() + 1 + last.size() * 2);
+		ret.append(1, ':');
+		for (auto it = last.begin(), end = last.end(); it != end; ++it) {
+			ret.append(1, digits[static_cast<unsigned char>(*it) >> 4]);
+			ret.append(1, digits[static_cast<unsigned char>(*it) & 0xf]);
 		}
+		return ret;
 	}
 
-	if (min_writes_ > groups_.size())
-		min_writes_ = groups_.size();
+	void parse_cursor(const std::string& cursor) {
+		const auto pos = cursor.find(':');
+		if (pos == std::string::npos || (cursor.size() - pos - 1) % 2 != 0)
+			throw std::invalid_argument("invalid cursor");
+
+		try {
+			chunk_ = boost::lexical_cast<uint32_t>(cursor.substr(0, pos));
+		}
+		catch (boost::bad_lexical_cast&) {
+			throw std::invalid_argument("invalid cursor");
+		}
+
+		if (chunk_ >= chunks_) // cursor of other number of chunks
+			throw std::invalid_argument("invalid cursor");
+
+		last_.reserve((cursor.size() - pos - 1) / 2);
+		for (size_t i = pos + 1; i < cursor.size(); i += 2) {
+			last_.append(1, static_cast<char>(hex_digit(cursor[i]) << 4 | hex_digit(cursor[i + 1])));
+		}
+	}
+
+	static int hex_digit(char c) {
+		if (c >= '0' && c <= '9')
+			return c - '0';
+		if (c >= 'a' && c <= 'f')
+			return c - 'a' + 10;
+		throw std::invalid_argument("invalid cursor");
+	}
+
+	const std::vector<std::string>	subkeys_;
+	const uint32_t					limit_; // maximum number of users in the page
+	const uint32_t					chunks_; // number of chunks of activity statistics
+	uint32_t						chunk_; // current chunk
+	std::string						last_; // the page starts after this user in the current chunk
+	bool							done_;
+	active_users_page				page_;
+};
+
+/* Selects users by the days in which they are active without building sets of the days.
+ * All activity indexes of the days are read by one find_any_indexes: elliptics returns each user once
+ * with the list of its matched indexes, so the days of the user are counted while the result is scanned.
+ * User is selected if it is active in at least min_days of the days and isn't active in any of the excluded days.
+ */
+class activity_filter
+{
+public:
+	activity_filter(ioremap::elliptics::session& s,
+	                const std::vector<std::string>& subkeys,
+	                const std::vector<std::string>& excluded,
+	                uint32_t chunks,
+	                size_t min_days)
+	: min_days_(min_days)
+	, seen_(subkeys.size(), 0)
+	, stamp_(0)
+	{
+		add_days(s, subkeys, chunks, false);
+		add_days(s, excluded, chunks, true);
+	}
+
+	// returns activity indexes of all days
+	const std::vector<std::string>& indexes() const { return indexes_; }
+
+	// inserts selected users found in the activity indexes
+	template<typename Result>
+	void filter(Result& result, std::set<std::string>& users) {
+		for (auto it = result.begin(), end = result.end(); it != end; ++it) {
+			if (it->indexes.empty())
+				continue;
+
+			++stamp_; // marks days of the current user without clearing seen_
+			size_t days = 0;
+			bool excluded = false;
+
+			for (auto ind_it = it->indexes.begin(), ind_end = it->indexes.end(); ind_it != ind_end && !excluded; ++ind_it) {
+				auto day = days_.find(std::string(reinterpret_cast<const char*>(ind_it->index.id), DNET_ID_SIZE));
+				if (day == days_.end())
+					continue;
+
+				if (day->second.second)
+					excluded = true;
+				else if (seen_[day->second.first] != stamp_) {
+					seen_[day->second.first] = stamp_;
+					++days;
+				}
+			}
+
+			if (!excluded && days >= min_days_)
+				users.insert(it->indexes.front().data.to_string());
+		}
+	}
+
+private:
+	void add_days(ioremap::elliptics::session& s, const std::vector<std::string>& subkeys, uint32_t chunks, bool excluded) {
+		for (size_t i = 0; i < subkeys.size(); ++i) {
+			for (uint32_t chunk = 0; chunk < chunks; ++chunk) {
+				indexes_.emplace_back(activity_index(subkeys[i], chunk, chunks));
+
+				dnet_raw_id id;
+				s.transform(indexes_.back(), id);
+				days_[std::string(reinterpret_cast<const char*>(id.id), DNET_ID_SIZE)] = std::make_pair(i, excluded);
+			}
+		}
+	}
+
+	const size_t											min_days_;
+	std::vector<std::string>								indexes_;
+	std::unordered_map<std::string, std::pair<size_t, bool>>	days_; // id of index -> day and whether the day is excluded
+	std::vector<size_t>										seen_; // stamp of the last user which is active in the day
+	size_t													stamp_;
+};
+
+/* Unites users found by several requests of activity indexes */
+class users_union
+{
+public:
+	typedef std::function<void(const std::set<std::string>& users)> callback_t;
+
+	users_union(callback_t callback, size_t count)
+	: callback_(callback)
+	, pending_(count)
+	{}
+
+	void on_users(const ioremap::elliptics::sync_find_indexes_result& result,
+	              const ioremap::elliptics::error_info &/*error*/) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			collect_users(result, users_);
+		}
+
+		if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			callback_(users_);
+	}
+
+private:
+	callback_t				callback_;
+	std::atomic<size_t>		pending_; // number of uncompleted requests
+	std::set<std::string>	users_;
+	std::mutex				mutex_; // protects users_
+};
+
+/* Computes retention matrix in parallel.
+ * At first threads read required days, each day is converted into sorted unique 64-bit hashes of users,
+ * so the sets of names are freed right after reading. Then threads take cells of the matrix and count
+ * intersection of the cohort day and the retention day by merging their hashes.
+ */
+class retention_job
+{
+public:
+	typedef std::function<std::set<std::string>(const std::string& subkey)> reader_t;
+
+	retention_job(uint64_t first_day, uint64_t last_day, const std::vector<uint32_t>& offsets, reader_t reader)
+	: first_day_(first_day)
+	, reader_(reader)
+	, next_(0)
+	{
+		matrix_.offsets = offsets;
+		for (uint64_t day = first_day; day <= last_day; ++day) {
+			matrix_.days.emplace_back(boost::lexical_cast<std::string>(day));
+		}
+
+		std::set<uint64_t> days; // each required day is read only once
+		for (uint64_t day = first_day; day <= last_day; ++day) {
+			days.insert(day);
+			for (auto it = offsets.begin(), end = offsets.end(); it != end; ++it) {
+				days.insert(day + *it);
+			}
+		}
+		days_.assign(days.begin(), days.end());
+		hashes_.resize(days_.size());
+	}
+
+	// returns number of days which are read
+	size_t days() const { return days_.size(); }
+
+	retention_matrix run(uint32_t threads) {
+		if (threads == 0)
+			threads = std::max(1U, std::thread::hardware_concurrency());
+
+		next_ = 0;
+		run_threads(threads, &retention_job::read_days);
+		next_ = 0;
+		run_threads(threads, &retention_job::intersect);
+
+		matrix_.cohorts.resize(matrix_.days.size());
+		for (size_t i = 0; i < matrix_.days.size(); ++i) {
+			matrix_.cohorts[i] = day_hashes(first_day_ + i).size();
+		}
+
+		return matrix_;
+	}
+
+	// counts common elements of sorted vectors
+	static uint64_t intersection(const std::vector<uint64_t>& lhs, const std::vector<uint64_t>& rhs) {
+		uint64_t ret = 0;
+		auto l = lhs.begin(), r = rhs.begin();
+		while (l != lhs.end() && r != rhs.end()) {
+			if (*l < *r)
+				++l;
+			else if (*r < *l)
+				++r;
+			else {
+				++ret;
+				++l;
+				++r;
+			}
+		}
+		return ret;
+	}
+
+private:
+	void run_threads(uint32_t threads, void (retention_job::*work)()) {
+		std::vector<std::thread> workers;
+		for (uint32_t i = 0; i < threads; ++i) {
+			workers.emplace_back(std::bind(&retention_job::run_work, this, work));
+		}
+		for (auto it = workers.begin(), end = workers.end(); it != end; ++it) {
+			it->join();
+		}
+
+		if (error_)
+			std::rethrow_exception(error_);
+	}
+
+	void run_work(void (retention_job::*work)()) {
+		try {
+			(this->*work)();
+		}
+		catch (...) {
+			std::unique_lock<std::mutex> lock(mutex_);
+			error_ = std::current_exception();
+		}
+	}
+
+	void read_days() {
+		for (size_t index; (index = next_++) < days_.size();) {
+			const auto users = reader_(boost::lexical_cast<std::string>(days_[index]));
+
+			auto& hashes = hashes_[index];
+			hashes.reserve(users.size());
+			for (auto it = users.begin(), end = users.end(); it != end; ++it) {
+				hashes.push_back(user_hash(*it));
+			}
+			std::sort(hashes.begin(), hashes.end());
+			hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+		}
+	}
+
+	void intersect() {
+		const size_t columns = matrix_.offsets.size();
+		std::vector<std::vector<uint64_t>> retained(matrix_.days.size(), std::vector<uint64_t>(columns));
+
+		for (size_t cell; (cell = next_++) < matrix_.days.size() * columns;) {
+			const size_t cohort = cell / columns, column = cell % columns;
+			retained[cohort][column] = intersection(day_hashes(first_day_ + cohort),
+			                                        day_hashes(first_day_ + cohort + matrix_.offsets[column]));
+		}
+
+		std::unique_lock<std::mutex> lock(mutex_); // each cell is computed by one thread, others have 0 in it
+		matrix_.retained.resize(matrix_.days.size(), std::vector<uint64_t>(columns));
+		for (size_t i = 0; i < retained.size(); ++i) {
+			for (size_t j = 0; j < columns; ++j) {
+				matrix_.retained[i][j] += retained[i][j];
+			}
+		}
+	}
+
+	const std::vector<uint64_t>& day_hashes(uint64_t day) const {
+		return hashes_[std::lower_bound(days_.begin(), days_.end(), day) - days_.begin()];
+	}
+
+	const uint64_t						first_day_;
+	reader_t							reader_; // reads active users of the day
+	retention_matrix					matrix_;
+	std::vector<uint64_t>				days_; // sorted days which are required for the matrix
+	std::vector<std::vector<uint64_t>>	hashes_; // sorted hashes of active users of each of days_
+	std::atomic<size_t>					next_; // the next day or cell which should be taken by a thread
+	std::exception_ptr					error_; // error of any thread
+	std::mutex							mutex_;
+};
+
+/* Limits number of reads of range operations which are in flight.
+ * Each operation runs its reads in order and keeps at most request limit of them in flight,
+ * all operations together keep at most global limit of reads in flight. Operations which wait for a global slot
+ * get it in turn, so a long range doesn't starve short ones.
+ * Only one thread starts tasks at a time: completions which free slots meanwhile leave starting to it,
+ * so reads which complete synchronously don't recurse into the scheduler.
+ * Index lookups of active users aren't scheduled: each of them is one elliptics request for all days of the range.
+ */
+class fanout_scheduler : public std::enable_shared_from_this<fanout_scheduler>
+{
+public:
+	typedef std::function<void()> done_t;
+	typedef std::function<void(done_t done)> task_t; // sends the read and calls done once the read is completed
+
+	/* Reads of one range operation */
+	class request
+	{
+	public:
+		request(std::vector<task_t>&& tasks, done_t complete)
+		: tasks_(std::move(tasks))
+		, complete_(complete)
+		, next_(0)
+		, in_flight_(0)
+		, queued_(false)
+		, cancelled_(false)
+		, completed_(false)
+		{}
+
+	private:
+		friend class fanout_scheduler;
+
+		bool has_tasks() const { return !cancelled_ && next_ < tasks_.size(); }
+
+		std::vector<task_t>	tasks_;
+		done_t				complete_; // is called once after all started reads are completed
+		size_t				next_; // the next task which should be started
+		size_t				in_flight_;
+		bool				queued_; // whether the request is in waiting_
+		bool				cancelled_; // tasks which haven't been started are skipped
+		bool				completed_;
+	};
+
+	fanout_scheduler()
+	: request_limit_(consts::FANOUT_REQUEST_LIMIT)
+	, global_limit_(consts::FANOUT_GLOBAL_LIMIT)
+	, in_flight_(0)
+	, queued_(0)
+	, scheduling_(false)
+	{}
+
+	void set_limits(size_t request_limit, size_t global_limit) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		request_limit_ = std::max<size_t>(1, request_limit);
+		global_limit_ = std::max<size_t>(1, global_limit);
+	}
+
+	// runs tasks, complete is called after all of them are done or after the request is cancelled
+	std::shared_ptr<request> run(std::vector<task_t>&& tasks, done_t complete) {
+		auto r = std::make_shared<request>(std::move(tasks), complete);
+		if (r->tasks_.empty()) {
+			complete();
+			return r;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			r->queued_ = true;
+			waiting_.push_back(r);
+			queued_ += r->tasks_.size();
+		}
+		schedule();
+		return r;
+	}
+
+	// skips tasks of the request which haven't been started
+	void cancel(const std::shared_ptr<request>& r) {
+		bool complete;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			if (!r->cancelled_)
+				queued_ -= r->tasks_.size() - r->next_;
+			r->cancelled_ = true;
+			complete = finish(*r);
+		}
+		if (complete)
+			r->complete_();
+	}
+
+	// returns number of reads which wait for free slots
+	size_t queued() const {
+		std::unique_lock<std::mutex> lock(mutex_);
+		return queued_;
+	}
+
+	// returns number of reads of all requests which are in flight
+	size_t in_flight() const {
+		std::unique_lock<std::mutex> lock(mutex_);
+		return in_flight_;
+	}
+
+private:
+	// returns true if the request has just been completed, mutex_ should be locked
+	static bool finish(request& r) {
+		if (r.completed_ || r.in_flight_ != 0 || r.has_tasks())
+			return false;
+		r.completed_ = true;
+		return true;
+	}
+
+	// starts tasks while there are free slots, returns at once if another call is starting them
+	void schedule() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (scheduling_) // it takes slots freed by this call after its current tasks
+			return;
+		scheduling_ = true;
+
+		while (true) {
+			std::vector<std::pair<std::shared_ptr<request>, size_t>> started;
+			while (in_flight_ < global_limit_ && !waiting_.empty()) {
+				auto r = waiting_.front();
+				waiting_.pop_front();
+
+				if (!r->has_tasks() || r->in_flight_ >= request_limit_) { // it is queued again by on_done
+					r->queued_ = false;
+					continue;
+				}
+
+				started.emplace_back(r, r->next_++);
+				++r->in_flight_;
+				++in_flight_;
+				--queued_;
+				waiting_.push_back(r); // the next task of the request waits for its turn
+			}
+
+			if (started.empty()) {
+				scheduling_ = false;
+				return;
+			}
+
+			lock.unlock();
+			for (auto it = started.begin(), end = started.end(); it != end; ++it) {
+				it->first->tasks_[it->second](std::bind(&fanout_scheduler::on_done, shared_from_this(), it->first));
+			}
+			lock.lock();
+		}
+	}
+
+	void on_done(const std::shared_ptr<request>& r) {
+		bool complete;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			--r->in_flight_;
+			--in_flight_;
+			if (!r->queued_ && r->has_tasks()) {
+				r->queued_ = true;
+				waiting_.push_back(r);
+			}
+			complete = finish(*r);
+		}
+
+		schedule();
+
+		if (complete)
+			r->complete_();
+	}
+
+	size_t									request_limit_;
+	size_t									global_limit_;
+	size_t									in_flight_; // reads of all requests in flight
+	size_t									queued_; // reads of all requests which haven't been started
+	std::deque<std::shared_ptr<request>>	waiting_; // requests which have tasks to start
+	bool									scheduling_; // whether some thread is starting tasks
+	mutable std::mutex						mutex_; // protects all above
+};
+
+/* Sums activity counters of users over days.
+ * Active users of each day are found by activity statistics and then their counters of the day are looked up
+ * through the fanout scheduler, so a day with many users doesn't send all lookups at once.
+ * Counter is the size of object which is appended by one byte on each activity, so concurrent increments commute.
+ */
+class activity_counts : public std::enable_shared_from_this<activity_counts>
+{
+public:
+	typedef std::function<void(const std::map<std::string, uint64_t>& counts)> callback_t;
+
+	activity_counts(const ioremap::elliptics::session& s,
+	                std::shared_ptr<fanout_scheduler> scheduler,
+	                callback_t callback,
+	                size_t days)
+	: s_(s)
+	, scheduler_(scheduler)
+	, callback_(callback)
+	, pending_(days)
+	{}
+
+	// schedules lookups of counters of the day users
+	void on_users(const std::string& subkey, const std::set<std::string>& users) {
+		pending_ += users.size(); // before completing the day, so the counts aren't reported too early
+
+		auto self = shared_from_this();
+
+		std::vector<fanout_scheduler::task_t> tasks;
+		tasks.reserve(users.size());
+
+		for (auto it = users.begin(), end = users.end(); it != end; ++it) {
+			const auto user = *it;
+			tasks.emplace_back([self, user, subkey](fanout_scheduler::done_t done) mutable {
+				self->s_.lookup(user + "." + subkey) // the same key as provider::impl::combine_key
+				.connect([self, user, done](const ioremap::elliptics::sync_lookup_result& result,
+				                            const ioremap::elliptics::error_info &/*error*/) {
+					self->on_lookup(user, result);
+					done();
+				});
+			});
+		}
+
+		scheduler_->run(std::move(tasks), fanout_scheduler::done_t([]() {}));
+
+		complete();
+	}
+
+	void on_lookup(const std::string& user, const ioremap::elliptics::sync_lookup_result& result) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			counts_[user] += count(result); // user without counter (e.g. added before counters were enabled) has 0
+		}
+		complete();
+	}
+
+	// returns counter value from the lookup result
+	static uint64_t count(const ioremap::elliptics::sync_lookup_result& result) {
+		for (auto it = result.begin(), end = result.end(); it != end; ++it) {
+			if (it->status() == 0)
+				return it->file_info()->size;
+		}
+		return 0;
+	}
+
+private:
+	void complete() {
+		if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			callback_(counts_);
+	}
+
+	ioremap::elliptics::session			s_; // session of counters namespace
+	std::shared_ptr<fanout_scheduler>	scheduler_;
+	callback_t							callback_;
+	std::atomic<size_t>					pending_; // number of uncompleted days and lookups
+	std::map<std::string, uint64_t>		counts_;
+	std::mutex							mutex_; // protects counts_
+};
+
+/* Iterates over active users of days without blocking.
+ * Active users of at most window days are read ahead, the next day is requested when a day has been handled.
+ * Days are handled by the callback one at a time in order of subkeys. When the callback returns false,
+ * no more days are requested and days which are still in flight are dropped.
+ */
+class active_users_iterator : public std::enable_shared_from_this<active_users_iterator>
+{
+public:
+	typedef std::function<bool(const std::set<std::string>& active_users)> callback_t;
+	typedef std::function<void()> complete_callback_t;
+
+	active_users_iterator(const ioremap::elliptics::session& s,
+	                      const std::vector<std::vector<std::string>>& indexes,
+	                      callback_t callback,
+	                      complete_callback_t complete_callback,
+	                      uint32_t merge_threads)
+	: s_(s)
+	, indexes_(indexes)
+	, callback_(callback)
+	, complete_callback_(complete_callback)
+	, merge_threads_(merge_threads)
+	, days_(indexes.size())
+	, found_(indexes.size(), false)
+	, next_read_(0)
+	, next_day_(0)
+	, delivering_(false)
+	, stopped_(false)
+	{}
+
+	// requests the first window of days
+	void start(size_t window) {
+		if (indexes_.empty()) {
+			complete_callback_();
+			return;
+		}
+
+		size_t count;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			count = std::min(window, indexes_.size());
+			next_read_ = count;
+		}
+
+		for (size_t i = 0; i < count; ++i) {
+			read(i);
+		}
+	}
+
+private:
+	void read(size_t index) {
+		s_.find_any_indexes(indexes_[index])
+		.connect(std::bind(&active_users_iterator::on_found,
+		                   shared_from_this(),
+		                   index,
+		                   std::placeholders::_1,
+		                   std::placeholders::_2));
+	}
+
+	void on_found(size_t index,
+	              const ioremap::elliptics::sync_find_indexes_result &result,
+	              const ioremap::elliptics::error_info &/*error*/) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (stopped_) // the day isn't needed anymore, so it isn't merged
+			return;
+		lock.unlock();
+
+		auto users = users_merge(result, merge_threads_).run(true); // merges out of the lock
+
+		lock.lock();
+		if (stopped_)
+			return;
+
+		days_[index] = std::set<std::string>(std::make_move_iterator(users.begin()), std::make_move_iterator(users.end()));
+		found_[index] = true;
+
+		if (delivering_) // the thread which is delivering days will deliver this day too
+			return;
+
+		delivering_ = true;
+		while (next_day_ < days_.size() && found_[next_day_]) {
+			std::set<std::string> day;
+			day.swap(days_[next_day_++]);
+
+			const bool requested = next_read_ < indexes_.size();
+			const size_t next_read = next_read_;
+			if (requested)
+				++next_read_;
+
+			lock.unlock();
+			if (requested) // the next day is read while the callback handles this one
+				read(next_read);
+			const bool proceed = callback_(day);
+			lock.lock();
+
+			if (!proceed) {
+				stopped_ = true;
+				break;
+			}
+		}
+		delivering_ = false;
+
+		if (stopped_ || next_day_ == days_.size()) {
+			stopped_ = true; // days which are still in flight are ignored
+			lock.unlock();
+			complete_callback_();
+		}
+	}
+
+	ioremap::elliptics::session					s_;
+	const std::vector<std::vector<std::string>>	indexes_; // indexes of activity statistics of each day
+	callback_t									callback_; // is called for each day
+	complete_callback_t							complete_callback_; // is called once after the last handled day
+	const uint32_t								merge_threads_;
+	std::vector<std::set<std::string>>			days_; // active users of days which have been read but not handled
+	std::vector<bool>							found_; // whether active users of the day have been read
+	size_t										next_read_; // the next day which should be requested
+	size_t										next_day_; // the next day which should be handled
+	bool										delivering_; // whether some thread is calling the callback
+	bool										stopped_; // whether the iteration is over
+	std::mutex									mutex_; // protects all above
+};
+
+// parses subkey of the day into number of the day, returns false for custom subkey
+bool subkey_to_day(const std::string& subkey, uint64_t& day)
+{
+	if (subkey.empty() || subkey.size() > 10 || subkey.find_first_not_of("0123456789") != std::string::npos)
+		return false;
+
+	day = boost::lexical_cast<uint64_t>(subkey);
+	return true;
+}
+
+// returns true if the subkey is the day before today, so its logs are rarely written
+bool is_past_day(const std::string& subkey)
+{
+	uint64_t day;
+	return subkey_to_day(subkey, day) && day < static_cast<uint64_t>(time(NULL)) / consts::SECONDS_IN_DAY;
+}
+
+/* Selects subkeys of user logs which exist.
+ * Days of the user which have logs are marked in objects of buckets of days, one byte at offset of the day
+ * in the bucket. Marks are idempotent, so each bucket takes at most consts::DAYS_IN_BUCKET bytes.
+ * Range read reads buckets of the days at first and then reads only logs of marked days.
+ * Custom subkeys and days of buckets which can't be read are always selected.
+ */
+class log_days_filter : public std::enable_shared_from_this<log_days_filter>
+{
+public:
+	typedef std::function<void(const std::vector<std::string>& subkeys)> callback_t;
+
+	log_days_filter(const std::string& user, const std::vector<std::string>& subkeys)
+	: subkeys_(subkeys)
+	, days_(subkeys.size(), 0)
+	, slots_(subkeys.size(), ~size_t(0))
+	{
+		std::map<uint64_t, size_t> buckets; // bucket -> index in keys_
+
+		for (size_t i = 0; i < subkeys_.size(); ++i) {
+			if (!subkey_to_day(subkeys_[i], days_[i]))
+				continue;
+
+			auto res = buckets.insert(std::make_pair(days_[i] / consts::DAYS_IN_BUCKET, keys_.size()));
+			if (res.second)
+				keys_.emplace_back(bucket_key(user, res.first->first));
+			slots_[i] = res.first->second;
+		}
+
+		marks_.resize(keys_.size());
+		states_.resize(keys_.size(), BUCKET_UNKNOWN);
+		pending_ = keys_.size();
+	}
+
+	// returns key of the object which marks days of the bucket
+	static std::string bucket_key(const std::string& user, uint64_t bucket) {
+		return user + "." + boost::lexical_cast<std::string>(bucket);
+	}
+
+	// returns key of the bucket of the day and offset of the day in the bucket
+	static std::string day_key(const std::string& user, uint64_t day, uint64_t& offset) {
+		offset = day % consts::DAYS_IN_BUCKET;
+		return bucket_key(user, day / consts::DAYS_IN_BUCKET);
+	}
+
+	// reads buckets and returns selected subkeys
+	std::vector<std::string> read(ioremap::elliptics::session& s) {
+		std::vector<ioremap::elliptics::async_read_result> results;
+		results.reserve(keys_.size());
+
+		for (auto it = keys_.begin(), end = keys_.end(); it != end; ++it) {
+			results.emplace_back(s.read_latest(*it, 0, 0));
+		}
+
+		for (size_t i = 0; i < results.size(); ++i) {
+			auto res = results[i].get();
+			on_bucket(i, res, results[i].error());
+		}
+
+		return subkeys();
+	}
+
+	// reads buckets and calls callback with selected subkeys
+	void read(ioremap::elliptics::session& s, callback_t callback) {
+		if (keys_.empty()) {
+			callback(subkeys_);
+			return;
+		}
+
+		callback_ = callback;
+
+		for (size_t i = 0; i < keys_.size(); ++i) {
+			s.read_latest(keys_[i], 0, 0)
+			.connect(std::bind(&log_days_filter::on_read,
+			                   shared_from_this(),
+			                   i,
+			                   std::placeholders::_1,
+			                   std::placeholders::_2));
+		}
+	}
+
+private:
+	enum bucket_state {
+		BUCKET_UNKNOWN, // the bucket can't be read, all its days are selected
+		BUCKET_MISSING, // the user doesn't have logs in days of the bucket
+		BUCKET_READ
+	};
+
+	void on_read(size_t index,
+	             const ioremap::elliptics::sync_read_result& result,
+	             const ioremap::elliptics::error_info& error) {
+		on_bucket(index, result, error);
+
+		if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			callback_(subkeys());
+	}
+
+	void on_bucket(size_t index,
+	               const ioremap::elliptics::sync_read_result& result,
+	               const ioremap::elliptics::error_info& error) {
+		for (auto it = result.begin(), end = result.end(); it != end; ++it) {
+			if (it->status() == 0) {
+				marks_[index] = it->file();
+				states_[index] = BUCKET_READ;
+				return;
+			}
+		}
+
+		if (error && error.code() == -ENOENT)
+			states_[index] = BUCKET_MISSING;
+	}
+
+	std::vector<std::string> subkeys() const {
+		std::vector<std::string> ret;
+
+		for (size_t i = 0; i < subkeys_.size(); ++i) {
+			const auto slot = slots_[i];
+			if (slot == ~size_t(0) || states_[slot] == BUCKET_UNKNOWN) {
+				ret.push_back(subkeys_[i]);
+				continue;
+			}
+
+			const auto offset = days_[i] % consts::DAYS_IN_BUCKET;
+			const auto& marks = marks_[slot];
+			if (states_[slot] == BUCKET_READ && offset < marks.size() && marks.data<char>()[offset] != 0)
+				ret.push_back(subkeys_[i]);
+		}
+
+		return ret;
+	}
+
+	const std::vector<std::string>					subkeys_;
+	std::vector<uint64_t>							days_; // day of each subkey
+	std::vector<size_t>								slots_; // bucket of each subkey, ~0 for custom subkey
+	std::vector<std::string>						keys_; // keys of the buckets
+	std::vector<ioremap::elliptics::data_pointer>	marks_; // marks of days of each bucket
+	std::vector<char>								states_; // bucket_state of each bucket
+	std::atomic<size_t>								pending_; // number of unread buckets
+	callback_t										callback_;
+};
+
+/* Remembers keys for the limited time, the least recently inserted keys are evicted if there are more than capacity keys.
+ * It remembers keys of user logs of past days which haven't been found recently, so repeated range reads skip them.
+ * Logs of today aren't remembered because they are being written. Logs which are written by this provider
+ * are forgotten immediately, logs written by other frontends are found after the entry has expired.
+ * It also remembers activities whose positions in filter of the day have been set, so they aren't written again.
+ */
+class recent_keys
+{
+public:
+	recent_keys(size_t capacity)
+	: capacity_(capacity)
+	, ttl_(0)
+	, hits_(0)
+	{}
+
+	// sets time of remembering keys, 0 disables the cache
+	void set_ttl(uint32_t ttl) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		ttl_ = std::chrono::seconds(ttl);
+		if (ttl == 0) {
+			entries_.clear();
+			lru_.clear();
+		}
+	}
+
+	bool contains(const std::string& key) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		auto it = entries_.find(key);
+		if (it == entries_.end())
+			return false;
+
+		if (it->second.first > clock::now()) {
+			++hits_;
+			return true;
+		}
+
+		lru_.erase(it->second.second);
+		entries_.erase(it);
+		return false;
+	}
+
+	void insert(const std::string& key) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (ttl_.count() == 0)
+			return;
+
+		auto& e = entries_[key];
+		if (e.first != clock::time_point())
+			lru_.erase(e.second);
+
+		lru_.push_front(key);
+		e = std::make_pair(clock::now() + ttl_, lru_.begin());
+
+		if (lru_.size() > capacity_) {
+			entries_.erase(lru_.back());
+			lru_.pop_back();
+		}
+	}
+
+	// returns number of lookups which have found the key
+	uint64_t hits() const {
+		return hits_;
+	}
+
+	void erase(const std::string& key) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (entries_.empty())
+			return;
+
+		auto it = entries_.find(key);
+		if (it == entries_.end())
+			return;
+
+		lru_.erase(it->second.second);
+		entries_.erase(it);
+	}
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	const size_t			capacity_; // maximum number of keys
+	std::chrono::seconds	ttl_;
+	std::list<std::string>	lru_; // keys from the most recently inserted
+	std::unordered_map<std::string, std::pair<clock::time_point, std::list<std::string>::iterator>>	entries_; // key -> expiration time and position in lru_
+	std::atomic<uint64_t>	hits_;
+	std::mutex				mutex_;
+};
+
+/* Reads logs of many users for the same subkeys.
+ * Keys of a batch of users are read by one bulk_read which elliptics splits into one command per destination node,
+ * so the number of requests depends on the number of nodes rather than on the number of users.
+ * At most window batches are in flight, the next batch is sent when one of them is completed.
+ * If days with user logs are marked, buckets of days of the batch users are bulk read at first
+ * and only logs of marked days are read, as log_days_filter does for one user.
+ * Logs of past days which haven't been found recently are skipped, missing logs of past days are remembered.
+ * User is delivered as soon as all its logs have been read, so users come in order of completion.
+ * Logs which don't exist aren't failures, failed reads and errors of the bulk read mark the user incomplete.
+ */
+class users_logs_reader : public std::enable_shared_from_this<users_logs_reader>
+{
+public:
+	typedef std::function<void(const std::string& user, const std::vector<char>& data, bool complete)> user_callback_t;
+	typedef std::function<void()> complete_callback_t;
+
+	users_logs_reader(const ioremap::elliptics::session& s,
+	                  const ioremap::elliptics::session& days_s,
+	                  bool log_days,
+	                  const std::shared_ptr<recent_keys>& missing,
+	                  const std::vector<std::string>& users,
+	                  const std::vector<std::string>& subkeys,
+	                  user_callback_t user_callback,
+	                  complete_callback_t complete_callback,
+	                  size_t batch_size)
+	: s_(s)
+	, days_s_(days_s)
+	, missing_(missing)
+	, users_(users)
+	, subkeys_(subkeys)
+	, days_(subkeys.size(), 0)
+	, slots_(subkeys.size(), ~size_t(0))
+	, past_(subkeys.size(), false)
+	, user_callback_(user_callback)
+	, complete_callback_(complete_callback)
+	, batch_size_(batch_size)
+	, batches_((users.size() + batch_size - 1) / batch_size)
+	, next_(0)
+	, completed_(0)
+	{
+		std::map<uint64_t, size_t> buckets; // bucket -> index in buckets_
+
+		for (size_t i = 0; i < subkeys_.size(); ++i) {
+			past_[i] = is_past_day(subkeys_[i]);
+			if (!log_days || !subkey_to_day(subkeys_[i], days_[i]))
+				continue;
+
+			auto res = buckets.insert(std::make_pair(days_[i] / consts::DAYS_IN_BUCKET, buckets_.size()));
+			if (res.second)
+				buckets_.push_back(res.first->first);
+			slots_[i] = res.first->second;
+		}
+	}
+
+	// sends the first window of batches
+	void start(size_t window) {
+		if (batches_ == 0) {
+			complete_callback_();
+			return;
+		}
+
+		for (size_t i = 0; i < window; ++i) {
+			send_next();
+		}
+	}
+
+private:
+	enum bucket_state {
+		BUCKET_UNKNOWN, // the bucket can't be read, all its days are read
+		BUCKET_MISSING, // the user doesn't have logs in days of the bucket
+		BUCKET_READ
+	};
+
+	/* Logs of one batch of users */
+	struct batch
+	{
+		struct user
+		{
+			std::vector<ioremap::elliptics::data_pointer>	files; // logs of each subkey
+			std::vector<bool>								read; // whether the log of the subkey has been read or isn't requested
+			size_t											pending; // number of unread subkeys, ~0 after the user has been delivered
+			std::vector<bool>								failed; // whether the read of the log of the subkey has failed
+			std::vector<ioremap::elliptics::data_pointer>	marks; // marks of days of each bucket
+			std::vector<char>								states; // bucket_state of each bucket
+		};
+
+		size_t													first; // index of the first user of the batch
+		std::vector<user>										users;
+		std::unordered_map<std::string, std::pair<size_t, size_t>>	keys; // id of key -> user of the batch and subkey or bucket
+		std::mutex												mutex; // protects users
+	};
+
+	// sends the next batch, batches which don't have logs to read are completed in place
+	void send_next() {
+		while (true) {
+			const size_t index = next_.fetch_add(1, std::memory_order_relaxed);
+			if (index >= batches_)
+				return;
+
+			auto b = std::make_shared<batch>();
+			b->first = index * batch_size_;
+			b->users.resize(std::min(batch_size_, users_.size() - b->first));
+
+			if (!buckets_.empty()) {
+				read_marks(b);
+				return;
+			}
+
+			if (read_logs(b))
+				return;
+
+			complete(b, ioremap::elliptics::error_info());
+		}
+	}
+
+	// reads buckets of days of the batch users
+	void read_marks(const std::shared_ptr<batch>& b) {
+		std::vector<std::string> keys;
+		keys.reserve(b->users.size() * buckets_.size());
+
+		for (size_t i = 0; i < b->users.size(); ++i) {
+			auto& u = b->users[i];
+			u.marks.resize(buckets_.size());
+			u.states.resize(buckets_.size(), BUCKET_UNKNOWN);
+
+			for (size_t j = 0; j < buckets_.size(); ++j) {
+				keys.emplace_back(log_days_filter::bucket_key(users_[b->first + i], buckets_[j]));
+				add_key(*b, days_s_, keys.back(), i, j);
+			}
+		}
+
+		days_s_.bulk_read(keys)
+		.connect(std::bind(&users_logs_reader::on_mark, shared_from_this(), b, std::placeholders::_1),
+		         std::bind(&users_logs_reader::on_marks, shared_from_this(), b, std::placeholders::_1));
+	}
+
+	void on_mark(const std::shared_ptr<batch>& b, const ioremap::elliptics::read_result_entry& entry) {
+		auto it = b->keys.find(std::string(reinterpret_cast<const char*>(entry.command()->id.id), DNET_ID_SIZE));
+		if (it == b->keys.end())
+			return;
+
+		std::unique_lock<std::mutex> lock(b->mutex);
+		auto& u = b->users[it->second.first];
+		auto& state = u.states[it->second.second];
+
+		if (entry.status() == 0) {
+			u.marks[it->second.second] = entry.file();
+			state = BUCKET_READ;
+		}
+		else if (entry.status() == -ENOENT && state == BUCKET_UNKNOWN)
+			state = BUCKET_MISSING;
+	}
+
+	// reads logs of marked days after all buckets of the batch have been read, failed buckets select all their days
+	void on_marks(const std::shared_ptr<batch>& b, const ioremap::elliptics::error_info &/*error*/) {
+		b->keys.clear();
+
+		if (read_logs(b))
+			return;
+
+		complete(b, ioremap::elliptics::error_info());
+		send_next();
+	}
+
+	// sends bulk read of logs of the batch, returns false if there are no logs to read
+	bool read_logs(const std::shared_ptr<batch>& b) {
+		std::vector<std::string> keys;
+		keys.reserve(b->users.size() * subkeys_.size());
+
+		for (size_t i = 0; i < b->users.size(); ++i) {
+			auto& u = b->users[i];
+			u.files.resize(subkeys_.size());
+			u.read.resize(subkeys_.size(), true);
+			u.pending = 0;
+			u.failed.resize(subkeys_.size(), false);
+
+			for (size_t j = 0; j < subkeys_.size(); ++j) {
+				if (!marked(u, j))
+					continue;
+
+				auto key = users_[b->first + i] + "." + subkeys_[j]; // the same key as provider::impl::combine_key
+				if (missing_->contains(key))
+					continue;
+
+				u.read[j] = false;
+				++u.pending;
+				keys.emplace_back(std::move(key));
+				add_key(*b, s_, keys.back(), i, j);
+			}
+		}
+
+		if (keys.empty())
+			return false;
+
+		s_.bulk_read(keys)
+		.connect(std::bind(&users_logs_reader::on_read, shared_from_this(), b, std::placeholders::_1),
+		         std::bind(&users_logs_reader::on_batch, shared_from_this(), b, std::placeholders::_1));
+		return true;
+	}
+
+	// returns true if the day of the subkey may have logs of the user
+	bool marked(const batch::user& u, size_t index) const {
+		const auto slot = slots_[index];
+		if (slot == ~size_t(0) || u.states[slot] == BUCKET_UNKNOWN)
+			return true;
+
+		const auto offset = days_[index] % consts::DAYS_IN_BUCKET;
+		const auto& marks = u.marks[slot];
+		return u.states[slot] == BUCKET_READ && offset < marks.size() && marks.data<char>()[offset] != 0;
+	}
+
+	static void add_key(batch& b, ioremap::elliptics::session& s, const std::string& key, size_t user, size_t index) {
+		dnet_raw_id id;
+		s.transform(key, id);
+		b.keys[std::string(reinterpret_cast<const char*>(id.id), DNET_ID_SIZE)] = std::make_pair(user, index);
+	}
+
+	void on_read(const std::shared_ptr<batch>& b, const ioremap::elliptics::read_result_entry& entry) {
+		auto it = b->keys.find(std::string(reinterpret_cast<const char*>(entry.command()->id.id), DNET_ID_SIZE));
+		if (it == b->keys.end())
+			return;
+
+		std::unique_lock<std::mutex> lock(b->mutex);
+		auto& u = b->users[it->second.first];
+		if (u.read[it->second.second] || u.pending == ~size_t(0)) // the same log from another group
+			return;
+
+		if (entry.status() != 0) {
+			if (entry.status() != -ENOENT) // missing log isn't a failure, the log still can be read from another group
+				u.failed[it->second.second] = true;
+			return;
+		}
+
+		if (entry.file().empty())
+			return;
+
+		u.files[it->second.second] = entry.file();
+		u.read[it->second.second] = true;
+		if (--u.pending == 0)
+			deliver(*b, it->second.first);
+	}
+
+	void on_batch(const std::shared_ptr<batch>& b, const ioremap::elliptics::error_info &error) {
+		complete(b, error);
+		send_next();
+	}
+
+	// delivers users of the completed batch which haven't been delivered yet
+	void complete(const std::shared_ptr<batch>& b, const ioremap::elliptics::error_info &error) {
+		const bool failed = error && error.code() != -ENOENT; // undelivered users may have unread logs
+
+		{
+			std::unique_lock<std::mutex> lock(b->mutex);
+			for (size_t i = 0; i < b->users.size(); ++i) { // users with missing logs get the logs which have been read
+				auto& u = b->users[i];
+				if (u.pending == ~size_t(0))
+					continue;
+
+				for (size_t j = 0; j < u.read.size(); ++j) {
+					if (u.read[j])
+						continue;
+
+					if (failed)
+						u.failed[j] = true;
+					else if (!u.failed[j] && past_[j]) // the log hasn't been found in any group
+						missing_->insert(users_[b->first + i] + "." + subkeys_[j]);
+				}
+				deliver(*b, i);
+			}
+		}
+
+		if (completed_.fetch_add(1, std::memory_order_acq_rel) + 1 == batches_)
+			complete_callback_();
+	}
+
+	// concatenates logs of the user in order of subkeys and calls the user callback, batch mutex should be locked
+	void deliver(batch& b, size_t index) {
+		auto& u = b.users[index];
+		u.pending = ~size_t(0);
+
+		size_t size = 0;
+		for (auto it = u.files.begin(), end = u.files.end(); it != end; ++it) {
+			size += it->size();
+		}
+
+		std::vector<char> data;
+		data.reserve(size);
+
+		for (auto it = u.files.begin(), end = u.files.end(); it != end; ++it) {
+			if (!it->empty())
+				data.insert(data.end(), it->data<char>(), it->data<char>() + it->size());
+		}
+		u.files.clear(); // frees the logs before the next users are read
+		u.marks.clear();
+
+		bool complete = true; // logs which have failed in all groups haven't been read
+		for (size_t i = 0; i < u.read.size(); ++i) {
+			if (u.failed[i] && !u.read[i])
+				complete = false;
+		}
+
+		std::unique_lock<std::mutex> lock(callback_mutex_);
+		user_callback_(users_[b.first + index], data, complete);
+	}
+
+	ioremap::elliptics::session		s_;
+	ioremap::elliptics::session		days_s_; // session of buckets of days
+	std::shared_ptr<recent_keys>	missing_; // user logs which haven't been found recently
+	const std::vector<std::string>	users_;
+	const std::vector<std::string>	subkeys_;
+	std::vector<uint64_t>			days_; // day of each subkey
+	std::vector<size_t>				slots_; // bucket of each subkey, ~0 for custom subkey or if days aren't marked
+	std::vector<bool>				past_; // whether missing log of the subkey should be remembered
+	std::vector<uint64_t>			buckets_; // buckets of days of the subkeys, empty if days aren't marked
+	user_callback_t					user_callback_; // is called for each user
+	complete_callback_t				complete_callback_; // is called after all users have been delivered
+	const size_t					batch_size_; // number of users in one bulk read
+	const size_t					batches_;
+	std::atomic<size_t>				next_; // index of the next batch which should be sent
+	std::atomic<size_t>				completed_; // number of completed batches
+	std::mutex						callback_mutex_; // user callback isn't called simultaneously
+};
+
+// returns positions of the user in activity filter of size positions, they are calculated by double hashing of the user name
+std::vector<uint64_t> activity_filter_positions(const std::string& user, uint64_t size)
+{
+	const auto hash = user_hash(user);
+	const uint64_t h1 = hash & 0xffffffff;
+	const uint64_t h2 = (hash >> 32) | 1;
+
+	std::vector<uint64_t> ret(consts::ACTIVITY_FILTER_HASHES);
+	for (size_t i = 0; i < ret.size(); ++i) {
+		ret[i] = (h1 + i * h2) % size;
+	}
+	return ret;
+}
+
+// returns key of the filter object of the day which contains the position and offset of the position in the object
+std::string activity_filter_key(const std::string& subkey, uint64_t position, uint64_t size, uint64_t& offset)
+{
+	const auto shard_size = size / consts::ACTIVITY_FILTER_SHARDS;
+	offset = position % shard_size;
+	return subkey + "." + boost::lexical_cast<std::string>(position / shard_size);
+}
+
+/* Checks whether users are active in the day.
+ * If activity filters are enabled, each added activity sets bytes of the user positions in the filter of the day,
+ * it is Bloom filter with one byte per position, so concurrent writes of different positions don't conflict.
+ * The filter is split into several objects, so writes of the day are spread over nodes.
+ * Filter bytes of the user are read at first: if any of them has been read and isn't set, the user isn't active.
+ * Set positions, missing filter or failed read mean "maybe", so the user is confirmed by the list of indexes
+ * of the user object, which contains activity index of each day in which the user has been active with filters.
+ * Users which aren't in their lists (false positives, days written without filters) are confirmed by the activity
+ * index of the day, each chunk of the index which contains such users is read once for all of them.
+ * Without filters all checked users are confirmed by the activity index, so the check reads whole chunks of the day.
+ */
+class activity_check : public std::enable_shared_from_this<activity_check>
+{
+public:
+	typedef std::function<void(const std::vector<bool>& active)> callback_t;
+
+	activity_check(const ioremap::elliptics::session& s,
+	               const ioremap::elliptics::session& filters_s,
+	               const std::vector<std::string>& users,
+	               const std::string& subkey,
+	               uint32_t chunks,
+	               uint64_t filter_size,
+	               callback_t callback)
+	: s_(s)
+	, filters_s_(filters_s)
+	, users_(users)
+	, subkey_(subkey)
+	, chunks_(chunks)
+	, filter_size_(filter_size)
+	, callback_(callback)
+	, states_(new user_state[users.size()])
+	, active_(users.size(), false)
+	, pending_(users.size())
+	, listing_(users.size())
+	{}
+
+	// checks users by filter, or only by indexes if filters are disabled
+	void start(bool filters) {
+		if (users_.empty()) {
+			callback_(std::vector<bool>());
+			return;
+		}
+
+		if (!filters) {
+			std::vector<size_t> users(users_.size());
+			for (size_t i = 0; i < users.size(); ++i) {
+				users[i] = i;
+			}
+			check_indexes(users);
+			return;
+		}
+
+		for (size_t i = 0; i < users_.size(); ++i) {
+			const auto positions = activity_filter_positions(users_[i], filter_size_);
+			states_[i].pending = positions.size();
+			states_[i].absent = false;
+
+			for (auto it = positions.begin(), end = positions.end(); it != end; ++it) {
+				uint64_t offset;
+				auto key = activity_filter_key(subkey_, *it, filter_size_, offset);
+				filters_s_.read_data(key, offset, 1)
+				.connect(std::bind(&activity_check::on_filter,
+				                   shared_from_this(),
+				                   i,
+				                   std::placeholders::_1,
+				                   std::placeholders::_2));
+			}
+		}
+	}
+
+private:
+	struct user_state
+	{
+		std::atomic<size_t>	pending; // number of unread filter positions
+		std::atomic<bool>	absent; // any of the filter positions isn't set
+	};
+
+	void on_filter(size_t index,
+	               const ioremap::elliptics::sync_read_result& result,
+	               const ioremap::elliptics::error_info& /*error*/) {
+		bool set = true; // missing filter, position beyond its end and errors mean "maybe"
+
+		for (auto it = result.begin(), end = result.end(); it != end; ++it) {
+			if (it->status() == 0) {
+				auto file = it->file();
+				if (!file.empty())
+					set = file.data<char>()[0] != 0;
+				break;
+			}
+		}
+
+		auto& state = states_[index];
+		if (!set)
+			state.absent = true;
+
+		if (state.pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+
+		if (state.absent) {
+			complete(index, false);
+			listed(index, true);
+		}
+		else
+			confirm(index);
+	}
+
+	void confirm(size_t index) {
+		const auto& user = users_[index];
+
+		dnet_raw_id id;
+		s_.transform(activity_index(subkey_, activity_chunk(user, chunks_), chunks_), id);
+
+		s_.list_indexes(user)
+		.connect(std::bind(&activity_check::on_indexes,
+		                   shared_from_this(),
+		                   index,
+		                   std::string(reinterpret_cast<const char*>(id.id), DNET_ID_SIZE),
+		                   std::placeholders::_1,
+		                   std::placeholders::_2));
+	}
+
+	void on_indexes(size_t index,
+	                const std::string& id,
+	                const ioremap::elliptics::sync_list_indexes_result& result,
+	                const ioremap::elliptics::error_info &/*error*/) {
+		for (auto it = result.begin(), end = result.end(); it != end; ++it) {
+			if (id.compare(0, DNET_ID_SIZE, reinterpret_cast<const char*>(it->index.id), DNET_ID_SIZE) == 0) {
+				complete(index, true);
+				listed(index, true);
+				return;
+			}
+		}
+
+		listed(index, false);
+	}
+
+	// the user has been checked by filter and list of indexes, users whose activity isn't known are checked by the index of the day
+	void listed(size_t index, bool known) {
+		std::vector<size_t> unconfirmed;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			if (!known)
+				unconfirmed_.push_back(index);
+
+			if (--listing_ != 0)
+				return;
+
+			unconfirmed.swap(unconfirmed_);
+		}
+
+		if (!unconfirmed.empty())
+			check_indexes(unconfirmed);
+	}
+
+	void check_indexes(const std::vector<size_t>& users) {
+		std::map<std::string, std::vector<size_t>> chunks; // activity index -> checked users in it
+		for (auto it = users.begin(), end = users.end(); it != end; ++it) {
+			chunks[activity_index(subkey_, activity_chunk(users_[*it], chunks_), chunks_)].push_back(*it);
+		}
+
+		for (auto it = chunks.begin(), end = chunks.end(); it != end; ++it) {
+			s_.find_all_indexes(std::vector<std::string>(1, it->first))
+			.connect(std::bind(&activity_check::on_chunk,
+			                   shared_from_this(),
+			                   it->second,
+			                   std::placeholders::_1,
+			                   std::placeholders::_2));
+		}
+	}
+
+	void on_chunk(const std::vector<size_t>& checked,
+	              const ioremap::elliptics::sync_find_indexes_result& result,
+	              const ioremap::elliptics::error_info &/*error*/) {
+		std::unordered_map<std::string, size_t> users; // checked user -> its index
+		for (auto it = checked.begin(), end = checked.end(); it != end; ++it) {
+			users.emplace(users_[*it], *it);
+		}
+
+		for (auto it = result.begin(), end = result.end(); it != end && !users.empty(); ++it) {
+			if (it->indexes.empty())
+				continue;
+
+			auto user = users.find(it->indexes.front().data.to_string());
+			if (user != users.end()) {
+				complete(user->second, true);
+				users.erase(user);
+			}
+		}
+
+		for (auto it = users.begin(), end = users.end(); it != end; ++it) {
+			complete(it->second, false);
+		}
+	}
+
+	void complete(size_t index, bool active) {
+		active_[index] = active;
+
+		if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			callback_(std::vector<bool>(active_.begin(), active_.end()));
+	}
+
+	ioremap::elliptics::session		s_;
+	ioremap::elliptics::session		filters_s_; // session of filters namespace
+	const std::vector<std::string>	users_;
+	const std::string				subkey_;
+	const uint32_t					chunks_; // number of chunks of activity statistics
+	const uint64_t					filter_size_; // number of positions in filter of the day
+	callback_t						callback_;
+	std::unique_ptr<user_state[]>	states_;
+	std::vector<char>				active_; // result of each user, each user writes only its own element
+	std::atomic<size_t>				pending_; // number of unchecked users
+	size_t							listing_; // number of users which haven't been checked by filter and list yet
+	std::vector<size_t>				unconfirmed_; // users which haven't been found in their lists
+	std::mutex						mutex_; // protects listing_ and unconfirmed_
+};
+
+class provider::impl : public std::enable_shared_from_this<provider::impl>
+{
+public:
+	impl(const std::vector<server_info>& servers,
+	     const std::vector<int>& groups,
+	     uint32_t min_writes,
+	     const std::string& log_file,
+	     const int log_level);
+	impl(const std::vector<std::string>& servers,
+	     const std::vector<int>& groups,
+	     uint32_t min_writes,
+	     const std::string& log_file,
+	     const int log_level);
+
+	void set_session_parameters(const std::vector<int>& groups, uint32_t min_writes);
+
+	void set_early_ack(bool early_ack);
+
+	void set_activity_chunks(uint32_t chunks);
+	uint32_t get_activity_chunks() const;
+
+	void set_activity_counters(bool enable);
+
+	void set_log_days(bool enable);
+
+	void set_missing_logs_ttl(uint32_t ttl);
+
+	void set_activity_filters(bool enable);
+	void set_activity_filter_users(uint32_t users);
+
+	void set_merge_threads(uint32_t threads);
+	void set_fanout_limits(uint32_t request_limit, uint32_t global_limit);
+	void set_max_range(uint32_t max_range);
+	void check_range(const std::vector<std::string>& subkeys) const;
+	void check_range(size_t subkeys) const;
+
+	provider_stats get_stats() const;
+
+	void add_log(const std::string& user,
+	             const std::string& subkey,
+	             const std::vector<char>& data);
+	void add_log(const std::string& user,
+	             const std::string& subkey,
+	             const std::vector<char>& data,
+	             std::function<void(bool added)> callback);
+
+	void write_log(const std::string& user,
+	               const std::string& subkey,
+	               const std::vector<char>& data);
+	void write_log(const std::string& user,
+	               const std::string& subkey,
+	               const std::vector<char>& data,
+	               std::function<void(bool written)> callback);
+
+	void add_activity(const std::string& user, const std::string& subkey);
+	void add_activity(const std::string& user,
+	                  const std::string& subkey,
+	                  std::function<void(bool added)> callback);
+
+	void add_log_with_activity(const std::string& user,
+	                           const std::string& subkey,
+	                           const std::vector<char>& data);
+	void add_log_with_activity(const std::string& user,
+	                           const std::string& subkey,
+	                           const std::vector<char>& data,
+	                           std::function<void(bool added)> callback);
+
+	std::vector<bool> add_logs(const std::vector<log_record>& records,
+	                           const std::vector<std::string>& subkeys);
+	void add_logs(const std::vector<log_record>& records,
+	              const std::vector<std::string>& subkeys,
+	              std::function<void(const std::vector<bool>& added)> callback);
+
+	std::vector<char> get_user_logs(const std::string& user,
+	                                const std::vector<std::string>& subkeys);
+	void get_user_logs(const std::string& user,
+	                   const std::vector<std::string>& subkeys,
+	                   std::function<void(const std::vector<char>& data)> callback);
+	void get_user_logs_checked(const std::string& user,
+	                           const std::vector<std::string>& subkeys,
+	                           std::function<void(const std::vector<char>& data, bool complete)> callback);
+	void select_user_logs(const std::string& user,
+	                      const std::vector<std::string>& subkeys,
+	                      std::function<void(const std::vector<std::string>& subkeys)> callback);
+	void read_user_logs(const std::string& user,
+	                    const std::vector<std::string>& subkeys,
+	                    std::function<void(const std::vector<char>& data, bool complete)> callback);
+
+	void get_users_logs(const std::vector<std::string>& users,
+	                    const std::vector<std::string>& subkeys,
+	                    std::function<void(const std::string& user, const std::vector<char>& data, bool complete)> callback);
+	void get_users_logs(const std::vector<std::string>& users,
+	                    const std::vector<std::string>& subkeys,
+	                    std::function<void(const std::string& user, const std::vector<char>& data, bool complete)> callback,
+	                    std::function<void()> complete_callback);
+
+	std::set<std::string> get_active_users(const std::vector<std::string>& subkeys);
+	void get_active_users(const std::vector<std::string>& subkeys,
+	                      std::function<void(const std::set<std::string> &active_users)> callback);
+	void get_active_users_checked(const std::vector<std::string>& subkeys,
+	                              std::function<void(const std::set<std::string>& active_users, bool complete)> callback);
+	void get_active_users_chunk(const std::vector<std::string>& subkeys,
+	                            uint32_t chunk,
+	                            std::function<void(const std::set<std::string>& active_users, bool complete)> callback);
+
+	std::vector<std::string> get_active_users_unsorted(const std::vector<std::string>& subkeys);
+	void get_active_users_unsorted(const std::vector<std::string>& subkeys,
+	                               std::function<void(const std::vector<std::string>& active_users)> callback);
+
+	active_users_list get_active_users_list(const std::vector<std::string>& subkeys);
+	void get_active_users_list(const std::vector<std::string>& subkeys,
+	                           std::function<void(const std::shared_ptr<const active_users_list>& active_users)> callback);
+
+	active_users_page get_active_users(const std::vector<std::string>& subkeys,
+	                                   const std::string& cursor,
+	                                   uint32_t limit);
+	void get_active_users(const std::vector<std::string>& subkeys,
+	                      const std::string& cursor,
+	                      uint32_t limit,
+	                      std::function<void(const active_users_page& page)> callback);
+	void get_active_users_checked(const std::vector<std::string>& subkeys,
+	                              const std::string& cursor,
+	                              uint32_t limit,
+	                              std::function<void(const active_users_page& page, bool complete)> callback);
+
+	std::set<std::string> get_active_users_intersection(const std::vector<std::string>& subkeys);
+	void get_active_users_intersection(const std::vector<std::string>& subkeys,
+	                                   std::function<void(const std::set<std::string>& active_users)> callback);
+
+	std::set<std::string> get_active_users_at_least(const std::vector<std::string>& subkeys, uint32_t days);
+	void get_active_users_at_least(const std::vector<std::string>& subkeys,
+	                               uint32_t days,
+	                               std::function<void(const std::set<std::string>& active_users)> callback);
+
+	std::set<std::string> get_active_users_difference(const std::vector<std::string>& subkeys,
+	                                                  const std::vector<std::string>& excluded);
+	void get_active_users_difference(const std::vector<std::string>& subkeys,
+	                                 const std::vector<std::string>& excluded,
+	                                 std::function<void(const std::set<std::string>& active_users)> callback);
+
+	retention_matrix get_retention(uint64_t first_day,
+	                               uint64_t last_day,
+	                               const std::vector<uint32_t>& offsets,
+	                               uint32_t threads);
+
+	std::vector<bool> is_active(const std::vector<std::string>& users, const std::string& subkey);
+	void is_active(const std::vector<std::string>& users,
+	               const std::string& subkey,
+	               std::function<void(const std::vector<bool>& active)> callback);
+
+	std::map<std::string, uint64_t> get_activity_counts(const std::vector<std::string>& subkeys);
+	void get_activity_counts(const std::vector<std::string>& subkeys,
+	                         std::function<void(const std::map<std::string, uint64_t>& counts)> callback);
+
+	void for_user_logs(const std::string& user,
+	                   const std::vector<std::string>& subkeys,
+	                   std::function<bool(const std::vector<char>& data)> callback);
+
+	void for_active_users(const std::vector<std::string>& subkeys,
+	                      std::function<bool(const std::set<std::string>& active_users)> callback);
+	void for_active_users(const std::vector<std::string>& subkeys,
+	                      std::function<bool(const std::set<std::string>& active_users)> callback,
+	                      std::function<void()> complete_callback);
+
+private:
+	ioremap::elliptics::session create_session(uint32_t io_flags = 0) const;
+	ioremap::elliptics::session create_counters_session(uint32_t io_flags = 0) const;
+	ioremap::elliptics::session create_days_session(uint32_t io_flags = 0) const;
+	ioremap::elliptics::session create_filters_session(uint32_t io_flags = 0) const;
+
+	template<typename Result, typename Handler>
+	void connect_write(Result result,
+	                   std::shared_ptr<aggregator> agg,
+	                   size_t index,
+	                   Handler on_completed);
+
+	ioremap::elliptics::async_write_result
+	add_log(ioremap::elliptics::session& s,
+	        const std::string& user,
+	        const std::string& subkey,
+	        const std::vector<char> data);
+	ioremap::elliptics::async_set_indexes_result
+	add_activity(ioremap::elliptics::session& s,
+	             const std::string& user,
+	             const std::string& subkey);
+	ioremap::elliptics::async_write_result
+	count_activity(ioremap::elliptics::session& s,
+	               const std::string& user,
+	               const std::string& subkey);
+	// logs failed increment of activity counter, it isn't retried because append of the counter isn't idempotent
+	void on_counter_written(const ioremap::elliptics::sync_write_result& result,
+	                        const ioremap::elliptics::error_info& error);
+	std::function<void(bool added)> remember_filtered(const std::string& user,
+	                                                  const std::string& subkey,
+	                                                  std::function<void(bool added)> callback);
+	void remember_filtered(const std::string& user, const std::string& subkey);
+	// sends increment of activity counter, which is only logged on failure, and returns writes of activity filter
+	std::vector<ioremap::elliptics::async_write_result>
+	activity_side_writes(const std::string& user, const std::string& subkey);
+	ioremap::elliptics::async_write_result
+	mark_day(ioremap::elliptics::session& s,
+	         const std::string& user,
+	         const std::string& subkey);
+	ioremap::elliptics::async_find_indexes_result
+	get_active_users(ioremap::elliptics::session& s,
+	                 const std::vector<std::string>& subkeys);
+
+	bool marks_day(const std::string& subkey) const;
+	std::vector<std::string> logs_subkeys(const std::string& user, const std::vector<std::string>& subkeys);
+
+	void filter_active_users(const std::vector<std::string>& subkeys,
+	                         const std::vector<std::string>& excluded,
+	                         size_t min_days,
+	                         std::function<void(const std::set<std::string>& active_users)> callback);
+	static void on_filtered(std::shared_ptr<activity_filter> filter,
+	                        std::function<void(const std::set<std::string>& active_users)> callback,
+	                        const ioremap::elliptics::sync_find_indexes_result &result,
+	                        const ioremap::elliptics::error_info &error);
+
+	static void on_add_logs(std::function<void(const std::vector<bool>& added)> callback,
+	                        const aggregator& agg);
+	static void on_user_logs(std::function<void(const std::vector<char>& data, bool complete)> callback,
+	                         const aggregator& agg);
+	typedef std::pair<ioremap::elliptics::sync_read_result, int> read_reply_t; // result of read and its error code
+	// reads keys through the scheduler, futures are in order of keys
+	std::vector<std::future<read_reply_t>> schedule_reads(const std::vector<std::string>& keys,
+	                                                      std::shared_ptr<fanout_scheduler::request>& request);
+
+	static void on_active_users(std::function<void(const std::set<std::string> &active_users, bool complete)> callback,
+	                            uint32_t threads,
+	                            const ioremap::elliptics::sync_find_indexes_result &result,
+	                            const ioremap::elliptics::error_info &error);
+
+	std::string combine_key(const std::string& user, const std::string& subkey) const;
+
+
+	std::vector<int>					groups_; // groups of elliptics
+	uint32_t							min_writes_; // minimum number of succeeded writes for each write attempt
+	bool								early_ack_; // acknowledge async writes as soon as min_writes groups have confirmed them
+	uint32_t							activity_chunks_; // number of chunks of each activity statistics index
+	bool								activity_counters_; // count activities of each user in each day
+	bool								log_days_; // mark days with user logs and read only marked days
+	bool								activity_filters_; // set positions of active users in filters of days
+	uint64_t							activity_filter_size_; // number of positions in filter of one day
+	uint32_t							merge_threads_; // threads which merge found active users, 0 - number of cores
+	uint32_t							max_range_; // maximum number of subkeys of range operation, 0 - unlimited
+	std::shared_ptr<fanout_scheduler>	scheduler_; // limits reads of range operations in flight
+	std::shared_ptr<recent_keys>		missing_; // user logs which haven't been found recently
+	std::shared_ptr<recent_keys>		filtered_; // activities whose positions in filters have been set recently
+	std::shared_ptr<counters>			counters_; // counters of the provider operations
+	dnet_config							config_; //elliptics config
+	ioremap::elliptics::file_logger		log_; // logger
+	ioremap::elliptics::node			node_; // elliptics node
+};
+
+dnet_config create_config()
+{
+	dnet_config config;
+	memset(&config, 0, sizeof(config));
+
+	config.io_thread_num = 100;
+	config.nonblocking_io_thread_num = 100;
+	config.net_thread_num = 16;
+	config.check_timeout = consts::TIMEOUT;
+	config.wait_timeout = consts::TIMEOUT;
+
+	return config;
+}
+
+provider::impl::impl(const std::vector<server_info>& servers,
+                     const std::vector<int>& groups,
+                     uint32_t min_writes,
+                     const std::string& log_file,
+                     const int log_level)
+: groups_(groups)
+, min_writes_(min_writes)
+, early_ack_(false)
+, activity_chunks_(1)
+, activity_counters_(false)
+, log_days_(false)
+, activity_filters_(false)
+, activity_filter_size_(consts::DEFAULT_ACTIVITY_FILTER_SIZE)
+, merge_threads_(0)
+, max_range_(0)
+, scheduler_(std::make_shared<fanout_scheduler>())
+, missing_(std::make_shared<recent_keys>(consts::MISSING_LOGS_CACHE_SIZE))
+, filtered_(std::make_shared<recent_keys>(consts::FILTERED_ACTIVITIES_CACHE_SIZE))
+, counters_(std::make_shared<counters>())
+, config_(create_config())
+, log_(log_file.c_str(), log_level)
+, node_(log_, config_)
+{
+	for (auto it = servers.begin(), end = servers.end(); it != end; ++it) {
+		try {
+			node_.add_remote(it->addr.c_str(), it->port, it->family);	// Adds connection parameters to the node.
+			LOG(DNET_LOG_INFO, "Added elliptics server: %s:%d:%d\n", it->addr.c_str(), it->port, it->family);
+		}
+		catch (ioremap::elliptics::error& e) {
+			LOG(DNET_LOG_ERROR, "Coudn't connect to %s:%d:%d: %s\n", it->addr.c_str(), it->port, it->family, e.error_message().c_str());
+		}
+	}
+
+	if (min_writes_ > groups_.size())
+		min_writes_ = groups_.size();
+
+	LOG(DNET_LOG_INFO, "provider::impl has been created\n");
+}
+
+provider::impl::impl(const std::vector<std::string>& servers,
+                     const std::vector<int>& groups,
+                     uint32_t min_writes,
+                     const std::string& log_file,
+                     const int log_level)
+: groups_(groups)
+, min_writes_(min_writes)
+, early_ack_(false)
+, activity_chunks_(1)
+, activity_counters_(false)
+, log_days_(false)
+, activity_filters_(false)
+, activity_filter_size_(consts::DEFAULT_ACTIVITY_FILTER_SIZE)
+, merge_threads_(0)
+, max_range_(0)
+, scheduler_(std::make_shared<fanout_scheduler>())
+, missing_(std::make_shared<recent_keys>(consts::MISSING_LOGS_CACHE_SIZE))
+, filtered_(std::make_shared<recent_keys>(consts::FILTERED_ACTIVITIES_CACHE_SIZE))
+, counters_(std::make_shared<counters>())
+, config_(create_config())
+, log_(log_file.c_str(), log_level)
+, node_(log_, config_)
+{
+	for (auto it = servers.begin(), end = servers.end(); it != end; ++it) {
+		try {
+			node_.add_remote(it->c_str());	// Adds connection parameters to the node.
+			LOG(DNET_LOG_INFO, "Added elliptics server: %s\n", it->c_str());
+		}
+		catch (ioremap::elliptics::error& e) {
+			LOG(DNET_LOG_ERROR, "Coudn't connect to %s: %s\n", it->c_str(), e.error_message().c_str());
+		}
+	}
+
+	if (min_writes_ > groups_.size())
+		min_writes_ = groups_.size();
+
+	LOG(DNET_LOG_INFO, "provider::impl has been created\n");
+}
+
+void provider::impl::set_session_parameters(const std::vector<int>& groups, uint32_t min_writes)
+{
+	groups_ = groups;
+	min_writes_ = min_writes;
+
+	if (min_writes_ > groups_.size())
+		min_writes_ = groups_.size();
+}
+
+void provider::impl::set_early_ack(bool early_ack)
+{
+	early_ack_ = early_ack;
+}
+
+void provider::impl::set_activity_chunks(uint32_t chunks)
+{
+	activity_chunks_ = chunks > 0 ? chunks : 1;
+}
+
+uint32_t provider::impl::get_activity_chunks() const
+{
+	return activity_chunks_;
+}
+
+void provider::impl::set_activity_counters(bool enable)
+{
+	activity_counters_ = enable;
+}
+
+void provider::impl::set_log_days(bool enable)
+{
+	log_days_ = enable;
+}
+
+void provider::impl::set_missing_logs_ttl(uint32_t ttl)
+{
+	missing_->set_ttl(ttl);
+}
+
+void provider::impl::set_activity_filters(bool enable)
+{
+	activity_filters_ = enable;
+	filtered_->set_ttl(enable ? consts::SECONDS_IN_DAY : 0);
+}
+
+void provider::impl::set_activity_filter_users(uint32_t users)
+{
+	if (users == 0) {
+		activity_filter_size_ = consts::DEFAULT_ACTIVITY_FILTER_SIZE;
+		return;
+	}
+
+	const uint64_t size = users * consts::ACTIVITY_FILTER_POSITIONS_PER_USER;
+	activity_filter_size_ = (size + consts::ACTIVITY_FILTER_SHARDS - 1) / consts::ACTIVITY_FILTER_SHARDS * consts::ACTIVITY_FILTER_SHARDS;
+}
+
+void provider::impl::set_merge_threads(uint32_t threads)
+{
+	merge_threads_ = threads;
+}
+
+void provider::impl::set_fanout_limits(uint32_t request_limit, uint32_t global_limit)
+{
+	scheduler_->set_limits(request_limit, global_limit);
+}
+
+void provider::impl::set_max_range(uint32_t max_range)
+{
+	max_range_ = max_range;
+}
+
+void provider::impl::check_range(const std::vector<std::string>& subkeys) const
+{
+	check_range(subkeys.size());
+}
+
+void provider::impl::check_range(size_t subkeys) const
+{
+	if (max_range_ != 0 && subkeys > max_range_)
+		throw std::invalid_argument("Too many subkeys: " + boost::lexical_cast<std::string>(subkeys) +
+		                            ", maximum is " + boost::lexical_cast<std::string>(max_range_));
+}
+
+provider_stats provider::impl::get_stats() const
+{
+	provider_stats ret;
+	ret.early_acks = counters_->early_acks;
+	ret.late_replica_failures = counters_->late_replica_failures;
+	ret.read_errors = counters_->read_errors;
+	ret.write_errors = counters_->write_errors;
+	ret.missing_logs_hits = missing_->hits();
+	ret.filtered_activities_hits = filtered_->hits();
+	ret.fanout_queued = scheduler_->queued();
+	ret.fanout_in_flight = scheduler_->in_flight();
+	return ret;
+}
+
+void provider::impl::add_log(const std::string& user,
+                             const std::string& subkey,
+                             const std::vector<char>& data)
+{
+	auto s = create_session(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
+
+	auto res = add_log(s, user, subkey, data);
+
+	if (marks_day(subkey)) {
+		auto days_s = create_days_session(DNET_IO_FLAGS_CACHE);
+		auto day_res = mark_day(days_s, user, subkey);
+		if (day_res.get().size() < min_writes_) {
+			LOG(DNET_LOG_ERROR, "Can't write data while marking day of user log: %s\n", day_res.error().message().c_str());
+			throw ioremap::elliptics::error(EREMOTEIO, "Data wasn't written to the minimum number of groups");
+		}
+	}
+
+	if (res.get().size() < min_writes_) {
+		LOG(DNET_LOG_ERROR, "Can't write data to the minimum number of groups while appending data to user log error: %s\n", res.error().message().c_str());
+		throw ioremap::elliptics::error(EREMOTEIO, "Data wasn't written to the minimum number of groups");
+	}
+}
+
+void provider::impl::add_log(const std::string& user,
+                             const std::string& subkey,
+                             const std::vector<char>& data,
+                             std::function<void(bool added)> callback)
+{
+	auto s = create_session(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
+
+	auto agg = aggregator::create(marks_day(subkey) ? 2 : 1, callback, node_, min_writes_);
+
+	connect_write(add_log(s, user, subkey, data), agg, 0, &aggregator::on_write);
+
+	if (marks_day(subkey)) {
+		auto days_s = create_days_session(DNET_IO_FLAGS_CACHE);
+		connect_write(mark_day(days_s, user, subkey), agg, 1, &aggregator::on_write);
+	}
+}
+
+void provider::impl::write_log(const std::string& user,
+                               const std::string& subkey,
+                               const std::vector<char>& data)
+{
+	auto s = create_session(DNET_IO_FLAGS_CACHE); // without append flag the log will be overwritten
+
+	auto res = add_log(s, user, subkey, data);
+
+	if (marks_day(subkey)) {
+		auto days_s = create_days_session(DNET_IO_FLAGS_CACHE);
+		auto day_res = mark_day(days_s, user, subkey);
+		if (day_res.get().size() < min_writes_) {
+			LOG(DNET_LOG_ERROR, "Can't write data while marking day of user log: %s\n", day_res.error().message().c_str());
+			throw ioremap::elliptics::error(EREMOTEIO, "Data wasn't written to the minimum number of groups");
+		}
+	}
+
+	if (res.get().size() < min_writes_) {
+		LOG(DNET_LOG_ERROR, "Can't write data to the minimum number of groups while rewriting user log error: %s\n", res.error().message().c_str());
+		throw ioremap::elliptics::error(EREMOTEIO, "Data wasn't written to the minimum number of groups");
+	}
+}
+
+void provider::impl::write_log(const std::string& user,
+                               const std::string& subkey,
+                               const std::vector<char>& data,
+                               std::function<void(bool written)> callback)
+{
+	auto s = create_session(DNET_IO_FLAGS_CACHE); // without append flag the log will be overwritten
+
+	auto agg = aggregator::create(marks_day(subkey) ? 2 : 1, callback, node_, min_writes_);
+
+	connect_write(add_log(s, user, subkey, data), agg, 0, &aggregator::on_write);
+
+	if (marks_day(subkey)) {
+		auto days_s = create_days_session(DNET_IO_FLAGS_CACHE);
+		connect_write(mark_day(days_s, user, subkey), agg, 1, &aggregator::on_write);
+	}
+}
+
+void provider::impl::add_activity(const std::string& user, const std::string& subkey)
+{
+	auto s = create_session(DNET_IO_FLAGS_CACHE);
+
+	auto res = add_activity(s, user, subkey);
+	auto side_res = activity_side_writes(user, subkey);
+
+	bool result = true;
+
+	for (auto it = side_res.begin(), end = side_res.end(); it != end; ++it) {
+		if (it->get().size() < min_writes_) {
+			LOG(DNET_LOG_ERROR, "Can't write data while updating activity filter: %s\n", it->error().message().c_str());
+			result = false;
+		}
+	}
+
+	if (res.get().size() < min_writes_) {
+		LOG(DNET_LOG_ERROR, "Can't write data while adding activity error: %s\n", res.error().message().c_str());
+		result = false;
+	}
+
+	if (!result)
+		throw ioremap::elliptics::error(EREMOTEIO, "Data wasn't written to the minimum number of groups");
+
+	remember_filtered(user, subkey);
+}
+
+void provider::impl::add_activity(const std::string& user,
+                                  const std::string& subkey,
+                                  std::function<void(bool added)> callback)
+{
+	auto s = create_session(DNET_IO_FLAGS_CACHE);
+
+	auto side_res = activity_side_writes(user, subkey);
+	auto agg = aggregator::create(1 + side_res.size(), remember_filtered(user, subkey, callback), node_, min_writes_);
+
+	connect_write(add_activity(s, user, subkey), agg, 0, &aggregator::on_indexes);
+
+	for (size_t i = 0; i < side_res.size(); ++i) {
+		connect_write(side_res[i], agg, 1 + i, &aggregator::on_write);
+	}
+}
+
+void provider::impl::on_counter_written(const ioremap::elliptics::sync_write_result& result,
+                                        const ioremap::elliptics::error_info& error)
+{
+	if (result.size() < min_writes_) {
+		LOG(DNET_LOG_ERROR, "Can't increment activity counter, activity is added without it: %s\n", error.message().c_str());
+	}
+}
+
+void provider::impl::add_log_with_activity(const std::string& user,
+                                           const std::string& subkey,
+                                           const std::vector<char>& data)
+{
+	auto log_s = create_session(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
+	auto act_s = create_session(DNET_IO_FLAGS_CACHE);
+
+	auto log_res = add_log(log_s, user, subkey, data);
+	auto act_res = add_activity(act_s, user, subkey);
+	auto side_res = activity_side_writes(user, subkey);
+
+	bool result = true;
+
+	if (marks_day(subkey)) {
+		auto days_s = create_days_session(DNET_IO_FLAGS_CACHE);
+		auto day_res = mark_day(days_s, user, subkey);
+		if (day_res.get().size() < min_writes_) {
+			LOG(DNET_LOG_ERROR, "Can't write data while marking day of user log: %s\n", day_res.error().message().c_str());
+			result = false;
+		}
+	}
+
+	for (auto it = side_res.begin(), end = side_res.end(); it != end; ++it) {
+		if (it->get().size() < min_writes_) {
+			LOG(DNET_LOG_ERROR, "Can't write data while updating activity filter: %s\n", it->error().message().c_str());
+			result = false;
+		}
+	}
+
+	if (log_res.get().size() < min_writes_) {
+		LOG(DNET_LOG_ERROR, "Can't write data while appending data to user log: %s\n", log_res.error().message().c_str());
+		result = false;
+	}
+
+	if (act_res.get().size() < min_writes_) {
+		LOG(DNET_LOG_ERROR, "Can't write data while adding activity: %s\n", act_res.error().message().c_str());
+		result = false;
+	}
+
+	if (!result)
+		throw ioremap::elliptics::error(EREMOTEIO, "Data wasn't written to the minimum number of groups");
+
+	remember_filtered(user, subkey);
+}
+
+void provider::impl::add_log_with_activity(const std::string& user,
+                                           const std::string& subkey,
+                                           const std::vector<char>& data,
+                                           std::function<void(bool added)> callback)
+{
+	const bool mark = marks_day(subkey);
+	auto side_res = activity_side_writes(user, subkey);
+	auto agg = aggregator::create(2 + side_res.size() + mark, remember_filtered(user, subkey, callback), node_, min_writes_);
+
+	auto log_s = create_session(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
+	auto act_s = create_session(DNET_IO_FLAGS_CACHE);
+
+	connect_write(add_log(log_s, user, subkey, data), agg, 0, &aggregator::on_write);
+	connect_write(add_activity(act_s, user, subkey), agg, 1, &aggregator::on_indexes);
+
+	for (size_t i = 0; i < side_res.size(); ++i) {
+		connect_write(side_res[i], agg, 2 + i, &aggregator::on_write);
+	}
+
+	if (mark) {
+		auto days_s = create_days_session(DNET_IO_FLAGS_CACHE);
+		connect_write(mark_day(days_s, user, subkey), agg, agg->size() - 1, &aggregator::on_write);
+	}
+}
+
+std::vector<bool> provider::impl::add_logs(const std::vector<log_record>& records,
+                                           const std::vector<std::string>& subkeys)
+{
+	auto log_s = create_session(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
+	auto act_s = create_session(DNET_IO_FLAGS_CACHE);
+
+	auto days_s = create_days_session(DNET_IO_FLAGS_CACHE);
+
+	std::vector<ioremap::elliptics::async_write_result> log_results;
+	std::list<std::pair<size_t, ioremap::elliptics::async_set_indexes_result>> act_results;
+	std::list<std::pair<size_t, ioremap::elliptics::async_write_result>> side_results;
+	std::list<std::pair<size_t, ioremap::elliptics::async_write_result>> day_results;
+	log_results.reserve(records.size());
+
+	for (size_t i = 0; i < records.size(); ++i) { // sends writes of all records before waiting any of them
+		const auto& record = records[i];
+		log_results.emplace_back(add_log(log_s, record.user, subkeys[i], record.data));
+		if (record.activity) {
+			act_results.emplace_back(i, add_activity(act_s, record.user, subkeys[i]));
+
+			auto side_res = activity_side_writes(record.user, subkeys[i]);
+			for (auto it = side_res.begin(), end = side_res.end(); it != end; ++it) {
+				side_results.emplace_back(i, *it);
+			}
+		}
+		if (marks_day(subkeys[i]))
+			day_results.emplace_back(i, mark_day(days_s, record.user, subkeys[i]));
+	}
+
+	std::vector<bool> ret(records.size(), true);
+
+	for (size_t i = 0; i < log_results.size(); ++i) {
+		if (log_results[i].get().size() < min_writes_) {
+			LOG(DNET_LOG_ERROR, "Can't write data while appending data to user log: %s\n", log_results[i].error().message().c_str());
+			ret[i] = false;
+		}
+	}
+
+	for (auto it = act_results.begin(), end = act_results.end(); it != end; ++it) {
+		if (it->second.get().size() < min_writes_) {
+			LOG(DNET_LOG_ERROR, "Can't write data while adding activity: %s\n", it->second.error().message().c_str());
+			ret[it->first] = false;
+		}
+	}
+
+	for (auto it = side_results.begin(), end = side_results.end(); it != end; ++it) {
+		if (it->second.get().size() < min_writes_) {
+			LOG(DNET_LOG_ERROR, "Can't write data while updating activity filter: %s\n", it->second.error().message().c_str());
+			ret[it->first] = false;
+		}
+	}
+
+	for (auto it = day_results.begin(), end = day_results.end(); it != end; ++it) {
+		if (it->second.get().size() < min_writes_) {
+			LOG(DNET_LOG_ERROR, "Can't write data while marking day of user log: %s\n", it->second.error().message().c_str());
+			ret[it->first] = false;
+		}
+	}
+
+	for (size_t i = 0; i < records.size(); ++i) {
+		if (records[i].activity && ret[i])
+			remember_filtered(records[i].user, subkeys[i]);
+	}
+
+	return ret;
+}
+
+void provider::impl::on_add_logs(std::function<void(const std::vector<bool>& added)> callback,
+                                 const aggregator& agg)
+{
+	std::vector<bool> added(agg.size());
+	for (size_t i = 0; i < agg.size(); ++i) {
+		added[i] = agg.result(i);
+	}
+
+	callback(added);
+}
+
+void provider::impl::add_logs(const std::vector<log_record>& records,
+                              const std::vector<std::string>& subkeys,
+                              std::function<void(const std::vector<bool>& added)> callback)
+{
+	if (records.empty()) {
+		callback(std::vector<bool>());
+		return;
+	}
+
+	auto agg = aggregator::create(records.size(),
+	                              aggregator::handler_t(std::bind(&provider::impl::on_add_logs,
+	                                                              callback,
+	                                                              std::placeholders::_1)),
+	                              node_,
+	                              min_writes_);
+
+	auto log_s = create_session(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
+	auto act_s = create_session(DNET_IO_FLAGS_CACHE);
+	auto days_s = create_days_session(DNET_IO_FLAGS_CACHE);
+
+	for (size_t i = 0; i < records.size(); ++i) {
+		const auto& record = records[i];
+		const bool mark = marks_day(subkeys[i]);
+
+		if (!record.activity && !mark) {
+			connect_write(add_log(log_s, record.user, subkeys[i], record.data), agg, i, &aggregator::on_write);
+			continue;
+		}
+
+		// the record is added when log, activity, its filter and mark of the day are written
+		std::vector<ioremap::elliptics::async_write_result> side_res;
+		if (record.activity)
+			side_res = activity_side_writes(record.user, subkeys[i]);
+
+		const size_t writes = record.activity ? 2 + side_res.size() : 1;
+		std::function<void(bool)> on_record(std::bind(&aggregator::on_result, agg, i, std::placeholders::_1));
+		auto record_agg = aggregator::create(writes + mark,
+		                                     record.activity ? remember_filtered(record.user, subkeys[i], on_record) : on_record,
+		                                     node_,
+		                                     min_writes_);
+
+		connect_write(add_log(log_s, record.user, subkeys[i], record.data), record_agg, 0, &aggregator::on_write);
+
+		if (record.activity) {
+			connect_write(add_activity(act_s, record.user, subkeys[i]), record_agg, 1, &aggregator::on_indexes);
+
+			for (size_t j = 0; j < side_res.size(); ++j) {
+				connect_write(side_res[j], record_agg, 2 + j, &aggregator::on_write);
+			}
+		}
+
+		if (mark)
+			connect_write(mark_day(days_s, record.user, subkeys[i]), record_agg, writes, &aggregator::on_write);
+	}
+}
+
+std::vector<std::string> provider::impl::logs_subkeys(const std::string& user, const std::vector<std::string>& subkeys)
+{
+	if (!log_days_)
+		return subkeys;
+
+	auto s = create_days_session(0);
+
+	log_days_filter filter(user, subkeys);
+	return filter.read(s);
+}
+
+std::vector<char> provider::impl::get_user_logs(const std::string& user, const std::vector<std::string>& subkeys)
+{
+	check_range(subkeys);
+
+	std::deque<char> data;
+
+	std::vector<std::string> read_subkeys, keys;
+
+	auto selected = logs_subkeys(user, subkeys);
+	for (auto it = selected.begin(), end = selected.end(); it != end; ++it) {
+		auto key = combine_key(user, *it);
+		if (!missing_->contains(key)) {
+			read_subkeys.emplace_back(*it);
+			keys.emplace_back(key);
+		}
+	}
+
+	std::shared_ptr<fanout_scheduler::request> request;
+	auto results = schedule_reads(keys, request);
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		const auto reply = results[i].get();
+		if (reply.second == -ENOENT) {
+			if (is_past_day(read_subkeys[i]))
+				missing_->insert(keys[i]);
+			continue;
+		}
+
+		if (reply.first.empty()) {
+			LOG(DNET_LOG_ERROR, "Can't read log file: %s: %d\n", keys[i].c_str(), reply.second);
+			continue;
+		}
+
+		auto file = reply.first.front().file(); // reads user log file
+		if (file.empty()) // if the file is empty
+			continue; // skip it and go to the next
+
+		data.insert(data.end(), file.data<char>(), file.data<char>() + file.size());
+	}
+
+	return std::vector<char>(data.begin(), data.end());
+}
+
+std::vector<std::future<provider::impl::read_reply_t>>
+provider::impl::schedule_reads(const std::vector<std::string>& keys,
+                               std::shared_ptr<fanout_scheduler::request>& request)
+{
+	auto s = create_session(0);
+	auto promises = std::make_shared<std::vector<std::promise<read_reply_t>>>(keys.size());
+
+	std::vector<std::future<read_reply_t>> ret;
+	ret.reserve(keys.size());
+
+	std::vector<fanout_scheduler::task_t> tasks;
+	tasks.reserve(keys.size());
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		ret.emplace_back((*promises)[i].get_future());
+
+		const auto& key = keys[i];
+		tasks.emplace_back([s, promises, i, key](fanout_scheduler::done_t done) mutable {
+			s.read_latest(key, 0, 0)
+			.connect([promises, i, done](const ioremap::elliptics::sync_read_result &res,
+			                             const ioremap::elliptics::error_info &error) {
+				(*promises)[i].set_value(read_reply_t(res, error.code()));
+				done();
+			});
+		});
+	}
+
+	request = scheduler_->run(std::move(tasks), fanout_scheduler::done_t([]() {}));
+	return ret;
+}
+
+void provider::impl::on_user_logs(std::function<void(const std::vector<char>& data, bool complete)> callback,
+                                  const aggregator& agg)
+{
+	size_t size = 0;
+	for (size_t i = 0; i < agg.size(); ++i) {
+		size += agg.data(i).size();
+	}
+
+	std::vector<char> data;
+	data.reserve(size);
+
+	for (size_t i = 0; i < agg.size(); ++i) { // concatenates logs in order of subkeys
+		const auto& file = agg.data(i);
+		if (!file.empty())
+			data.insert(data.end(), file.data<char>(), file.data<char>() + file.size());
+	}
+
+	callback(data, agg.result()); // slots of missing logs are succeeded, only failed reads make it incomplete
+}
+
+void provider::impl::get_user_logs(const std::string& user,
+                                   const std::vector<std::string>& subkeys,
+                                   std::function<void(const std::vector<char>& data)> callback)
+{
+	get_user_logs_checked(user, subkeys, [callback](const std::vector<char>& data, bool /*complete*/) {
+		callback(data);
+	});
+}
+
+void provider::impl::get_user_logs_checked(const std::string& user,
+                                           const std::vector<std::string>& subkeys,
+                                           std::function<void(const std::vector<char>& data, bool complete)> callback)
+{
+	check_range(subkeys);
+
+	if (!log_days_) {
+		read_user_logs(user, subkeys, callback);
+		return;
+	}
+
+	auto s = create_days_session(0);
+	auto self = shared_from_this();
+
+	auto filter = std::make_shared<log_days_filter>(user, subkeys);
+	filter->read(s, [self, user, callback](const std::vector<std::string>& selected) {
+		self->read_user_logs(user, selected, callback);
+	});
+}
+
+void provider::impl::select_user_logs(const std::string& user,
+                                      const std::vector<std::string>& subkeys,
+                                      std::function<void(const std::vector<std::string>& subkeys)> callback)
+{
+	check_range(subkeys);
+
+	auto self = shared_from_this();
+	auto skip_missing = [self, user, callback](const std::vector<std::string>& selected) {
+		std::vector<std::string> ret;
+		ret.reserve(selected.size());
+
+		for (auto it = selected.begin(), end = selected.end(); it != end; ++it) {
+			if (!self->missing_->contains(self->combine_key(user, *it)))
+				ret.push_back(*it);
+		}
+		callback(ret);
+	};
+
+	if (!log_days_) {
+		skip_missing(subkeys);
+		return;
+	}
+
+	auto s = create_days_session(0);
+
+	auto filter = std::make_shared<log_days_filter>(user, subkeys);
+	filter->read(s, skip_missing);
+}
+
+void provider::impl::read_user_logs(const std::string& user,
+                                    const std::vector<std::string>& subkeys,
+                                    std::function<void(const std::vector<char>& data, bool complete)> callback)
+{
+	std::vector<std::string> keys;
+	keys.reserve(subkeys.size());
+
+	std::vector<bool> past; // whether missing log of the subkey should be remembered
+	past.reserve(subkeys.size());
+
+	for (auto it = subkeys.begin(), end = subkeys.end(); it != end; ++it) {
+		auto key = combine_key(user, *it);
+		if (missing_->contains(key))
+			continue;
+
+		keys.emplace_back(key);
+		past.push_back(is_past_day(*it));
+	}
+
+	if (keys.empty()) {
+		callback(std::vector<char>(), true);
+		return;
+	}
+
+	auto agg = aggregator::create(keys.size(),
+	                              aggregator::handler_t(std::bind(&provider::impl::on_user_logs,
+	                                                              callback,
+	                                                              std::placeholders::_1)),
+	                              node_,
+	                              min_writes_);
+
+	auto s = create_session(0);
+	auto missing = missing_;
+
+	std::vector<fanout_scheduler::task_t> tasks;
+	tasks.reserve(keys.size());
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		const auto& cmb_key = keys[i];
+		const bool remember = past[i];
+		LOG(DNET_LOG_DEBUG, "Try to read user: %s log file: %s\n", user.c_str(), cmb_key.c_str());
+		tasks.emplace_back([s, agg, i, missing, cmb_key, remember](fanout_scheduler::done_t done) mutable {
+			s.read_latest(cmb_key, 0, 0)
+			.connect([agg, i, missing, cmb_key, remember, done](const ioremap::elliptics::sync_read_result &res,
+			                                                     const ioremap::elliptics::error_info &error) {
+				if (error.code() == -ENOENT) { // missing log isn't a failure
+					if (remember)
+						missing->insert(cmb_key);
+					agg->on_result(i, true);
+				}
+				else
+					agg->on_read(i, res, error);
+				done();
+			});
+		});
+	}
+
+	scheduler_->run(std::move(tasks), fanout_scheduler::done_t([]() {}));
+}
+
+void provider::impl::get_users_logs(const std::vector<std::string>& users,
+                                    const std::vector<std::string>& subkeys,
+                                    std::function<void(const std::string& user, const std::vector<char>& data, bool complete)> callback)
+{
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool completed = false;
+
+	get_users_logs(users, subkeys, callback, [&]() {
+		std::unique_lock<std::mutex> lock(mutex);
+		completed = true;
+		cond.notify_all();
+	});
+
+	std::unique_lock<std::mutex> lock(mutex);
+	cond.wait(lock, [&]() { return completed; });
+}
+
+void provider::impl::get_users_logs(const std::vector<std::string>& users,
+                                    const std::vector<std::string>& subkeys,
+                                    std::function<void(const std::string& user, const std::vector<char>& data, bool complete)> callback,
+                                    std::function<void()> complete_callback)
+{
+	check_range(subkeys);
+
+	LOG(DNET_LOG_DEBUG, "Try to read logs of %zu users for %zu subkeys\n", users.size(), subkeys.size());
+
+	auto reader = std::make_shared<users_logs_reader>(create_session(0),
+	                                                  create_days_session(0),
+	                                                  log_days_,
+	                                                  missing_,
+	                                                  users,
+	                                                  subkeys,
+	                                                  callback,
+	                                                  complete_callback,
+	                                                  consts::USERS_LOGS_BATCH);
+	reader->start(consts::USERS_LOGS_WINDOW);
+}
+
+ioremap::elliptics::async_find_indexes_result
+provider::impl::get_active_users(ioremap::elliptics::session& s,
+                                 const std::vector<std::string>& subkeys)
+{
+	check_range(subkeys);
+
+	return s.find_any_indexes(activity_indexes(subkeys, activity_chunks_));
+}
+
+std::set<std::string> provider::impl::get_active_users(const std::vector<std::string>& subkeys)
+{
+	auto s = create_session();
+
+	auto users = users_merge(get_active_users(s, subkeys).get(), merge_threads_).run(true);
+	LOG(DNET_LOG_DEBUG, "Found %zu active users\n", users.size());
+
+	// users are sorted, so the set is built in linear time
+	return std::set<std::string>(std::make_move_iterator(users.begin()), std::make_move_iterator(users.end()));
+}
+
+void provider::impl::on_active_users(std::function<void(const std::set<std::string> &active_users, bool complete)> callback,
+                                     uint32_t threads,
+                                     const ioremap::elliptics::sync_find_indexes_result &result,
+                                     const ioremap::elliptics::error_info &error)
+{
+	auto users = users_merge(result, threads).run(true);
+	const bool complete = !error || error.code() == -ENOENT; // missing index means the day without activity
+
+	callback(std::set<std::string>(std::make_move_iterator(users.begin()), std::make_move_iterator(users.end())),
+	         complete);
+}
+
+void provider::impl::get_active_users(const std::vector<std::string>& subkeys,
+                                      std::function<void(const std::set<std::string> &active_users)> callback)
+{
+	get_active_users_checked(subkeys, [callback](const std::set<std::string>& active_users, bool /*complete*/) {
+		callback(active_users);
+	});
+}
+
+void provider::impl::get_active_users_checked(const std::vector<std::string>& subkeys,
+                                              std::function<void(const std::set<std::string>& active_users, bool complete)> callback)
+{
+	auto s = create_session();
+
+	get_active_users(s, subkeys)
+	.connect(boost::bind(&provider::impl::on_active_users,
+	                     callback,
+	                     merge_threads_,
+	                     _1,
+	                     _2));
+}
+
+void provider::impl::get_active_users_chunk(const std::vector<std::string>& subkeys,
+                                            uint32_t chunk,
+                                            std::function<void(const std::set<std::string>& active_users, bool complete)> callback)
+{
+	check_range(subkeys);
+
+	if (subkeys.empty() || chunk >= activity_chunks_) {
+		callback(std::set<std::string>(), true);
+		return;
+	}
+
+	std::vector<std::string> indexes;
+	indexes.reserve(subkeys.size());
+	for (auto it = subkeys.begin(), end = subkeys.end(); it != end; ++it) {
+		indexes.emplace_back(activity_index(*it, chunk, activity_chunks_));
+	}
+
+	auto s = create_session();
+
+	s.find_any_indexes(indexes)
+	.connect(boost::bind(&provider::impl::on_active_users,
+	                     callback,
+	                     merge_threads_,
+	                     _1,
+	                     _2));
+}
+
+std::vector<std::string> provider::impl::get_active_users_unsorted(const std::vector<std::string>& subkeys)
+{
+	auto s = create_session();
+
+	auto ret = users_merge(get_active_users(s, subkeys).get(), merge_threads_).run(false);
+	LOG(DNET_LOG_DEBUG, "Found %zu active users\n", ret.size());
+
+	return ret;
+}
+
+void provider::impl::get_active_users_unsorted(const std::vector<std::string>& subkeys,
+                                               std::function<void(const std::vector<std::string>& active_users)> callback)
+{
+	auto s = create_session();
+	const auto threads = merge_threads_;
+
+	get_active_users(s, subkeys)
+	.connect([callback, threads](const ioremap::elliptics::sync_find_indexes_result &result,
+	                             const ioremap::elliptics::error_info &/*error*/) {
+		callback(users_merge(result, threads).run(false));
+	});
+}
+
+active_users_page provider::impl::get_active_users(const std::vector<std::string>& subkeys,
+                                                   const std::string& cursor,
+                                                   uint32_t limit)
+{
+	check_range(subkeys);
+
+	active_users_pager pager(subkeys, cursor, limit, activity_chunks_);
+
+	auto s = create_session();
+
+	while (!pager.done()) {
+		std::set<std::string> users;
+		auto async_result = s.find_any_indexes(pager.indexes());
+		collect_users(async_result, users);
+
+		const auto error = async_result.error();
+		if (error && error.code() != -ENOENT)
+			throw ioremap::elliptics::error(EIO, "Can't read chunk of active users: " + error.message());
 
-	LOG(DNET_LOG_INFO, "provider::impl has been created\n");
+		pager.on_chunk(users);
+	}
+
+	return pager.page();
 }
 
-void provider::impl::set_session_parameters(const std::vector<int>& groups, uint32_t min_writes)
+active_users_list provider::impl::get_active_users_list(const std::vector<std::string>& subkeys)
 {
-	groups_ = groups;
-	min_writes_ = min_writes;
+	active_users_list ret;
 
-	if (min_writes_ > groups_.size())
-		min_writes_ = groups_.size();
+	auto s = create_session();
+
+	auto async_result = get_active_users(s, subkeys);
+
+	collect_users(async_result, ret);
+	LOG(DNET_LOG_DEBUG, "Found %zu active users\n", ret.size());
+
+	return ret;
 }
 
-void provider::impl::add_log(const std::string& user,
-                             const std::string& subkey,
-                             const std::vector<char>& data)
+void provider::impl::get_active_users_list(const std::vector<std::string>& subkeys,
+                                           std::function<void(const std::shared_ptr<const active_users_list>& active_users)> callback)
 {
-	auto s = create_session(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
+	auto s = create_session();
 
-	auto res = add_log(s, user, subkey, data);
+	get_active_users(s, subkeys)
+	.connect([callback](const ioremap::elliptics::sync_find_indexes_result &result,
+	                    const ioremap::elliptics::error_info &/*error*/) {
+		auto active_users = std::make_shared<active_users_list>();
+		collect_users(result, *active_users);
+		callback(active_users);
+	});
+}
 
-	if (res.get().size() < min_writes_) {
-		LOG(DNET_LOG_ERROR, "Can't write data to the minimum number of groups while appending data to user log error: %s\n", res.error().message().c_str());
-		throw ioremap::elliptics::error(EREMOTEIO, "Data wasn't written to the minimum number of groups");
-	}
+void provider::impl::get_active_users(const std::vector<std::string>& subkeys,
+                                      const std::string& cursor,
+                                      uint32_t limit,
+                                      std::function<void(const active_users_page& page)> callback)
+{
+	get_active_users_checked(subkeys, cursor, limit, [callback](const active_users_page& page, bool /*complete*/) {
+		callback(page);
+	});
 }
 
-void provider::impl::add_log(const std::string& user,
-                             const std::string& subkey,
-                             const std::vector<char>& data,
-                             std::function<void(bool added)> callback)
+void provider::impl::get_active_users_checked(const std::vector<std::string>& subkeys,
+                                              const std::string& cursor,
+                                              uint32_t limit,
+                                              std::function<void(const active_users_page& page, bool complete)> callback)
 {
-	auto s = create_session(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
+	check_range(subkeys);
 
-	auto w = boost::make_shared<waiter>(callback, node_, min_writes_, false, true);
+	auto pager = std::make_shared<active_users_pager>(subkeys, cursor, limit, activity_chunks_);
 
-	add_log(s, user, subkey, data)
-	.connect(boost::bind(&waiter::on_log,
-	                     w,
-	                     _1,
-	                     _2));
+	pager->read(create_session(), callback);
 }
 
-void provider::impl::add_activity(const std::string& user, const std::string& subkey)
+std::set<std::string> provider::impl::get_active_users_intersection(const std::vector<std::string>& subkeys)
 {
-	auto s = create_session(DNET_IO_FLAGS_CACHE);
+	check_range(subkeys);
 
-	auto res = add_activity(s, user, subkey);
+	std::set<std::string> ret;
 
-	if (res.get().size() < min_writes_) {
-		LOG(DNET_LOG_ERROR, "Can't write data while adding activity error: %s\n", res.error().message().c_str());
-		throw ioremap::elliptics::error(EREMOTEIO, "Data wasn't written to the minimum number of groups");
+	if (subkeys.empty())
+		return ret;
+
+	auto s = create_session();
+
+	// the user is in the same chunk of each day, so the days are intersected by elliptics chunk by chunk
+	std::list<ioremap::elliptics::async_find_indexes_result> results;
+	for (uint32_t chunk = 0; chunk < activity_chunks_; ++chunk) {
+		std::vector<std::string> indexes;
+		for (auto it = subkeys.begin(), end = subkeys.end(); it != end; ++it) {
+			indexes.emplace_back(activity_index(*it, chunk, activity_chunks_));
+		}
+		results.emplace_back(s.find_all_indexes(indexes));
 	}
+
+	for (auto it = results.begin(), end = results.end(); it != end; ++it) {
+		collect_users(*it, ret);
+	}
+
+	return ret;
 }
 
-void provider::impl::add_activity(const std::string& user,
-                                  const std::string& subkey,
-                                  std::function<void(bool added)> callback)
+void provider::impl::get_active_users_intersection(const std::vector<std::string>& subkeys,
+                                                   std::function<void(const std::set<std::string>& active_users)> callback)
 {
-	auto s = create_session(DNET_IO_FLAGS_CACHE);
+	check_range(subkeys);
 
-	auto w = boost::make_shared<waiter>(callback, node_, min_writes_, true, false);
+	if (subkeys.empty()) {
+		callback(std::set<std::string>());
+		return;
+	}
 
-	add_activity(s, user, subkey)
-	.connect(boost::bind(&waiter::on_activity,
-	                     w,
-	                     _1,
-	                     _2));
+	auto s = create_session();
+	auto users = std::make_shared<users_union>(callback, activity_chunks_);
+
+	for (uint32_t chunk = 0; chunk < activity_chunks_; ++chunk) {
+		std::vector<std::string> indexes;
+		for (auto it = subkeys.begin(), end = subkeys.end(); it != end; ++it) {
+			indexes.emplace_back(activity_index(*it, chunk, activity_chunks_));
+		}
+		s.find_all_indexes(indexes)
+		.connect(std::bind(&users_union::on_users, users, std::placeholders::_1, std::placeholders::_2));
+	}
 }
 
-void provider::impl::add_log_with_activity(const std::string& user,
-                                           const std::string& subkey,
-                                           const std::vector<char>& data)
+std::set<std::string> provider::impl::get_active_users_at_least(const std::vector<std::string>& subkeys, uint32_t days)
 {
-	auto log_s = create_session(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
-	auto act_s = create_session(DNET_IO_FLAGS_CACHE);
+	check_range(subkeys);
 
-	auto log_res = add_log(log_s, user, subkey, data);
-	auto act_res = add_activity(act_s, user, subkey);
+	if (days == 0)
+		throw std::invalid_argument("number of days should be positive");
 
-	bool result = true;
+	std::set<std::string> ret;
 
-	if (log_res.get().size() < min_writes_) {
-		LOG(DNET_LOG_ERROR, "Can't write data while appending data to user log: %s\n", log_res.error().message().c_str());
-		result = false;
-	}
+	if (days > subkeys.size())
+		return ret;
 
-	if (act_res.get().size() < min_writes_) {
-		LOG(DNET_LOG_ERROR, "Can't write data while adding activity: %s\n", act_res.error().message().c_str());
-		result = false;
-	}
+	auto s = create_session();
+	activity_filter filter(s, subkeys, std::vector<std::string>(), activity_chunks_, days);
 
-	if (!result)
-		throw ioremap::elliptics::error(EREMOTEIO, "Data wasn't written to the minimum number of groups");
+	auto async_result = s.find_any_indexes(filter.indexes());
+	filter.filter(async_result, ret);
+
+	return ret;
 }
 
-void provider::impl::add_log_with_activity(const std::string& user,
-                                           const std::string& subkey,
-                                           const std::vector<char>& data,
-                                           std::function<void(bool added)> callback)
+void provider::impl::get_active_users_at_least(const std::vector<std::string>& subkeys,
+                                               uint32_t days,
+                                               std::function<void(const std::set<std::string>& active_users)> callback)
 {
-	auto w = boost::make_shared<waiter>(callback, node_, min_writes_);
-
-	auto log_s = create_session(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
-	auto act_s = create_session(DNET_IO_FLAGS_CACHE);
+	if (days == 0)
+		throw std::invalid_argument("number of days should be positive");
 
-	add_log(log_s, user, subkey, data)
-	.connect(boost::bind(&waiter::on_log,
-	                     w,
-	                     _1,
-	                     _2));
-
-	add_activity(act_s, user, subkey)
-	.connect(boost::bind(&waiter::on_activity,
-	                     w,
-	                     _1,
-	                     _2));
+	filter_active_users(subkeys, std::vector<std::string>(), days, callback);
 }
 
-std::vector<char> provider::impl::get_user_logs(const std::string& user, const std::vector<std::string>& subkeys)
+std::set<std::string> provider::impl::get_active_users_difference(const std::vector<std::string>& subkeys,
+                                                                  const std::vector<std::string>& excluded)
 {
-	std::deque<char> data;
+	check_range(subkeys);
+	check_range(excluded);
 
-	std::list<ioremap::elliptics::async_read_result> results;
+	std::set<std::string> ret;
 
-	auto s = create_session(0);
+	if (subkeys.empty())
+		return ret;
 
-	for (auto it = subkeys.begin(), end = subkeys.end(); it != end; ++it) {
-		results.emplace_back(s.read_latest(combine_key(user, *it), 0, 0));
-	}
+	auto s = create_session();
+	activity_filter filter(s, subkeys, excluded, activity_chunks_, 1);
 
-	try {
-		for (auto it = results.begin(), end = results.end(); it != end; ++it) {
-			try {
-				auto file = it->get_one().file(); // reads user log file
-				if (file.empty()) // if the file is empty
-					continue; // skip it and go to the next
+	auto async_result = s.find_any_indexes(filter.indexes());
+	filter.filter(async_result, ret);
 
-				data.insert(data.end(), file.data<char>(), file.data<char>() + file.size());
-			}
-			catch (ioremap::elliptics::error& e) {
-				LOG(DNET_LOG_ERROR, "Can't read log file: %s\n", e.error_message().c_str());
-			}
-		}
-	}
-	catch (ioremap::elliptics::error& e) {
-		LOG(DNET_LOG_ERROR, "Error while getting user logs: %s\n", e.error_message().c_str());
+	return ret;
+}
+
+void provider::impl::get_active_users_difference(const std::vector<std::string>& subkeys,
+                                                 const std::vector<std::string>& excluded,
+                                                 std::function<void(const std::set<std::string>& active_users)> callback)
+{
+	filter_active_users(subkeys, excluded, 1, callback);
+}
+
+void provider::impl::filter_active_users(const std::vector<std::string>& subkeys,
+                                         const std::vector<std::string>& excluded,
+                                         size_t min_days,
+                                         std::function<void(const std::set<std::string>& active_users)> callback)
+{
+	check_range(subkeys);
+	check_range(excluded);
+
+	if (subkeys.empty() || min_days > subkeys.size()) {
+		callback(std::set<std::string>());
+		return;
 	}
 
-	return std::vector<char>(data.begin(), data.end());
+	auto s = create_session();
+	auto filter = std::make_shared<activity_filter>(s, subkeys, excluded, activity_chunks_, min_days);
+
+	s.find_any_indexes(filter->indexes())
+	.connect(std::bind(&provider::impl::on_filtered,
+	                   filter,
+	                   callback,
+	                   std::placeholders::_1,
+	                   std::placeholders::_2));
 }
 
-void provider::impl::on_user_log(std::shared_ptr<std::list<ioremap::elliptics::async_read_result>> results,
-                                 std::shared_ptr<std::deque<char>> data,
-                                 std::function<void(const std::vector<char>& data)> callback,
-                                 const ioremap::elliptics::sync_read_result &entry,
+void provider::impl::on_filtered(std::shared_ptr<activity_filter> filter,
+                                 std::function<void(const std::set<std::string>& active_users)> callback,
+                                 const ioremap::elliptics::sync_find_indexes_result &result,
                                  const ioremap::elliptics::error_info &/*error*/)
 {
-	try {
-		results->erase(results->begin());
-		if (!entry.empty()) {
-			auto file = entry.front().file();
-			if (!file.empty())
-				data->insert(data->end(), file.data<char>(), file.data<char>() + file.size());
-		}
-	}
-	catch (ioremap::elliptics::error& e) {}
+	std::set<std::string> active_users;
 
-	if (!results->empty()) {
-		results->front().connect(boost::bind(&provider::impl::on_user_log, results, data, callback, _1, _2));
-	}
-	else
-		callback(std::vector<char>(data->begin(), data->end()));
+	filter->filter(result, active_users);
+
+	callback(active_users);
 }
 
-void provider::impl::get_user_logs(const std::string& user,
-                                   const std::vector<std::string>& subkeys,
-                                   std::function<void(const std::vector<char>& data)> callback)
+retention_matrix provider::impl::get_retention(uint64_t first_day,
+                                               uint64_t last_day,
+                                               const std::vector<uint32_t>& offsets,
+                                               uint32_t threads)
 {
-	auto data = std::make_shared<std::deque<char>>();
+	if (last_day < first_day)
+		throw std::invalid_argument("end of the period is before its begin");
 
-	auto results = std::make_shared<std::list<ioremap::elliptics::async_read_result>>();
+	check_range(last_day - first_day + 1); // cohort days are read anyway, so too long period is rejected before listing days
 
-	auto s = create_session(0);
+	retention_job job(first_day,
+	                  last_day,
+	                  offsets,
+	                  [this](const std::string& subkey) { return get_active_users(std::vector<std::string>(1, subkey)); });
 
-	for (auto it = subkeys.begin(), end = subkeys.end(); it != end; ++it) {
-		auto cmb_key = combine_key(user, *it);
-		LOG(DNET_LOG_DEBUG, "Try to read user: %s log file: %s\n", user.c_str(), cmb_key.c_str());
-		results->emplace_back(s.read_latest(cmb_key, 0, 0));
-	}
+	check_range(job.days()); // days of offsets are read too
 
-	results->front()
-	.connect(boost::bind(&provider::impl::on_user_log,
-	                     results,
-	                     data,
-	                     callback,
-	                     _1,
-	                     _2));
+	return job.run(threads);
 }
 
-ioremap::elliptics::async_find_indexes_result
-provider::impl::get_active_users(ioremap::elliptics::session& s,
-                                 const std::vector<std::string>& subkeys)
+std::vector<bool> provider::impl::is_active(const std::vector<std::string>& users, const std::string& subkey)
 {
-	return s.find_any_indexes(subkeys);
+	auto promise = std::make_shared<std::promise<std::vector<bool>>>();
+	auto future = promise->get_future();
+
+	is_active(users, subkey, [promise](const std::vector<bool>& active) {
+		promise->set_value(active);
+	});
+
+	return future.get();
 }
 
-std::set<std::string> provider::impl::get_active_users(const std::vector<std::string>& subkeys)
+void provider::impl::is_active(const std::vector<std::string>& users,
+                               const std::string& subkey,
+                               std::function<void(const std::vector<bool>& active)> callback)
 {
-	std::set<std::string> ret;
+	LOG(DNET_LOG_DEBUG, "Check activity of %zu users in: %s\n", users.size(), subkey.c_str());
+
+	auto check = std::make_shared<activity_check>(create_session(),
+	                                              create_filters_session(DNET_IO_FLAGS_CACHE), // filters are written to cache
+	                                              users,
+	                                              subkey,
+	                                              activity_chunks_,
+	                                              activity_filter_size_,
+	                                              callback);
+	check->start(activity_filters_);
+}
 
-	auto s = create_session();
+std::map<std::string, uint64_t> provider::impl::get_activity_counts(const std::vector<std::string>& subkeys)
+{
+	check_range(subkeys);
 
-	auto async_result = get_active_users(s, subkeys);
+	std::map<std::string, uint64_t> ret;
 
-	for (auto it = async_result.begin(), end = async_result.end(); it != end; ++it) {
-		for (auto ind_it = it->indexes.begin(), ind_end = it->indexes.end(); ind_it != ind_end; ++ind_it) {
-			ret.insert(ind_it->data.to_string());
-			LOG(DNET_LOG_DEBUG, "Found value: %s\n", ret.rbegin()->c_str());
+	auto s = create_counters_session();
+
+	for (auto it = subkeys.begin(), end = subkeys.end(); it != end; ++it) {
+		const auto day_users = get_active_users(std::vector<std::string>(1, *it));
+		const std::vector<std::string> users(day_users.begin(), day_users.end());
+
+		// lookups of the day go through the scheduler, so at most request limit of them are in flight
+		auto promises = std::make_shared<std::vector<std::promise<uint64_t>>>(users.size());
+
+		std::vector<std::future<uint64_t>> counts;
+		counts.reserve(users.size());
+
+		std::vector<fanout_scheduler::task_t> tasks;
+		tasks.reserve(users.size());
+
+		for (size_t i = 0; i < users.size(); ++i) {
+			counts.emplace_back((*promises)[i].get_future());
+
+			const auto key = combine_key(users[i], *it);
+			tasks.emplace_back([s, promises, i, key](fanout_scheduler::done_t done) mutable {
+				s.lookup(key)
+				.connect([promises, i, done](const ioremap::elliptics::sync_lookup_result& result,
+				                             const ioremap::elliptics::error_info &/*error*/) {
+					(*promises)[i].set_value(activity_counts::count(result));
+					done();
+				});
+			});
+		}
+
+		scheduler_->run(std::move(tasks), fanout_scheduler::done_t([]() {}));
+
+		for (size_t i = 0; i < users.size(); ++i) {
+			ret[users[i]] += counts[i].get();
 		}
 	}
 
 	return ret;
 }
 
-void provider::impl::on_active_users(std::function<void(const std::set<std::string> &active_users)> callback,
-                                     const ioremap::elliptics::sync_find_indexes_result &result,
-                                     const ioremap::elliptics::error_info &/*error*/)
+void provider::impl::get_activity_counts(const std::vector<std::string>& subkeys,
+                                         std::function<void(const std::map<std::string, uint64_t>& counts)> callback)
 {
-	std::set<std::string> active_users;
+	check_range(subkeys);
 
-	for (auto it = result.begin(), end = result.end(); it != end; ++it) {
-		for (auto ind_it = it->indexes.begin(), ind_end = it->indexes.end(); ind_it != ind_end; ++ind_it) {
-			active_users.insert(ind_it->data.to_string());
-		}
+	if (subkeys.empty()) {
+		callback(std::map<std::string, uint64_t>());
+		return;
 	}
 
-	callback(active_users);
-}
+	auto counts = std::make_shared<activity_counts>(create_counters_session(), scheduler_, callback, subkeys.size());
+	auto self = shared_from_this();
 
-void provider::impl::get_active_users(const std::vector<std::string>& subkeys,
-                                      std::function<void(const std::set<std::string> &active_users)> callback)
-{
-	auto s = create_session();
+	std::vector<fanout_scheduler::task_t> tasks;
+	tasks.reserve(subkeys.size());
 
-	get_active_users(s, subkeys)
-	.connect(boost::bind(&provider::impl::on_active_users,
-	                     callback,
-	                     _1,
-	                     _2));
+	for (auto it = subkeys.begin(), end = subkeys.end(); it != end; ++it) {
+		const auto subkey = *it;
+		tasks.emplace_back([self, counts, subkey](fanout_scheduler::done_t done) {
+			self->get_active_users(std::vector<std::string>(1, subkey),
+			                       [counts, subkey, done](const std::set<std::string>& active_users) {
+				counts->on_users(subkey, active_users);
+				done();
+			});
+		});
+	}
+
+	scheduler_->run(std::move(tasks), fanout_scheduler::done_t([]() {}));
 }
 
 void provider::impl::for_user_logs(const std::string& user,
                                    const std::vector<std::string>& subkeys,
                                    std::function<bool(const std::vector<char>& data)> callback)
 {
-	std::list<ioremap::elliptics::async_read_result> results;
-
-	auto s = create_session(0);
+	check_range(subkeys);
 
+	std::vector<std::string> keys;
+	keys.reserve(subkeys.size());
 	for (auto it = subkeys.begin(), end = subkeys.end(); it != end; ++it) {
-		results.emplace_back(s.read_latest(combine_key(user, *it), 0, 0));
+		keys.emplace_back(combine_key(user, *it));
 	}
 
-	try {
-		for (auto it = results.begin(), end = results.end(); it != end; ++it) {
-			try {
-				auto file = it->get_one().file(); // reads user log file
-				if (file.empty()) // if the file is empty
-					continue; // skip it and go to the next
+	std::shared_ptr<fanout_scheduler::request> request;
+	auto results = schedule_reads(keys, request);
 
-				if (!callback(std::vector<char>(file.data<char>(), file.data<char>())))
-					return;
-			}
-			catch (ioremap::elliptics::error& e) {
-				LOG(DNET_LOG_ERROR, "Can't read log file: %s\n", e.error_message().c_str());
-			}
+	for (size_t i = 0; i < results.size(); ++i) {
+		const auto reply = results[i].get();
+		if (reply.first.empty()) {
+			if (reply.second != -ENOENT)
+				LOG(DNET_LOG_ERROR, "Can't read log file: %s: %d\n", keys[i].c_str(), reply.second);
+			continue;
+		}
+
+		auto file = reply.first.front().file(); // reads user log file
+		if (file.empty()) // if the file is empty
+			continue; // skip it and go to the next
+
+		if (!callback(std::vector<char>(file.data<char>(), file.data<char>() + file.size()))) {
+			scheduler_->cancel(request); // logs which haven't been requested yet aren't read
+			return;
 		}
-	}
-	catch (ioremap::elliptics::error& e) {
-		LOG(DNET_LOG_ERROR, "Error while iterating log files: %s\n", e.error_message().c_str());
 	}
 }
 
 void provider::impl::for_active_users(const std::vector<std::string>& subkeys,
                                       std::function<bool(const std::set<std::string>& active_users)> callback)
 {
+	check_range(subkeys);
+
+	std::deque<ioremap::elliptics::async_find_indexes_result> results; // days which are read ahead
+
+	auto s = create_session();
+	auto next = subkeys.begin();
+
+	for (; next != subkeys.end() && results.size() < consts::ACTIVE_USERS_PREFETCH; ++next) {
+		results.emplace_back(get_active_users(s, std::vector<std::string>(1, *next)));
+	}
+
+	while (!results.empty()) {
+		auto users = users_merge(results.front().get(), merge_threads_).run(true);
+		results.pop_front();
+
+		if (next != subkeys.end()) { // the next day is read while the callback handles this one
+			results.emplace_back(get_active_users(s, std::vector<std::string>(1, *next)));
+			++next;
+		}
+
+		if (!callback(std::set<std::string>(std::make_move_iterator(users.begin()), std::make_move_iterator(users.end()))))
+			return; // days which are still in flight are dropped
+	}
+}
+
+void provider::impl::for_active_users(const std::vector<std::string>& subkeys,
+                                      std::function<bool(const std::set<std::string>& active_users)> callback,
+                                      std::function<void()> complete_callback)
+{
+	check_range(subkeys);
+
+	std::vector<std::vector<std::string>> indexes;
+	indexes.reserve(subkeys.size());
 	for (auto it = subkeys.begin(), end = subkeys.end(); it != end; ++it) {
-		std::vector<std::string> one_subkey;
-		one_subkey.push_back(*it);
-		if (!callback(get_active_users(one_subkey)))
-			return;
+		indexes.emplace_back(activity_indexes(std::vector<std::string>(1, *it), activity_chunks_));
 	}
+
+	auto iterator = std::make_shared<active_users_iterator>(create_session(),
+	                                                        indexes,
+	                                                        callback,
+	                                                        complete_callback,
+	                                                        merge_threads_);
+	iterator->start(consts::ACTIVE_USERS_PREFETCH);
 }
 
 ioremap::elliptics::session provider::impl::create_session(uint32_t io_flags) const
@@ -538,9 +3660,70 @@ ioremap::elliptics::session provider::impl::create_session(uint32_t io_flags) co
 	ret.set_exceptions_policy(ioremap::elliptics::session::exceptions_policy::no_exceptions);
 	ret.set_timeout(consts::TIMEOUT);
 
+	auto counters = counters_;
+	ret.set_filter([counters](const ioremap::elliptics::callback_result_entry& entry) { // counts errors of all operations
+		counters->on_entry(entry);
+		return ioremap::elliptics::filters::positive(entry);
+	});
+
+	return ret;
+}
+
+ioremap::elliptics::session provider::impl::create_counters_session(uint32_t io_flags) const
+{
+	auto ret = create_session(io_flags);
+
+	ret.set_namespace(consts::COUNTERS_NAMESPACE, sizeof(consts::COUNTERS_NAMESPACE) - 1);
+
+	return ret;
+}
+
+ioremap::elliptics::session provider::impl::create_filters_session(uint32_t io_flags) const
+{
+	auto ret = create_session(io_flags);
+
+	ret.set_namespace(consts::FILTERS_NAMESPACE, sizeof(consts::FILTERS_NAMESPACE) - 1);
+
+	return ret;
+}
+
+ioremap::elliptics::session provider::impl::create_days_session(uint32_t io_flags) const
+{
+	auto ret = create_session(io_flags);
+
+	ret.set_namespace(consts::LOG_DAYS_NAMESPACE, sizeof(consts::LOG_DAYS_NAMESPACE) - 1);
+
 	return ret;
 }
 
+template<typename Result, typename Handler>
+void provider::impl::connect_write(Result result,
+                                   std::shared_ptr<aggregator> agg,
+                                   size_t index,
+                                   Handler on_completed)
+{
+	if (!early_ack_) {
+		result.connect(std::bind(on_completed,
+		                         agg,
+		                         index,
+		                         std::placeholders::_1,
+		                         std::placeholders::_2));
+		return;
+	}
+
+	auto q = quorum::create(std::bind(&aggregator::on_result,
+	                                  agg,
+	                                  index,
+	                                  std::placeholders::_1),
+	                        node_,
+	                        min_writes_,
+	                        groups_.size(),
+	                        counters_);
+
+	result.connect(std::bind(&quorum::on_entry, q, std::placeholders::_1),
+	               std::bind(&quorum::on_final, q, std::placeholders::_1));
+}
+
 ioremap::elliptics::async_write_result
 provider::impl::add_log(ioremap::elliptics::session& s,
                         const std::string& user,
@@ -551,6 +3734,8 @@ provider::impl::add_log(ioremap::elliptics::session& s,
 
 	LOG(DNET_LOG_DEBUG, "Try to append data to user log key: %s\n", write_key.c_str());
 
+	missing_->erase(write_key);
+
 	auto dp = ioremap::elliptics::data_pointer::copy(data.data(), data.size());
 
 	return s.write_data(write_key, dp, 0); // write data into elliptics
@@ -565,13 +3750,104 @@ provider::impl::add_activity(ioremap::elliptics::session& s,
 
 	std::vector<std::string> indexes;
 	std::vector<ioremap::elliptics::data_pointer> datas;
-	indexes.push_back(subkey);
+	indexes.push_back(activity_index(subkey, activity_chunk(user, activity_chunks_), activity_chunks_));
 	datas.push_back(user);
 
 	LOG(DNET_LOG_DEBUG, "Update indexes with key: %s and index: %s\n", subkey.c_str(), indexes.front().c_str());
+	if (activity_filters_) // is_active confirms users by their lists of indexes, add_indexes keeps them unlike update_indexes_internal
+		return s.add_indexes(user, indexes, datas);
 	return s.update_indexes_internal(user, indexes, datas);
 }
 
+ioremap::elliptics::async_write_result
+provider::impl::mark_day(ioremap::elliptics::session& s,
+                         const std::string& user,
+                         const std::string& subkey)
+{
+	uint64_t day = 0, offset = 0;
+	subkey_to_day(subkey, day);
+	auto write_key = log_days_filter::day_key(user, day, offset);
+
+	LOG(DNET_LOG_DEBUG, "Try to mark day %s of user log key: %s\n", subkey.c_str(), write_key.c_str());
+
+	auto dp = ioremap::elliptics::data_pointer::copy(consts::DAY_MARK, sizeof(consts::DAY_MARK) - 1);
+
+	return s.write_data(write_key, dp, offset); // session doesn't append, so the mark is set in place
+}
+
+std::function<void(bool added)> provider::impl::remember_filtered(const std::string& user,
+                                                                  const std::string& subkey,
+                                                                  std::function<void(bool added)> callback)
+{
+	if (!activity_filters_)
+		return callback;
+
+	auto filtered = filtered_;
+	auto key = combine_key(user, subkey);
+	return [filtered, key, callback](bool added) {
+		if (added) // positions are set only if all writes have succeeded, otherwise they are written again by retry
+			filtered->insert(key);
+		callback(added);
+	};
+}
+
+void provider::impl::remember_filtered(const std::string& user, const std::string& subkey)
+{
+	if (activity_filters_)
+		filtered_->insert(combine_key(user, subkey));
+}
+
+std::vector<ioremap::elliptics::async_write_result>
+provider::impl::activity_side_writes(const std::string& user, const std::string& subkey)
+{
+	std::vector<ioremap::elliptics::async_write_result> ret;
+
+	if (activity_counters_) { // failed counter doesn't fail the activity, so a retry doesn't count it twice
+		auto cnt_s = create_counters_session(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
+		count_activity(cnt_s, user, subkey).connect(std::bind(&provider::impl::on_counter_written,
+		                                                      shared_from_this(),
+		                                                      std::placeholders::_1,
+		                                                      std::placeholders::_2));
+	}
+
+	// repeated activities of the user in the day don't write positions which have been already set
+	if (activity_filters_ && !filtered_->contains(combine_key(user, subkey))) {
+		auto flt_s = create_filters_session(DNET_IO_FLAGS_CACHE); // filter objects are small, so they are kept in cache
+
+		LOG(DNET_LOG_DEBUG, "Try to set positions of user in activity filter: %s\n", subkey.c_str());
+
+		auto dp = ioremap::elliptics::data_pointer::copy(consts::FILTER_MARK, sizeof(consts::FILTER_MARK) - 1);
+		auto positions = activity_filter_positions(user, activity_filter_size_);
+		for (auto it = positions.begin(), end = positions.end(); it != end; ++it) {
+			uint64_t offset;
+			auto key = activity_filter_key(subkey, *it, activity_filter_size_, offset);
+			ret.emplace_back(flt_s.write_data(key, dp, offset));
+		}
+	}
+
+	return ret;
+}
+
+bool provider::impl::marks_day(const std::string& subkey) const
+{
+	uint64_t day;
+	return log_days_ && subkey_to_day(subkey, day);
+}
+
+ioremap::elliptics::async_write_result
+provider::impl::count_activity(ioremap::elliptics::session& s,
+                               const std::string& user,
+                               const std::string& subkey)
+{
+	auto write_key = combine_key(user, subkey);
+
+	LOG(DNET_LOG_DEBUG, "Try to increment activity counter key: %s\n", write_key.c_str());
+
+	auto dp = ioremap::elliptics::data_pointer::copy(consts::COUNTER_INCREMENT, sizeof(consts::COUNTER_INCREMENT) - 1);
+
+	return s.write_data(write_key, dp, 0); // session appends, so the counter is the size of the object
+}
+
 std::string provider::impl::combine_key(const std::string& basekey, const std::string& subkey) const
 {
 	return basekey + "." + subkey;
@@ -0,0 +1,133 @@
+#include "active_users_cache.h"
+
+#include <algorithm>
+#include <ctime>
+
+#include <historydb/provider.h>
+
+namespace history {
+
+active_users_cache::active_users_cache(size_t max_size, uint32_t ttl, uint32_t past_ttl)
+: max_size_(max_size)
+, ttl_(ttl)
+, past_ttl_(past_ttl)
+, size_(0)
+{
+	stats_ = stats();
+}
+
+void active_users_cache::normalize(std::vector<std::string>& subkeys)
+{
+	std::sort(subkeys.begin(), subkeys.end());
+	subkeys.erase(std::unique(subkeys.begin(), subkeys.end()), subkeys.end());
+}
+
+void active_users_cache::get(const std::vector<std::string>& subkeys, bool msgpack, fetcher_t fetch, callback_t callback)
+{
+	auto normalized = subkeys;
+	normalize(normalized);
+
+	std::string key(msgpack ? "m" : "j"); // format and normalized subkeys separated by ':'
+	for (auto it = normalized.begin(), end = normalized.end(); it != end; ++it) {
+		key.append(1, ':').append(*it);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		auto it = entries_.find(key);
+
+		if (it != entries_.end()) {
+			auto& e = it->second;
+			if (!e.reply) { // the reply is being fetched by another request
+				e.waiters.push_back(callback);
+				++stats_.coalesced;
+				++stats_.waiting;
+				return;
+			}
+
+			if (e.expires > clock::now()) {
+				lru_.splice(lru_.begin(), lru_, e.lru_it);
+				auto reply = e.reply;
+				++stats_.hits;
+				lock.unlock();
+				callback(reply);
+				return;
+			}
+
+			size_ -= e.reply->size(); // the reply has expired, fetches it again
+			lru_.erase(e.lru_it);
+			e.reply.reset();
+		}
+
+		entries_[key].waiters.push_back(callback);
+		++stats_.misses;
+		++stats_.waiting;
+	}
+
+	fetch(std::bind(&active_users_cache::on_fetched, this, key, ttl(subkeys), std::placeholders::_1));
+}
+
+void active_users_cache::on_fetched(const std::string& key, std::chrono::seconds ttl, const reply_ptr& reply)
+{
+	std::list<callback_t> waiters;
+
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		auto& e = entries_[key];
+		waiters.swap(e.waiters);
+		stats_.waiting -= waiters.size();
+
+		if (!reply || reply->size() > max_size_) { // the reply can't be cached, only waiters get it
+			entries_.erase(key);
+		}
+		else {
+			e.reply = reply;
+			e.expires = clock::now() + ttl;
+			lru_.push_front(key);
+			e.lru_it = lru_.begin();
+			size_ += reply->size();
+			evict();
+		}
+	}
+
+	for (auto it = waiters.begin(), end = waiters.end(); it != end; ++it) {
+		(*it)(reply);
+	}
+}
+
+active_users_cache::stats active_users_cache::get_stats()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	stats ret = stats_;
+	ret.entries = lru_.size();
+	ret.size = size_;
+	return ret;
+}
+
+std::chrono::seconds active_users_cache::ttl(const std::vector<std::string>& subkeys) const
+{
+	const auto now = time(NULL);
+	const auto today = time_period_to_subkeys(now, now).front();
+
+	for (auto it = subkeys.begin(), end = subkeys.end(); it != end; ++it) {
+		if (it->empty() || it->find_first_not_of("0123456789") != std::string::npos) // custom subkey can be updated anytime
+			return ttl_;
+
+		if (it->size() > today.size() || (it->size() == today.size() && *it >= today)) // today or future day
+			return ttl_;
+	}
+
+	return past_ttl_;
+}
+
+void active_users_cache::evict()
+{
+	while (size_ > max_size_ && !lru_.empty()) {
+		auto it = entries_.find(lru_.back());
+		size_ -= it->second.reply->size();
+		entries_.erase(it);
+		lru_.pop_back();
+	}
+}
+
+} /* namespace history */
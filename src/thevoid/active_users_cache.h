@@ -0,0 +1,84 @@
+#ifndef HISTORY_SRC_THEVOID_ACTIVE_USERS_CACHE_H
+#define HISTORY_SRC_THEVOID_ACTIVE_USERS_CACHE_H
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace history {
+
+/* Cache of serialized get_active_users replies.
+ * Replies are keyed by subkeys and format, so hits are sent without reading and serializing active users.
+ * Reply which includes today (or custom subkey) expires after short ttl, reply of past days - after long ttl.
+ * Concurrent requests of the same missed key are coalesced: only the first of them fetches the reply,
+ * the others wait for its result. Least recently used replies are evicted when the cache exceeds its size.
+ * Failed fetches aren't cached, so the next request fetches the reply again.
+ */
+class active_users_cache
+{
+public:
+	struct stats
+	{
+		uint64_t	hits; // requests which have got cached reply
+		uint64_t	misses; // requests which have fetched the reply
+		uint64_t	coalesced; // requests which have waited for the reply fetched by another request
+		uint64_t	waiting; // requests which are waiting for the reply now
+		uint64_t	entries; // number of cached replies
+		uint64_t	size; // total size of cached replies
+	};
+
+	typedef std::shared_ptr<const std::string> reply_ptr; // NULL if the reply can't be fetched
+	typedef std::function<void(const reply_ptr& reply)> callback_t;
+	typedef std::function<void(callback_t done)> fetcher_t;
+
+	active_users_cache(size_t max_size, uint32_t ttl, uint32_t past_ttl);
+
+	/* Calls callback with cached reply or fetches it.
+		subkeys - subkeys of the request, they should be normalized
+		msgpack - format of the reply
+		fetch - fetches and serializes the reply if it isn't cached and isn't being fetched, must call done exactly once,
+			with NULL if some reads have failed
+		callback - gets the reply or NULL if it can't be fetched,
+			it can be called from the current thread or from the thread which has fetched the reply
+	*/
+	void get(const std::vector<std::string>& subkeys, bool msgpack, fetcher_t fetch, callback_t callback);
+
+	// sorts subkeys and removes repeated ones, so the same set of days has the same key and the same reply
+	static void normalize(std::vector<std::string>& subkeys);
+
+	// returns counters and gauges of the cache
+	stats get_stats();
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	struct entry
+	{
+		reply_ptr							reply; // NULL while the reply is being fetched
+		clock::time_point					expires;
+		std::list<callback_t>				waiters; // requests which wait for the reply being fetched
+		std::list<std::string>::iterator	lru_it; // position in lru_ list, valid only for fetched reply
+	};
+
+	void on_fetched(const std::string& key, std::chrono::seconds ttl, const reply_ptr& reply);
+	std::chrono::seconds ttl(const std::vector<std::string>& subkeys) const;
+	void evict(); // removes least recently used replies until the cache fits max_size_
+
+	const size_t							max_size_; // maximum total size of cached replies
+	const std::chrono::seconds				ttl_; // ttl of replies which include today
+	const std::chrono::seconds				past_ttl_; // ttl of replies of past days
+	size_t									size_; // total size of cached replies
+	stats									stats_; // counters of requests, size and entries are filled by get_stats
+	std::unordered_map<std::string, entry>	entries_;
+	std::list<std::string>					lru_; // keys of fetched replies, the most recently used is the first
+	std::mutex								mutex_;
+};
+
+} /* namespace history */
+
+#endif //HISTORY_SRC_THEVOID_ACTIVE_USERS_CACHE_H
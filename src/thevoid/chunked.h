@@ -0,0 +1,74 @@
+#ifndef HISTORY_SRC_THEVOID_CHUNKED_H
+#define HISTORY_SRC_THEVOID_CHUNKED_H
+
+#include <cstdio>
+#include <string>
+
+#include <boost/thread/tss.hpp>
+#include <boost/system/error_code.hpp>
+
+#include "../fastcgi/rapidjson/writer.h"
+#include "../fastcgi/rapidjson/stringbuffer.h"
+
+namespace history { namespace chunked {
+
+/* Helpers for replies with chunked transfer-encoding.
+ * Such replies are serialized and sent by parts as soon as the parts are read from elliptics,
+ * so memory used by a request doesn't depend on the size of the whole reply.
+ */
+
+const char TRANSFER_ENCODING[] = "Transfer-Encoding";
+const char CHUNKED[] = "chunked";
+const char LAST_CHUNK[] = "0\r\n\r\n";
+const size_t MAX_KEPT_BUFFER = 1024 * 1024; // larger escaping buffer of the thread is freed after use
+
+// error which closes the reply if a part has failed after the headers have been sent:
+// the last chunk isn't sent, so the client sees the reply as incomplete instead of a shorter one
+inline boost::system::error_code part_error()
+{
+	return boost::system::errc::make_error_code(boost::system::errc::io_error);
+}
+
+// frames data as one chunk and appends it to out
+inline void append_chunk(std::string& out, const char* data, size_t size)
+{
+	if (size == 0) // empty chunk means the end of the reply
+		return;
+
+	char header[32];
+	const int header_size = snprintf(header, sizeof(header), "%zx\r\n", size);
+	out.append(header, header_size);
+	out.append(data, size);
+	out.append("\r\n", 2);
+}
+
+inline void append_chunk(std::string& out, const std::string& data)
+{
+	append_chunk(out, data.data(), data.size());
+}
+
+// escapes data as a part of json string value and appends it to out without quotes,
+// so the string value could be sent by parts
+inline void append_json_string_part(std::string& out, const char* data, size_t size)
+{
+	static boost::thread_specific_ptr<rapidjson::StringBuffer> thread_buffer; // keeps its memory between calls up to the limit
+	if (!thread_buffer.get())
+		thread_buffer.reset(new rapidjson::StringBuffer());
+
+	auto& buffer = *thread_buffer;
+	buffer.Clear();
+
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	writer.StartArray(); // root value should be an array or an object
+	writer.String(data, size);
+	writer.EndArray();
+
+	out.append(buffer.GetString() + 2, buffer.Size() - 4); // strips '["' and '"]'
+
+	if (buffer.stack_.GetCapacity() > MAX_KEPT_BUFFER) // a large day of logs doesn't keep its memory in the thread forever
+		thread_buffer.reset();
+}
+
+} } /* namespace history::chunked */
+
+#endif //HISTORY_SRC_THEVOID_CHUNKED_H
@@ -0,0 +1,105 @@
+#include "on_add_logs.h"
+
+#include <historydb/provider.h>
+#include <elliptics/error.hpp>
+
+#include <algorithm>
+
+namespace history {
+
+namespace consts {
+const char MSGPACK_CONTENT_TYPE[] = "application/x-msgpack";
+}
+
+on_add_logs::on_add_logs()
+: remaining_(0)
+, msgpack_request_(false)
+, msgpack_(false)
+, failed_(false)
+{}
+
+void on_add_logs::on_headers(const ioremap::swarm::network_request &req)
+{
+	batch_.reset(new log_batch(get_server()->get_max_batch()));
+	remaining_ = req.get_content_length();
+	msgpack_request_ = webserver::sends_msgpack(req);
+	msgpack_ = webserver::accepts_msgpack(req);
+
+	if (remaining_ == 0) // empty batch doesn't have data parts
+		parse("", 0);
+}
+
+size_t on_add_logs::on_data(const boost::asio::const_buffer &buffer)
+{
+	const auto data = boost::asio::buffer_cast<const char*>(buffer);
+	const auto size = boost::asio::buffer_size(buffer);
+
+	if (!failed_ && remaining_ != 0) {
+		remaining_ -= std::min(size, remaining_);
+		parse(data, size);
+	}
+
+	return size;
+}
+
+void on_add_logs::parse(const char* data, size_t size)
+{
+	try {
+		if (!msgpack_request_)
+			batch_->feed_json(data, size);
+		else if (!batch_->feed_msgpack(data, size))
+			throw std::invalid_argument("Malformed msgpack");
+
+		if (remaining_ != 0) // waits for the rest of the body
+			return;
+
+		if (!msgpack_request_)
+			batch_->finish_json();
+		else if (!batch_->finish_msgpack())
+			throw std::invalid_argument("Malformed msgpack");
+
+		add();
+	}
+	catch(ioremap::elliptics::error&) {
+		failed_ = true;
+		get_reply()->send_error(ioremap::swarm::network_reply::internal_server_error);
+	}
+	catch(...) {
+		failed_ = true;
+		get_reply()->send_error(ioremap::swarm::network_reply::bad_request);
+	}
+}
+
+void on_add_logs::add()
+{
+	get_server()
+	->get_provider()
+	->add_logs(batch_->records(),
+	           std::bind(&on_add_logs::on_finish,
+	                     shared_from_this(),
+	                     std::placeholders::_1));
+}
+
+void on_add_logs::on_finish(const std::vector<bool>& added)
+{
+	batch_->set_results(added);
+
+	const std::string result_str = batch_->write_statuses(msgpack_);
+
+	ioremap::swarm::network_reply reply;
+	reply.set_code(ioremap::swarm::network_reply::ok);
+	reply.set_content_length(result_str.size());
+	reply.set_content_type(msgpack_ ? consts::MSGPACK_CONTENT_TYPE : "text/json");
+	get_reply()->send_headers(reply,
+	                          boost::asio::buffer(result_str),
+	                          std::bind(&on_add_logs::on_send_finished,
+	                                    shared_from_this(),
+	                                    result_str));
+}
+
+void on_add_logs::on_send_finished(const std::string &)
+{
+	get_reply()->close(boost::system::error_code());
+}
+
+} /* namespace history */
@@ -0,0 +1,40 @@
+#ifndef HISTORY_SRC_THEVOID_ON_ADD_LOGS_H
+#define HISTORY_SRC_THEVOID_ON_ADD_LOGS_H
+
+#include "webserver.h"
+#include "../common/log_batch.h"
+
+#include <memory>
+
+namespace history {
+
+	/* Adds batch of log records which are sent as NDJSON or msgpack and replies with status of each record.
+	 * The body is parsed by parts as it is received, so it isn't buffered as a whole:
+	 * only parsed records and the incomplete last record are kept.
+	 */
+	struct on_add_logs :
+		public ioremap::thevoid::request_stream<webserver>,
+		public std::enable_shared_from_this<on_add_logs>
+	{
+		on_add_logs();
+
+		virtual void on_headers(const ioremap::swarm::network_request &req);
+		virtual size_t on_data(const boost::asio::const_buffer &buffer);
+		virtual void on_close(const boost::system::error_code &) {}
+		void on_finish(const std::vector<bool>& added);
+		void on_send_finished(const std::string &);
+
+	private:
+		void parse(const char* data, size_t size); // parses the part of the body and adds the batch after the last part
+		void add();
+
+		std::unique_ptr<log_batch>	batch_;
+		size_t						remaining_; // size of the body which hasn't been received yet
+		bool						msgpack_request_; // true if the body is serialized into msgpack
+		bool						msgpack_; // true if the reply is serialized into msgpack
+		bool						failed_; // true if the error has been replied, so the rest of the body is skipped
+	};
+
+} /* namespace history */
+
+#endif //HISTORY_SRC_THEVOID_ON_ADD_LOGS_H
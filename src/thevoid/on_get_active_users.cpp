@@ -8,11 +8,10 @@
 
 #include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
-#include <boost/algorithm/string.hpp>
 
-#include "../fastcgi/rapidjson/document.h"
-#include "../fastcgi/rapidjson/writer.h"
-#include "../fastcgi/rapidjson/stringbuffer.h"
+#include <msgpack.hpp>
+
+#include "chunked.h"
 
 namespace history {
 
@@ -22,8 +21,39 @@ const char DATA_ITEM[] = "data";
 const char BEGIN_TIME_ITEM[] = "begin_time";
 const char END_TIME_ITEM[] = "end_time";
 const char KEYS_ITEM[] = "keys";
+const char ACTIVE_USERS_ITEM[] = "active_users";
+const char LIMIT_ITEM[] = "limit";
+const char CURSOR_ITEM[] = "cursor";
+const char MSGPACK_CONTENT_TYPE[] = "application/x-msgpack";
+const size_t PARTS_IN_FLIGHT = 2; // number of days or chunks which are read or sent simultaneously
+const size_t CHUNK_SIZE = 64 * 1024; // approximate size of one chunk with active users
+}
+
+namespace {
+// msgpack stream which appends packed data to the string
+struct string_stream
+{
+	string_stream(std::string& out) : out_(out) {}
+	void write(const char* data, size_t size) { out_.append(data, size); }
+	std::string&	out_;
+};
 }
 
+on_get_active_users::on_get_active_users()
+: current_it_(current_.end())
+, parts_(0)
+, next_read_(0)
+, next_send_(0)
+, sending_(false)
+, headers_sent_(false)
+, finished_(false)
+, failed_(false)
+, msgpack_(false)
+, writer_(buffer_)
+, fetch_pending_(0)
+, fetch_failed_(false)
+{}
+
 void on_get_active_users::on_request(const ioremap::swarm::network_request &req,
                                      const boost::asio::const_buffer &/*buffer*/)
 {
@@ -31,29 +61,69 @@ void on_get_active_users::on_request(const ioremap::swarm::network_request &req,
 		ioremap::swarm::network_url url(req.get_url());
 		ioremap::swarm::network_query_list query_list(url.query());
 
-		if (query_list.has_item(consts::KEYS_ITEM)) {
-			std::string keys_value = query_list.item_value(consts::KEYS_ITEM);
-			std::vector<std::string> keys;
-			boost::split(keys, keys_value, boost::is_any_of(":"));
+		msgpack_ = webserver::accepts_msgpack(req);
+
+		if (!webserver::request_keys(query_list, consts::KEYS_ITEM, consts::BEGIN_TIME_ITEM, consts::END_TIME_ITEM, subkeys_))
+			throw std::invalid_argument("key and time are missed");
+
+		get_server()->get_provider()->check_range(subkeys_); // rejects too long range before any read
+
+		if (query_list.has_item(consts::LIMIT_ITEM)) { // pages aren't cached, they are small and the cursor is unique
 			get_server()
 			->get_provider()
-			->get_active_users(keys,
-			                   std::bind(&on_get_active_users::on_finished,
-			                             shared_from_this(),
-			                             std::placeholders::_1));
+			->get_active_users_checked(subkeys_,
+			                           query_list.has_item(consts::CURSOR_ITEM) ? query_list.item_value(consts::CURSOR_ITEM) : std::string(),
+			                           boost::lexical_cast<uint32_t>(query_list.item_value(consts::LIMIT_ITEM)),
+			                           std::bind(&on_get_active_users::on_page,
+			                                     shared_from_this(),
+			                                     std::placeholders::_1,
+			                                     std::placeholders::_2));
+			return;
 		}
-		else if (query_list.has_item(consts::BEGIN_TIME_ITEM) and
-		         query_list.has_item(consts::END_TIME_ITEM)) {
-			get_server()
-			->get_provider()
-			->get_active_users(boost::lexical_cast<uint64_t>(query_list.item_value(consts::BEGIN_TIME_ITEM)),
-			                   boost::lexical_cast<uint64_t>(query_list.item_value(consts::END_TIME_ITEM)),
-			                   std::bind(&on_get_active_users::on_finished,
-			                             shared_from_this(),
-			                             std::placeholders::_1));
+
+		auto cache = get_server()->get_active_users_cache();
+		if (cache) // the reply of the same set of days is the same, parts are counted by normalized days
+			active_users_cache::normalize(subkeys_);
+
+		// the reply lists each user once, so it is read by chunks of activity statistics of all days which don't share users
+		parts_ = subkeys_.empty() ? 0 : get_server()->get_provider()->get_activity_chunks();
+
+		if (cache) {
+			cache->get(subkeys_,
+			           msgpack_,
+			           std::bind(&on_get_active_users::fetch, shared_from_this(), std::placeholders::_1),
+			           std::bind(&on_get_active_users::on_cached, shared_from_this(), std::placeholders::_1));
+			return;
 		}
-		else
-			throw std::invalid_argument("key and time are missed");
+
+		std::vector<size_t> reads;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			if (msgpack_) { // {"active_users": [[users of each chunk]]}
+				string_stream stream(packed_);
+				msgpack::packer<string_stream> packer(stream);
+				packer.pack_map(1);
+				packer.pack_raw(sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+				packer.pack_raw_body(consts::ACTIVE_USERS_ITEM, sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+				packer.pack_array(parts_);
+			}
+			else {
+				writer_.StartObject();
+				writer_.String(consts::ACTIVE_USERS_ITEM);
+				writer_.StartArray();
+			}
+
+			while (next_read_ < parts_ && next_read_ < consts::PARTS_IN_FLIGHT) {
+				reads.push_back(next_read_++);
+			}
+		}
+
+		for (auto it = reads.begin(), end = reads.end(); it != end; ++it) {
+			read_part(*it);
+		}
+
+		if (parts_ == 0)
+			process();
 	}
 	catch(ioremap::elliptics::error& e) {
 		get_reply()->send_error(ioremap::swarm::network_reply::internal_server_error);
@@ -63,40 +133,310 @@ void on_get_active_users::on_request(const ioremap::swarm::network_request &req,
 	}
 }
 
-void on_get_active_users::on_finished(const std::set<std::string>& active_users)
+void on_get_active_users::read_part(size_t index)
 {
-	rapidjson::Document d; // creates document for json serialization
-	d.SetObject();
+	auto provider = get_server()->get_provider();
 
-	rapidjson::Value ausers(rapidjson::kArrayType);
+	auto self = shared_from_this();
+	provider->get_active_users_chunk(subkeys_,
+	                                 index,
+	                                 [self, index](const std::set<std::string>& active_users, bool complete) {
+		self->on_part(index, active_users, complete);
+	});
+}
 
-	for (auto it = active_users.begin(), itEnd = active_users.end(); it != itEnd; ++it) { // adds all active user with counters to json
-		rapidjson::Value user(it->c_str(), it->size(), d.GetAllocator());
-		ausers.PushBack(user, d.GetAllocator());
+void on_get_active_users::on_part(size_t index, const std::set<std::string>& active_users, bool complete)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (complete)
+			parts_read_[index] = active_users;
+		else
+			failed_ = true;
 	}
+	process();
+}
 
-	d.AddMember("active_users", ausers, d.GetAllocator());
+void on_get_active_users::process()
+{
+	std::vector<size_t> reads;
+	bool send_headers = false;
+	bool send_data = false;
+
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (sending_ || finished_)
+			return;
+
+		if (failed_) { // parts which are in flight are ignored
+			finished_ = true;
+			const bool headers_sent = headers_sent_;
+			lock.unlock();
+			if (headers_sent)
+				get_reply()->close(chunked::part_error());
+			else
+				get_reply()->send_error(ioremap::swarm::network_reply::internal_server_error);
+			return;
+		}
+
+		string_stream stream(packed_);
+		msgpack::packer<string_stream> packer(stream);
+
+		while (pending_size() < consts::CHUNK_SIZE) {
+			if (current_it_ == current_.end()) { // current part has been serialized, takes the next one
+				auto it = parts_read_.find(next_send_);
+				if (it == parts_read_.end())
+					break;
+
+				current_.clear();
+				current_.swap(it->second);
+				parts_read_.erase(it);
+				++next_send_;
+
+				if (next_read_ < parts_) // starts reading the next part instead of taken one
+					reads.push_back(next_read_++);
+
+				current_it_ = current_.begin(); // chunks don't share users, so the part is sent as is
+				if (msgpack_)
+					packer.pack_array(current_.size());
+				continue;
+			}
+
+			for (; current_it_ != current_.end() && pending_size() < consts::CHUNK_SIZE; ++current_it_) {
+				if (msgpack_) {
+					packer.pack_raw(current_it_->size());
+					packer.pack_raw_body(current_it_->data(), current_it_->size());
+				}
+				else
+					writer_.String(current_it_->c_str(), current_it_->size());
+			}
+		}
+
+		const bool last = current_it_ == current_.end() && next_send_ == parts_;
+		if (last && !msgpack_) {
+			writer_.EndArray();
+			writer_.EndObject();
+		}
 
-	rapidjson::StringBuffer buffer; // creates string buffer for serialized json
-	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer); // creates json writer
-	d.Accept(writer); // accepts writer by json document
+		if (last || pending_size() >= consts::CHUNK_SIZE) {
+			chunk_.clear();
+			if (msgpack_) {
+				chunked::append_chunk(chunk_, packed_);
+				packed_.clear();
+			}
+			else {
+				chunked::append_chunk(chunk_, buffer_.GetString(), buffer_.Size());
+				buffer_.Clear();
+			}
 
-	const std::string result_str = buffer.GetString();
+			if (last) {
+				chunk_.append(chunked::LAST_CHUNK);
+				finished_ = true;
+			}
+
+			send_data = true;
+			sending_ = true;
+			send_headers = !headers_sent_;
+			headers_sent_ = true;
+		}
+	}
+
+	for (auto it = reads.begin(), end = reads.end(); it != end; ++it) {
+		read_part(*it);
+	}
+
+	if (!send_data)
+		return;
+
+	auto handler = std::bind(&on_get_active_users::on_send_finished,
+	                         shared_from_this(),
+	                         std::placeholders::_1);
+
+	if (!send_headers) {
+		get_reply()->send_data(boost::asio::buffer(chunk_), handler);
+		return;
+	}
 
 	ioremap::swarm::network_reply reply;
 	reply.set_code(ioremap::swarm::network_reply::ok);
-	reply.set_content_length(result_str.size());
-	reply.set_content_type("text/json");
-	get_reply()->send_headers(reply,
-	                          boost::asio::buffer(result_str),
-	                          std::bind(&on_get_active_users::on_send_finished,
+	reply.set_content_type(msgpack_ ? consts::MSGPACK_CONTENT_TYPE : "text/json");
+	reply.add_header(chunked::TRANSFER_ENCODING, chunked::CHUNKED);
+	get_reply()->send_headers(reply, boost::asio::buffer(chunk_), handler);
+}
+
+void on_get_active_users::fetch(active_users_cache::callback_t done)
+{
+	if (parts_ == 0) {
+		done(std::make_shared<const std::string>(serialize(fetched_, msgpack_)));
+		return;
+	}
+
+	fetched_.resize(parts_);
+	fetch_pending_ = parts_;
+
+	auto provider = get_server()->get_provider();
+
+	for (size_t i = 0; i < parts_; ++i) {
+		auto callback = std::bind(&on_get_active_users::on_fetched_part,
+		                          shared_from_this(),
+		                          i,
+		                          std::placeholders::_1,
+		                          std::placeholders::_2,
+		                          done);
+		provider->get_active_users_chunk(subkeys_, i, callback);
+	}
+}
+
+void on_get_active_users::on_fetched_part(size_t index,
+                                          const std::set<std::string>& active_users,
+                                          bool complete,
+                                          active_users_cache::callback_t done)
+{
+	fetched_[index] = active_users; // each part has own slot, so only the last part needs synchronization
+	if (!complete)
+		fetch_failed_ = true;
+
+	if (fetch_pending_.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		return;
+
+	if (fetch_failed_) { // incomplete reply isn't cached and isn't sent
+		fetched_.clear();
+		done(active_users_cache::reply_ptr());
+		return;
+	}
+
+	auto reply = std::make_shared<const std::string>(serialize(fetched_, msgpack_));
+	fetched_.clear();
+	done(reply);
+}
+
+void on_get_active_users::on_cached(const active_users_cache::reply_ptr& reply)
+{
+	if (!reply) {
+		get_reply()->send_error(ioremap::swarm::network_reply::internal_server_error);
+		return;
+	}
+
+	ioremap::swarm::network_reply headers;
+	headers.set_code(ioremap::swarm::network_reply::ok);
+	headers.set_content_length(reply->size());
+	headers.set_content_type(msgpack_ ? consts::MSGPACK_CONTENT_TYPE : "text/json");
+	get_reply()->send_headers(headers,
+	                          boost::asio::buffer(*reply),
+	                          std::bind(&on_get_active_users::on_cached_sent,
 	                                    shared_from_this(),
-	                                    result_str));
+	                                    reply,
+	                                    std::placeholders::_1));
+}
+
+void on_get_active_users::on_cached_sent(const active_users_cache::reply_ptr& /*reply*/, const boost::system::error_code &error)
+{
+	get_reply()->close(error);
+}
+
+void on_get_active_users::on_page(const active_users_page& page, bool complete)
+{
+	if (!complete) { // the cursor would skip users of the failed chunk
+		get_reply()->send_error(ioremap::swarm::network_reply::internal_server_error);
+		return;
+	}
+
+	on_cached(std::make_shared<const std::string>(serialize(page, msgpack_))); // the page is sent whole as cached reply
 }
 
-void on_get_active_users::on_send_finished(const std::string &)
+std::string on_get_active_users::serialize(const active_users_page& page, bool msgpack)
 {
-	get_reply()->close(boost::system::error_code());
+	if (msgpack) {
+		std::string ret;
+		string_stream stream(ret);
+		msgpack::packer<string_stream> packer(stream);
+		packer.pack_map(2);
+		packer.pack_raw(sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+		packer.pack_raw_body(consts::ACTIVE_USERS_ITEM, sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+		packer.pack_array(page.users.size());
+		for (auto it = page.users.begin(), end = page.users.end(); it != end; ++it) {
+			packer.pack_raw(it->size());
+			packer.pack_raw_body(it->data(), it->size());
+		}
+		packer.pack_raw(sizeof(consts::CURSOR_ITEM) - 1);
+		packer.pack_raw_body(consts::CURSOR_ITEM, sizeof(consts::CURSOR_ITEM) - 1);
+		packer.pack_raw(page.cursor.size());
+		packer.pack_raw_body(page.cursor.data(), page.cursor.size());
+		return ret;
+	}
+
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	writer.StartObject();
+	writer.String(consts::ACTIVE_USERS_ITEM);
+	writer.StartArray();
+	for (auto it = page.users.begin(), end = page.users.end(); it != end; ++it) {
+		writer.String(it->c_str(), it->size());
+	}
+	writer.EndArray();
+	writer.String(consts::CURSOR_ITEM);
+	writer.String(page.cursor.c_str(), page.cursor.size());
+	writer.EndObject();
+	return std::string(buffer.GetString(), buffer.Size());
+}
+
+std::string on_get_active_users::serialize(const std::vector<std::set<std::string>>& chunks, bool msgpack)
+{
+	if (msgpack) {
+		std::string ret;
+		string_stream stream(ret);
+		msgpack::packer<string_stream> packer(stream);
+		packer.pack_map(1);
+		packer.pack_raw(sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+		packer.pack_raw_body(consts::ACTIVE_USERS_ITEM, sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+		packer.pack_array(chunks.size());
+
+		for (auto chunk = chunks.begin(), end = chunks.end(); chunk != end; ++chunk) {
+			packer.pack_array(chunk->size());
+			for (auto it = chunk->begin(), it_end = chunk->end(); it != it_end; ++it) {
+				packer.pack_raw(it->size());
+				packer.pack_raw_body(it->data(), it->size());
+			}
+		}
+		return ret;
+	}
+
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	writer.StartObject();
+	writer.String(consts::ACTIVE_USERS_ITEM);
+	writer.StartArray();
+	for (auto chunk = chunks.begin(), end = chunks.end(); chunk != end; ++chunk) {
+		for (auto it = chunk->begin(), it_end = chunk->end(); it != it_end; ++it) {
+			writer.String(it->c_str(), it->size());
+		}
+	}
+	writer.EndArray();
+	writer.EndObject();
+	return std::string(buffer.GetString(), buffer.Size());
+}
+
+size_t on_get_active_users::pending_size() const
+{
+	return msgpack_ ? packed_.size() : buffer_.Size();
+}
+
+void on_get_active_users::on_send_finished(const boost::system::error_code &error)
+{
+	bool finished = false;
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		sending_ = false;
+		finished = finished_ || error;
+		finished_ = finished;
+	}
+
+	if (finished) {
+		get_reply()->close(error);
+		return;
+	}
+
+	process();
 }
 
 } /* namespace history */
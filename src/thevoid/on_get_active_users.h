@@ -3,19 +3,80 @@
 
 #include "webserver.h"
 
+#include <historydb/provider.h>
+
 #include <set>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+#include "../fastcgi/rapidjson/writer.h"
+#include "../fastcgi/rapidjson/stringbuffer.h"
 
 namespace history {
 
+	/* Sends active users part by part in chunked reply, users of one part are sent by batches.
+	 * The next part is read while the current one is being sent.
+	 * Users which are active in several days are sent once.
+	 * The reply is read by chunks of activity statistics of all days: each user is in one chunk,
+	 * so chunks are deduplicated independently and memory is bounded by one chunk of all days.
+	 * If the client accepts msgpack, the reply is {"active_users": [[users of each chunk]]},
+	 * users are listed once as in json and only the size of each chunk is known before it is sent.
+	 * If some part fails, the request replies with error or, if the headers have been sent,
+ * closes the connection without the last chunk.
+ * If the cache is enabled, days are sorted and deduplicated, the whole reply is serialized once
+	 * and then is sent from the cache.
+	 * If the request has parameter limit, only one page of users is sent:
+	 * {"active_users": [...], "cursor": "cursor of the next page or empty"}.
+	 */
 	struct on_get_active_users :
 		public ioremap::thevoid::simple_request_stream<webserver>,
 		public std::enable_shared_from_this<on_get_active_users>
 	{
+		on_get_active_users();
+
 		virtual void on_request(const ioremap::swarm::network_request &req,
 		                        const boost::asio::const_buffer &buffer);
-		void on_finished(const std::set<std::string>& active_users);
-		void on_send_finished(const std::string &);
+		void on_part(size_t index, const std::set<std::string>& active_users, bool complete);
+		void on_send_finished(const boost::system::error_code &error);
+		void fetch(active_users_cache::callback_t done);
+		void on_fetched_part(size_t index,
+		                     const std::set<std::string>& active_users,
+		                     bool complete,
+		                     active_users_cache::callback_t done);
+		void on_cached(const active_users_cache::reply_ptr& reply);
+		void on_cached_sent(const active_users_cache::reply_ptr& reply, const boost::system::error_code &error);
+		void on_page(const active_users_page& page, bool complete);
 		virtual void on_close(const boost::system::error_code &) {}
+
+	private:
+		void read_part(size_t index); // reads the chunk of all days
+		void process();
+		size_t pending_size() const; // size of serialized users which haven't been framed into chunk
+		// serializes the whole reply of chunks in the same format and order as it is streamed
+		static std::string serialize(const std::vector<std::set<std::string>>& chunks, bool msgpack);
+		static std::string serialize(const active_users_page& page, bool msgpack);
+
+		std::vector<std::string>					subkeys_; // subkeys of the days in order of sending
+		std::map<size_t, std::set<std::string>>		parts_read_; // parts which have been read but haven't been sent yet
+		std::set<std::string>						current_; // part which is being sent
+		std::set<std::string>::const_iterator		current_it_; // the first user of current_ which hasn't been sent
+		size_t										parts_; // number of chunks of activity statistics
+		size_t										next_read_; // index of the next part which should be read
+		size_t										next_send_; // index of the next part which should be sent
+		bool										sending_; // true if some chunk is being sent
+		bool										headers_sent_;
+		bool										finished_; // true if the last chunk has been sent
+		bool										failed_; // true if some part hasn't been read completely
+		bool										msgpack_; // true if the reply is serialized into msgpack
+		rapidjson::StringBuffer						buffer_; // serialized users which haven't been framed into chunk
+		rapidjson::Writer<rapidjson::StringBuffer>	writer_;
+		std::string									packed_; // packed users which haven't been framed into chunk
+		std::string									chunk_; // chunk which is being sent
+		std::vector<std::set<std::string>>			fetched_; // parts which are fetched for the cache
+		std::atomic<size_t>							fetch_pending_; // number of parts which are being fetched
+		std::atomic<bool>							fetch_failed_; // true if some part hasn't been read completely
+		std::mutex									mutex_;
 	};
 
 } /* namespace history */
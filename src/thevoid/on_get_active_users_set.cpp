@@ -0,0 +1,132 @@
+#include "on_get_active_users_set.h"
+
+#include <swarm/network_url.h>
+#include <swarm/network_query_list.h>
+
+#include <historydb/provider.h>
+#include <elliptics/error.hpp>
+
+#include <boost/lexical_cast.hpp>
+
+#include <msgpack.hpp>
+
+#include "../fastcgi/rapidjson/writer.h"
+#include "../fastcgi/rapidjson/stringbuffer.h"
+
+namespace history {
+
+namespace consts {
+const char BEGIN_TIME_ITEM[] = "begin_time";
+const char END_TIME_ITEM[] = "end_time";
+const char KEYS_ITEM[] = "keys";
+const char OP_ITEM[] = "op";
+const char DAYS_ITEM[] = "days";
+const char EXCLUDE_KEYS_ITEM[] = "exclude_keys";
+const char EXCLUDE_BEGIN_TIME_ITEM[] = "exclude_begin_time";
+const char EXCLUDE_END_TIME_ITEM[] = "exclude_end_time";
+const char INTERSECTION_OP[] = "intersection";
+const char AT_LEAST_OP[] = "at_least";
+const char DIFFERENCE_OP[] = "difference";
+const char ACTIVE_USERS_ITEM[] = "active_users";
+const char MSGPACK_CONTENT_TYPE[] = "application/x-msgpack";
+}
+
+on_get_active_users_set::on_get_active_users_set()
+: msgpack_(false)
+{}
+
+void on_get_active_users_set::on_request(const ioremap::swarm::network_request &req,
+                                         const boost::asio::const_buffer &/*buffer*/)
+{
+	try {
+		ioremap::swarm::network_url url(req.get_url());
+		ioremap::swarm::network_query_list query_list(url.query());
+
+		msgpack_ = webserver::accepts_msgpack(req);
+
+		std::vector<std::string> subkeys;
+		if (!webserver::request_keys(query_list, consts::KEYS_ITEM, consts::BEGIN_TIME_ITEM, consts::END_TIME_ITEM, subkeys))
+			throw std::invalid_argument("key and time are missed");
+		if (!query_list.has_item(consts::OP_ITEM))
+			throw std::invalid_argument("op is missed");
+
+		auto provider = get_server()->get_provider();
+		provider->check_range(subkeys); // rejects too long range before any read
+
+		auto callback = std::bind(&on_get_active_users_set::on_users, shared_from_this(), std::placeholders::_1);
+
+		const auto op = query_list.item_value(consts::OP_ITEM);
+		if (op == consts::INTERSECTION_OP)
+			provider->get_active_users_intersection(subkeys, callback);
+		else if (op == consts::AT_LEAST_OP)
+			provider->get_active_users_at_least(subkeys,
+			                                    boost::lexical_cast<uint32_t>(query_list.item_value(consts::DAYS_ITEM)),
+			                                    callback);
+		else if (op == consts::DIFFERENCE_OP) {
+			std::vector<std::string> excluded;
+			if (!webserver::request_keys(query_list,
+			                             consts::EXCLUDE_KEYS_ITEM,
+			                             consts::EXCLUDE_BEGIN_TIME_ITEM,
+			                             consts::EXCLUDE_END_TIME_ITEM,
+			                             excluded))
+				throw std::invalid_argument("exclude key and time are missed");
+			provider->check_range(excluded);
+			provider->get_active_users_difference(subkeys, excluded, callback);
+		}
+		else
+			throw std::invalid_argument("unknown op");
+	}
+	catch(ioremap::elliptics::error& e) {
+		get_reply()->send_error(ioremap::swarm::network_reply::internal_server_error);
+	}
+	catch(...) {
+		get_reply()->send_error(ioremap::swarm::network_reply::bad_request);
+	}
+}
+
+void on_get_active_users_set::on_users(const std::set<std::string>& active_users)
+{
+	if (msgpack_) {
+		msgpack::sbuffer buffer;
+		msgpack::packer<msgpack::sbuffer> packer(&buffer);
+		packer.pack_map(1);
+		packer.pack_raw(sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+		packer.pack_raw_body(consts::ACTIVE_USERS_ITEM, sizeof(consts::ACTIVE_USERS_ITEM) - 1);
+		packer.pack_array(active_users.size());
+		for (auto it = active_users.begin(), end = active_users.end(); it != end; ++it) {
+			packer.pack_raw(it->size());
+			packer.pack_raw_body(it->data(), it->size());
+		}
+		body_.assign(buffer.data(), buffer.size());
+	}
+	else {
+		rapidjson::StringBuffer buffer;
+		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+		writer.StartObject();
+		writer.String(consts::ACTIVE_USERS_ITEM);
+		writer.StartArray();
+		for (auto it = active_users.begin(), end = active_users.end(); it != end; ++it) {
+			writer.String(it->c_str(), it->size());
+		}
+		writer.EndArray();
+		writer.EndObject();
+		body_.assign(buffer.GetString(), buffer.Size());
+	}
+
+	ioremap::swarm::network_reply reply;
+	reply.set_code(ioremap::swarm::network_reply::ok);
+	reply.set_content_length(body_.size());
+	reply.set_content_type(msgpack_ ? consts::MSGPACK_CONTENT_TYPE : "text/json");
+	get_reply()->send_headers(reply,
+	                          boost::asio::buffer(body_),
+	                          std::bind(&on_get_active_users_set::on_send_finished,
+	                                    shared_from_this(),
+	                                    std::placeholders::_1));
+}
+
+void on_get_active_users_set::on_send_finished(const boost::system::error_code &error)
+{
+	get_reply()->close(error);
+}
+
+} /* namespace history */
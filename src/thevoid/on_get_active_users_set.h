@@ -0,0 +1,33 @@
+#ifndef HISTORY_SRC_THEVOID_ON_GET_ACTIVE_USERS_SET_H
+#define HISTORY_SRC_THEVOID_ON_GET_ACTIVE_USERS_SET_H
+
+#include "webserver.h"
+
+#include <set>
+
+namespace history {
+
+	/* Sends result of set operation over active users of the days: {"active_users": [...]}.
+	 * Operation "intersection" - users active in each day, "at_least" - users active in at least "days" days,
+	 * "difference" - users active in the days and not active in excluded days.
+	 */
+	struct on_get_active_users_set :
+		public ioremap::thevoid::simple_request_stream<webserver>,
+		public std::enable_shared_from_this<on_get_active_users_set>
+	{
+		on_get_active_users_set();
+
+		virtual void on_request(const ioremap::swarm::network_request &req,
+		                        const boost::asio::const_buffer &buffer);
+		void on_users(const std::set<std::string>& active_users);
+		void on_send_finished(const boost::system::error_code &error);
+		virtual void on_close(const boost::system::error_code &) {}
+
+	private:
+		bool		msgpack_; // true if the reply is serialized into msgpack
+		std::string	body_; // serialized users, it is kept until the reply is sent
+	};
+
+} /* namespace history */
+
+#endif //HISTORY_SRC_THEVOID_ON_GET_ACTIVE_USERS_SET_H
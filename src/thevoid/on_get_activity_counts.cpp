@@ -0,0 +1,106 @@
+#include "on_get_activity_counts.h"
+
+#include <swarm/network_url.h>
+#include <swarm/network_query_list.h>
+
+#include <historydb/provider.h>
+#include <elliptics/error.hpp>
+
+
+#include <msgpack.hpp>
+
+#include "../fastcgi/rapidjson/writer.h"
+#include "../fastcgi/rapidjson/stringbuffer.h"
+
+namespace history {
+
+namespace consts {
+const char BEGIN_TIME_ITEM[] = "begin_time";
+const char END_TIME_ITEM[] = "end_time";
+const char KEYS_ITEM[] = "keys";
+const char ACTIVITY_COUNTS_ITEM[] = "activity_counts";
+const char MSGPACK_CONTENT_TYPE[] = "application/x-msgpack";
+}
+
+on_get_activity_counts::on_get_activity_counts()
+: msgpack_(false)
+{}
+
+void on_get_activity_counts::on_request(const ioremap::swarm::network_request &req,
+                                        const boost::asio::const_buffer &/*buffer*/)
+{
+	try {
+		ioremap::swarm::network_url url(req.get_url());
+		ioremap::swarm::network_query_list query_list(url.query());
+
+		msgpack_ = webserver::accepts_msgpack(req);
+
+		std::vector<std::string> subkeys;
+		if (!webserver::request_keys(query_list, consts::KEYS_ITEM, consts::BEGIN_TIME_ITEM, consts::END_TIME_ITEM, subkeys))
+			throw std::invalid_argument("key and time are missed");
+
+		get_server()->get_provider()->check_range(subkeys); // rejects too long range before any read
+
+		get_server()
+		->get_provider()
+		->get_activity_counts(subkeys,
+		                      std::bind(&on_get_activity_counts::on_counts,
+		                                shared_from_this(),
+		                                std::placeholders::_1));
+	}
+	catch(ioremap::elliptics::error& e) {
+		get_reply()->send_error(ioremap::swarm::network_reply::internal_server_error);
+	}
+	catch(...) {
+		get_reply()->send_error(ioremap::swarm::network_reply::bad_request);
+	}
+}
+
+void on_get_activity_counts::on_counts(const std::map<std::string, uint64_t>& counts)
+{
+	if (msgpack_) {
+		msgpack::sbuffer buffer;
+		msgpack::packer<msgpack::sbuffer> packer(&buffer);
+		packer.pack_map(1);
+		packer.pack_raw(sizeof(consts::ACTIVITY_COUNTS_ITEM) - 1);
+		packer.pack_raw_body(consts::ACTIVITY_COUNTS_ITEM, sizeof(consts::ACTIVITY_COUNTS_ITEM) - 1);
+		packer.pack_map(counts.size());
+		for (auto it = counts.begin(), end = counts.end(); it != end; ++it) {
+			packer.pack_raw(it->first.size());
+			packer.pack_raw_body(it->first.data(), it->first.size());
+			packer.pack_uint64(it->second);
+		}
+		body_.assign(buffer.data(), buffer.size());
+	}
+	else {
+		rapidjson::StringBuffer buffer;
+		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+		writer.StartObject();
+		writer.String(consts::ACTIVITY_COUNTS_ITEM);
+		writer.StartObject();
+		for (auto it = counts.begin(), end = counts.end(); it != end; ++it) {
+			writer.String(it->first.c_str(), it->first.size());
+			writer.Uint64(it->second);
+		}
+		writer.EndObject();
+		writer.EndObject();
+		body_.assign(buffer.GetString(), buffer.Size());
+	}
+
+	ioremap::swarm::network_reply reply;
+	reply.set_code(ioremap::swarm::network_reply::ok);
+	reply.set_content_length(body_.size());
+	reply.set_content_type(msgpack_ ? consts::MSGPACK_CONTENT_TYPE : "text/json");
+	get_reply()->send_headers(reply,
+	                          boost::asio::buffer(body_),
+	                          std::bind(&on_get_activity_counts::on_send_finished,
+	                                    shared_from_this(),
+	                                    std::placeholders::_1));
+}
+
+void on_get_activity_counts::on_send_finished(const boost::system::error_code &error)
+{
+	get_reply()->close(error);
+}
+
+} /* namespace history */
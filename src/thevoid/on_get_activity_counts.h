@@ -0,0 +1,32 @@
+#ifndef HISTORY_SRC_THEVOID_ON_GET_ACTIVITY_COUNTS_H
+#define HISTORY_SRC_THEVOID_ON_GET_ACTIVITY_COUNTS_H
+
+#include "webserver.h"
+
+#include <map>
+
+namespace history {
+
+	/* Sends number of activities of each active user: {"activity_counts": {"user": count}}.
+	 * If the client accepts msgpack, the reply is the same map packed into msgpack.
+	 */
+	struct on_get_activity_counts :
+		public ioremap::thevoid::simple_request_stream<webserver>,
+		public std::enable_shared_from_this<on_get_activity_counts>
+	{
+		on_get_activity_counts();
+
+		virtual void on_request(const ioremap::swarm::network_request &req,
+		                        const boost::asio::const_buffer &buffer);
+		void on_counts(const std::map<std::string, uint64_t>& counts);
+		void on_send_finished(const boost::system::error_code &error);
+		virtual void on_close(const boost::system::error_code &) {}
+
+	private:
+		bool		msgpack_; // true if the reply is serialized into msgpack
+		std::string	body_; // serialized counts, it is kept until the reply is sent
+	};
+
+} /* namespace history */
+
+#endif //HISTORY_SRC_THEVOID_ON_GET_ACTIVITY_COUNTS_H
@@ -7,12 +7,10 @@
 #include <elliptics/error.hpp>
 
 #include <boost/bind.hpp>
-#include <boost/lexical_cast.hpp>
-#include <boost/algorithm/string.hpp>
 
-#include "../fastcgi/rapidjson/document.h"
-#include "../fastcgi/rapidjson/writer.h"
-#include "../fastcgi/rapidjson/stringbuffer.h"
+#include <msgpack.hpp>
+
+#include "chunked.h"
 
 namespace history {
 
@@ -21,8 +19,23 @@ const char USER_ITEM[] = "user";
 const char BEGIN_TIME_ITEM[] = "begin_time";
 const char END_TIME_ITEM[] = "end_time";
 const char KEYS_ITEM[] = "keys";
+const char LOGS_BEGIN[] = "{\"logs\":\"";
+const char LOGS_END[] = "\"}";
+const char LOGS_ITEM[] = "logs";
+const char MSGPACK_CONTENT_TYPE[] = "application/x-msgpack";
+const size_t DAYS_IN_FLIGHT = 2; // number of days which are read or sent simultaneously
 }
 
+on_get_user_logs::on_get_user_logs()
+: next_read_(0)
+, next_send_(0)
+, sending_(false)
+, headers_sent_(false)
+, finished_(false)
+, failed_(false)
+, msgpack_(false)
+{}
+
 void on_get_user_logs::on_request(const ioremap::swarm::network_request &req, const boost::asio::const_buffer &/*buffer*/)
 {
 	try {
@@ -30,36 +43,21 @@ void on_get_user_logs::on_request(const ioremap::swarm::network_request &req, co
 		ioremap::swarm::network_query_list query_list(url.query());
 
 		if (!query_list.has_item(consts::USER_ITEM) ||
-		    (!query_list.has_item(consts::KEYS_ITEM) &&
-		    (!query_list.has_item(consts::BEGIN_TIME_ITEM) ||
-		     !query_list.has_item(consts::END_TIME_ITEM)))) // checks required parameters
+		    !webserver::request_keys(query_list, consts::KEYS_ITEM, consts::BEGIN_TIME_ITEM, consts::END_TIME_ITEM, subkeys_)) // checks required parameters
 			throw std::invalid_argument("user or begin_time or end_time is missed");
 
-		if (query_list.has_item(consts::KEYS_ITEM)) {
-			std::string keys_value = query_list.item_value(consts::KEYS_ITEM);
-			std::vector<std::string> keys;
-			boost::split(keys, keys_value, boost::is_any_of(":"));
-			get_server()
-			->get_provider()
-			->get_user_logs(query_list.item_value(consts::USER_ITEM),
-			                keys,
-			                std::bind(&on_get_user_logs::on_finished,
-			                          shared_from_this(),
-			                          std::placeholders::_1));
-		}
-		else if(query_list.has_item(consts::BEGIN_TIME_ITEM) && query_list.has_item(consts::END_TIME_ITEM)) {
-			get_server()
-			->get_provider()
-			->get_user_logs(query_list.item_value(consts::USER_ITEM),
-			                boost::lexical_cast<uint64_t>(query_list.item_value(consts::BEGIN_TIME_ITEM)),
-			                boost::lexical_cast<uint64_t>(query_list.item_value(consts::END_TIME_ITEM)),
-			                std::bind(&on_get_user_logs::on_finished,
-			                          shared_from_this(),
-			                          std::placeholders::_1));
-		}
-		else
-			throw std::invalid_argument("something is missed");
+		user_ = query_list.item_value(consts::USER_ITEM);
+		msgpack_ = webserver::accepts_msgpack(req);
+
+		get_server()->get_provider()->check_range(subkeys_); // rejects too long range before any read
 
+		get_server()
+		->get_provider()
+		->select_user_logs(user_,
+		                   subkeys_,
+		                   std::bind(&on_get_user_logs::on_selected,
+		                             shared_from_this(),
+		                             std::placeholders::_1));
 	}
 	catch(ioremap::elliptics::error& e) {
 		get_reply()->send_error(ioremap::swarm::network_reply::internal_server_error);
@@ -69,39 +67,197 @@ void on_get_user_logs::on_request(const ioremap::swarm::network_request &req, co
 	}
 }
 
-bool on_get_user_logs::on_finished(const std::vector<char>& data)
+void on_get_user_logs::on_selected(const std::vector<std::string>& selected)
+{
+	std::vector<size_t> reads;
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		selected_.resize(subkeys_.size(), false);
+		for (size_t i = 0, j = 0; i < subkeys_.size() && j < selected.size(); ++i) { // selected subkeys are in order of subkeys_
+			if (subkeys_[i] == selected[j]) {
+				selected_[i] = true;
+				reads_.push_back(i);
+				++j;
+			}
+		}
+
+		while (next_read_ < reads_.size() && next_read_ < consts::DAYS_IN_FLIGHT) {
+			reads.push_back(reads_[next_read_++]);
+		}
+	}
+
+	for (auto it = reads.begin(), end = reads.end(); it != end; ++it) {
+		read_day(*it);
+	}
+
+	process();
+}
+
+void on_get_user_logs::read_day(size_t index)
 {
-	std::string result_str;
-	if(!data.empty()) {
-		rapidjson::Document d; // creates json document
-		d.SetObject();
+	get_server()
+	->get_provider()
+	->get_selected_user_logs(user_,
+	                         std::vector<std::string>(1, subkeys_[index]),
+	                         std::bind(&on_get_user_logs::on_day,
+	                                   shared_from_this(),
+	                                   index,
+	                                   std::placeholders::_1,
+	                                   std::placeholders::_2));
+}
+
+void on_get_user_logs::on_day(size_t index, const std::vector<char>& data, bool complete)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (complete)
+			days_[index] = data;
+		else
+			failed_ = true;
+	}
+	process();
+}
+
+void on_get_user_logs::process()
+{
+	std::vector<size_t> reads;
+	bool send_headers = false;
+	bool send_data = false;
+
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (sending_ || finished_ || selected_.size() != subkeys_.size()) // days haven't been selected yet
+			return;
+
+		if (failed_) { // days which are in flight are ignored
+			finished_ = true;
+			const bool headers_sent = headers_sent_;
+			lock.unlock();
+			if (headers_sent)
+				get_reply()->close(chunked::part_error());
+			else
+				get_reply()->send_error(ioremap::swarm::network_reply::internal_server_error);
+			return;
+		}
+
+		chunk_.clear();
+		while (next_send_ < subkeys_.size()) { // takes days in order until non-empty day is found
+			std::vector<char> data;
+			if (selected_[next_send_]) { // days which aren't selected don't have logs
+				auto it = days_.find(next_send_);
+				if (it == days_.end())
+					break;
+
+				data.swap(it->second);
+				days_.erase(it);
+
+				if (next_read_ < reads_.size()) // starts reading the next day instead of taken one
+					reads.push_back(reads_[next_read_++]);
+			}
+			++next_send_;
+
+			if (data.empty() && !msgpack_) // msgpack reply has an item for each day
+				continue;
+
+			if (msgpack_) {
+				append_msgpack(chunk_, &data);
+			}
+			else {
+				std::string part;
+				if (!headers_sent_)
+					part = consts::LOGS_BEGIN;
+				chunked::append_json_string_part(part, data.data(), data.size());
+				chunked::append_chunk(chunk_, part);
+			}
+			send_data = true;
+
+			if (!data.empty())
+				break;
+		}
+
+		if (!send_data && next_send_ == subkeys_.size()) { // all days have been sent
+			if (msgpack_) {
+				if (!headers_sent_) // there are no days
+					append_msgpack(chunk_, NULL);
+				chunk_.append(chunked::LAST_CHUNK);
+			}
+			else if (headers_sent_) {
+				chunked::append_chunk(chunk_, consts::LOGS_END, sizeof(consts::LOGS_END) - 1);
+				chunk_.append(chunked::LAST_CHUNK);
+			}
+			send_data = true;
+			finished_ = true;
+		}
+
+		if (send_data) {
+			sending_ = true;
+			send_headers = !headers_sent_;
+			headers_sent_ = true;
+		}
+	}
 
-		rapidjson::Value user_logs(data.data(), data.size(), d.GetAllocator()); // creates vector value for user one's day log
+	for (auto it = reads.begin(), end = reads.end(); it != end; ++it) {
+		read_day(*it);
+	}
 
-		d.AddMember("logs", user_logs, d.GetAllocator()); // adds logs array to json document
+	if (!send_data)
+		return;
 
-		rapidjson::StringBuffer buffer; // creates string buffer for serialized json
-		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer); // creates json writer
-		d.Accept(writer); // accepts writer by json document
+	auto handler = std::bind(&on_get_user_logs::on_send_finished,
+	                         shared_from_this(),
+	                         std::placeholders::_1);
 
-		result_str = buffer.GetString();
+	if (!send_headers) {
+		get_reply()->send_data(boost::asio::buffer(chunk_), handler);
+		return;
 	}
 
 	ioremap::swarm::network_reply reply;
 	reply.set_code(ioremap::swarm::network_reply::ok);
-	reply.set_content_length(result_str.size());
-	reply.set_content_type("text/json");
-	get_reply()->send_headers(reply,
-	                          boost::asio::buffer(result_str),
-	                          std::bind(&on_get_user_logs::on_send_finished,
-	                                    shared_from_this(),
-	                                    result_str));
-	return false;
+	reply.set_content_type(msgpack_ ? consts::MSGPACK_CONTENT_TYPE : "text/json");
+	if (chunk_.empty()) // user has no logs: replies with empty body as before
+		reply.set_content_length(0);
+	else
+		reply.add_header(chunked::TRANSFER_ENCODING, chunked::CHUNKED);
+	get_reply()->send_headers(reply, boost::asio::buffer(chunk_), handler);
 }
 
-void on_get_user_logs::on_send_finished(const std::string &)
+void on_get_user_logs::append_msgpack(std::string& out, const std::vector<char>* data)
 {
-	get_reply()->close(boost::system::error_code());
+	msgpack::sbuffer buffer;
+	msgpack::packer<msgpack::sbuffer> packer(&buffer);
+
+	if (!headers_sent_ && out.empty()) { // the first chunk starts the map: {"logs": [day logs, ...]}
+		packer.pack_map(1);
+		packer.pack_raw(sizeof(consts::LOGS_ITEM) - 1);
+		packer.pack_raw_body(consts::LOGS_ITEM, sizeof(consts::LOGS_ITEM) - 1);
+		packer.pack_array(subkeys_.size());
+	}
+
+	if (data) {
+		packer.pack_raw(data->size());
+		packer.pack_raw_body(data->data(), data->size());
+	}
+
+	chunked::append_chunk(out, buffer.data(), buffer.size());
+}
+
+void on_get_user_logs::on_send_finished(const boost::system::error_code &error)
+{
+	bool finished = false;
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		sending_ = false;
+		finished = finished_ || error;
+		finished_ = finished;
+	}
+
+	if (finished) {
+		get_reply()->close(error);
+		return;
+	}
+
+	process();
 }
 
 } /* namespace history */
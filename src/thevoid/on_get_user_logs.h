@@ -3,17 +3,51 @@
 
 #include "webserver.h"
 
+#include <map>
+#include <mutex>
+
 namespace history {
 
+	/* Sends user logs day by day in chunked reply.
+	 * Days which may have logs are selected once for the whole range, so marks of days are read once,
+	 * and only selected days are read. The next day is read while the current one is being sent,
+	 * so the request holds at most two days of logs. Empty days of msgpack reply are sent with the next day.
+	 * If the client accepts msgpack, the reply is {"logs": [raw logs of each day]}.
+ * If some day fails, the request replies with error or, if the headers have been sent,
+ * closes the connection without the last chunk.
+	 */
 	struct on_get_user_logs :
 		public ioremap::thevoid::simple_request_stream<webserver>,
 		public std::enable_shared_from_this<on_get_user_logs>
 	{
+		on_get_user_logs();
+
 		virtual void on_request(const ioremap::swarm::network_request &req,
 		                        const boost::asio::const_buffer &buffer);
-		bool on_finished(const std::vector<char>& data);
-		void on_send_finished(const std::string &);
+		void on_selected(const std::vector<std::string>& selected);
+		void on_day(size_t index, const std::vector<char>& data, bool complete);
+		void on_send_finished(const boost::system::error_code &error);
 		virtual void on_close(const boost::system::error_code &) {}
+
+	private:
+		void read_day(size_t index);
+		void process();
+		void append_msgpack(std::string& out, const std::vector<char>* data); // data is NULL if there are no days
+
+		std::string							user_;
+		std::vector<std::string>			subkeys_; // subkeys of the days in order of sending
+		std::vector<bool>					selected_; // whether the day may have logs, empty until days are selected
+		std::vector<size_t>					reads_; // indexes of selected days in order of reading
+		std::map<size_t, std::vector<char>>	days_; // days which have been read but haven't been sent yet
+		size_t								next_read_; // index of the next day in reads_ which should be read
+		size_t								next_send_; // index of the next day which should be sent
+		bool								sending_; // true if some chunk is being sent
+		bool								headers_sent_;
+		bool								finished_; // true if the last chunk has been sent
+		bool								failed_; // true if some day hasn't been read completely
+		bool								msgpack_; // true if the reply is serialized into msgpack
+		std::string							chunk_; // chunk which is being sent
+		std::mutex							mutex_;
 	};
 
 } /* namespace history */
@@ -0,0 +1,126 @@
+#include "on_is_active.h"
+
+#include <swarm/network_url.h>
+#include <swarm/network_query_list.h>
+
+#include <historydb/provider.h>
+#include <elliptics/error.hpp>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include <msgpack.hpp>
+
+#include "../fastcgi/rapidjson/writer.h"
+#include "../fastcgi/rapidjson/stringbuffer.h"
+
+namespace history {
+
+namespace consts {
+const char USER_ITEM[] = "user";
+const char USERS_ITEM[] = "users";
+const char TIME_ITEM[] = "time";
+const char KEY_ITEM[] = "key";
+const char ACTIVE_ITEM[] = "active";
+const char MSGPACK_CONTENT_TYPE[] = "application/x-msgpack";
+}
+
+on_is_active::on_is_active()
+: msgpack_(false)
+{}
+
+void on_is_active::on_request(const ioremap::swarm::network_request &req,
+                              const boost::asio::const_buffer &/*buffer*/)
+{
+	try {
+		ioremap::swarm::network_url url(req.get_url());
+		ioremap::swarm::network_query_list query_list(url.query());
+
+		msgpack_ = webserver::accepts_msgpack(req);
+
+		if (query_list.has_item(consts::USERS_ITEM)) {
+			std::string users_value = query_list.item_value(consts::USERS_ITEM);
+			boost::split(users_, users_value, boost::is_any_of(":"));
+		}
+		else if (query_list.has_item(consts::USER_ITEM))
+			users_.push_back(query_list.item_value(consts::USER_ITEM));
+		else
+			throw std::invalid_argument("user is missed");
+
+		std::string subkey;
+		if (query_list.has_item(consts::KEY_ITEM))
+			subkey = query_list.item_value(consts::KEY_ITEM);
+		else if (query_list.has_item(consts::TIME_ITEM)) {
+			auto time = boost::lexical_cast<uint64_t>(query_list.item_value(consts::TIME_ITEM));
+			subkey = time_period_to_subkeys(time, time).front();
+		}
+		else
+			throw std::invalid_argument("key and time are missed");
+
+		get_server()
+		->get_provider()
+		->is_active(users_,
+		            subkey,
+		            std::bind(&on_is_active::on_active,
+		                      shared_from_this(),
+		                      std::placeholders::_1));
+	}
+	catch(ioremap::elliptics::error& e) {
+		get_reply()->send_error(ioremap::swarm::network_reply::internal_server_error);
+	}
+	catch(...) {
+		get_reply()->send_error(ioremap::swarm::network_reply::bad_request);
+	}
+}
+
+void on_is_active::on_active(const std::vector<bool>& active)
+{
+	if (msgpack_) {
+		msgpack::sbuffer buffer;
+		msgpack::packer<msgpack::sbuffer> packer(&buffer);
+		packer.pack_map(1);
+		packer.pack_raw(sizeof(consts::ACTIVE_ITEM) - 1);
+		packer.pack_raw_body(consts::ACTIVE_ITEM, sizeof(consts::ACTIVE_ITEM) - 1);
+		packer.pack_map(users_.size());
+		for (size_t i = 0; i < users_.size(); ++i) {
+			packer.pack_raw(users_[i].size());
+			packer.pack_raw_body(users_[i].data(), users_[i].size());
+			if (active[i])
+				packer.pack_true();
+			else
+				packer.pack_false();
+		}
+		body_.assign(buffer.data(), buffer.size());
+	}
+	else {
+		rapidjson::StringBuffer buffer;
+		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+		writer.StartObject();
+		writer.String(consts::ACTIVE_ITEM);
+		writer.StartObject();
+		for (size_t i = 0; i < users_.size(); ++i) {
+			writer.String(users_[i].c_str(), users_[i].size());
+			writer.Bool(active[i]);
+		}
+		writer.EndObject();
+		writer.EndObject();
+		body_.assign(buffer.GetString(), buffer.Size());
+	}
+
+	ioremap::swarm::network_reply reply;
+	reply.set_code(ioremap::swarm::network_reply::ok);
+	reply.set_content_length(body_.size());
+	reply.set_content_type(msgpack_ ? consts::MSGPACK_CONTENT_TYPE : "text/json");
+	get_reply()->send_headers(reply,
+	                          boost::asio::buffer(body_),
+	                          std::bind(&on_is_active::on_send_finished,
+	                                    shared_from_this(),
+	                                    std::placeholders::_1));
+}
+
+void on_is_active::on_send_finished(const boost::system::error_code &error)
+{
+	get_reply()->close(error);
+}
+
+} /* namespace history */
@@ -0,0 +1,31 @@
+#ifndef HISTORY_SRC_THEVOID_ON_IS_ACTIVE_H
+#define HISTORY_SRC_THEVOID_ON_IS_ACTIVE_H
+
+#include "webserver.h"
+
+namespace history {
+
+	/* Sends activity of users in the day: {"active": {"user": true}}.
+	 * If the client accepts msgpack, the reply is the same map packed into msgpack.
+	 */
+	struct on_is_active :
+		public ioremap::thevoid::simple_request_stream<webserver>,
+		public std::enable_shared_from_this<on_is_active>
+	{
+		on_is_active();
+
+		virtual void on_request(const ioremap::swarm::network_request &req,
+		                        const boost::asio::const_buffer &buffer);
+		void on_active(const std::vector<bool>& active);
+		void on_send_finished(const boost::system::error_code &error);
+		virtual void on_close(const boost::system::error_code &) {}
+
+	private:
+		bool						msgpack_; // true if the reply is serialized into msgpack
+		std::vector<std::string>	users_; // checked users
+		std::string					body_; // serialized activity, it is kept until the reply is sent
+	};
+
+} /* namespace history */
+
+#endif //HISTORY_SRC_THEVOID_ON_IS_ACTIVE_H
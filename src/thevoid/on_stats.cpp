@@ -0,0 +1,265 @@
+#include "on_stats.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <swarm/network_url.h>
+#include <swarm/network_query_list.h>
+
+#include <historydb/provider.h>
+
+#include "../fastcgi/rapidjson/writer.h"
+#include "../fastcgi/rapidjson/stringbuffer.h"
+
+namespace history {
+
+namespace consts {
+const char FORMAT_ITEM[] = "format";
+const char PROMETHEUS_FORMAT[] = "prometheus";
+const char ACCEPT_HEADER[] = "Accept";
+const char TEXT_CONTENT_TYPE[] = "text/plain";
+const char PROMETHEUS_CONTENT_TYPE[] = "text/plain; version=0.0.4";
+const char* const CODE_CLASSES[server_stats::CODE_CLASSES] = {"none", "1xx", "2xx", "3xx", "4xx", "5xx"};
+}
+
+namespace {
+// number of requests which are being processed, counters are read without synchronization, so it can't be negative
+uint64_t in_flight(const server_stats::snapshot::endpoint& endpoint)
+{
+	return endpoint.started > endpoint.finished ? endpoint.started - endpoint.finished : 0;
+}
+
+std::string to_json(const server_stats::snapshot& stats,
+                    const provider_stats& provider,
+                    const active_users_cache::stats* cache)
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+
+	writer.StartObject();
+	writer.String("uptime");
+	writer.Uint64(stats.uptime);
+
+	writer.String("endpoints");
+	writer.StartObject();
+	for (size_t i = 0; i < ENDPOINTS_COUNT; ++i) {
+		const auto& endpoint = stats.endpoints[i];
+
+		writer.String(endpoint_path(static_cast<endpoint_id>(i)));
+		writer.StartObject();
+		writer.String("requests");
+		writer.Uint64(endpoint.finished);
+		writer.String("in_flight");
+		writer.Uint64(in_flight(endpoint));
+
+		writer.String("codes");
+		writer.StartObject();
+		for (size_t j = 0; j < server_stats::CODE_CLASSES; ++j) {
+			writer.String(consts::CODE_CLASSES[j]);
+			writer.Uint64(endpoint.codes[j]);
+		}
+		writer.EndObject();
+
+		writer.String("latency_sum_us");
+		writer.Uint64(endpoint.latency_sum);
+
+		writer.String("latency_us"); // [upper bound, count] of non-empty buckets, the last bound is null
+		writer.StartArray();
+		for (size_t j = 0; j <= server_stats::LATENCY_BUCKETS; ++j) {
+			if (endpoint.latency[j] == 0)
+				continue;
+			writer.StartArray();
+			if (j < server_stats::LATENCY_BUCKETS)
+				writer.Uint64(server_stats::bucket_bound(j));
+			else
+				writer.Null();
+			writer.Uint64(endpoint.latency[j]);
+			writer.EndArray();
+		}
+		writer.EndArray();
+		writer.EndObject();
+	}
+	writer.EndObject();
+
+	writer.String("provider");
+	writer.StartObject();
+	writer.String("early_acks");
+	writer.Uint64(provider.early_acks);
+	writer.String("late_replica_failures");
+	writer.Uint64(provider.late_replica_failures);
+	writer.String("read_errors");
+	writer.Uint64(provider.read_errors);
+	writer.String("write_errors");
+	writer.Uint64(provider.write_errors);
+	writer.String("missing_logs_hits");
+	writer.Uint64(provider.missing_logs_hits);
+	writer.String("filtered_activities_hits");
+	writer.Uint64(provider.filtered_activities_hits);
+	writer.String("fanout_queued");
+	writer.Uint64(provider.fanout_queued);
+	writer.String("fanout_in_flight");
+	writer.Uint64(provider.fanout_in_flight);
+	writer.EndObject();
+
+	if (cache) {
+		writer.String("active_users_cache");
+		writer.StartObject();
+		writer.String("hits");
+		writer.Uint64(cache->hits);
+		writer.String("misses");
+		writer.Uint64(cache->misses);
+		writer.String("coalesced");
+		writer.Uint64(cache->coalesced);
+		writer.String("waiting");
+		writer.Uint64(cache->waiting);
+		writer.String("entries");
+		writer.Uint64(cache->entries);
+		writer.String("size");
+		writer.Uint64(cache->size);
+		writer.EndObject();
+	}
+
+	writer.EndObject();
+	return std::string(buffer.GetString(), buffer.Size());
+}
+
+// appends one sample of Prometheus text format
+void append_sample(std::string& out, const char* name, const std::string& labels, uint64_t value)
+{
+	char line[256];
+	const int size = snprintf(line, sizeof(line), "%s%s %llu\n", name, labels.c_str(), static_cast<unsigned long long>(value));
+	out.append(line, std::min<size_t>(size, sizeof(line) - 1));
+}
+
+void append_type(std::string& out, const char* name, const char* type)
+{
+	out.append("# TYPE ").append(name).append(1, ' ').append(type).append(1, '\n');
+}
+
+std::string to_prometheus(const server_stats::snapshot& stats,
+                          const provider_stats& provider,
+                          const active_users_cache::stats* cache)
+{
+	std::string out;
+	char value[32];
+
+	append_type(out, "historydb_uptime_seconds", "gauge");
+	append_sample(out, "historydb_uptime_seconds", std::string(), stats.uptime);
+
+	append_type(out, "historydb_requests_total", "counter");
+	for (size_t i = 0; i < ENDPOINTS_COUNT; ++i) {
+		const std::string endpoint = std::string("{endpoint=\"") + endpoint_path(static_cast<endpoint_id>(i)) + "\"";
+		for (size_t j = 0; j < server_stats::CODE_CLASSES; ++j) {
+			append_sample(out, "historydb_requests_total",
+			              endpoint + ",code=\"" + consts::CODE_CLASSES[j] + "\"}",
+			              stats.endpoints[i].codes[j]);
+		}
+	}
+
+	append_type(out, "historydb_requests_in_flight", "gauge");
+	for (size_t i = 0; i < ENDPOINTS_COUNT; ++i) {
+		append_sample(out, "historydb_requests_in_flight",
+		              std::string("{endpoint=\"") + endpoint_path(static_cast<endpoint_id>(i)) + "\"}",
+		              in_flight(stats.endpoints[i]));
+	}
+
+	append_type(out, "historydb_request_duration_seconds", "histogram");
+	for (size_t i = 0; i < ENDPOINTS_COUNT; ++i) {
+		const auto& endpoint = stats.endpoints[i];
+		const std::string label = std::string("{endpoint=\"") + endpoint_path(static_cast<endpoint_id>(i)) + "\"";
+
+		uint64_t count = 0; // Prometheus buckets are cumulative
+		for (size_t j = 0; j <= server_stats::LATENCY_BUCKETS; ++j) {
+			count += endpoint.latency[j];
+			if (j < server_stats::LATENCY_BUCKETS)
+				snprintf(value, sizeof(value), "%g", server_stats::bucket_bound(j) / 1000000.);
+			else
+				snprintf(value, sizeof(value), "+Inf");
+			append_sample(out, "historydb_request_duration_seconds_bucket", label + ",le=\"" + value + "\"}", count);
+		}
+
+		snprintf(value, sizeof(value), "%.6f", endpoint.latency_sum / 1000000.);
+		out.append("historydb_request_duration_seconds_sum").append(label).append("} ").append(value).append(1, '\n');
+		append_sample(out, "historydb_request_duration_seconds_count", label + "}", count);
+	}
+
+	append_type(out, "historydb_provider_early_acks_total", "counter");
+	append_sample(out, "historydb_provider_early_acks_total", std::string(), provider.early_acks);
+	append_type(out, "historydb_provider_late_replica_failures_total", "counter");
+	append_sample(out, "historydb_provider_late_replica_failures_total", std::string(), provider.late_replica_failures);
+	append_type(out, "historydb_provider_errors_total", "counter");
+	append_sample(out, "historydb_provider_errors_total", "{op=\"read\"}", provider.read_errors);
+	append_sample(out, "historydb_provider_errors_total", "{op=\"write\"}", provider.write_errors);
+	append_type(out, "historydb_provider_missing_logs_hits_total", "counter");
+	append_sample(out, "historydb_provider_missing_logs_hits_total", std::string(), provider.missing_logs_hits);
+	append_type(out, "historydb_provider_filtered_activities_hits_total", "counter");
+	append_sample(out, "historydb_provider_filtered_activities_hits_total", std::string(), provider.filtered_activities_hits);
+	append_type(out, "historydb_provider_fanout_queued_reads", "gauge");
+	append_sample(out, "historydb_provider_fanout_queued_reads", std::string(), provider.fanout_queued);
+	append_type(out, "historydb_provider_fanout_reads_in_flight", "gauge");
+	append_sample(out, "historydb_provider_fanout_reads_in_flight", std::string(), provider.fanout_in_flight);
+
+	if (cache) {
+		append_type(out, "historydb_active_users_cache_hits_total", "counter");
+		append_sample(out, "historydb_active_users_cache_hits_total", std::string(), cache->hits);
+		append_type(out, "historydb_active_users_cache_misses_total", "counter");
+		append_sample(out, "historydb_active_users_cache_misses_total", std::string(), cache->misses);
+		append_type(out, "historydb_active_users_cache_coalesced_total", "counter");
+		append_sample(out, "historydb_active_users_cache_coalesced_total", std::string(), cache->coalesced);
+		append_type(out, "historydb_active_users_cache_waiting", "gauge");
+		append_sample(out, "historydb_active_users_cache_waiting", std::string(), cache->waiting);
+		append_type(out, "historydb_active_users_cache_entries", "gauge");
+		append_sample(out, "historydb_active_users_cache_entries", std::string(), cache->entries);
+		append_type(out, "historydb_active_users_cache_size_bytes", "gauge");
+		append_sample(out, "historydb_active_users_cache_size_bytes", std::string(), cache->size);
+	}
+
+	return out;
+}
+}
+
+void on_stats::on_request(const ioremap::swarm::network_request &req,
+                          const boost::asio::const_buffer &/*buffer*/)
+{
+	try {
+		ioremap::swarm::network_url url(req.get_url());
+		ioremap::swarm::network_query_list query_list(url.query());
+
+		const bool prometheus = query_list.has_item(consts::FORMAT_ITEM) ?
+		                        query_list.item_value(consts::FORMAT_ITEM) == consts::PROMETHEUS_FORMAT :
+		                        req.has_header(consts::ACCEPT_HEADER) &&
+		                        req.get_header(consts::ACCEPT_HEADER).find(consts::TEXT_CONTENT_TYPE) != std::string::npos;
+
+		auto server = get_server();
+		const auto stats = server->get_stats()->get_snapshot();
+		const auto provider = server->get_provider()->get_stats();
+
+		active_users_cache::stats cache_stats;
+		auto cache = server->get_active_users_cache();
+		if (cache)
+			cache_stats = cache->get_stats();
+
+		body_ = prometheus ? to_prometheus(stats, provider, cache ? &cache_stats : NULL)
+		                   : to_json(stats, provider, cache ? &cache_stats : NULL);
+
+		ioremap::swarm::network_reply reply;
+		reply.set_code(ioremap::swarm::network_reply::ok);
+		reply.set_content_length(body_.size());
+		reply.set_content_type(prometheus ? consts::PROMETHEUS_CONTENT_TYPE : "text/json");
+		get_reply()->send_headers(reply,
+		                          boost::asio::buffer(body_),
+		                          std::bind(&on_stats::on_send_finished,
+		                                    shared_from_this(),
+		                                    std::placeholders::_1));
+	}
+	catch(...) {
+		get_reply()->send_error(ioremap::swarm::network_reply::bad_request);
+	}
+}
+
+void on_stats::on_send_finished(const boost::system::error_code &error)
+{
+	get_reply()->close(error);
+}
+
+} /* namespace history */
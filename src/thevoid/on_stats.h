@@ -0,0 +1,27 @@
+#ifndef HISTORY_SRC_THEVOID_ON_STATS_H
+#define HISTORY_SRC_THEVOID_ON_STATS_H
+
+#include "webserver.h"
+
+namespace history {
+
+	/* Sends statistics of the webserver: counters and latency histograms of the endpoints,
+	 * requests in flight, counters of the provider and of active users cache.
+	 * The reply is json or, with "format=prometheus" or "Accept: text/plain", Prometheus text format.
+	 */
+	struct on_stats :
+		public ioremap::thevoid::simple_request_stream<webserver>,
+		public std::enable_shared_from_this<on_stats>
+	{
+		virtual void on_request(const ioremap::swarm::network_request &req,
+		                        const boost::asio::const_buffer &buffer);
+		void on_send_finished(const boost::system::error_code &error);
+		virtual void on_close(const boost::system::error_code &) {}
+
+	private:
+		std::string	body_; // serialized statistics, it is kept until the reply is sent
+	};
+
+} /* namespace history */
+
+#endif //HISTORY_SRC_THEVOID_ON_STATS_H
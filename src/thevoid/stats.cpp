@@ -0,0 +1,153 @@
+#include "stats.h"
+
+namespace history {
+
+namespace {
+// increments counter which is written only by the current thread, so it doesn't need locked instruction
+inline void increment(std::atomic<uint64_t>& counter, uint64_t value = 1)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+}
+
+const char* endpoint_path(endpoint_id endpoint)
+{
+	static const char* const paths[ENDPOINTS_COUNT] = {
+		"/",
+		"/add_log",
+		"/add_activity",
+		"/add_log_with_activity",
+		"/add_logs",
+		"/get_active_users",
+		"/get_user_logs",
+		"/get_active_users_set",
+		"/get_activity_counts",
+		"/is_active",
+		"/stats"
+	};
+
+	return paths[endpoint];
+}
+
+server_stats::server_stats()
+: started_(std::chrono::steady_clock::now())
+, local_(&server_stats::keep_shard)
+{}
+
+void server_stats::on_started(endpoint_id endpoint)
+{
+	increment(local_shard().endpoints[endpoint].started);
+}
+
+void server_stats::on_finished(endpoint_id endpoint, int code, uint64_t latency)
+{
+	auto& counters = local_shard().endpoints[endpoint];
+
+	size_t code_class = code / 100;
+	if (code_class >= CODE_CLASSES)
+		code_class = 0;
+
+	size_t bucket = 0;
+	while (bucket < LATENCY_BUCKETS && latency >= bucket_bound(bucket)) {
+		++bucket;
+	}
+
+	increment(counters.codes[code_class]);
+	increment(counters.latency[bucket]);
+	increment(counters.latency_sum, latency);
+	increment(counters.finished);
+}
+
+server_stats::snapshot server_stats::get_snapshot()
+{
+	snapshot ret = snapshot();
+	ret.uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started_).count();
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	for (auto it = shards_.begin(), end = shards_.end(); it != end; ++it) {
+		for (size_t i = 0; i < ENDPOINTS_COUNT; ++i) {
+			const auto& from = (*it)->endpoints[i];
+			auto& to = ret.endpoints[i];
+
+			to.finished += from.finished.load(std::memory_order_relaxed);
+			to.started += from.started.load(std::memory_order_relaxed);
+			to.latency_sum += from.latency_sum.load(std::memory_order_relaxed);
+			for (size_t j = 0; j < CODE_CLASSES; ++j) {
+				to.codes[j] += from.codes[j].load(std::memory_order_relaxed);
+			}
+			for (size_t j = 0; j <= LATENCY_BUCKETS; ++j) {
+				to.latency[j] += from.latency[j].load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	return ret;
+}
+
+server_stats::shard& server_stats::local_shard()
+{
+	auto ret = local_.get();
+	if (ret)
+		return *ret;
+
+	std::unique_ptr<shard> created(new shard()); // value-initialization zeroes the counters
+	ret = created.get();
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		shards_.push_back(std::move(created)); // shard outlives its thread, so its counters aren't lost
+	}
+	local_.reset(ret);
+	return *ret;
+}
+
+measured_reply::measured_reply(const std::shared_ptr<ioremap::thevoid::reply_stream>& reply, endpoint_id endpoint)
+: reply_(reply)
+, endpoint_(endpoint)
+, start_(std::chrono::steady_clock::now())
+, stats_(NULL)
+, code_(0)
+{}
+
+measured_reply::~measured_reply()
+{
+	if (!stats_)
+		return;
+
+	const auto latency = std::chrono::steady_clock::now() - start_;
+	stats_->on_finished(endpoint_,
+	                    code_,
+	                    std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+}
+
+void measured_reply::start(server_stats* stats)
+{
+	stats_ = stats;
+	stats_->on_started(endpoint_);
+}
+
+void measured_reply::send_headers(const ioremap::swarm::network_reply &rep,
+                                  const boost::asio::const_buffer &content,
+                                  const std::function<void (const boost::system::error_code &err)> &handler)
+{
+	code_ = rep.get_code();
+	reply_->send_headers(rep, content, handler);
+}
+
+void measured_reply::send_data(const boost::asio::const_buffer &buffer,
+                               const std::function<void (const boost::system::error_code &err)> &handler)
+{
+	reply_->send_data(buffer, handler);
+}
+
+void measured_reply::close(const boost::system::error_code &err)
+{
+	reply_->close(err);
+}
+
+void measured_reply::send_error(ioremap::swarm::network_reply::status_type type)
+{
+	code_ = type;
+	reply_->send_error(type);
+}
+
+} /* namespace history */
@@ -0,0 +1,125 @@
+#ifndef HISTORY_SRC_THEVOID_STATS_H
+#define HISTORY_SRC_THEVOID_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include <boost/thread/tss.hpp>
+
+#include <thevoid/server.hpp>
+
+namespace history {
+
+/* Endpoints of the webserver which are measured */
+enum endpoint_id {
+	ENDPOINT_ROOT,
+	ENDPOINT_ADD_LOG,
+	ENDPOINT_ADD_ACTIVITY,
+	ENDPOINT_ADD_LOG_WITH_ACTIVITY,
+	ENDPOINT_ADD_LOGS,
+	ENDPOINT_GET_ACTIVE_USERS,
+	ENDPOINT_GET_USER_LOGS,
+	ENDPOINT_GET_ACTIVE_USERS_SET,
+	ENDPOINT_GET_ACTIVITY_COUNTS,
+	ENDPOINT_IS_ACTIVE,
+	ENDPOINT_STATS,
+	ENDPOINTS_COUNT
+};
+
+// returns path of the endpoint
+const char* endpoint_path(endpoint_id endpoint);
+
+/* Request counters and latency histograms of the webserver endpoints.
+ * Each thread records into its own shard, so recording doesn't lock and doesn't share cache lines
+ * with other threads. Shards are summed only when the statistics is requested.
+ */
+class server_stats
+{
+public:
+	static const size_t LATENCY_BUCKETS = 18; // bucket i counts requests completed in less than 128us << i
+	static const size_t CODE_CLASSES = 6; // 0 - request has been finished without reply, 1-5 - 1xx-5xx
+
+	/* Sum of all shards */
+	struct snapshot
+	{
+		struct endpoint
+		{
+			uint64_t	started; // requests which have been started
+			uint64_t	finished; // requests which have been finished
+			uint64_t	codes[CODE_CLASSES]; // finished requests by class of reply code
+			uint64_t	latency_sum; // total latency of finished requests in microseconds
+			uint64_t	latency[LATENCY_BUCKETS + 1]; // finished requests by latency, the last bucket is unbounded
+		};
+
+		endpoint	endpoints[ENDPOINTS_COUNT];
+		uint64_t	uptime; // seconds since the webserver has been started
+	};
+
+	server_stats();
+
+	// upper bound of latency bucket in microseconds
+	static uint64_t bucket_bound(size_t bucket) { return 128ULL << bucket; }
+
+	void on_started(endpoint_id endpoint);
+	void on_finished(endpoint_id endpoint, int code, uint64_t latency);
+
+	snapshot get_snapshot();
+
+private:
+	struct shard
+	{
+		struct endpoint
+		{
+			std::atomic<uint64_t>	started;
+			std::atomic<uint64_t>	finished;
+			std::atomic<uint64_t>	codes[CODE_CLASSES];
+			std::atomic<uint64_t>	latency_sum;
+			std::atomic<uint64_t>	latency[LATENCY_BUCKETS + 1];
+		};
+
+		endpoint	endpoints[ENDPOINTS_COUNT];
+	};
+
+	shard& local_shard();
+	static void keep_shard(shard*) {} // cleanup of local_ which keeps the shard in shards_ after its thread exits
+
+	const std::chrono::steady_clock::time_point	started_; // time when the webserver has been started
+	boost::thread_specific_ptr<shard>			local_; // shard of the current thread, it is owned by shards_
+	std::list<std::unique_ptr<shard>>			shards_; // shards of all threads which have recorded requests
+	std::mutex									mutex_; // protects shards_
+};
+
+/* Reply stream which forwards the reply to thevoid and records it into server_stats.
+ * The request is counted as finished when the stream is destroyed together with its handler.
+ */
+class measured_reply : public ioremap::thevoid::reply_stream
+{
+public:
+	measured_reply(const std::shared_ptr<ioremap::thevoid::reply_stream>& reply, endpoint_id endpoint);
+	~measured_reply();
+
+	// starts measuring the request
+	void start(server_stats* stats);
+
+	virtual void send_headers(const ioremap::swarm::network_reply &rep,
+	                          const boost::asio::const_buffer &content,
+	                          const std::function<void (const boost::system::error_code &err)> &handler);
+	virtual void send_data(const boost::asio::const_buffer &buffer,
+	                       const std::function<void (const boost::system::error_code &err)> &handler);
+	virtual void close(const boost::system::error_code &err);
+	virtual void send_error(ioremap::swarm::network_reply::status_type type);
+
+private:
+	std::shared_ptr<ioremap::thevoid::reply_stream>	reply_; // reply stream of thevoid
+	const endpoint_id								endpoint_;
+	const std::chrono::steady_clock::time_point		start_; // time when the request has been received
+	server_stats*									stats_; // NULL until the request is started
+	int												code_; // code of the reply, 0 until the reply is sent
+};
+
+} /* namespace history */
+
+#endif //HISTORY_SRC_THEVOID_STATS_H
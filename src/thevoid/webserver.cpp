@@ -1,6 +1,8 @@
 #include "webserver.h"
 
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
 
 #include <historydb/provider.h>
 #include <elliptics/interface.h>
@@ -8,12 +10,27 @@
 #include "on_add_log.h"
 #include "on_add_activity.h"
 #include "on_add_log_with_activity.h"
+#include "on_add_logs.h"
 #include "on_get_active_users.h"
 #include "on_get_user_logs.h"
+#include "on_get_active_users_set.h"
+#include "on_get_activity_counts.h"
+#include "on_is_active.h"
+#include "on_stats.h"
 
 namespace history {
 
+namespace consts {
+const char ACCEPT_HEADER[] = "Accept";
+const char CONTENT_TYPE_HEADER[] = "Content-Type";
+const uint64_t DEFAULT_CACHE_SIZE = 256 * 1024 * 1024; // default maximum size of cached get_active_users replies
+const uint32_t DEFAULT_CACHE_TTL = 10; // default ttl in seconds of cached replies which include today
+const uint32_t DEFAULT_CACHE_PAST_TTL = 60 * 60; // default ttl in seconds of cached replies of past days
+const char MSGPACK_CONTENT_TYPE[] = "application/x-msgpack";
+}
+
 webserver::webserver()
+: max_batch_(consts::batch::DEFAULT_MAX_RECORDS)
 {}
 
 bool webserver::initialize(const rapidjson::Value &config)
@@ -55,12 +72,59 @@ bool webserver::initialize(const rapidjson::Value &config)
 	                                       logfile,
 	                                       loglevel);
 
-	on<on_root>("/");
-	on<on_add_log>("/add_log");
-	on<on_add_activity>("/add_activity");
-	on<on_add_log_with_activity>("/add_log_with_activity");
-	on<on_get_active_users>("/get_active_users");
-	on<on_get_user_logs>("/get_user_logs");
+	if (config.HasMember("early_ack"))
+		provider_->set_early_ack(config["early_ack"].GetBool());
+
+	if (config.HasMember("activity_chunks"))
+		provider_->set_activity_chunks(config["activity_chunks"].GetUint());
+
+	if (config.HasMember("activity_counters"))
+		provider_->set_activity_counters(config["activity_counters"].GetBool());
+
+	if (config.HasMember("activity_filters"))
+		provider_->set_activity_filters(config["activity_filters"].GetBool());
+
+	if (config.HasMember("activity_filter_users"))
+		provider_->set_activity_filter_users(config["activity_filter_users"].GetUint());
+
+	if (config.HasMember("merge_threads"))
+		provider_->set_merge_threads(config["merge_threads"].GetUint());
+
+	if (config.HasMember("fanout_request_limit") || config.HasMember("fanout_global_limit"))
+		provider_->set_fanout_limits(config.HasMember("fanout_request_limit") ? config["fanout_request_limit"].GetUint() : 32,
+		                             config.HasMember("fanout_global_limit") ? config["fanout_global_limit"].GetUint() : 1024);
+
+	if (config.HasMember("max_range"))
+		provider_->set_max_range(config["max_range"].GetUint());
+
+	if (config.HasMember("max_batch"))
+		max_batch_ = config["max_batch"].GetUint();
+
+	if (config.HasMember("log_days"))
+		provider_->set_log_days(config["log_days"].GetBool());
+
+	if (config.HasMember("missing_logs_ttl"))
+		provider_->set_missing_logs_ttl(config["missing_logs_ttl"].GetUint());
+
+	if (config.HasMember("active_users_cache")) {
+		auto &cache = config["active_users_cache"];
+		active_users_cache_ = std::make_shared<active_users_cache>(
+			cache.HasMember("size") ? cache["size"].GetUint64() : consts::DEFAULT_CACHE_SIZE,
+			cache.HasMember("ttl") ? cache["ttl"].GetUint() : consts::DEFAULT_CACHE_TTL,
+			cache.HasMember("past_ttl") ? cache["past_ttl"].GetUint() : consts::DEFAULT_CACHE_PAST_TTL);
+	}
+
+	on<measured<on_root, ENDPOINT_ROOT>>(endpoint_path(ENDPOINT_ROOT));
+	on<measured<on_add_log, ENDPOINT_ADD_LOG>>(endpoint_path(ENDPOINT_ADD_LOG));
+	on<measured<on_add_activity, ENDPOINT_ADD_ACTIVITY>>(endpoint_path(ENDPOINT_ADD_ACTIVITY));
+	on<measured<on_add_log_with_activity, ENDPOINT_ADD_LOG_WITH_ACTIVITY>>(endpoint_path(ENDPOINT_ADD_LOG_WITH_ACTIVITY));
+	on<measured<on_add_logs, ENDPOINT_ADD_LOGS>>(endpoint_path(ENDPOINT_ADD_LOGS));
+	on<measured<on_get_active_users, ENDPOINT_GET_ACTIVE_USERS>>(endpoint_path(ENDPOINT_GET_ACTIVE_USERS));
+	on<measured<on_get_user_logs, ENDPOINT_GET_USER_LOGS>>(endpoint_path(ENDPOINT_GET_USER_LOGS));
+	on<measured<on_get_active_users_set, ENDPOINT_GET_ACTIVE_USERS_SET>>(endpoint_path(ENDPOINT_GET_ACTIVE_USERS_SET));
+	on<measured<on_get_activity_counts, ENDPOINT_GET_ACTIVITY_COUNTS>>(endpoint_path(ENDPOINT_GET_ACTIVITY_COUNTS));
+	on<measured<on_is_active, ENDPOINT_IS_ACTIVE>>(endpoint_path(ENDPOINT_IS_ACTIVE));
+	on<measured<on_stats, ENDPOINT_STATS>>(endpoint_path(ENDPOINT_STATS));
 
 	return true;
 }
@@ -71,6 +135,39 @@ void webserver::on_root::on_request(const ioremap::swarm::network_request &/*req
 	get_reply()->send_error(ioremap::swarm::network_reply::ok);
 }
 
+bool webserver::accepts_msgpack(const ioremap::swarm::network_request &req)
+{
+	return req.has_header(consts::ACCEPT_HEADER) &&
+	       req.get_header(consts::ACCEPT_HEADER).find(consts::MSGPACK_CONTENT_TYPE) != std::string::npos;
+}
+
+bool webserver::sends_msgpack(const ioremap::swarm::network_request &req)
+{
+	return req.has_header(consts::CONTENT_TYPE_HEADER) &&
+	       req.get_header(consts::CONTENT_TYPE_HEADER).find(consts::MSGPACK_CONTENT_TYPE) != std::string::npos;
+}
+
+bool webserver::request_keys(const ioremap::swarm::network_query_list &query_list,
+                             const char* keys_item,
+                             const char* begin_time_item,
+                             const char* end_time_item,
+                             std::vector<std::string>& keys)
+{
+	if (query_list.has_item(keys_item) && !query_list.item_value(keys_item).empty()) {
+		std::string keys_value = query_list.item_value(keys_item);
+		boost::split(keys, keys_value, boost::is_any_of(":"));
+		return true;
+	}
+
+	if (query_list.has_item(begin_time_item) && query_list.has_item(end_time_item)) {
+		keys = time_period_to_subkeys(boost::lexical_cast<uint64_t>(query_list.item_value(begin_time_item)),
+		                              boost::lexical_cast<uint64_t>(query_list.item_value(end_time_item)));
+		return true;
+	}
+
+	return false;
+}
+
 } /* namespace history */
 
 int main(int argc, char **argv)
@@ -2,6 +2,10 @@
 #define HISTORY_SRC_THEVOID_WEBSERVER_H
 
 #include <thevoid/server.hpp>
+#include <swarm/network_query_list.h>
+
+#include "active_users_cache.h"
+#include "stats.h"
 
 namespace history {
 class provider;
@@ -21,8 +25,48 @@ public:
 
 	std::shared_ptr<provider> get_provider() { return provider_; }
 
+	// returns NULL if the cache is disabled
+	std::shared_ptr<active_users_cache> get_active_users_cache() { return active_users_cache_; }
+
+	server_stats* get_stats() { return &stats_; }
+
+	// returns maximum number of records of /add_logs request, 0 - unlimited
+	size_t get_max_batch() const { return max_batch_; }
+
+	// returns true if the client prefers msgpack reply instead of json
+	static bool accepts_msgpack(const ioremap::swarm::network_request &req);
+	// returns true if the request body is serialized into msgpack
+	static bool sends_msgpack(const ioremap::swarm::network_request &req);
+	// gets subkeys from parameter with custom keys or from parameters with time period, returns false if they are missed
+	static bool request_keys(const ioremap::swarm::network_query_list &query_list,
+	                         const char* keys_item,
+	                         const char* begin_time_item,
+	                         const char* end_time_item,
+	                         std::vector<std::string>& keys);
+
 private:
-	std::shared_ptr<provider> provider_;
+	std::shared_ptr<provider>			provider_;
+	std::shared_ptr<active_users_cache>	active_users_cache_;
+	server_stats						stats_; // counters and latencies of the endpoints
+	size_t								max_batch_;
+};
+
+/* Handler wrapper which records requests of the endpoint into webserver stats */
+template<typename Handler, endpoint_id Endpoint>
+struct measured : public Handler
+{
+	virtual void initialize(const std::shared_ptr<ioremap::thevoid::reply_stream> &reply) {
+		reply_ = std::make_shared<measured_reply>(reply, Endpoint);
+		Handler::initialize(reply_);
+	}
+
+	virtual void on_request(const ioremap::swarm::network_request &req,
+	                        const boost::asio::const_buffer &buffer) {
+		reply_->start(this->get_server()->get_stats());
+		Handler::on_request(req, buffer);
+	}
+
+	std::shared_ptr<measured_reply>	reply_;
 };
 
 } /* namespace history */
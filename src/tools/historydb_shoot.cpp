@@ -0,0 +1,576 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <numeric>
+#include <map>
+#include <list>
+#include <cstdlib>
+#include <time.h>
+
+#include <boost/asio.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "../app/histogram.h"
+
+namespace consts {
+	const uint32_t DEFAULT_DURATION = 60; // default duration of the shooting in seconds
+	const uint32_t DEFAULT_THREADS = 16; // default number of threads, each thread uses own keep-alive connection
+	const uint32_t DEFAULT_USERS = 1000000; // default number of users for synthetic requests
+	const uint32_t DEFAULT_PAYLOAD = 100; // default size of log record for synthetic requests
+	const char DEFAULT_MIX[] = "add_log_with_activity=90,get_user_logs=10";
+	const uint32_t SECONDS_IN_DAY = 24 * 60 * 60;
+} /* namespace consts */
+
+const char* ENDPOINTS[] = {
+	"/add_log",
+	"/add_log_with_activity",
+	"/get_user_logs",
+	"/get_active_users"
+};
+const size_t ENDPOINTS_NO = sizeof(ENDPOINTS) / sizeof(ENDPOINTS[0]);
+
+void print_usage(char* s)
+{
+	std::cout << "Usage: " << s << " [options]\n"
+	<< " -H host:port           - address of HistoryDB HTTP frontend\n"
+	<< " -f ammo                - replays requests from ammo file instead of generating synthetic requests.\n"
+	<< "                          Each request in the file is preceded by line 'SIZE [TAG]' and followed by new line\n"
+	<< " -l                     - replays ammo file in loop until the end of the shooting\n"
+	<< " -t threads             - number of threads, each thread uses own keep-alive connection [default: "
+	<< consts::DEFAULT_THREADS << "]\n"
+	<< " -R rate                - target rate of requests per second, 0 - as fast as possible (closed loop) [default: 0]\n"
+	<< " -d seconds             - duration of the shooting [default: " << consts::DEFAULT_DURATION << "]\n"
+	<< " -x mix                 - weights of synthetic requests: add_log, add_log_with_activity, get_user_logs, get_active_users\n"
+	<< "                          [default: " << consts::DEFAULT_MIX << "]\n"
+	<< " -u users               - number of users for synthetic requests [default: " << consts::DEFAULT_USERS << "]\n"
+	<< " -s size                - size of log record for synthetic requests [default: " << consts::DEFAULT_PAYLOAD << "]\n"
+	<< " -S seed                - seed of synthetic requests, the same seed gives the same requests [default: current time]\n"
+	<< " -o file                - file for json report [default: stdout]\n"
+	;
+}
+
+uint64_t now_us()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Latencies and response codes of one endpoint
+ */
+struct endpoint_stats
+{
+	endpoint_stats()
+	: errors(0)
+	{}
+
+	void merge(const endpoint_stats& other) {
+		latency.merge(other.latency);
+		errors += other.errors;
+		for (auto it = other.codes.begin(), end = other.codes.end(); it != end; ++it) {
+			codes[it->first] += it->second;
+		}
+	}
+
+	history::histogram			latency; // latencies in microseconds
+	std::map<int, uint64_t>		codes; // number of responses by HTTP code
+	uint64_t					errors; // network errors and malformed responses
+};
+
+/* Keep-alive HTTP/1.1 connection which sends one request at a time and reads whole response.
+ * Supports responses with Content-Length, chunked transfer encoding and responses closed by server.
+ */
+class connection
+{
+public:
+	connection(boost::asio::io_service& io_service, const std::string& host, const std::string& port)
+	: io_service_(io_service)
+	, socket_(io_service)
+	, host_(host)
+	, port_(port)
+	{}
+
+	// sends request and returns HTTP code of the response
+	int request(const std::string& request) {
+		if (!socket_.is_open())
+			connect();
+
+		try {
+			boost::asio::write(socket_, boost::asio::buffer(request));
+			return read_response();
+		}
+		catch (...) {
+			close();
+			throw;
+		}
+	}
+
+private:
+	void connect() {
+		boost::asio::ip::tcp::resolver resolver(io_service_);
+		boost::asio::ip::tcp::resolver::query query(host_, port_);
+		boost::asio::connect(socket_, resolver.resolve(query));
+		socket_.set_option(boost::asio::ip::tcp::no_delay(true));
+		buffer_.consume(buffer_.size());
+	}
+
+	void close() {
+		boost::system::error_code ec;
+		socket_.close(ec);
+	}
+
+	std::string read_line() {
+		boost::asio::read_until(socket_, buffer_, "\r\n");
+		std::istream stream(&buffer_);
+		std::string line;
+		std::getline(stream, line);
+		if (!line.empty() && *line.rbegin() == '\r')
+			line.erase(line.size() - 1);
+		return line;
+	}
+
+	void skip(size_t size) {
+		if (buffer_.size() < size)
+			boost::asio::read(socket_, buffer_, boost::asio::transfer_at_least(size - buffer_.size()));
+		buffer_.consume(size);
+	}
+
+	int read_response() {
+		std::istringstream status_line(read_line());
+		std::string version;
+		int code = 0;
+		status_line >> version >> code;
+		if (!status_line)
+			throw std::runtime_error("malformed status line");
+
+		bool keep_alive = version == "HTTP/1.1";
+		bool chunked = false;
+		int64_t content_length = -1;
+
+		for (auto line = read_line(); !line.empty(); line = read_line()) {
+			const auto pos = line.find(':');
+			if (pos == std::string::npos)
+				continue;
+
+			const auto name = boost::algorithm::trim_copy(line.substr(0, pos));
+			const auto value = boost::algorithm::trim_copy(line.substr(pos + 1));
+
+			if (boost::iequals(name, "Content-Length"))
+				content_length = boost::lexical_cast<int64_t>(value);
+			else if (boost::iequals(name, "Transfer-Encoding"))
+				chunked = boost::iequals(value, "chunked");
+			else if (boost::iequals(name, "Connection"))
+				keep_alive = boost::iequals(value, "keep-alive");
+		}
+
+		if (chunked) {
+			while (true) {
+				const auto size = strtoull(read_line().c_str(), NULL, 16);
+				if (size == 0)
+					break;
+				skip(size + 2); // chunk data and CRLF
+			}
+			for (auto line = read_line(); !line.empty(); line = read_line()) {} // trailer
+		}
+		else if (content_length >= 0) {
+			skip(content_length);
+		}
+		else {
+			boost::system::error_code ec;
+			boost::asio::read(socket_, buffer_, boost::asio::transfer_all(), ec); // response is ended by closing connection
+			keep_alive = false;
+		}
+
+		if (!keep_alive)
+			close();
+
+		return code;
+	}
+
+	boost::asio::io_service&		io_service_;
+	boost::asio::ip::tcp::socket	socket_;
+	boost::asio::streambuf			buffer_;
+	std::string						host_;
+	std::string						port_;
+};
+
+/* Source of requests: replays ammo file or generates synthetic requests.
+ * Each request is paired with endpoint under which its latency is recorded.
+ */
+class requests
+{
+public:
+	typedef std::pair<std::string, std::string> request_t; // endpoint and request
+
+	requests(const std::string& host,
+	         const std::string& ammo,
+	         bool loop,
+	         const std::string& mix,
+	         uint64_t users,
+	         uint32_t payload,
+	         uint64_t seed)
+	: host_(host)
+	, loop_(loop)
+	, users_(users)
+	, payload_(payload)
+	, seed_(seed)
+	, time_(::time(NULL))
+	{
+		if (!ammo.empty())
+			load(ammo);
+		else
+			parse_mix(mix);
+	}
+
+	/* Returns the next request of the thread or false if there are no more requests.
+	 * Each thread gets its own subsequence of ammo or its own generator, so the same seed gives the same requests.
+	 */
+	class iterator
+	{
+	public:
+		iterator(const requests& parent, uint32_t thread, uint32_t threads)
+		: parent_(parent)
+		, index_(thread)
+		, step_(threads)
+		, gen_(parent.seed_ + thread)
+		, operations_(parent.weights_.begin(), parent.weights_.end())
+		, users_(1, parent.users_)
+		{}
+
+		bool next(request_t& request) {
+			if (!parent_.ammo_.empty()) {
+				if (index_ >= parent_.ammo_.size()) {
+					if (!parent_.loop_)
+						return false;
+					index_ %= parent_.ammo_.size();
+				}
+				request = parent_.ammo_[index_];
+				index_ += step_;
+				return true;
+			}
+
+			request = parent_.generate(operations_(gen_), users_(gen_));
+			return true;
+		}
+
+	private:
+		const requests&							parent_;
+		size_t									index_;
+		size_t									step_;
+		std::mt19937_64							gen_;
+		std::discrete_distribution<int>			operations_;
+		std::uniform_int_distribution<uint64_t>	users_;
+	};
+
+	bool empty() const { return ammo_.empty() && weights_.empty(); }
+
+private:
+	void load(const std::string& path) {
+		std::ifstream file(path.c_str(), std::ios::binary);
+		if (!file)
+			throw std::invalid_argument("can't open ammo file");
+
+		std::string line;
+		while (std::getline(file, line)) {
+			if (line.empty())
+				continue;
+
+			const auto size = boost::lexical_cast<size_t>(line.substr(0, line.find(' ')));
+			std::string packet(size, '\0');
+			if (!file.read(&packet[0], size))
+				break;
+
+			const auto begin = packet.find(' ') + 1;
+			const auto end = packet.find_first_of("? ", begin);
+			ammo_.push_back(std::make_pair(packet.substr(begin, end - begin), packet));
+		}
+	}
+
+	void parse_mix(const std::string& mix) {
+		std::vector<std::string> items;
+		boost::split(items, mix, boost::is_any_of(","));
+
+		weights_.assign(ENDPOINTS_NO, 0);
+		for (auto it = items.begin(), end = items.end(); it != end; ++it) {
+			std::vector<std::string> strs;
+			boost::split(strs, *it, boost::is_any_of("="));
+			if (strs.size() != 2)
+				throw std::invalid_argument("mix");
+
+			auto endpoint = std::find(ENDPOINTS, ENDPOINTS + ENDPOINTS_NO, "/" + strs[0]) - ENDPOINTS;
+			if (endpoint == ENDPOINTS_NO)
+				throw std::invalid_argument("mix");
+
+			weights_[endpoint] = boost::lexical_cast<double>(strs[1]);
+		}
+
+		if (std::accumulate(weights_.begin(), weights_.end(), 0.) <= 0)
+			throw std::invalid_argument("mix");
+	}
+
+	request_t generate(size_t endpoint, uint64_t user_no) const {
+		const auto user = "user" + boost::lexical_cast<std::string>(user_no);
+		const auto time = boost::lexical_cast<std::string>(time_);
+
+		std::ostringstream request;
+		if (endpoint == 0 || endpoint == 1) { // add_log and add_log_with_activity
+			const auto body = "user=" + user + "&time=" + time + "&data=" + std::string(payload_, 'a');
+			request << "POST " << ENDPOINTS[endpoint] << " HTTP/1.1\r\n"
+			        << "Host: " << host_ << "\r\n"
+			        << "Content-Type: application/x-www-form-urlencoded\r\n"
+			        << "Content-Length: " << body.size() << "\r\n"
+			        << "\r\n"
+			        << body;
+		}
+		else {
+			request << "GET " << ENDPOINTS[endpoint];
+			if (endpoint == 2)
+				request << "?user=" << user << "&begin_time=" << time << "&end_time=" << time;
+			else
+				request << "?begin_time=" << time << "&end_time=" << time;
+			request << " HTTP/1.1\r\n"
+			        << "Host: " << host_ << "\r\n"
+			        << "\r\n";
+		}
+
+		return std::make_pair(std::string(ENDPOINTS[endpoint]), request.str());
+	}
+
+	std::string							host_;
+	bool								loop_;
+	uint64_t							users_;
+	uint32_t							payload_;
+	uint64_t							seed_;
+	uint64_t							time_; // timestamp of synthetic requests
+	std::vector<double>					weights_; // weights of synthetic requests
+	std::vector<request_t>				ammo_; // requests from ammo file
+};
+
+/* Sends requests from several threads with target rate and collects stats per endpoint.
+ * In open loop mode latencies are measured from the scheduled time of the request.
+ */
+class shooter
+{
+public:
+	shooter(const std::string& host, const std::string& port, const requests& reqs,
+	        uint32_t threads, double rate, uint32_t duration)
+	: host_(host)
+	, port_(port)
+	, requests_(reqs)
+	, threads_(threads)
+	, rate_(rate)
+	, duration_(duration)
+	, elapsed_(0)
+	{}
+
+	void run() {
+		start_ = now_us();
+		end_ = start_ + uint64_t(duration_) * 1000000;
+
+		std::list<boost::thread> threads;
+		for (uint32_t i = 0; i < threads_; ++i) {
+			threads.push_back(boost::thread(boost::bind(&shooter::shoot, this, i)));
+		}
+
+		while(!threads.empty()) {
+			threads.begin()->join();
+			threads.erase(threads.begin());
+		}
+
+		elapsed_ = (now_us() - start_) / 1000000.;
+	}
+
+	void report(std::ostream& out) const {
+		endpoint_stats total;
+		for (auto it = stats_.begin(), end = stats_.end(); it != end; ++it) {
+			total.merge(it->second);
+		}
+
+		out << "{\n"
+		    << "\t\"config\": {"
+		    << "\"target\": \"" << host_ << ":" << port_ << "\", "
+		    << "\"threads\": " << threads_ << ", "
+		    << "\"rate\": " << rate_ << ", "
+		    << "\"duration\": " << duration_ << "},\n"
+		    << "\t\"elapsed\": " << elapsed_ << ",\n"
+		    << "\t\"total\": ";
+		report(out, total);
+		out << ",\n\t\"endpoints\": {";
+
+		for (auto it = stats_.begin(), end = stats_.end(); it != end; ++it) {
+			out << (it == stats_.begin() ? "\n" : ",\n") << "\t\t\"" << it->first << "\": ";
+			report(out, it->second);
+		}
+
+		out << "\n\t}\n}" << std::endl;
+	}
+
+private:
+	void report(std::ostream& out, const endpoint_stats& stats) const {
+		const auto& l = stats.latency;
+		out << "{\"requests\": " << l.count()
+		    << ", \"errors\": " << stats.errors
+		    << ", \"throughput\": " << (elapsed_ > 0 ? l.count() / elapsed_ : 0)
+		    << ", \"codes\": {";
+		for (auto it = stats.codes.begin(), end = stats.codes.end(); it != end; ++it) {
+			out << (it == stats.codes.begin() ? "" : ", ") << "\"" << it->first << "\": " << it->second;
+		}
+		out << "}, \"latency_us\": {"
+		    << "\"min\": " << l.min()
+		    << ", \"mean\": " << l.mean()
+		    << ", \"p50\": " << l.percentile(50)
+		    << ", \"p99\": " << l.percentile(99)
+		    << ", \"p999\": " << l.percentile(99.9)
+		    << ", \"max\": " << l.max()
+		    << "}, \"histogram\": [";
+
+		// collapses histogram into power of two buckets: [upper bound, number of requests]
+		std::map<uint64_t, uint64_t> buckets;
+		const auto all_buckets = l.buckets();
+		for (auto it = all_buckets.begin(), end = all_buckets.end(); it != end; ++it) {
+			uint64_t bound = 1;
+			while (bound - 1 < it->first && bound < (uint64_t(1) << 63))
+				bound <<= 1;
+			buckets[bound - 1] += it->second;
+		}
+
+		for (auto it = buckets.begin(), end = buckets.end(); it != end; ++it) {
+			out << (it == buckets.begin() ? "" : ", ") << "[" << it->first << ", " << it->second << "]";
+		}
+		out << "]}";
+	}
+
+	void shoot(uint32_t thread) {
+		boost::asio::io_service io_service;
+		connection conn(io_service, host_, port_);
+		requests::iterator it(requests_, thread, threads_);
+		std::map<std::string, endpoint_stats> stats;
+
+		const double interval = rate_ > 0 ? 1000000. * threads_ / rate_ : 0;
+		requests::request_t request;
+
+		for (uint64_t i = 0; it.next(request); ++i) {
+			uint64_t scheduled = now_us();
+			if (interval > 0) {
+				scheduled = start_ + uint64_t(i * interval);
+				const auto now = now_us();
+				if (scheduled > now)
+					boost::this_thread::sleep(boost::posix_time::microseconds(scheduled - now));
+			}
+
+			if (scheduled >= end_)
+				break;
+
+			auto& s = stats[request.first];
+			try {
+				++s.codes[conn.request(request.second)];
+			}
+			catch (...) {
+				++s.errors;
+			}
+			s.latency.record(now_us() - scheduled);
+		}
+
+		boost::unique_lock<boost::mutex> lock(mutex_);
+		for (auto it = stats.begin(), end = stats.end(); it != end; ++it) {
+			stats_[it->first].merge(it->second);
+		}
+	}
+
+	const std::string						host_;
+	const std::string						port_;
+	const requests&							requests_;
+	const uint32_t							threads_;
+	const double							rate_;
+	const uint32_t							duration_;
+
+	boost::mutex							mutex_;
+	std::map<std::string, endpoint_stats>	stats_; // stats by endpoints
+	uint64_t								start_; // start of the shooting in microseconds
+	uint64_t								end_; // end of the shooting in microseconds
+	double									elapsed_; // actual duration of the shooting in seconds
+};
+
+int main(int argc, char* argv[])
+{
+	int ch, err = 0;
+	std::string host, port, ammo, output;
+	bool loop = false;
+	uint32_t threads = consts::DEFAULT_THREADS;
+	double rate = 0;
+	uint32_t duration = consts::DEFAULT_DURATION;
+	std::string mix = consts::DEFAULT_MIX;
+	uint64_t users = consts::DEFAULT_USERS;
+	uint32_t payload = consts::DEFAULT_PAYLOAD;
+	uint64_t seed = time(NULL);
+
+	try {
+		while((ch = getopt(argc, argv, "H:f:lt:R:d:x:u:s:S:o:")) != -1) {
+			switch(ch) {
+				case 'H': {
+					std::vector<std::string> strs;
+					boost::split(strs, optarg, boost::is_any_of(":"));
+
+					if (strs.size() != 2)
+						throw std::invalid_argument("-H");
+
+					host = strs[0];
+					port = strs[1];
+				}
+				break;
+				case 'f': ammo = optarg; break;
+				case 'l': loop = true; break;
+				case 't': threads = boost::lexical_cast<uint32_t>(optarg); break;
+				case 'R': rate = boost::lexical_cast<double>(optarg); break;
+				case 'd': duration = boost::lexical_cast<uint32_t>(optarg); break;
+				case 'x': mix = optarg; break;
+				case 'u': users = boost::lexical_cast<uint64_t>(optarg); break;
+				case 's': payload = boost::lexical_cast<uint32_t>(optarg); break;
+				case 'S': seed = boost::lexical_cast<uint64_t>(optarg); break;
+				case 'o': output = optarg; break;
+				default: throw std::invalid_argument("unknown option");
+			}
+		}
+
+		if (host.empty() ||
+		    threads == 0 ||
+		    users == 0 ||
+		    rate < 0)
+			throw std::invalid_argument("Required parameters are missing");
+	}
+	catch(...) {
+		err = -1;
+	}
+
+	if (err) {
+		print_usage(argv[0]);
+		return err;
+	}
+
+	try {
+		requests reqs(host, ammo, loop, mix, users, payload, seed);
+		if (reqs.empty())
+			throw std::invalid_argument("there are no requests to send");
+
+		shooter s(host, port, reqs, threads, rate, duration);
+		s.run();
+
+		if (output.empty()) {
+			s.report(std::cout);
+		}
+		else {
+			std::ofstream out(output.c_str());
+			s.report(out);
+		}
+	}
+	catch (std::exception& e) {
+		std::cerr << "Shooting failed: " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,759 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <deque>
+#include <algorithm>
+
+#include <zlib.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "historydb/provider.h"
+
+namespace consts {
+	const char COMBINE_TOOL[] = "combine";
+	const char RETENTION_TOOL[] = "retention";
+	const char EXPORT_TOOL[] = "export";
+	const char DEFAULT_OFFSETS[] = "1,7,30"; // default retention offsets in days
+	const uint32_t SECONDS_IN_DAY = 24 * 60 * 60; // number of seconds in one day. used for calculation days
+	const uint32_t DEFAULT_PARALLEL = 64; // default number of users which are combined simultaneously
+	const uint32_t DEFAULT_PROGRESS_INTERVAL = 10; // default interval in seconds between throughput reports
+	const uint32_t CHECKPOINT_INTERVAL = 1000; // number of combined users between checkpoint updates
+	const char DEFAULT_LOG_FILE[] = "/dev/stderr";
+	const char EXPORT_MAGIC[4] = {'H', 'D', 'B', 'X'}; // magic of the beginning and the end of export file
+	const uint32_t EXPORT_VERSION = 1; // version of export file format
+	const uint32_t EXPORT_TIMESTAMPS = 1; // flag of export file which has timestamps column
+	const size_t ROW_GROUP_ROWS = 16384; // maximum number of users in one row group
+	const size_t ROW_GROUP_BYTES = 64 * 1024 * 1024; // row group is written as soon as its logs exceed this size
+	const char EXPORT_SUFFIX[] = ".hdbx"; // suffix of export file of the day
+	const size_t EXPORT_WINDOW_USERS = 10000; // users whose logs are read at once, read logs of at most two windows wait for the writer
+} /* namespace consts */
+
+void print_usage(char* s)
+{
+	std::cout << "Usage: " << s << " TOOL [options]\n"
+	<< "Tools:\n"
+	<< " combine                - combines user logs from keys into the new key and updates activity for the new key\n"
+	<< " retention              - prints retention of cohorts of the days from time period (-t)\n"
+	<< " export                 - writes logs of all active users of each day into compressed columnar file in directory (-d)\n"
+	<< "Options:\n"
+	<< " -r addr:port:family    - adds a route to the given node, could be specified several times\n"
+	<< " -g groups              - groups id to connect which are separated by ','\n"
+	<< " -m min_writes          - minimum number of succeeded writes [default: number of groups]\n"
+	<< " -k keys                - custom subkeys of user logs and activity separated by ':'\n"
+	<< " -t begin_time:end_time - time period of user logs and activity\n"
+	<< " -n new_key             - new subkey for combined user logs and activity\n"
+	<< " -u user                - user whose logs should be combined, could be specified several times [default: all active users]\n"
+	<< " -j parallel            - number of users which are combined simultaneously [default: " << consts::DEFAULT_PARALLEL << "]\n"
+	<< " -c checkpoint          - file for storing progress, combining will be resumed from it if the file exists\n"
+	<< " -p seconds             - interval between throughput reports [default: " << consts::DEFAULT_PROGRESS_INTERVAL << "]\n"
+	<< " -o offsets             - retention offsets in days separated by ',' [default: " << consts::DEFAULT_OFFSETS << "]\n"
+	<< " -T threads             - number of threads which compute retention [default: number of cores]\n"
+	<< " -a activity_chunks     - number of chunks of activity statistics, should be the same as in the frontends [default: 1]\n"
+	<< " -d directory           - directory for export files, file of each day is named day" << consts::EXPORT_SUFFIX << "\n"
+	<< " -s                     - adds timestamps (begin of the day) column to export files\n"
+	<< " -l log_file            - elliptics client log file [default: " << consts::DEFAULT_LOG_FILE << "]\n"
+	<< " -L log_level           - elliptics client log level: DATA, ERROR, INFO, NOTICE, DEBUG [default: ERROR]\n"
+	;
+}
+
+/* Combines logs of the users from the keys into the new key.
+ * Users are processed in sorted order with limited number of users in flight.
+ * Checkpoint file contains the last user before which all users have been successfully combined,
+ * so the restarted tool skips them. Rewriting the new key and updating activity are idempotent,
+ * so users which were in flight at the moment of interrupt are safely combined again.
+ */
+class combiner
+{
+public:
+	combiner(std::shared_ptr<history::provider> provider,
+	         const std::vector<std::string>& keys,
+	         const std::string& new_key,
+	         uint32_t parallel,
+	         const std::string& checkpoint,
+	         uint32_t progress_interval)
+	: provider_(provider)
+	, keys_(keys)
+	, new_key_(new_key)
+	, parallel_(parallel)
+	, checkpoint_(checkpoint)
+	, progress_interval_(progress_interval)
+	, in_flight_(0)
+	, done_prefix_(0)
+	, checkpoint_prefix_(0)
+	, combined_(0)
+	, skipped_(0)
+	, failed_(0)
+	, bytes_(0)
+	{}
+
+	int run(std::set<std::string> users) {
+		auto last_done = load_checkpoint();
+		if (!last_done.empty()) {
+			std::cout << "Resuming after user: " << last_done << std::endl;
+			users.erase(users.begin(), users.upper_bound(last_done));
+		}
+
+		users_.assign(users.begin(), users.end());
+		done_.assign(users_.size(), false);
+
+		std::cout << "Users to combine: " << users_.size() << std::endl;
+
+		start_time_ = boost::posix_time::microsec_clock::universal_time();
+		boost::thread reporter(boost::bind(&combiner::report_progress, this));
+
+		for (size_t index = 0; index < users_.size(); ++index) {
+			boost::unique_lock<boost::mutex> lock(mutex_);
+			while (in_flight_ >= parallel_)
+				cond_.wait(lock);
+			++in_flight_;
+			lock.unlock();
+
+			provider_->get_user_logs_checked(users_[index],
+			                                 keys_,
+			                                 boost::bind(&combiner::on_logs, this, index, _1, _2));
+		}
+
+		{
+			boost::unique_lock<boost::mutex> lock(mutex_);
+			while (in_flight_ > 0)
+				cond_.wait(lock);
+		}
+
+		reporter.interrupt();
+		reporter.join();
+
+		print_progress();
+
+		for (auto it = failed_users_.begin(), end = failed_users_.end(); it != end; ++it) {
+			std::cout << "Failed to combine user: " << *it << std::endl;
+		}
+
+		return failed_ > 0 ? -1 : 0;
+	}
+
+private:
+	void on_logs(size_t index, const std::vector<char>& data, bool complete) {
+		if (!complete) { // new key is rewritten, so incomplete logs would be lost
+			finish(index, false);
+			return;
+		}
+
+		if (data.empty()) { // user has no logs in the keys, there is nothing to combine
+			++skipped_;
+			finish(index, true);
+			return;
+		}
+
+		bytes_ += data.size();
+
+		provider_->write_log(users_[index],
+		                     new_key_,
+		                     data,
+		                     boost::bind(&combiner::on_written, this, index, _1));
+	}
+
+	void on_written(size_t index, bool written) {
+		if (!written) {
+			finish(index, false);
+			return;
+		}
+
+		provider_->add_activity(users_[index],
+		                        new_key_,
+		                        boost::bind(&combiner::on_activity, this, index, _1));
+	}
+
+	void on_activity(size_t index, bool added) {
+		if (added)
+			++combined_;
+		finish(index, added);
+	}
+
+	void finish(size_t index, bool result) {
+		boost::unique_lock<boost::mutex> lock(mutex_);
+
+		if (result) {
+			done_[index] = true;
+			bool advanced = false;
+			while (done_prefix_ < done_.size() && done_[done_prefix_]) {
+				++done_prefix_;
+				advanced = true;
+			}
+			if (advanced &&
+			    (done_prefix_ / consts::CHECKPOINT_INTERVAL != checkpoint_prefix_ / consts::CHECKPOINT_INTERVAL ||
+			     done_prefix_ == done_.size())) {
+				checkpoint_prefix_ = done_prefix_;
+				save_checkpoint(users_[done_prefix_ - 1]);
+			}
+		}
+		else {
+			++failed_;
+			failed_users_.push_back(users_[index]);
+		}
+
+		--in_flight_;
+		cond_.notify_all();
+	}
+
+	std::string load_checkpoint() const {
+		std::string ret;
+		if (checkpoint_.empty())
+			return ret;
+
+		std::ifstream file(checkpoint_.c_str());
+		if (file)
+			std::getline(file, ret);
+		return ret;
+	}
+
+	void save_checkpoint(const std::string& user) {
+		if (checkpoint_.empty())
+			return;
+
+		const auto tmp = checkpoint_ + ".tmp";
+		{
+			std::ofstream file(tmp.c_str(), std::ios::trunc);
+			file << user << std::endl;
+			if (!file)
+				return;
+		}
+		std::rename(tmp.c_str(), checkpoint_.c_str()); // replaces checkpoint atomically
+	}
+
+	void report_progress() {
+		try {
+			while (true) {
+				boost::this_thread::sleep(boost::posix_time::seconds(progress_interval_));
+				print_progress();
+			}
+		}
+		catch (boost::thread_interrupted&) {}
+	}
+
+	void print_progress() {
+		const auto elapsed = (boost::posix_time::microsec_clock::universal_time() - start_time_).total_milliseconds() / 1000.;
+		const uint64_t processed = combined_ + skipped_ + failed_;
+		const double users_rate = elapsed > 0 ? processed / elapsed : 0;
+		const double bytes_rate = elapsed > 0 ? bytes_ / elapsed : 0;
+
+		std::cout << "Processed: " << processed << "/" << users_.size()
+		          << " combined: " << combined_
+		          << " skipped: " << skipped_
+		          << " failed: " << failed_
+		          << " bytes: " << bytes_
+		          << " elapsed: " << elapsed << "s"
+		          << " rate: " << users_rate << " users/s, " << bytes_rate / (1024 * 1024) << " MB/s"
+		          << std::endl;
+	}
+
+	std::shared_ptr<history::provider>	provider_;
+	const std::vector<std::string>		keys_; // keys which should be combined
+	const std::string					new_key_; // key in which logs will be combined
+	const uint32_t						parallel_; // maximum number of users in flight
+	const std::string					checkpoint_; // path to checkpoint file
+	const uint32_t						progress_interval_; // interval between throughput reports
+
+	std::vector<std::string>			users_; // sorted users which should be combined
+	std::vector<bool>					done_; // successfully combined users
+	std::list<std::string>				failed_users_;
+
+	boost::mutex						mutex_;
+	boost::condition_variable			cond_;
+	uint32_t							in_flight_; // number of users which are being combined
+	size_t								done_prefix_; // number of users from the beginning which have been combined
+	size_t								checkpoint_prefix_; // done_prefix_ at the moment of the last checkpoint update
+
+	std::atomic<uint64_t>				combined_;
+	std::atomic<uint64_t>				skipped_;
+	std::atomic<uint64_t>				failed_;
+	std::atomic<uint64_t>				bytes_;
+	boost::posix_time::ptime			start_time_;
+};
+
+/* Writes rows (user, log of the day) into columnar file.
+ * Rows are accumulated into row group, each column of the group is compressed by zlib separately:
+ *	users - uint32 offsets[rows + 1] into the names, then names end to end
+ *	records - uint64 offsets[rows + 1] into the logs, then logs end to end
+ *	timestamps - uint64 timestamp of each row, only if EXPORT_TIMESTAMPS flag is set
+ * File is: magic, uint32 version, uint32 flags, row groups, index, uint64 offset of the index, uint32 number of groups, magic.
+ * Index contains uint64 first row and uint32 number of rows of each group, then uint64 file offset,
+ * uint64 compressed size and uint64 raw size of each column of the group. All numbers are little-endian,
+ * so the file can be mapped and any group can be found and decompressed without reading the others.
+ */
+class export_writer
+{
+public:
+	export_writer(const std::string& path, bool timestamps)
+	: path_(path)
+	, file_(path.c_str(), std::ios::binary | std::ios::trunc)
+	, timestamps_(timestamps)
+	, rows_(0)
+	, bytes_(0)
+	{
+		if (!file_)
+			throw std::runtime_error("Can't create export file: " + path);
+
+		file_.write(consts::EXPORT_MAGIC, sizeof(consts::EXPORT_MAGIC));
+		write_number<uint32_t>(consts::EXPORT_VERSION);
+		write_number<uint32_t>(timestamps ? consts::EXPORT_TIMESTAMPS : 0);
+		reset_group();
+	}
+
+	void add(const std::string& user, const std::vector<char>& data, uint64_t timestamp) {
+		names_.insert(names_.end(), user.begin(), user.end());
+		name_offsets_.push_back(names_.size());
+		records_.insert(records_.end(), data.begin(), data.end());
+		record_offsets_.push_back(records_.size());
+		if (timestamps_)
+			times_.push_back(timestamp);
+
+		if (name_offsets_.size() > consts::ROW_GROUP_ROWS || records_.size() >= consts::ROW_GROUP_BYTES)
+			flush_group();
+	}
+
+	// writes the last group and the index
+	void close() {
+		flush_group();
+
+		const uint64_t index_offset = file_.tellp();
+		for (auto it = index_.begin(), end = index_.end(); it != end; ++it) {
+			write_number<uint64_t>(it->first_row);
+			write_number<uint32_t>(it->rows);
+			for (auto col = it->columns.begin(), col_end = it->columns.end(); col != col_end; ++col) {
+				write_number<uint64_t>(col->offset);
+				write_number<uint64_t>(col->compressed);
+				write_number<uint64_t>(col->raw);
+			}
+		}
+		write_number<uint64_t>(index_offset);
+		write_number<uint32_t>(index_.size());
+		file_.write(consts::EXPORT_MAGIC, sizeof(consts::EXPORT_MAGIC));
+
+		file_.close();
+		if (!file_)
+			throw std::runtime_error("Can't write export file: " + path_);
+	}
+
+	uint64_t rows() const { return rows_; }
+	uint64_t bytes() const { return bytes_; }
+	size_t groups() const { return index_.size(); }
+
+private:
+	/* Place of one column of row group in the file */
+	struct column
+	{
+		uint64_t	offset;
+		uint64_t	compressed;
+		uint64_t	raw;
+	};
+
+	/* Entry of the index of row groups */
+	struct group
+	{
+		uint64_t			first_row;
+		uint32_t			rows;
+		std::vector<column>	columns;
+	};
+
+	template<typename T>
+	void write_number(T value) {
+		char buf[sizeof(T)];
+		for (size_t i = 0; i < sizeof(T); ++i) { // little-endian regardless of the host
+			buf[i] = static_cast<char>(value >> (8 * i));
+		}
+		file_.write(buf, sizeof(buf));
+	}
+
+	template<typename T>
+	static void append_numbers(std::vector<char>& buf, const std::vector<T>& values) {
+		for (auto it = values.begin(), end = values.end(); it != end; ++it) {
+			for (size_t i = 0; i < sizeof(T); ++i) {
+				buf.push_back(static_cast<char>(*it >> (8 * i)));
+			}
+		}
+	}
+
+	void reset_group() {
+		names_.clear();
+		name_offsets_.assign(1, 0);
+		records_.clear();
+		record_offsets_.assign(1, 0);
+		times_.clear();
+	}
+
+	// compresses the column and writes it into the file
+	column write_column(const std::vector<char>& raw) {
+		uLongf size = compressBound(raw.size());
+		std::vector<Bytef> compressed(size);
+		if (compress2(compressed.data(), &size, reinterpret_cast<const Bytef*>(raw.data()), raw.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+			throw std::runtime_error("Can't compress column of export file: " + path_);
+
+		column ret;
+		ret.offset = file_.tellp();
+		ret.compressed = size;
+		ret.raw = raw.size();
+
+		file_.write(reinterpret_cast<const char*>(compressed.data()), size);
+		if (!file_)
+			throw std::runtime_error("Can't write export file: " + path_);
+		return ret;
+	}
+
+	void flush_group() {
+		const uint32_t rows = name_offsets_.size() - 1;
+		if (rows == 0)
+			return;
+
+		group g;
+		g.first_row = rows_;
+		g.rows = rows;
+
+		std::vector<char> raw;
+		raw.reserve(name_offsets_.size() * sizeof(uint32_t) + names_.size());
+		append_numbers(raw, name_offsets_);
+		raw.insert(raw.end(), names_.begin(), names_.end());
+		g.columns.push_back(write_column(raw));
+
+		raw.clear();
+		raw.reserve(record_offsets_.size() * sizeof(uint64_t) + records_.size());
+		append_numbers(raw, record_offsets_);
+		raw.insert(raw.end(), records_.begin(), records_.end());
+		g.columns.push_back(write_column(raw));
+
+		if (timestamps_) {
+			raw.clear();
+			append_numbers(raw, times_);
+			g.columns.push_back(write_column(raw));
+		}
+
+		rows_ += rows;
+		bytes_ += records_.size();
+		index_.push_back(g);
+		reset_group();
+	}
+
+	const std::string		path_;
+	std::ofstream			file_;
+	const bool				timestamps_;
+	std::vector<char>		names_; // names of users of the current group
+	std::vector<uint32_t>	name_offsets_;
+	std::vector<char>		records_; // logs of users of the current group
+	std::vector<uint64_t>	record_offsets_;
+	std::vector<uint64_t>	times_;
+	std::vector<group>		index_; // written row groups
+	uint64_t				rows_; // rows in written groups
+	uint64_t				bytes_; // bytes of logs in written groups
+};
+
+/* Exports logs of all active users of the day.
+ * Active users are read as flat list, their logs are read by bulk reads with bounded number of reads in flight.
+ * Elliptics threads only pass read users to the main thread, which compresses and writes them,
+ * so memory is bounded by one row group and the queue. If the queue is full, callbacks wait for the writer,
+ * so reads don't outrun it. The day fails if logs of some user can't be read and the file isn't left.
+ */
+int export_day(std::shared_ptr<history::provider> provider,
+               const std::string& day,
+               const std::string& directory,
+               bool timestamps)
+{
+	const auto path = directory + "/" + day + consts::EXPORT_SUFFIX;
+	const std::vector<std::string> days(1, day);
+
+	uint64_t timestamp = 0;
+	try {
+		timestamp = boost::lexical_cast<uint64_t>(day) * consts::SECONDS_IN_DAY;
+	}
+	catch (boost::bad_lexical_cast&) {} // custom key has no timestamp
+
+	const auto start = boost::posix_time::microsec_clock::universal_time();
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::deque<std::pair<std::string, std::vector<char>>> rows; // read users which wait for the writer
+	size_t incomplete = 0; // number of users whose logs can't be read
+	bool reading = false; // a window of users is being read
+	bool opened = false; // the export file has been created
+
+	// callbacks don't wait for the writer, so elliptics threads aren't blocked: memory is bounded by the window of users
+	auto on_user = [&](const std::string& user, const std::vector<char>& data, bool complete) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!complete) {
+			++incomplete;
+			return;
+		}
+		if (data.empty()) // user is active but has no logs in the day
+			return;
+
+		rows.emplace_back(user, data);
+		cond.notify_all();
+	};
+
+	auto on_complete = [&]() {
+		std::unique_lock<std::mutex> lock(mutex);
+		reading = false;
+		cond.notify_all();
+	};
+
+	try {
+		const auto users = provider->get_active_users_list(days);
+
+		std::vector<std::string> names;
+		names.reserve(users.size());
+		for (size_t i = 0; i < users.size(); ++i) {
+			names.emplace_back(users[i]);
+		}
+
+		export_writer writer(path, timestamps);
+		opened = true;
+
+		size_t next = 0; // the first user of the next window
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			// the next window is read while rows of the previous one are written, so at most two windows are kept
+			if (!reading && next < names.size() && rows.size() <= consts::EXPORT_WINDOW_USERS) {
+				const size_t end = std::min(names.size(), next + consts::EXPORT_WINDOW_USERS);
+				const std::vector<std::string> window(names.begin() + next, names.begin() + end);
+				next = end;
+				reading = true;
+
+				lock.unlock();
+				provider->get_users_logs(window, days, on_user, on_complete);
+				lock.lock();
+				continue;
+			}
+
+			cond.wait(lock, [&]() { return !reading || !rows.empty(); });
+			if (rows.empty()) {
+				if (next < names.size())
+					continue;
+				break;
+			}
+
+			auto row = std::move(rows.front());
+			rows.pop_front();
+
+			lock.unlock();
+			writer.add(row.first, row.second, timestamp);
+			lock.lock();
+		}
+		lock.unlock();
+
+		if (incomplete != 0)
+			throw std::runtime_error("logs of " + boost::lexical_cast<std::string>(incomplete) + " users can't be read");
+
+		writer.close();
+
+		const auto elapsed = (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds() / 1000.;
+		std::cout << "Exported day: " << day
+		          << " file: " << path
+		          << " active: " << users.size()
+		          << " rows: " << writer.rows()
+		          << " bytes: " << writer.bytes()
+		          << " row groups: " << writer.groups()
+		          << " elapsed: " << elapsed << "s"
+		          << std::endl;
+		return 0;
+	}
+	catch (std::exception& e) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait(lock, [&]() { return !reading; }); // callbacks use the locals
+		}
+		if (opened)
+			std::remove(path.c_str()); // incomplete file isn't left as exported day
+		std::cout << "Failed to export day: " << day << ": " << e.what() << std::endl;
+		return -1;
+	}
+}
+
+// prints retention matrix: cohort day, cohort size and retained users with percentage for each offset
+void print_retention(const history::retention_matrix& matrix)
+{
+	std::cout << "day\tcohort";
+	for (auto it = matrix.offsets.begin(), end = matrix.offsets.end(); it != end; ++it) {
+		std::cout << "\tD" << *it;
+	}
+	std::cout << std::endl;
+
+	std::cout << std::fixed << std::setprecision(1);
+	for (size_t i = 0; i < matrix.days.size(); ++i) {
+		std::cout << matrix.days[i] << "\t" << matrix.cohorts[i];
+		for (size_t j = 0; j < matrix.offsets.size(); ++j) {
+			const double percent = matrix.cohorts[i] ? 100. * matrix.retained[i][j] / matrix.cohorts[i] : 0;
+			std::cout << "\t" << matrix.retained[i][j] << " (" << percent << "%)";
+		}
+		std::cout << std::endl;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	const std::string tool = argv[1];
+
+	int ch, err = 0;
+	std::vector<std::string> remotes;
+	std::vector<int> groups;
+	int min_writes = -1;
+	std::vector<std::string> keys;
+	std::string new_key;
+	std::set<std::string> users;
+	uint32_t parallel = consts::DEFAULT_PARALLEL;
+	std::string checkpoint;
+	uint32_t progress_interval = consts::DEFAULT_PROGRESS_INTERVAL;
+	uint64_t begin_time = 0, end_time = 0;
+	std::vector<uint32_t> offsets;
+	uint32_t threads = 0;
+	uint32_t activity_chunks = 1;
+	std::string log_file = consts::DEFAULT_LOG_FILE;
+	std::string log_level = "ERROR";
+	std::string directory;
+	bool timestamps = false;
+
+	optind = 2;
+
+	try {
+		while((ch = getopt(argc, argv, "r:g:m:k:t:n:u:j:c:p:o:T:a:l:L:d:s")) != -1) {
+			switch(ch) {
+				case 'r': remotes.push_back(optarg); break;
+				case 'g': {
+					std::vector<std::string> strs;
+					boost::split(strs, optarg, boost::is_any_of(","));
+
+					for (auto it = strs.begin(), itEnd = strs.end(); it != itEnd; ++it) {
+						groups.push_back(boost::lexical_cast<int>(*it));
+					}
+				}
+				break;
+				case 'm': min_writes = boost::lexical_cast<int>(optarg); break;
+				case 'k': boost::split(keys, optarg, boost::is_any_of(":")); break;
+				case 't': {
+					std::vector<std::string> strs;
+					boost::split(strs, optarg, boost::is_any_of(":"));
+
+					if (strs.size() != 2)
+						throw std::invalid_argument("-t");
+
+					begin_time = boost::lexical_cast<uint64_t>(strs[0]);
+					end_time = boost::lexical_cast<uint64_t>(strs[1]);
+
+					auto begin = begin_time / consts::SECONDS_IN_DAY;
+					auto end = end_time / consts::SECONDS_IN_DAY;
+
+					for (; begin <= end; ++begin) {
+						keys.push_back(boost::lexical_cast<std::string>(begin));
+					}
+				}
+				break;
+				case 'n': new_key = optarg; break;
+				case 'u': users.insert(optarg); break;
+				case 'j': parallel = boost::lexical_cast<uint32_t>(optarg); break;
+				case 'c': checkpoint = optarg; break;
+				case 'p': progress_interval = boost::lexical_cast<uint32_t>(optarg); break;
+				case 'o': {
+					std::vector<std::string> strs;
+					boost::split(strs, optarg, boost::is_any_of(","));
+
+					for (auto it = strs.begin(), itEnd = strs.end(); it != itEnd; ++it) {
+						offsets.push_back(boost::lexical_cast<uint32_t>(*it));
+					}
+				}
+				break;
+				case 'T': threads = boost::lexical_cast<uint32_t>(optarg); break;
+				case 'a': activity_chunks = boost::lexical_cast<uint32_t>(optarg); break;
+				case 'l': log_file = optarg; break;
+				case 'L': log_level = optarg; break;
+				case 'd': directory = optarg; break;
+				case 's': timestamps = true; break;
+				default: throw std::invalid_argument("unknown option");
+			}
+		}
+
+		if (offsets.empty()) {
+			std::vector<std::string> strs;
+			boost::split(strs, consts::DEFAULT_OFFSETS, boost::is_any_of(","));
+			for (auto it = strs.begin(), itEnd = strs.end(); it != itEnd; ++it) {
+				offsets.push_back(boost::lexical_cast<uint32_t>(*it));
+			}
+		}
+
+		if (remotes.empty() ||
+		    groups.empty() ||
+		    activity_chunks == 0)
+			throw std::invalid_argument("Required parameters are missing");
+
+		if (tool == consts::COMBINE_TOOL) {
+			if (keys.empty() ||
+			    new_key.empty() ||
+			    parallel == 0 ||
+			    progress_interval == 0)
+				throw std::invalid_argument("Required parameters are missing");
+		}
+		else if (tool == consts::RETENTION_TOOL) {
+			if (end_time == 0 || end_time < begin_time)
+				throw std::invalid_argument("-t");
+		}
+		else if (tool == consts::EXPORT_TOOL) {
+			if (keys.empty() || directory.empty())
+				throw std::invalid_argument("Required parameters are missing");
+		}
+		else
+			throw std::invalid_argument("Unknown tool");
+	}
+	catch(...) {
+		err = -1;
+	}
+
+	if (err) {
+		print_usage(argv[0]);
+		return err;
+	}
+
+	if (min_writes < 0)
+		min_writes = groups.size();
+
+	auto provider = std::make_shared<history::provider>(remotes,
+	                                                    groups,
+	                                                    min_writes,
+	                                                    log_file,
+	                                                    history::get_log_level(log_level));
+
+	provider->set_activity_chunks(activity_chunks);
+
+	if (tool == consts::RETENTION_TOOL) {
+		print_retention(provider->get_retention(begin_time, end_time, offsets, threads));
+		return 0;
+	}
+
+	if (tool == consts::EXPORT_TOOL) {
+		int ret = 0;
+		for (auto it = keys.begin(), end = keys.end(); it != end; ++it) {
+			if (export_day(provider, *it, directory, timestamps) != 0)
+				ret = -1;
+		}
+		return ret;
+	}
+
+	if (users.empty()) {
+		std::cout << "Looking for active users" << std::endl;
+		users = provider->get_active_users(keys);
+	}
+
+	combiner c(provider, keys, new_key, parallel, checkpoint, progress_interval);
+	return c.run(users);
+}
@@ -52,7 +52,7 @@ class historydb(object):
             return (500, "")
         return res.status
 
-    def get_user_logs(self, user, keys=None, begin_time=None, end_time=None):
+    def get_user_logs(self, user, keys=None, begin_time=None, end_time=None, msgpack=False):
         p = {'user' : user}
         if keys:
                 p["keys"] = ':'.join(keys)
@@ -61,12 +61,60 @@ class historydb(object):
                 p['end_time'] = end_time
         else:
                 return
-        res = self.__send__(p, "/get_user_logs", "GET")
+        res = self.__send__(p, "/get_user_logs", "GET", self.__accept__(msgpack))
         if res is None:
             return (500, "")
         return (res.status, res.read(), res.reason)
 
-    def get_active_users(self, begin_time=None, end_time=None, keys=None):
+    def open_user_logs(self, user, begin_time, end_time):
+        # returns the response whose body hasn't been read, so the reply could be read after its headers
+        return self.__send__({'user' : user, 'begin_time' : begin_time, 'end_time' : end_time}, "/get_user_logs", "GET")
+
+    def get_active_users(self, begin_time=None, end_time=None, keys=None, limit=None, cursor=None, msgpack=False):
+        p = {}
+        if keys:
+                p["keys"] = ':'.join(keys)
+        elif begin_time is not None and end_time is not None:
+                p["begin_time"] = begin_time
+                p['end_time'] = end_time
+        else:
+                return
+        if limit is not None:
+                p['limit'] = limit
+                if cursor:
+                        p['cursor'] = cursor
+        res = self.__send__(p, "/get_active_users", "GET", self.__accept__(msgpack))
+        if res is None:
+            return (500, "")
+        return (res.status, res.read(), res.reason)
+
+    def add_logs(self, records):
+        import json
+        body = '\n'.join([json.dumps(x) for x in records])
+        res = self.__send__({}, "/add_logs", body=body)
+        if res is None:
+            return (500, "")
+        return (res.status, res.read())
+
+    def get_active_users_set(self, op, begin_time=None, end_time=None, keys=None, days=None, exclude_keys=None):
+        p = {'op' : op}
+        if keys:
+                p["keys"] = ':'.join(keys)
+        elif begin_time is not None and end_time is not None:
+                p["begin_time"] = begin_time
+                p['end_time'] = end_time
+        else:
+                return
+        if days is not None:
+                p['days'] = days
+        if exclude_keys:
+                p['exclude_keys'] = ':'.join(exclude_keys)
+        res = self.__send__(p, "/get_active_users_set", "GET")
+        if res is None:
+            return (500, "")
+        return (res.status, res.read(), res.reason)
+
+    def get_activity_counts(self, begin_time=None, end_time=None, keys=None):
         p = {}
         if keys:
                 p["keys"] = ':'.join(keys)
@@ -75,22 +123,52 @@ class historydb(object):
                 p['end_time'] = end_time
         else:
                 return
-        res = self.__send__(p, "/get_active_users", "GET")
+        res = self.__send__(p, "/get_activity_counts", "GET")
         if res is None:
             return (500, "")
         return (res.status, res.read(), res.reason)
 
-    def __send__(self, params, url, method="POST"):
+    def is_active(self, users, time=None, key=None):
+        p = {'users' : ':'.join(users)}
+        if not time is None:
+                p['time'] = time
+        elif key:
+                p['key'] = key
+        else:
+                return
+        res = self.__send__(p, "/is_active", "GET")
+        if res is None:
+            return (500, "")
+        return (res.status, res.read(), res.reason)
+
+    def stats(self, prometheus=False):
+        p = {}
+        if prometheus:
+                p['format'] = 'prometheus'
+        res = self.__send__(p, "/stats", "GET")
+        if res is None:
+            return (500, "")
+        return (res.status, res.read())
+
+    def __accept__(self, msgpack):
+        if msgpack:
+            return {'Accept' : 'application/x-msgpack'}
+        return {}
+
+    def __send__(self, params, url, method="POST", headers={}, body=None):
         try:
             from httplib import HTTPConnection
             from urllib import urlencode
             h = HTTPConnection(self.addr)
             h.set_debuglevel(self.debug_level)
-            body = urlencode(params)
+            query = urlencode(params)
             if method == "GET":
-                url += "?" + body
-                body = None
-            h.request(method, url, body)
+                url += "?" + query
+            elif body is None:
+                body = query
+            elif query:
+                url += "?" + query
+            h.request(method, url, body, headers)
             response = h.getresponse()
             return response
         except Exception as e:
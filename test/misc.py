@@ -9,20 +9,41 @@ from time import sleep
 
 random.seed()
 
-ioserv, thevoid, root_dir = (None, None, None)
+ioserv, thevoid, root_dir = ([], [], None)
+
+# storages: elliptics port and group, each storage has own data directory
+STORAGES = [(2025, 1), (2026, 2)]
+
+# frontends: port and options of historydb-thevoid application, each frontend uses one of the storages.
+# The second storage is shared by frontends with optional features, so they read what each other writes.
+# Filter of few positions makes false positives, so is_active confirms them by indexes.
+TUNED_OPTIONS = {"activity_chunks": 4, "log_days": True, "missing_logs_ttl": 60,
+                 "activity_filters": True, "activity_filter_users": 16, "max_range": 1000}
+FRONTENDS = [(8082, 0, {"activity_counters": True}),
+             (8083, 1, dict(TUNED_OPTIONS, active_users_cache={"size": 1048576, "ttl": 1, "past_ttl": 1})),
+             (8084, 1, TUNED_OPTIONS)]
 
 
 def output_configs(host):
+    for i, (port, group) in enumerate(STORAGES):
+        output_elliptics_config(host, i, port, group)
+    for i, (port, storage, options) in enumerate(FRONTENDS):
+        output_historydb_config(host, i, port, STORAGES[storage], options)
+
+
+def output_elliptics_config(host, index, port, group):
+    data_dir = '{0}/storage-{1}'.format(root_dir, index)
+    os.mkdir(data_dir)
     e_str_conf = '''log = {0}/historydb-elliptics.log
 log_level = 5
-group = 1
+group = {2}
 history = {0}
 io_thread_num = 250
 net_thread_num = 100
 nonblocking_io_thread_num = 50
 join = 1
-remote =  {1}:2025:2
-addr = {1}:2025:2
+remote =  {1}:{3}:2
+addr = {1}:{3}:2
 wait_timeout = 30
 check_timeout = 50
 auth_cookie = unique_storage_cookie
@@ -39,31 +60,29 @@ defrag_timeout = 3600
 defrag_percentage = 25
 sync = -1
 data = {0}/data
-iterate_thread_num = 2'''.format(root_dir, host)
-    e_conf = open(root_dir + '/elliptics.conf', "w+")
+iterate_thread_num = 2'''.format(data_dir, host, group, port)
+    e_conf = open('{0}/elliptics-{1}.conf'.format(root_dir, index), "w+")
     e_conf.write(e_str_conf)
-    h_str_json = '''{{
-    "endpoints": [
-        "0.0.0.0:8082"
-    ],
-    "daemon": {{
-        "monitor-port": 20000
-    }},
-    "backlog": 128,
-    "threads": 2,
-    "application": {{
+
+
+def output_historydb_config(host, index, port, storage, options):
+    import json
+    application = {
         "loglevel": 5,
-        "logfile": "{0}/historydb-test.log",
-        "remotes": [
-            "{1}:2025:2"
-        ],
-        "groups": [
-            1
-        ]
-    }}
-}}'''.format(root_dir, host)
-    h_json = open(root_dir + '/historydb.json', "w+")
-    h_json.write(h_str_json)
+        "logfile": "{0}/historydb-test-{1}.log".format(root_dir, index),
+        "remotes": ["{0}:{1}:2".format(host, storage[0])],
+        "groups": [storage[1]]
+    }
+    application.update(options)
+    h_conf = {
+        "endpoints": ["0.0.0.0:{0}".format(port)],
+        "daemon": {"monitor-port": 20000 + index},
+        "backlog": 128,
+        "threads": 2,
+        "application": application
+    }
+    h_json = open('{0}/historydb-{1}.json'.format(root_dir, index), "w+")
+    json.dump(h_conf, h_json, indent=4)
 
 
 def start(host, tmp_dir):
@@ -81,15 +100,34 @@ def start(host, tmp_dir):
     os.mkdir(root_dir)
     output_configs(host=host)
 
-    ioserv = Popen(['dnet_ioserv', '-c', root_dir + '/elliptics.conf'])
+    for i in range(len(STORAGES)):
+        ioserv.append(None)
+        start_storage(i)
+    for i in range(len(FRONTENDS)):
+        thevoid.append(Popen(['historydb-thevoid', '-c', '{0}/historydb-{1}.json'.format(root_dir, i)]))
     sleep(0.5)
-    thevoid = Popen(['historydb-thevoid', '-c', root_dir + '/historydb.json'])
+
+
+def start_storage(index):
+    ioserv[index] = Popen(['dnet_ioserv', '-c', '{0}/elliptics-{1}.conf'.format(root_dir, index)])
     sleep(0.5)
 
 
+def stop_storage(index):
+    stop_app(ioserv[index])
+    sleep(1)  # frontends notice that the storage is gone
+
+
+def frontend(host, index):
+    return '{0}:{1}'.format(host, FRONTENDS[index][0])
+
+
 def stop_app(app):
     import signal
 
+    if app.poll() is not None:
+        return
+
     app.send_signal(signal.SIGINT)
     if app.poll():
         sleep(5)
@@ -101,11 +139,13 @@ def stop_app(app):
 def stop(leave=False):
     global ioserv, thevoid
 
-    stop_app(ioserv)
-    ioserv = None
+    for app in ioserv:
+        stop_app(app)
+    ioserv = []
 
-    stop_app(thevoid)
-    thevoid = None
+    for app in thevoid:
+        stop_app(app)
+    thevoid = []
 
     if not leave:
         rmtree(root_dir, True)
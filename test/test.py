@@ -10,6 +10,7 @@ import logging.handlers
 import sys
 from time import sleep
 import itertools
+import msgpack
 
 random.seed()
 
@@ -242,9 +243,572 @@ def test_add_log_with_activity(host, iterations, debug):
     return result
 
 
+def test_add_logs(host, iterations, debug):
+    log.info("Run add_logs test with {0} records".format(iterations))
+    result = True
+    hdb = historydb(host, debug)
+
+    user = "test_user_" + hex(random.randint(0, MAX_USER_NO))[2:]
+    keys = set()
+    records = []
+    added = defaultdict(str)
+    active_keys = set()
+
+    begin_time = int(datetime.now().strftime('%s'))
+    for _ in range(iterations):
+        data = ''.join([hex(x)[2:] for x in random.sample(range(100), 100)])
+        dt = datetime.now()
+        record = {'user': user, 'data': data, 'activity': random.randint(0, 1) == 0}
+        if random.randint(0, 1) == 0:
+            key = dt.strftime('%b_%d_%y')
+            keys.add(key)
+            record['key'] = key
+        else:
+            time = int(dt.strftime("%s"))
+            key = int(time / (24 * 60 * 60))
+            record['time'] = time
+        added[user + str(key)] += data
+        if record['activity']:
+            active_keys.add(key)
+        records.append(record)
+    end_time = int(datetime.now().strftime("%s"))
+
+    # invalid records are rejected, other records of the batch are added
+    records.append({'user': user, 'key': 'no_data'})
+    records.append({'user': user, 'data': 'empty key', 'key': ''})
+
+    resp = hdb.add_logs(records)
+    if resp[0] != 200:
+        log.error("Error while adding batch of logs: {0}".format(resp[0]))
+        return False
+
+    try:
+        statuses = json.loads(resp[1])['statuses']
+    except Exception as e:
+        log.error("Got exception: {0}".format(e))
+        return False
+
+    if statuses != [200] * iterations + [400, 400]:
+        log.error("Invalid statuses of batch records: {0}".format(statuses))
+        result = False
+    else:
+        for k, v in added.iteritems():
+            logs[k] += v
+        for key in active_keys:
+            activity[key] += [user]
+
+    log.info("Checking results")
+
+    if not check_logs(hdb, user, keys=keys):
+        result = False
+
+    if not check_logs(hdb, user, begin_time=begin_time, end_time=end_time):
+        result = False
+
+    if not check_activity(hdb, begin_time=begin_time, end_time=end_time):
+        result = False
+
+    if result:
+        log.info("Add_logs test successed")
+    else:
+        log.info("Add_logs failed")
+    return result
+
+
+def test_stats(host, iterations, debug):
+    log.info("Run stats test")
+    result = True
+    hdb = historydb(host, debug)
+
+    def root_stats():
+        resp = hdb.stats()
+        if resp[0] != 200:
+            log.error("Error while getting stats: {0}".format(resp[0]))
+            return None
+        try:
+            return json.loads(resp[1])['endpoints']['/']
+        except Exception as e:
+            log.error("Got exception: {0}".format(e))
+            return None
+
+    before = root_stats()
+    for _ in range(iterations):
+        hdb.ping()
+    after = root_stats()
+
+    if before is None or after is None:
+        result = False
+    elif after['requests'] - before['requests'] != iterations or after['codes']['2xx'] - before['codes']['2xx'] != iterations:
+        log.error("Invalid stats of pings: {0} -> {1}".format(before, after))
+        result = False
+
+    resp = hdb.stats()
+    provider_items = ['early_acks', 'late_replica_failures', 'read_errors', 'write_errors', 'missing_logs_hits',
+                      'filtered_activities_hits', 'fanout_queued', 'fanout_in_flight']
+    if resp[0] != 200 or any(x not in json.loads(resp[1])['provider'] for x in provider_items):
+        log.error("Invalid provider stats: {0}".format(resp))
+        result = False
+
+    resp = hdb.stats(prometheus=True)
+    samples = ['historydb_requests_total{endpoint="/",code="2xx"}', 'historydb_provider_errors_total{op="read"}',
+               'historydb_provider_missing_logs_hits_total', 'historydb_provider_fanout_queued_reads']
+    if resp[0] != 200 or any(x not in resp[1] for x in samples):
+        log.error("Invalid prometheus stats: {0}".format(resp))
+        result = False
+
+    if result:
+        log.info("Stats test successed")
+    else:
+        log.info("Stats failed")
+    return result
+
+
+def test_active_users_pages(host, iterations, debug):
+    log.info("Run active users pages test for {0} users".format(iterations))
+    result = True
+    hdb = historydb(host, debug)
+
+    key = "pages_" + hex(random.randint(0, MAX_USER_NO))[2:]
+    users = set()
+    for _ in range(iterations):
+        user = "test_user_" + hex(random.randint(0, MAX_USER_NO))[2:]
+        if hdb.add_activity(user=user, key=key) != 200:
+            log.error("Error while adding activity by keys")
+            result = False
+        else:
+            users.add(user)
+            activity[key] += [user]
+
+    log.info("Checking results")
+
+    limit = 7
+    r_users = []
+    cursor = None
+    while True:
+        resp = hdb.get_active_users(keys=[key], limit=limit, cursor=cursor)
+        if resp[0] != 200:
+            log.error("Error while getting page of active users by cursor: {0}".format(cursor))
+            return False
+        try:
+            page = json.loads(resp[1])
+        except Exception as e:
+            log.error("Got exception: {0}".format(e))
+            return False
+        if len(page['active_users']) > limit:
+            log.error("Page has more users than limit: {0}".format(len(page['active_users'])))
+            result = False
+        r_users += page['active_users']
+        cursor = page['cursor']
+        if not cursor:
+            break
+
+    if len(r_users) != len(set(r_users)):
+        log.error("Pages repeat users: {0} != {1}".format(len(r_users), len(set(r_users))))
+        result = False
+
+    if set(r_users) != users:
+        log.error("Invalid activity from pages: {0} != {1}".format(len(set(r_users)), len(users)))
+        result = False
+
+    if result:
+        log.info("Active users pages test successed")
+    else:
+        log.info("Active users pages failed")
+    return result
+
+
+def test_activity_counts(host, iterations, debug):
+    log.info("Run activity counts test for {0} activities".format(iterations))
+    result = True
+    hdb = historydb(host, debug)
+
+    keys = ["counts_" + hex(random.randint(0, MAX_USER_NO))[2:] for _ in range(2)]
+    users = ["test_user_" + hex(random.randint(0, MAX_USER_NO))[2:] for _ in range(max(1, iterations / 10))]
+    counts = defaultdict(int)
+
+    for _ in range(iterations):
+        user = random.choice(users)
+        key = random.choice(keys)
+        if hdb.add_activity(user=user, key=key) != 200:
+            log.error("Error while adding activity by keys")
+            result = False
+        else:
+            counts[user] += 1
+            activity[key] += [user]
+
+    log.info("Checking results")
+
+    resp = hdb.get_activity_counts(keys=keys)
+    r_counts = {}
+    if resp[0] != 200:
+        log.error("Error while getting activity counts by keys: {0}".format(keys))
+        return False
+    try:
+        r_counts = json.loads(resp[1])['activity_counts']
+    except Exception as e:
+        log.error("Got exception: {0}".format(e))
+        return False
+
+    if r_counts != counts:
+        log.error("Invalid activity counts: {0} != {1}".format(r_counts, dict(counts)))
+        result = False
+
+    if result:
+        log.info("Activity counts test successed")
+    else:
+        log.info("Activity counts failed")
+    return result
+
+
+def check_active_users_set(hdb, expected, op, keys, days=None, exclude_keys=None):
+    log.debug("Getting {0} of active users by keys: {1}".format(op, keys))
+    resp = hdb.get_active_users_set(op, keys=keys, days=days, exclude_keys=exclude_keys)
+    r_users = set()
+    if resp[0] != 200:
+        log.error("Error while getting {0} of active users by keys: {1}".format(op, keys))
+        return False
+    try:
+        r_users = set(json.loads(resp[1])['active_users'])
+    except Exception as e:
+        log.error("Got exception: {0}".format(e))
+        return False
+    if r_users != expected:
+        log.error("Invalid {0} of active users: {1} != {2}".format(op, len(r_users), len(expected)))
+        return False
+    return True
+
+
+def test_active_users_set(host, iterations, debug):
+    log.info("Run active users set test for {0} users".format(iterations))
+    result = True
+    hdb = historydb(host, debug)
+
+    keys = ["set_" + hex(random.randint(0, MAX_USER_NO))[2:] for _ in range(3)]
+    days = defaultdict(set)
+
+    for _ in range(iterations):
+        user = "test_user_" + hex(random.randint(0, MAX_USER_NO))[2:]
+        for key in keys:
+            if random.randint(0, 1) == 0:
+                continue
+            if hdb.add_activity(user=user, key=key) != 200:
+                log.error("Error while adding activity by keys")
+                result = False
+            else:
+                days[user].add(key)
+                activity[key] += [user]
+
+    log.info("Checking results")
+
+    intersection = set([u for u, d in days.iteritems() if len(d) == len(keys)])
+    if not check_active_users_set(hdb, intersection, 'intersection', keys):
+        result = False
+
+    at_least = set([u for u, d in days.iteritems() if len(d) >= 2])
+    if not check_active_users_set(hdb, at_least, 'at_least', keys, days=2):
+        result = False
+
+    difference = set([u for u, d in days.iteritems() if d & set(keys[:2]) and keys[2] not in d])
+    if not check_active_users_set(hdb, difference, 'difference', keys[:2], exclude_keys=keys[2:]):
+        result = False
+
+    if result:
+        log.info("Active users set test successed")
+    else:
+        log.info("Active users set failed")
+    return result
+
+
+def test_is_active(host, iterations, debug):
+    log.info("Run is_active test for {0} users".format(iterations))
+    result = True
+    hdb = historydb(host, debug)
+
+    key = "is_active_" + hex(random.randint(0, MAX_USER_NO))[2:]
+    expected = {}
+
+    for _ in range(iterations):
+        user = "test_user_" + hex(random.randint(0, MAX_USER_NO))[2:]
+        expected[user] = random.randint(0, 1) == 0
+        if not expected[user]:
+            continue
+        if hdb.add_activity(user=user, key=key) != 200:
+            log.error("Error while adding activity by keys")
+            result = False
+            expected[user] = False
+        else:
+            activity[key] += [user]
+
+    log.info("Checking results")
+
+    resp = hdb.is_active(expected.keys(), key=key)
+    r_active = {}
+    if resp[0] != 200:
+        log.error("Error while checking activity of users by key: {0}".format(key))
+        return False
+    try:
+        r_active = json.loads(resp[1])['active']
+    except Exception as e:
+        log.error("Got exception: {0}".format(e))
+        return False
+
+    if r_active != expected:
+        log.error("Invalid activity of users: {0} != {1}".format(r_active, expected))
+        result = False
+
+    if result:
+        log.info("Is_active test successed")
+    else:
+        log.info("Is_active failed")
+    return result
+
+
+def test_msgpack(host, iterations, debug):
+    log.info("Run msgpack test for {0} records".format(iterations))
+    result = True
+    hdb = historydb(host, debug)
+
+    user = "test_user_" + hex(random.randint(0, MAX_USER_NO))[2:]
+    keys = ["msgpack_" + hex(random.randint(0, MAX_USER_NO))[2:] for _ in range(2)]
+    day_logs = defaultdict(str)
+
+    for _ in range(iterations):
+        data = ''.join([hex(x)[2:] for x in random.sample(range(100), 100)]) + '"\\\n'  # isn't escaped in msgpack
+        key = random.choice(keys)
+        if hdb.add_log_with_activity(user=user, data=data, key=key) != 200:
+            log.error('Failed add log by key')
+            result = False
+        else:
+            day_logs[key] += data
+            logs[user + key] += data
+            activity[key] += [user]
+
+    log.info("Checking results")
+
+    resp = hdb.get_user_logs(user=user, keys=keys, msgpack=True)
+    if resp[0] != 200:
+        log.error("Error while getting user logs in msgpack")
+        return False
+    try:
+        r_logs = msgpack.unpackb(resp[1])['logs']
+    except Exception as e:
+        log.error("Got exception: {0}".format(e))
+        return False
+    if r_logs != [day_logs[x] for x in keys]:
+        log.error("Invalid logs in msgpack: {0} != {1}".format(len(''.join(r_logs)), len(''.join(day_logs.values()))))
+        result = False
+
+    resp = hdb.get_active_users(keys=keys, msgpack=True)
+    if resp[0] != 200:
+        log.error("Error while getting active users in msgpack")
+        return False
+    try:
+        r_users = msgpack.unpackb(resp[1])['active_users']
+    except Exception as e:
+        log.error("Got exception: {0}".format(e))
+        return False
+    # users are listed once as in json, grouped by chunks of activity statistics
+    if list(itertools.chain(*r_users)) != [user]:
+        log.error("Invalid active users in msgpack: {0}".format(r_users))
+        result = False
+
+    if result:
+        log.info("Msgpack test successed")
+    else:
+        log.info("Msgpack failed")
+    return result
+
+
+def test_log_days(host, iterations, debug):
+    log.info("Run log days test for {0} records".format(iterations))
+    result = True
+    hdb = historydb(host, debug)
+
+    user = "test_user_" + hex(random.randint(0, MAX_USER_NO))[2:]
+    day = 24 * 60 * 60
+    now = int(datetime.now().strftime('%s'))
+    times = [now, now - 3 * day, now - 600 * day]  # days are marked in two buckets of 512 days
+    day_logs = defaultdict(str)
+
+    for _ in range(iterations):
+        data = ''.join([hex(x)[2:] for x in random.sample(range(100), 100)])
+        time = random.choice(times)
+        if hdb.add_log(user=user, data=data, time=time) != 200:
+            log.error('Failed add log by timestamp')
+            result = False
+        else:
+            day_logs[time / day] += data
+
+    log.info("Checking results")
+
+    begin_time = now - 601 * day
+    days = range(begin_time / day, now / day + 1)
+
+    for _ in range(2):  # the second read skips remembered missing logs of past days
+        resp = hdb.get_user_logs(user=user, begin_time=begin_time, end_time=now)
+        if resp[0] != 200:
+            log.error("Error while getting user logs of marked days")
+            return False
+        r_logs = json.loads(resp[1])['logs']
+        if r_logs != ''.join([day_logs[x] for x in days]):
+            log.error("Invalid logs of marked days: {0} != {1}".format(len(r_logs), len(''.join(day_logs.values()))))
+            result = False
+
+    resp = hdb.get_user_logs(user=user, begin_time=begin_time, end_time=now, msgpack=True)
+    if resp[0] != 200:
+        log.error("Error while getting user logs of marked days in msgpack")
+        return False
+    r_logs = msgpack.unpackb(resp[1])['logs']
+    if r_logs != [day_logs[x] for x in days]:  # days without marks are empty items
+        log.error("Invalid logs of marked days in msgpack: {0} != {1}".format(len(r_logs), len(days)))
+        result = False
+
+    if result:
+        log.info("Log days test successed")
+    else:
+        log.info("Log days failed")
+    return result
+
+
+def test_max_range(host, iterations, debug):
+    log.info("Run max range test")
+    result = True
+    hdb = historydb(host, debug)
+
+    user = "test_user_" + hex(random.randint(0, MAX_USER_NO))[2:]
+    day = 24 * 60 * 60
+    now = int(datetime.now().strftime('%s'))
+
+    # the frontend accepts at most 1000 days
+    for days, code in ((1000, 200), (1001, 400)):
+        begin_time = now - (days - 1) * day
+        resp = hdb.get_user_logs(user=user, begin_time=begin_time, end_time=now)
+        if resp[0] != code:
+            log.error("Unexpected status of user logs of {0} days: {1} != {2}".format(days, resp[0], code))
+            result = False
+
+        resp = hdb.get_active_users(begin_time=begin_time, end_time=now, limit=10)
+        if resp[0] != code:
+            log.error("Unexpected status of page of active users of {0} days: {1} != {2}".format(days, resp[0], code))
+            result = False
+
+    resp = hdb.get_active_users(begin_time=now - 1000 * day, end_time=now)
+    if resp[0] != 400:
+        log.error("Unexpected status of active users of 1001 days: {0}".format(resp[0]))
+        result = False
+
+    if result:
+        log.info("Max range test successed")
+    else:
+        log.info("Max range failed")
+    return result
+
+
+def test_incomplete_reads(host, iterations, debug):
+    log.info("Run incomplete reads test")
+    from httplib import IncompleteRead
+    from misc import start_storage, stop_storage
+    result = True
+    hdb = historydb(host, debug)
+
+    user = "test_user_" + hex(random.randint(0, MAX_USER_NO))[2:]
+    day = 24 * 60 * 60
+    now = int(datetime.now().strftime('%s'))
+    begin_time = now - 15 * day
+
+    # large days fill socket buffers, so later days are read after the headers have been sent
+    data = ''.join([random.choice('0123456789abcdef') for _ in range(256 * 1024)])
+    for time in range(begin_time, now + 1, day):
+        for _ in range(4):
+            if hdb.add_log_with_activity(user=user, data=data, time=time) != 200:
+                log.error('Failed add log with activity')
+                return False
+
+    res = hdb.open_user_logs(user=user, begin_time=begin_time, end_time=now)
+    if res is None or res.status != 200:
+        log.error("Error while opening user logs")
+        return False
+
+    stop_storage(0)
+    try:
+        try:
+            body = res.read()
+            log.error("Reply of user logs is complete after the storage has stopped: {0} bytes".format(len(body)))
+            result = False
+        except IncompleteRead:  # the connection is closed without the last chunk
+            pass
+
+        # reads which fail before the headers are replied with error
+        resp = hdb.get_user_logs(user=user, begin_time=begin_time, end_time=now)
+        if resp[0] != 500:
+            log.error("Unexpected status of failed user logs: {0}".format(resp[0]))
+            result = False
+
+        resp = hdb.get_active_users(begin_time=begin_time, end_time=now)
+        if resp[0] != 500:
+            log.error("Unexpected status of failed active users: {0}".format(resp[0]))
+            result = False
+    finally:
+        start_storage(0)
+
+    if result:
+        log.info("Incomplete reads test successed")
+    else:
+        log.info("Incomplete reads failed")
+    return result
+
+
+def test_active_users_cache(host, iterations, debug):
+    log.info("Run active users cache test for {0} users".format(iterations))
+    result = True
+    hdb = historydb(host, debug)
+
+    keys = ["cache_" + hex(random.randint(0, MAX_USER_NO))[2:] for _ in range(2)]
+    days = defaultdict(set)
+
+    for _ in range(iterations):
+        user = "test_user_" + hex(random.randint(0, MAX_USER_NO))[2:]
+        key = random.choice(keys)
+        if hdb.add_activity(user=user, key=key) != 200:
+            log.error("Error while adding activity by keys")
+            result = False
+        else:
+            days[key].add(user)
+
+    log.info("Checking results")
+
+    # duplicate and permuted keys share one cached reply of normalized keys
+    for req_keys in ([keys[0], keys[0]], [keys[1], keys[0], keys[1]], keys):
+        users = set(itertools.chain(*[days[x] for x in req_keys]))
+        for _ in range(2):  # the second request is replied from the cache
+            resp = hdb.get_active_users(keys=req_keys)
+            if resp[0] != 200:
+                log.error("Error while getting active users by keys: {0}".format(req_keys))
+                return False
+            r_users = json.loads(resp[1])['active_users']
+            if len(r_users) != len(set(r_users)) or set(r_users) != users:
+                log.error("Invalid cached activity by keys: {0}: {1} != {2}".format(req_keys, len(r_users), len(users)))
+                result = False
+
+        resp = hdb.get_active_users(keys=req_keys, msgpack=True)
+        if resp[0] != 200:
+            log.error("Error while getting active users in msgpack by keys: {0}".format(req_keys))
+            return False
+        r_users = list(itertools.chain(*msgpack.unpackb(resp[1])['active_users']))
+        if len(r_users) != len(set(r_users)) or set(r_users) != users:
+            log.error("Invalid cached activity in msgpack by keys: {0}: {1} != {2}".format(req_keys, len(r_users), len(users)))
+            result = False
+
+    if result:
+        log.info("Active users cache test successed")
+    else:
+        log.info("Active users cache failed")
+    return result
+
+
 if __name__ == '__main__':
     from optparse import OptionParser
-    from misc import start, stop
+    from misc import start, stop, frontend
     import socket
 
     parser = OptionParser()
@@ -269,7 +833,9 @@ if __name__ == '__main__':
 
     start(host=socket.gethostname(), tmp_dir=options.tmp_dir)
 
-    host = socket.gethostname() + ':8082'
+    host = frontend(socket.gethostname(), 0)
+    cached_host = frontend(socket.gethostname(), 1)  # frontend of the second storage with active users cache
+    tuned_host = frontend(socket.gethostname(), 2)  # frontend of the second storage without cache
 
     log.info("Starting tests")
 
@@ -280,14 +846,28 @@ if __name__ == '__main__':
     iterations = int(options.iterations)
 
     for _ in range(int(options.repeat)):
-        tests.append(test_ping)
-        tests.append(test_add_log)
-        tests.append(test_add_activity)
-        tests.append(test_add_log_with_activity)
+        tests.append((test_ping, host))
+        tests.append((test_add_log, host))
+        tests.append((test_add_activity, host))
+        tests.append((test_add_log_with_activity, host))
+        tests.append((test_add_logs, host))
+        tests.append((test_stats, host))
+        tests.append((test_active_users_pages, host))
+        tests.append((test_activity_counts, host))
+        tests.append((test_active_users_set, host))
+        tests.append((test_is_active, host))
+        tests.append((test_msgpack, host))
+        tests.append((test_active_users_cache, cached_host))
+        tests.append((test_msgpack, tuned_host))
+        tests.append((test_log_days, tuned_host))
+        tests.append((test_is_active, tuned_host))
+        tests.append((test_active_users_pages, tuned_host))
+        tests.append((test_max_range, tuned_host))
+        tests.append((test_incomplete_reads, host))  # stops the storage of the host for a while
 
     test_time = datetime.now()
-    for t in tests:
-        if t(host=host, iterations=iterations, debug=options.debug):
+    for t, h in tests:
+        if t(host=h, iterations=iterations, debug=options.debug):
             succ += 1
         else:
             fail += 1